@@ -0,0 +1,210 @@
+#include "cache.h"
+#include "repository.h"
+#include "object-store.h"
+#include "blame-cache.h"
+#include "dir.h"
+#include "lockfile.h"
+#include "quote.h"
+#include "string-list.h"
+
+static char *blame_cache_file(struct repository *r,
+			      const struct object_id *commit,
+			      const char *path, const char *variant)
+{
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	const char *hex;
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, variant, strlen(variant) + 1);
+	the_hash_algo->update_fn(&ctx, commit->hash, the_hash_algo->rawsz);
+	the_hash_algo->update_fn(&ctx, path, strlen(path));
+	the_hash_algo->final_fn(hash, &ctx);
+
+	hex = hash_to_hex(hash);
+	return xstrfmt("%s/info/blame-cache/%.2s/%s",
+		       r->objects->odb->path, hex, hex + 2);
+}
+
+static int parse_int(const char **p, int *v)
+{
+	char *end;
+	long l = strtol(*p, &end, 10);
+
+	if (end == *p || l < 0 || l > INT_MAX)
+		return -1;
+	*v = l;
+	*p = end;
+	return 0;
+}
+
+static int parse_path_ref(const char **p, char **paths, int nr, char **v)
+{
+	int i;
+
+	if (parse_int(p, &i) || i >= nr)
+		return -1;
+	*v = xstrdup(paths[i]);
+	return 0;
+}
+
+/*
+ * The file starts with "blame-cache v1 <number of lines>". It
+ * continues with lines "path <path>", each defining the next path
+ * index, and entries of the form
+ *
+ *   <lno> <num_lines> <s_lno> <commit> <path index> [<previous> <path index>]
+ *
+ * Paths are C-quoted if needed.
+ */
+int blame_cache_read(struct repository *r, const struct object_id *commit,
+		     const char *path, const char *variant,
+		     struct blame_cache_result *result)
+{
+	char *file = blame_cache_file(r, commit, path, variant);
+	FILE *fp = fopen(file, "r");
+	struct strbuf line = STRBUF_INIT;
+	char **paths = NULL;
+	int paths_nr = 0, paths_alloc = 0;
+	int next_lno = 0, ret = -1, i;
+	const char *p;
+
+	memset(result, 0, sizeof(*result));
+	if (!fp)
+		goto out;
+
+	if (strbuf_getline(&line, fp) ||
+	    !skip_prefix(line.buf, "blame-cache v1 ", &p) ||
+	    parse_int(&p, &result->num_lines) || *p)
+		goto out;
+
+	while (!strbuf_getline(&line, fp)) {
+		struct blame_cache_entry *e;
+
+		if (skip_prefix(line.buf, "path ", &p)) {
+			struct strbuf unquoted = STRBUF_INIT;
+
+			if (*p == '"') {
+				const char *end;
+
+				if (unquote_c_style(&unquoted, p, &end) || *end)
+					goto out;
+			} else {
+				strbuf_addstr(&unquoted, p);
+			}
+			ALLOC_GROW(paths, paths_nr + 1, paths_alloc);
+			paths[paths_nr++] = strbuf_detach(&unquoted, NULL);
+			continue;
+		}
+
+		ALLOC_GROW(result->entries, result->nr + 1, result->alloc);
+		e = &result->entries[result->nr];
+		memset(e, 0, sizeof(*e));
+		p = line.buf;
+		if (parse_int(&p, &e->lno) || *p++ != ' ' ||
+		    parse_int(&p, &e->num_lines) || *p++ != ' ' ||
+		    parse_int(&p, &e->s_lno) || *p++ != ' ' ||
+		    parse_oid_hex(p, &e->commit, &p) || *p++ != ' ' ||
+		    parse_path_ref(&p, paths, paths_nr, &e->path))
+			goto out;
+		result->nr++;
+		if (*p == ' ' &&
+		    (parse_oid_hex(p + 1, &e->previous, &p) || *p++ != ' ' ||
+		     parse_path_ref(&p, paths, paths_nr, &e->previous_path)))
+			goto out;
+		if (*p || e->lno != next_lno || !e->num_lines)
+			goto out;
+		next_lno += e->num_lines;
+	}
+	if (next_lno == result->num_lines)
+		ret = 0;
+
+out:
+	if (ret)
+		blame_cache_result_release(result);
+	for (i = 0; i < paths_nr; i++)
+		free(paths[i]);
+	free(paths);
+	strbuf_release(&line);
+	if (fp)
+		fclose(fp);
+	free(file);
+	return ret;
+}
+
+static int path_index(struct string_list *paths, const char *path)
+{
+	struct string_list_item *item;
+
+	item = unsorted_string_list_lookup(paths, path);
+	if (!item) {
+		item = string_list_append(paths, path);
+		item->util = (void *)(intptr_t)(paths->nr - 1);
+	}
+	return (intptr_t)item->util;
+}
+
+void blame_cache_write(struct repository *r, const struct object_id *commit,
+		       const char *path, const char *variant,
+		       const struct blame_cache_result *result)
+{
+	char *file = blame_cache_file(r, commit, path, variant);
+	struct lock_file lk = LOCK_INIT;
+	struct string_list paths = STRING_LIST_INIT_NODUP;
+	struct strbuf entries = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	int i;
+
+	/*
+	 * Both the leading directories and the lock file that becomes the
+	 * cache file go through adjust_shared_perm(), so the cache stays
+	 * usable by everyone sharing the repository.
+	 */
+	if (file_exists(file) ||
+	    safe_create_leading_directories_const(file) ||
+	    hold_lock_file_for_update(&lk, file, 0) < 0)
+		goto out;
+
+	for (i = 0; i < result->nr; i++) {
+		const struct blame_cache_entry *e = &result->entries[i];
+
+		strbuf_addf(&entries, "%d %d %d %s %d", e->lno, e->num_lines,
+			    e->s_lno, oid_to_hex(&e->commit),
+			    path_index(&paths, e->path));
+		if (e->previous_path)
+			strbuf_addf(&entries, " %s %d", oid_to_hex(&e->previous),
+				    path_index(&paths, e->previous_path));
+		strbuf_addch(&entries, '\n');
+	}
+
+	strbuf_addf(&buf, "blame-cache v1 %d\n", result->num_lines);
+	for (i = 0; i < paths.nr; i++) {
+		strbuf_addstr(&buf, "path ");
+		quote_c_style(paths.items[i].string, &buf, NULL, 0);
+		strbuf_addch(&buf, '\n');
+	}
+	strbuf_addbuf(&buf, &entries);
+
+	if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0)
+		rollback_lock_file(&lk);
+	else
+		commit_lock_file(&lk);
+
+out:
+	string_list_clear(&paths, 0);
+	strbuf_release(&entries);
+	strbuf_release(&buf);
+	free(file);
+}
+
+void blame_cache_result_release(struct blame_cache_result *result)
+{
+	int i;
+
+	for (i = 0; i < result->nr; i++) {
+		free(result->entries[i].path);
+		free(result->entries[i].previous_path);
+	}
+	FREE_AND_NULL(result->entries);
+	result->nr = result->alloc = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef BLAME_CACHE_H
+#define BLAME_CACHE_H
+
+#include "hash.h"
+
+struct repository;
+
+/*
+ * The blame cache remembers the result of blaming a whole file at a
+ * commit, so that a later blame that reaches this (commit, path) while
+ * digging through history can take the rest of the answer from the
+ * cache instead of digging further.
+ *
+ * The cache lives in $GIT_DIR/objects/info/blame-cache/, one file per
+ * (commit, path) and set of options that influence the result (e.g.
+ * whitespace handling). Files are written once and never modified;
+ * the directory can be removed at any time.
+ */
+
+/*
+ * One range of lines of the file, and the commit and path these lines
+ * were blamed on. Line numbers are 0-based; "lno" counts in the cached
+ * file, "s_lno" in the file at "commit".
+ */
+struct blame_cache_entry {
+	int lno, num_lines, s_lno;
+	struct object_id commit;
+	char *path;
+	/* the commit and path the blamed lines are compared with, if any */
+	struct object_id previous;
+	char *previous_path;
+};
+
+struct blame_cache_result {
+	/* sorted by lno, covering the whole file without gaps */
+	struct blame_cache_entry *entries;
+	int nr, alloc;
+	int num_lines;
+};
+
+/*
+ * Look up the blame of "path" at "commit" that was computed with the
+ * options described by "variant". Returns 0 and fills "result" on
+ * success, -1 if there is no such (or only a corrupt) cache entry.
+ */
+int blame_cache_read(struct repository *r, const struct object_id *commit,
+		     const char *path, const char *variant,
+		     struct blame_cache_result *result);
+
+/*
+ * Store "result" as the blame of "path" at "commit". Failures are not
+ * reported; it is only a cache.
+ */
+void blame_cache_write(struct repository *r, const struct object_id *commit,
+		       const char *path, const char *variant,
+		       const struct blame_cache_result *result);
+
+void blame_cache_result_release(struct blame_cache_result *result);
+
+#endif /* BLAME_CACHE_H */
@@ -11,6 +11,10 @@
 #include "commit-slab.h"
 #include "bloom.h"
 #include "commit-graph.h"
+#include "thread-utils.h"
+#include "blame-cache.h"
+#include "shallow.h"
+#include "blob.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -313,6 +317,113 @@ static int diff_hunks(mmfile_t *file_a, mmfile_t *file_b,
 	return xdi_diff(file_a, file_b, &xpp, &xecfg, &ecb);
 }
 
+/*
+ * The diffs run by the move and copy detection are independent of each
+ * other, and by far the most expensive part of "blame -M/-C". They are
+ * set up as a batch of jobs that run up front, possibly in parallel;
+ * each job records its hunks, which are then fed to the usual callbacks
+ * one job after the other, in the same order as if the diffs had been
+ * run one by one.
+ */
+struct blame_hunk {
+	long start_a, count_a;
+	long start_b, count_b;
+};
+
+struct blame_diff_job {
+	mmfile_t file_a, file_b;
+	struct blame_hunk *hunks;
+	int nr, alloc;
+	int ret;
+};
+
+/* Starting a thread is not worth it for fewer jobs */
+#define DIFF_JOBS_PER_THREAD 4
+
+struct diff_job_queue {
+	struct blame_diff_job *jobs;
+	int nr, next;
+	int xdl_opts;
+	pthread_mutex_t mutex;
+};
+
+static int record_hunk(long start_a, long count_a,
+		       long start_b, long count_b, void *data)
+{
+	struct blame_diff_job *job = data;
+	struct blame_hunk *h;
+
+	ALLOC_GROW(job->hunks, job->nr + 1, job->alloc);
+	h = &job->hunks[job->nr++];
+	h->start_a = start_a;
+	h->count_a = count_a;
+	h->start_b = start_b;
+	h->count_b = count_b;
+	return 0;
+}
+
+static void run_diff_job(struct blame_diff_job *job, int xdl_opts)
+{
+	job->ret = diff_hunks(&job->file_a, &job->file_b, record_hunk, job,
+			      xdl_opts);
+}
+
+static void *diff_job_worker(void *data)
+{
+	struct diff_job_queue *q = data;
+
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&q->mutex);
+		i = q->next++;
+		pthread_mutex_unlock(&q->mutex);
+		if (i >= q->nr)
+			return NULL;
+		run_diff_job(&q->jobs[i], q->xdl_opts);
+	}
+}
+
+static void run_diff_jobs(struct blame_scoreboard *sb,
+			  struct blame_diff_job *jobs, int nr)
+{
+	struct diff_job_queue q;
+	pthread_t *threads;
+	int i, nr_threads = sb->num_threads;
+
+	if (nr_threads > nr / DIFF_JOBS_PER_THREAD)
+		nr_threads = nr / DIFF_JOBS_PER_THREAD;
+	if (!HAVE_THREADS || nr_threads < 2) {
+		for (i = 0; i < nr; i++)
+			run_diff_job(&jobs[i], sb->xdl_opts);
+		return;
+	}
+
+	q.jobs = jobs;
+	q.nr = nr;
+	q.next = 0;
+	q.xdl_opts = sb->xdl_opts;
+	pthread_mutex_init(&q.mutex, NULL);
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, diff_job_worker, &q);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&q.mutex);
+}
+
+static void clear_diff_jobs(struct blame_diff_job *jobs, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		FREE_AND_NULL(jobs[i].hunks);
+}
+
 static const char *get_next_line(const char *start, const char *end)
 {
 	const char *nl = memchr(start, '\n', end - start);
@@ -2084,38 +2195,57 @@ static int handle_split_cb(long start_a, long count_a,
 	return 0;
 }
 
+/*
+ * Prepare the job that diffs file_p, the blob contents for a parent,
+ * against the lines in ent.
+ */
+static void prepare_copy_job(struct blame_scoreboard *sb,
+			     struct blame_diff_job *job,
+			     struct blame_entry *ent,
+			     mmfile_t *file_p)
+{
+	const char *cp;
+
+	memset(job, 0, sizeof(*job));
+	job->file_a = *file_p;
+	/*
+	 * Prepare mmfile that contains only the lines in ent.
+	 */
+	cp = blame_nth_line(sb, ent->lno);
+	job->file_b.ptr = (char *) cp;
+	job->file_b.size = blame_nth_line(sb, ent->lno + ent->num_lines) - cp;
+}
+
 /*
  * Find the lines from parent that are the same as ent so that
- * we can pass blames to it.  file_p has the blob contents for
- * the parent.
+ * we can pass blames to it.  job has the diff prepared by
+ * prepare_copy_job() for the blob contents of the parent.
  */
 static void find_copy_in_blob(struct blame_scoreboard *sb,
 			      struct blame_entry *ent,
 			      struct blame_origin *parent,
 			      struct blame_entry *split,
-			      mmfile_t *file_p)
+			      struct blame_diff_job *job)
 {
-	const char *cp;
-	mmfile_t file_o;
 	struct handle_split_cb_data d;
+	int i;
 
 	memset(&d, 0, sizeof(d));
 	d.sb = sb; d.ent = ent; d.parent = parent; d.split = split;
-	/*
-	 * Prepare mmfile that contains only the lines in ent.
-	 */
-	cp = blame_nth_line(sb, ent->lno);
-	file_o.ptr = (char *) cp;
-	file_o.size = blame_nth_line(sb, ent->lno + ent->num_lines) - cp;
 
 	/*
-	 * file_o is a part of final image we are annotating.
-	 * file_p partially may match that image.
+	 * job->file_b is a part of final image we are annotating.
+	 * job->file_a partially may match that image.
 	 */
 	memset(split, 0, sizeof(struct blame_entry [3]));
-	if (diff_hunks(file_p, &file_o, handle_split_cb, &d, sb->xdl_opts))
+	if (job->ret)
 		die("unable to generate diff (%s)",
 		    oid_to_hex(&parent->commit->object.oid));
+	for (i = 0; i < job->nr; i++) {
+		struct blame_hunk *h = &job->hunks[i];
+		handle_split_cb(h->start_a, h->count_a,
+				h->start_b, h->count_b, &d);
+	}
 	/* remainder, if any, all match the preimage */
 	handle_split(sb, ent, d.tlno, d.plno, ent->num_lines, parent, split);
 }
@@ -2179,9 +2309,19 @@ static void find_move_in_parent(struct blame_scoreboard *sb,
 	do {
 		struct blame_entry **unblamedtail = &unblamed;
 		struct blame_entry *next;
-		for (e = unblamed; e; e = next) {
+		struct blame_diff_job *jobs;
+		int i, nr;
+
+		for (e = unblamed, nr = 0; e; e = e->next)
+			nr++;
+		jobs = xcalloc(nr, sizeof(*jobs));
+		for (e = unblamed, i = 0; e; e = e->next, i++)
+			prepare_copy_job(sb, &jobs[i], e, &file_p);
+		run_diff_jobs(sb, jobs, nr);
+
+		for (e = unblamed, i = 0; e; e = next, i++) {
 			next = e->next;
-			find_copy_in_blob(sb, e, parent, split, &file_p);
+			find_copy_in_blob(sb, e, parent, split, &jobs[i]);
 			if (split[1].suspect &&
 			    sb->move_score < blame_entry_score(sb, &split[1])) {
 				split_blame(blamed, &unblamedtail, split, e);
@@ -2191,6 +2331,8 @@ static void find_move_in_parent(struct blame_scoreboard *sb,
 			}
 			decref_split(split);
 		}
+		clear_diff_jobs(jobs, nr);
+		free(jobs);
 		*unblamedtail = NULL;
 		toosmall = filter_small(sb, toosmall, &unblamed, sb->move_score);
 	} while (unblamed);
@@ -2238,11 +2380,14 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 				int opt)
 {
 	struct diff_options diff_opts;
-	int i, j;
+	int i, j, k, b;
 	struct blame_list *blame_list;
 	int num_ents;
 	struct blame_entry *unblamed = target->suspects;
 	struct blame_entry *leftover = NULL;
+	struct blame_origin **norigins = NULL;
+	struct blame_diff_job *jobs = NULL;
+	int norigins_alloc = 0, jobs_alloc = 0;
 
 	if (!unblamed)
 		return; /* nothing remains for this target */
@@ -2277,38 +2422,66 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 
 	do {
 		struct blame_entry **unblamedtail = &unblamed;
+		int batch_size = 1;
+
 		blame_list = setup_blame_list(unblamed, &num_ents);
 
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			struct diff_filepair *p = diff_queued_diff.queue[i];
-			struct blame_origin *norigin;
-			mmfile_t file_p;
-			struct blame_entry potential[3];
-
-			if (!DIFF_FILE_VALID(p->one))
-				continue; /* does not exist in parent */
-			if (S_ISGITLINK(p->one->mode))
-				continue; /* ignore git links */
-			if (porigin && !strcmp(p->one->path, porigin->path))
-				/* find_move already dealt with this path */
-				continue;
+		/*
+		 * Read the blobs of as many paths at once as it takes to
+		 * keep all threads busy diffing them against the entries.
+		 */
+		if (sb->num_threads > 1)
+			batch_size = DIV_ROUND_UP(sb->num_threads *
+						  DIFF_JOBS_PER_THREAD,
+						  num_ents);
+		ALLOC_GROW(norigins, batch_size, norigins_alloc);
+		ALLOC_GROW(jobs, st_mult(batch_size, num_ents), jobs_alloc);
+
+		for (i = 0; i < diff_queued_diff.nr; i = k) {
+			int nr = 0;
+
+			for (k = i; k < diff_queued_diff.nr && nr < batch_size; k++) {
+				struct diff_filepair *p = diff_queued_diff.queue[k];
+				struct blame_origin *norigin;
+				mmfile_t file_p;
+
+				if (!DIFF_FILE_VALID(p->one))
+					continue; /* does not exist in parent */
+				if (S_ISGITLINK(p->one->mode))
+					continue; /* ignore git links */
+				if (porigin && !strcmp(p->one->path, porigin->path))
+					/* find_move already dealt with this path */
+					continue;
 
-			norigin = get_origin(parent, p->one->path);
-			oidcpy(&norigin->blob_oid, &p->one->oid);
-			norigin->mode = p->one->mode;
-			fill_origin_blob(&sb->revs->diffopt, norigin, &file_p,
-					 &sb->num_read_blob, 0);
-			if (!file_p.ptr)
-				continue;
+				norigin = get_origin(parent, p->one->path);
+				oidcpy(&norigin->blob_oid, &p->one->oid);
+				norigin->mode = p->one->mode;
+				fill_origin_blob(&sb->revs->diffopt, norigin, &file_p,
+						 &sb->num_read_blob, 0);
+				if (!file_p.ptr)
+					continue;
 
-			for (j = 0; j < num_ents; j++) {
-				find_copy_in_blob(sb, blame_list[j].ent,
-						  norigin, potential, &file_p);
-				copy_split_if_better(sb, blame_list[j].split,
-						     potential);
-				decref_split(potential);
+				for (j = 0; j < num_ents; j++)
+					prepare_copy_job(sb, &jobs[nr * num_ents + j],
+							 blame_list[j].ent, &file_p);
+				norigins[nr++] = norigin;
 			}
-			blame_origin_decref(norigin);
+			run_diff_jobs(sb, jobs, nr * num_ents);
+
+			for (b = 0; b < nr; b++) {
+				for (j = 0; j < num_ents; j++) {
+					struct blame_entry potential[3];
+
+					find_copy_in_blob(sb, blame_list[j].ent,
+							  norigins[b], potential,
+							  &jobs[b * num_ents + j]);
+					copy_split_if_better(sb, blame_list[j].split,
+							     potential);
+					decref_split(potential);
+				}
+				blame_origin_decref(norigins[b]);
+			}
+			clear_diff_jobs(jobs, nr * num_ents);
 		}
 
 		for (j = 0; j < num_ents; j++) {
@@ -2328,6 +2501,8 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 		toosmall = filter_small(sb, toosmall, &unblamed, sb->copy_score);
 	} while (unblamed);
 	target->suspects = reverse_blame(leftover, NULL);
+	free(norigins);
+	free(jobs);
 	diff_flush(&diff_opts);
 	clear_pathspec(&diff_opts.pathspec);
 }
@@ -2579,6 +2754,127 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 		free(sg_origin);
 }
 
+/*
+ * Look up the origin a cached blame entry blames its lines on, with its
+ * previous origin if there is one. Returns NULL if the commit or path
+ * do not exist (anymore).
+ */
+static struct blame_origin *get_cached_origin(struct blame_scoreboard *sb,
+					      const struct blame_cache_entry *c)
+{
+	struct commit *commit, *prev_commit;
+	struct blame_origin *o, *prev;
+
+	commit = lookup_commit(sb->repo, &c->commit);
+	if (!commit || parse_commit(commit))
+		return NULL;
+	/* treat root commit as boundary, as assign_blame() does */
+	if (!commit->parents && !sb->show_root)
+		commit->object.flags |= UNINTERESTING;
+
+	o = get_origin(commit, c->path);
+	if (fill_blob_sha1_and_mode(sb->repo, o))
+		goto fail;
+	if (!c->previous_path || o->previous)
+		return o;
+
+	prev_commit = lookup_commit(sb->repo, &c->previous);
+	if (!prev_commit || parse_commit(prev_commit))
+		goto fail;
+	prev = get_origin(prev_commit, c->previous_path);
+	if (fill_blob_sha1_and_mode(sb->repo, prev)) {
+		blame_origin_decref(prev);
+		goto fail;
+	}
+	o->previous = prev;
+	return o;
+
+fail:
+	blame_origin_decref(o);
+	return NULL;
+}
+
+/*
+ * If the blame cache knows the blame of the whole file of origin,
+ * blame the lines origin is suspected for on the commits the cache
+ * says they come from, and return 1. Otherwise return 0 and leave
+ * origin alone.
+ */
+static int splice_cached_blame(struct blame_scoreboard *sb,
+			       struct blame_origin *origin)
+{
+	struct blame_cache_result res;
+	struct blame_origin **guilty = NULL;
+	struct blame_entry *e, *next;
+	int i, ret = 0;
+
+	if (!sb->cache_variant || is_null_oid(&origin->commit->object.oid))
+		return 0;
+	if (blame_cache_read(sb->repo, &origin->commit->object.oid,
+			     origin->path, sb->cache_variant, &res))
+		return 0;
+
+	for (e = origin->suspects; e; e = e->next)
+		if (e->s_lno + e->num_lines > res.num_lines)
+			goto out;
+
+	guilty = xcalloc(res.nr, sizeof(*guilty));
+	for (i = 0; i < res.nr; i++) {
+		guilty[i] = get_cached_origin(sb, &res.entries[i]);
+		if (!guilty[i])
+			goto out;
+	}
+
+	for (e = origin->suspects; e; e = next) {
+		int lo = 0, hi = res.nr;
+
+		next = e->next;
+
+		/* find the cached entry that contains the first line of e */
+		while (hi - lo > 1) {
+			int mid = lo + (hi - lo) / 2;
+			if (res.entries[mid].lno <= e->s_lno)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		for (i = lo;
+		     i < res.nr && res.entries[i].lno < e->s_lno + e->num_lines;
+		     i++) {
+			const struct blame_cache_entry *c = &res.entries[i];
+			int start = e->s_lno > c->lno ? e->s_lno : c->lno;
+			int end = e->s_lno + e->num_lines;
+			struct blame_entry *n = xcalloc(1, sizeof(*n));
+
+			if (end > c->lno + c->num_lines)
+				end = c->lno + c->num_lines;
+			n->lno = e->lno + start - e->s_lno;
+			n->num_lines = end - start;
+			n->s_lno = c->s_lno + start - c->lno;
+			n->suspect = blame_origin_incref(guilty[i]);
+			n->suspect->guilty = 1;
+			if (sb->found_guilty_entry)
+				sb->found_guilty_entry(n, sb->found_guilty_entry_data);
+			n->next = sb->ent;
+			sb->ent = n;
+		}
+		blame_origin_decref(e->suspect);
+		free(e);
+	}
+	origin->suspects = NULL;
+	ret = 1;
+
+out:
+	if (guilty) {
+		for (i = 0; i < res.nr; i++)
+			blame_origin_decref(guilty[i]);
+		free(guilty);
+	}
+	blame_cache_result_release(&res);
+	return ret;
+}
+
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
@@ -2609,7 +2905,9 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		 */
 		blame_origin_incref(suspect);
 		parse_commit(commit);
-		if (sb->reverse ||
+		if (splice_cached_blame(sb, suspect))
+			; /* all lines were blamed on cached results */
+		else if (sb->reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
 		     !(revs->max_age != -1 && commit->date < revs->max_age)))
 			pass_blame(sb, suspect, opt);
@@ -2912,8 +3210,125 @@ void setup_blame_bloom_data(struct blame_scoreboard *sb,
 	sb->bloom_data = bd;
 }
 
+void setup_blame_cache(struct blame_scoreboard *sb, int opt)
+{
+	int i;
+
+	/*
+	 * The cache only holds results for plain, unbounded blames:
+	 * anything that limits the history that is dug through, or
+	 * looks for lines in other files, would not be reflected in the
+	 * cached result, or in the results spliced from it.
+	 */
+	if (opt || sb->reverse || oidset_size(&sb->ignore_list) ||
+	    sb->revs->max_age != -1 || sb->revs->first_parent_only ||
+	    is_repository_shallow(sb->repo))
+		return;
+	for (i = 0; i < sb->revs->cmdline.nr; i++)
+		if (sb->revs->cmdline.rev[i].flags & UNINTERESTING)
+			return;
+
+	sb->cache_variant = xstrfmt("xdl=%d renames=%d textconv=%d",
+				    sb->xdl_opts, !sb->no_whole_file_rename,
+				    sb->revs->diffopt.flags.allow_textconv);
+}
+
+static int compare_cache_entry_lno(const void *a_, const void *b_)
+{
+	const struct blame_cache_entry *a = a_, *b = b_;
+
+	return a->lno < b->lno ? -1 : a->lno > b->lno;
+}
+
+/*
+ * The commit whose blame of sb->path we computed. When blaming the
+ * working tree, that is its only parent, if the file is unchanged.
+ */
+static const struct object_id *blamed_commit(struct blame_scoreboard *sb)
+{
+	const struct object_id *parent;
+	struct object_id blob_oid, oid;
+	unsigned short mode;
+
+	if (!is_null_oid(&sb->final->object.oid))
+		return &sb->final->object.oid;
+
+	if (!sb->final->parents || sb->final->parents->next)
+		return NULL;
+	parent = &sb->final->parents->item->object.oid;
+	if (get_tree_entry(sb->repo, parent, sb->path, &blob_oid, &mode))
+		return NULL;
+	hash_object_file(the_hash_algo, sb->final_buf, sb->final_buf_size,
+			 blob_type, &oid);
+	return oideq(&oid, &blob_oid) ? parent : NULL;
+}
+
+void write_blame_cache(struct blame_scoreboard *sb)
+{
+	struct blame_cache_result res;
+	const struct object_id *commit;
+	struct blame_entry *e;
+	int i, nr = 0, next_lno = 0;
+
+	if (!sb->cache_variant || !(commit = blamed_commit(sb)))
+		return;
+
+	memset(&res, 0, sizeof(res));
+	res.num_lines = sb->num_lines;
+	for (e = sb->ent; e; e = e->next) {
+		struct blame_cache_entry *c;
+
+		ALLOC_GROW(res.entries, res.nr + 1, res.alloc);
+		c = &res.entries[res.nr++];
+		memset(c, 0, sizeof(*c));
+		c->lno = e->lno;
+		c->num_lines = e->num_lines;
+		c->s_lno = e->s_lno;
+		oidcpy(&c->commit, &e->suspect->commit->object.oid);
+		c->path = xstrdup(e->suspect->path);
+		if (e->suspect->previous) {
+			oidcpy(&c->previous,
+			       &e->suspect->previous->commit->object.oid);
+			c->previous_path = xstrdup(e->suspect->previous->path);
+		}
+	}
+	QSORT(res.entries, res.nr, compare_cache_entry_lno);
+
+	/* Only the blame of the whole file is worth keeping */
+	for (i = 0; i < res.nr; i++) {
+		if (res.entries[i].lno != next_lno)
+			goto out;
+		next_lno += res.entries[i].num_lines;
+	}
+	if (next_lno != res.num_lines)
+		goto out;
+
+	/* coalesce what blame_coalesce() would */
+	for (i = 0; i < res.nr; i++) {
+		struct blame_cache_entry *prev = nr ? &res.entries[nr - 1] : NULL;
+		struct blame_cache_entry *c = &res.entries[i];
+
+		if (prev && oideq(&prev->commit, &c->commit) &&
+		    !strcmp(prev->path, c->path) &&
+		    prev->s_lno + prev->num_lines == c->s_lno) {
+			prev->num_lines += c->num_lines;
+			free(c->path);
+			free(c->previous_path);
+			continue;
+		}
+		res.entries[nr++] = *c;
+	}
+	res.nr = nr;
+
+	blame_cache_write(sb->repo, commit, sb->path,
+			  sb->cache_variant, &res);
+out:
+	blame_cache_result_release(&res);
+}
+
 void cleanup_scoreboard(struct blame_scoreboard *sb)
 {
+	FREE_AND_NULL(sb->cache_variant);
 	if (sb->bloom_data) {
 		int i;
 		for (i = 0; i < sb->bloom_data->nr; i++) {
@@ -153,12 +153,25 @@ struct blame_scoreboard {
 	int no_whole_file_rename;
 	int debug;
 
+	/*
+	 * The number of threads to run the diffs of the move and copy
+	 * detection with; 0 or 1 runs them in the calling thread.
+	 */
+	int num_threads;
+
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
 	void(*found_guilty_entry)(struct blame_entry *, void *);
 
 	void *found_guilty_entry_data;
 	struct blame_bloom_data *bloom_data;
+
+	/*
+	 * Describes the options the blame cache entries have to be
+	 * computed with; NULL if the blame cache is not used. Set by
+	 * setup_blame_cache().
+	 */
+	char *cache_variant;
 };
 
 /*
@@ -187,6 +200,14 @@ void setup_blame_bloom_data(struct blame_scoreboard *sb,
 			    const char *path);
 void cleanup_scoreboard(struct blame_scoreboard *sb);
 
+/*
+ * Use the blame cache (see blame-cache.h) if the scoreboard is set up
+ * for a blame whose result it can hold, and store the result of
+ * assign_blame() in it.
+ */
+void setup_blame_cache(struct blame_scoreboard *sb, int opt);
+void write_blame_cache(struct blame_scoreboard *sb);
+
 struct blame_entry *blame_entry_prepend(struct blame_entry *head,
 					long start, long end,
 					struct blame_origin *o);
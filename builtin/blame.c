@@ -50,6 +50,8 @@ static int xdl_opts;
 static int abbrev = -1;
 static int no_whole_file_rename;
 static int show_progress;
+static int num_threads;
+static int use_blame_cache;
 static char repeated_meta_color[COLOR_MAXLEN];
 static int coloring_mode;
 static struct string_list ignore_revs_file_list = STRING_LIST_INIT_NODUP;
@@ -684,6 +686,17 @@ static const char *add_prefix(const char *prefix, const char *path)
 
 static int git_blame_config(const char *var, const char *value, void *cb)
 {
+	if (!strcmp(var, "blame.threads")) {
+		num_threads = git_config_int(var, value);
+		if (num_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    num_threads, var);
+		return 0;
+	}
+	if (!strcmp(var, "blame.cache")) {
+		use_blame_cache = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "blame.showroot")) {
 		show_root = git_config_bool(var, value);
 		return 0;
@@ -1124,6 +1137,9 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	sb.show_root = show_root;
 	sb.xdl_opts = xdl_opts;
 	sb.no_whole_file_rename = no_whole_file_rename;
+	if (!num_threads)
+		num_threads = online_cpus();
+	sb.num_threads = HAVE_THREADS ? num_threads : 1;
 
 	read_mailmap(&mailmap, NULL);
 
@@ -1132,8 +1148,13 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	if (show_progress)
 		pi.progress = start_delayed_progress(_("Blaming lines"), sb.num_lines);
 
+	if (use_blame_cache && !revs_file)
+		setup_blame_cache(&sb, opt);
+
 	assign_blame(&sb, opt);
 
+	write_blame_cache(&sb);
+
 	stop_progress(&pi.progress);
 
 	if (!incremental)
@@ -12,6 +12,7 @@
 #include "ll-merge.h"
 #include "lockfile.h"
 #include "merge-recursive.h"
+#include "parallel-checkout.h"
 #include "object-store.h"
 #include "parse-options.h"
 #include "refs.h"
@@ -358,6 +359,7 @@ static int checkout_worktree(const struct checkout_opts *opts,
 	int nr_checkouts = 0, nr_unmerged = 0;
 	int errs = 0;
 	int pos;
+	int pc_workers, pc_threshold;
 
 	state.force = 1;
 	state.refresh_cache = 1;
@@ -367,7 +369,18 @@ static int checkout_worktree(const struct checkout_opts *opts,
 			       info->commit ? &info->commit->object.oid : &info->oid,
 			       NULL);
 
+	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
+
+	/*
+	 * checkout_merged() writes out transient cache entries that are
+	 * discarded right away, so they cannot be queued.
+	 */
+	if (opts->merge)
+		pc_workers = 1;
+
 	enable_delayed_checkout(&state);
+	if (pc_workers > 1)
+		init_parallel_checkout();
 	for (pos = 0; pos < active_nr; pos++) {
 		struct cache_entry *ce = active_cache[pos];
 		if (ce->ce_flags & CE_MATCHED) {
@@ -387,6 +400,9 @@ static int checkout_worktree(const struct checkout_opts *opts,
 			pos = skip_same_name(ce, pos) - 1;
 		}
 	}
+	if (pc_workers > 1)
+		errs |= run_parallel_checkout(&state, pc_workers, pc_threshold,
+					      NULL, NULL);
 	remove_marked_cache_entries(&the_index, 1);
 	remove_scheduled_dirs();
 	errs |= finish_delayed_checkout(&state, &nr_checkouts);
@@ -0,0 +1,525 @@
+#include "builtin.h"
+#include "config.h"
+#include "parse-options.h"
+#include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
+#include "run-command.h"
+
+static const char * const builtin_fsmonitor__daemon_usage[] = {
+	N_("git fsmonitor--daemon (start | run | stop | status)"),
+	NULL
+};
+
+#ifdef HAVE_FSMONITOR_DAEMON_BACKEND
+
+#include "compat/fsmonitor/fsm-listen.h"
+#include "sigchain.h"
+#include "tempfile.h"
+#include "unix-socket.h"
+
+/*
+ * Once this many distinct paths changed, the daemon forgets about
+ * them, and clients that ask about changes since before that point
+ * are told to check everything. This bounds the memory used by a
+ * daemon that runs for a long time next to tools that touch many
+ * files (e.g. builds).
+ */
+#define MAX_CHANGED_PATHS (1 << 20)
+
+/*
+ * How long a client has to send its whole request, and to take the
+ * whole answer. Clients are served one at a time, so one that connects
+ * and then sends nothing, never closes its end, or never reads what we
+ * send back, must not keep the others waiting forever.
+ */
+#define CLIENT_TIMEOUT_MS 5000
+
+/*
+ * Events are grouped into batches: everything that was read from the
+ * kernel in one go gets the sequence number of a new batch. A token
+ * handed out to a client names this daemon instance and the last
+ * batch the client has been told about.
+ */
+struct fsmonitor_daemon_state {
+	struct fsm_listen *listen;
+	const char *worktree;
+	char *token_id;
+
+	uint64_t seq;
+	/* We only know about the changes made in batches after this one */
+	uint64_t oldest_seq;
+	int batch_has_changes;
+
+	struct hashmap changed; /* struct changed_path */
+};
+
+struct changed_path {
+	struct hashmap_entry ent;
+	uint64_t seq; /* of the last batch the path changed in */
+	char path[FLEX_ARRAY];
+};
+
+static int changed_path_cmp(const void *unused_cmp_data,
+			    const struct hashmap_entry *eptr,
+			    const struct hashmap_entry *entry_or_key,
+			    const void *keydata)
+{
+	const struct changed_path *a, *b;
+
+	a = container_of(eptr, const struct changed_path, ent);
+	b = container_of(entry_or_key, const struct changed_path, ent);
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static void record_change(const char *path, void *data)
+{
+	struct fsmonitor_daemon_state *state = data;
+	unsigned int hash = strhash(path);
+	struct changed_path *c;
+
+	c = hashmap_get_entry_from_hash(&state->changed, hash, path,
+					struct changed_path, ent);
+	if (!c) {
+		FLEX_ALLOC_STR(c, path, path);
+		hashmap_entry_init(&c->ent, hash);
+		hashmap_add(&state->changed, &c->ent);
+	}
+	c->seq = state->seq + 1;
+	state->batch_has_changes = 1;
+}
+
+static void forget_changes(struct fsmonitor_daemon_state *state)
+{
+	hashmap_free_entries(&state->changed, struct changed_path, ent);
+	hashmap_init(&state->changed, changed_path_cmp, NULL, 0);
+	state->seq++;
+	state->oldest_seq = state->seq;
+}
+
+/*
+ * Take in the events queued by the kernel. Returns -1 if the working
+ * tree went away and the daemon should exit.
+ */
+static int process_events(struct fsmonitor_daemon_state *state)
+{
+	int ret = fsm_listen_drain(state->listen, record_change, state);
+
+	if (ret < 0)
+		return -1;
+	if (state->batch_has_changes) {
+		state->seq++;
+		state->batch_has_changes = 0;
+	}
+	if (ret > 0 || hashmap_get_size(&state->changed) > MAX_CHANGED_PATHS) {
+		trace_printf_key(&trace_fsmonitor,
+				 "fsmonitor--daemon: resync at batch %"PRIu64,
+				 state->seq);
+		forget_changes(state);
+	}
+	return 0;
+}
+
+/*
+ * Parse a token we handed out before. Returns 0 and the sequence
+ * number if it is ours, -1 if it is not (e.g. it was issued by a
+ * previous instance of the daemon, or is a hook version 1 timestamp).
+ */
+static int parse_token(struct fsmonitor_daemon_state *state,
+		       const char *token, uint64_t *seq)
+{
+	const char *p;
+	char *end;
+
+	if (!skip_prefix(token, state->token_id, &p) || *p++ != ':')
+		return -1;
+	*seq = strtoumax(p, &end, 10);
+	if (end == p || *end)
+		return -1;
+	return 0;
+}
+
+static void answer_query(struct fsmonitor_daemon_state *state,
+			 const char *token, struct strbuf *answer)
+{
+	struct hashmap_iter iter;
+	struct changed_path *c;
+	uint64_t since;
+
+	strbuf_addf(answer, "%s:%"PRIu64, state->token_id, state->seq);
+	strbuf_addch(answer, '\0');
+
+	if (parse_token(state, token, &since) < 0 ||
+	    since < state->oldest_seq || since > state->seq) {
+		/* We cannot tell; the client has to check everything */
+		strbuf_addstr(answer, "/");
+		strbuf_addch(answer, '\0');
+		return;
+	}
+
+	hashmap_for_each_entry(&state->changed, &iter, c, ent) {
+		if (c->seq <= since)
+			continue;
+		strbuf_addstr(answer, c->path);
+		strbuf_addch(answer, '\0');
+	}
+}
+
+static uint64_t client_deadline(void)
+{
+	uint64_t timeout = git_env_ulong("GIT_TEST_FSMONITOR_CLIENT_TIMEOUT",
+					 CLIENT_TIMEOUT_MS);
+
+	return getnanotime() / 1000000 + timeout;
+}
+
+/*
+ * Wait until the client is ready for 'events'. Returns 0 when it is,
+ * and -1 with errno set (to ETIMEDOUT if the deadline passed) if not.
+ */
+static int wait_for_client(int fd, short events, uint64_t deadline)
+{
+	for (;;) {
+		uint64_t now = getnanotime() / 1000000;
+		struct pollfd pfd;
+		int ret;
+
+		if (now >= deadline) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		pfd.fd = fd;
+		pfd.events = events;
+		ret = poll(&pfd, 1, deadline - now);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (!ret) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		return 0;
+	}
+}
+
+/*
+ * Read a request up to the end of file, unless the client does not
+ * finish sending it in time. Returns 0 on success, and -1 with errno
+ * set (to ETIMEDOUT if the client was too slow) on failure.
+ */
+static int read_request(int fd, struct strbuf *request)
+{
+	uint64_t deadline = client_deadline();
+
+	for (;;) {
+		ssize_t n;
+
+		if (wait_for_client(fd, POLLIN, deadline) < 0)
+			return -1;
+		n = strbuf_read_once(request, fd, 0);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		if (!n)
+			return 0;
+	}
+}
+
+/*
+ * Send the answer, unless the client does not take it in time. The
+ * socket is made non-blocking, so that a write never waits for more
+ * room than poll() said there was. Returns 0 on success, and -1 with
+ * errno set (to ETIMEDOUT if the client was too slow, or to EPIPE if
+ * it went away) on failure.
+ */
+static int write_answer(int fd, const char *buf, size_t len)
+{
+	uint64_t deadline = client_deadline();
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return -1;
+
+	while (len) {
+		ssize_t n;
+
+		if (wait_for_client(fd, POLLOUT, deadline) < 0)
+			return -1;
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Serve one client. Returns 1 if the daemon was asked to exit.
+ */
+static int serve_client(struct fsmonitor_daemon_state *state, int fd)
+{
+	struct strbuf request = STRBUF_INIT;
+	struct strbuf answer = STRBUF_INIT;
+	const char *token;
+	int quit = 0;
+
+	if (read_request(fd, &request) < 0) {
+		if (errno == ETIMEDOUT)
+			warning(_("fsmonitor--daemon: dropping a client that "
+				  "did not send its request in time"));
+		else
+			warning_errno(_("fsmonitor--daemon: failed to read request"));
+		goto out;
+	}
+	strbuf_trim_trailing_newline(&request);
+
+	/*
+	 * Pick up everything the kernel has queued so far, so that the
+	 * answer covers all changes made before the request was sent.
+	 */
+	if (process_events(state) < 0) {
+		quit = 1;
+		goto out;
+	}
+
+	if (skip_prefix(request.buf, "query ", &token))
+		answer_query(state, token, &answer);
+	else if (!strcmp(request.buf, "status"))
+		strbuf_addf(&answer, _("fsmonitor-daemon is watching '%s'\n"),
+			    state->worktree);
+	else if (!strcmp(request.buf, "quit"))
+		quit = 1;
+	else
+		warning(_("fsmonitor--daemon: unknown request '%s'"),
+			request.buf);
+
+	if (answer.len && write_answer(fd, answer.buf, answer.len) < 0) {
+		/* A client that went away before the answer is no news */
+		if (errno == ETIMEDOUT)
+			warning(_("fsmonitor--daemon: dropping a client that "
+				  "did not read its answer in time"));
+		else if (errno != EPIPE)
+			warning_errno(_("fsmonitor--daemon: failed to send answer"));
+	}
+
+out:
+	strbuf_release(&request);
+	strbuf_release(&answer);
+	return quit;
+}
+
+static void serve(struct fsmonitor_daemon_state *state, int listen_fd)
+{
+	struct pollfd pfd[2];
+
+	pfd[0].fd = listen_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = fsm_listen_fd(state->listen);
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die_errno(_("poll failed"));
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			if (process_events(state) < 0)
+				return;
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			int client = accept(listen_fd, NULL, NULL);
+			int quit;
+
+			if (client < 0) {
+				warning_errno(_("accept failed"));
+				continue;
+			}
+			quit = serve_client(state, client);
+			if (quit) {
+				/*
+				 * Remove the socket before the client sees
+				 * us close the connection (see
+				 * credential-cache--daemon).
+				 */
+				return;
+			}
+			close(client);
+		}
+	}
+}
+
+static int is_daemon_running(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+	int ret = !fsmonitor_ipc__send_command("status", &answer);
+
+	strbuf_release(&answer);
+	return ret;
+}
+
+static int fsmonitor_run_daemon(int background)
+{
+	struct fsmonitor_daemon_state state;
+	const char *socket_path = fsmonitor_ipc__get_path();
+	struct tempfile *socket_file;
+	int fd;
+
+	memset(&state, 0, sizeof(state));
+	state.worktree = get_git_work_tree();
+	if (!state.worktree)
+		die(_("fsmonitor--daemon requires a working tree"));
+
+	if (is_daemon_running())
+		die(_("fsmonitor--daemon is already running in '%s'"),
+		    state.worktree);
+
+	state.token_id = xstrfmt("builtin:%"PRIuMAX".%"PRIu64,
+				 (uintmax_t)getpid(), getnanotime());
+	hashmap_init(&state.changed, changed_path_cmp, NULL, 0);
+	state.listen = fsm_listen_init(state.worktree);
+	if (!state.listen)
+		die(_("could not watch '%s'"), state.worktree);
+
+	socket_file = register_tempfile(socket_path);
+	fd = unix_stream_listen(socket_path);
+	if (fd < 0)
+		die_errno(_("unable to bind to '%s'"), socket_path);
+
+	/*
+	 * A client that hangs up before reading its answer must only
+	 * make write() fail with EPIPE, not take the daemon down.
+	 */
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	printf("ok\n");
+	fflush(stdout);
+	if (background) {
+		fclose(stdout);
+		if (!freopen("/dev/null", "w", stderr))
+			die_errno("unable to point stderr to /dev/null");
+		setsid();
+	}
+
+	serve(&state, fd);
+	sigchain_pop(SIGPIPE);
+
+	close(fd);
+	delete_tempfile(&socket_file);
+	fsm_listen_free(state.listen);
+	hashmap_free_entries(&state.changed, struct changed_path, ent);
+	free(state.token_id);
+	return 0;
+}
+
+static int fsmonitor_start_daemon(void)
+{
+	struct child_process daemon = CHILD_PROCESS_INIT;
+	char buf[128];
+	int r;
+
+	if (is_daemon_running())
+		return error(_("fsmonitor--daemon is already running in '%s'"),
+			     get_git_work_tree());
+
+	strvec_pushl(&daemon.args, "fsmonitor--daemon", "run", "--background",
+		     NULL);
+	daemon.git_cmd = 1;
+	daemon.no_stdin = 1;
+	daemon.out = -1;
+
+	if (start_command(&daemon))
+		return error_errno(_("unable to start fsmonitor--daemon"));
+	r = read_in_full(daemon.out, buf, sizeof(buf));
+	close(daemon.out);
+	if (r < 0)
+		return error_errno(_("unable to read result code from fsmonitor--daemon"));
+	if (r != 3 || memcmp(buf, "ok\n", 3))
+		return error(_("fsmonitor--daemon did not start"));
+	return 0;
+}
+
+static int fsmonitor_stop_daemon(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+
+	if (fsmonitor_ipc__send_command("quit", &answer)) {
+		strbuf_release(&answer);
+		return error(_("fsmonitor--daemon is not running"));
+	}
+	strbuf_release(&answer);
+	return 0;
+}
+
+static int fsmonitor_daemon_status(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+
+	if (fsmonitor_ipc__send_command("status", &answer)) {
+		printf(_("fsmonitor-daemon is not watching '%s'\n"),
+		       get_git_work_tree());
+		strbuf_release(&answer);
+		return 1;
+	}
+	fputs(answer.buf, stdout);
+	strbuf_release(&answer);
+	return 0;
+}
+
+int cmd_fsmonitor__daemon(int argc, const char **argv, const char *prefix)
+{
+	const char *subcmd;
+	int background = 0;
+	struct option options[] = {
+		OPT_HIDDEN_BOOL(0, "background", &background,
+				N_("detach from the terminal once started")),
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_fsmonitor__daemon_usage, 0);
+	if (argc != 1)
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+	subcmd = argv[0];
+
+	if (!strcmp(subcmd, "start"))
+		return !!fsmonitor_start_daemon();
+	if (!strcmp(subcmd, "run"))
+		return !!fsmonitor_run_daemon(background);
+	if (!strcmp(subcmd, "stop"))
+		return !!fsmonitor_stop_daemon();
+	if (!strcmp(subcmd, "status"))
+		return fsmonitor_daemon_status();
+
+	die(_("unhandled subcommand '%s'"), subcmd);
+}
+
+#else
+
+int cmd_fsmonitor__daemon(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+
+	die(_("fsmonitor--daemon not supported on this platform"));
+}
+
+#endif /* HAVE_FSMONITOR_DAEMON_BACKEND */
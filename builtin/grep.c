@@ -25,6 +25,8 @@
 #include "submodule-config.h"
 #include "object-store.h"
 #include "packfile.h"
+#include "grep-trigrams.h"
+#include "convert.h"
 
 static char const * const grep_usage[] = {
 	N_("git grep [<options>] [-e] <pattern> [<rev>...] [[--] <path>...]"),
@@ -37,6 +39,11 @@ static int num_threads;
 
 static pthread_t *threads;
 
+static int use_trigram_index;
+static struct grep_trigrams *trigrams;
+static struct grep_trigram_query *trigram_query;
+static intmax_t trigram_skipped;
+
 /* We use one producer thread and THREADS consumer
  * threads. The producer adds struct work_items to 'todo' and the
  * consumers pick work items from the same array.
@@ -45,6 +52,12 @@ struct work_item {
 	struct grep_source source;
 	char done;
 	struct strbuf out;
+	/* the blob to remember the trigrams of, if any */
+	struct object_id trigram_oid;
+	int add_trigrams;
+	/* what the file looked like when it matched that blob, if a file */
+	struct stat_data trigram_sd;
+	int check_trigram_sd;
 };
 
 /* In the range [todo_done, todo_start) in 'todo' we have work_items
@@ -54,10 +67,14 @@ struct work_item {
  * The work_items in [todo_start, todo_end) are waiting to be picked
  * up by a consumer thread.
  *
- * The ranges are modulo TODO_SIZE.
+ * The ranges are modulo todo_size. The ring holds at least TODO_SIZE
+ * items, and TODO_PER_THREAD for each consumer, so that one slow
+ * file does not stall the producer while the others are idle.
  */
 #define TODO_SIZE 128
-static struct work_item todo[TODO_SIZE];
+#define TODO_PER_THREAD 32
+static struct work_item *todo;
+static int todo_size;
 static int todo_start;
 static int todo_end;
 static int todo_done;
@@ -65,6 +82,9 @@ static int todo_done;
 /* Has all work items been added? */
 static int all_work_added;
 
+/* Is a consumer writing out the results of finished work_items? */
+static int writing_output;
+
 /* This lock protects all the variables above. */
 static pthread_mutex_t grep_mutex;
 
@@ -91,21 +111,29 @@ static pthread_cond_t cond_result;
 
 static int skip_first_line;
 
-static void add_work(struct grep_opt *opt, struct grep_source *gs)
+static void add_work(struct grep_opt *opt, struct grep_source *gs,
+		     const struct object_id *trigram_oid,
+		     const struct stat_data *trigram_sd)
 {
 	if (opt->binary != GREP_BINARY_TEXT)
 		grep_source_load_driver(gs, opt->repo->index);
 
 	grep_lock();
 
-	while ((todo_end+1) % ARRAY_SIZE(todo) == todo_done) {
+	while ((todo_end+1) % todo_size == todo_done) {
 		pthread_cond_wait(&cond_write, &grep_mutex);
 	}
 
 	todo[todo_end].source = *gs;
 	todo[todo_end].done = 0;
+	todo[todo_end].add_trigrams = !!trigram_oid;
+	if (trigram_oid)
+		oidcpy(&todo[todo_end].trigram_oid, trigram_oid);
+	todo[todo_end].check_trigram_sd = !!trigram_sd;
+	if (trigram_sd)
+		todo[todo_end].trigram_sd = *trigram_sd;
 	strbuf_reset(&todo[todo_end].out);
-	todo_end = (todo_end + 1) % ARRAY_SIZE(todo);
+	todo_end = (todo_end + 1) % todo_size;
 
 	pthread_cond_signal(&cond_add);
 	grep_unlock();
@@ -124,43 +152,62 @@ static struct work_item *get_work(void)
 		ret = NULL;
 	} else {
 		ret = &todo[todo_start];
-		todo_start = (todo_start + 1) % ARRAY_SIZE(todo);
+		todo_start = (todo_start + 1) % todo_size;
 	}
 	grep_unlock();
 	return ret;
 }
 
-static void work_done(struct work_item *w)
+static void write_work(struct work_item *w)
 {
-	int old_done;
-
-	grep_lock();
-	w->done = 1;
-	old_done = todo_done;
-	for(; todo[todo_done].done && todo_done != todo_start;
-	    todo_done = (todo_done+1) % ARRAY_SIZE(todo)) {
-		w = &todo[todo_done];
-		if (w->out.len) {
-			const char *p = w->out.buf;
-			size_t len = w->out.len;
-
-			/* Skip the leading hunk mark of the first file. */
-			if (skip_first_line) {
-				while (len) {
-					len--;
-					if (*p++ == '\n')
-						break;
-				}
-				skip_first_line = 0;
+	if (w->out.len) {
+		const char *p = w->out.buf;
+		size_t len = w->out.len;
+
+		/* Skip the leading hunk mark of the first file. */
+		if (skip_first_line) {
+			while (len) {
+				len--;
+				if (*p++ == '\n')
+					break;
 			}
-
-			write_or_die(1, p, len);
+			skip_first_line = 0;
 		}
-		grep_source_clear(&w->source);
+
+		write_or_die(1, p, len);
 	}
+	grep_source_clear(&w->source);
+}
+
+static void work_done(struct work_item *w)
+{
+	grep_lock();
+	w->done = 1;
 
-	if (old_done != todo_done)
+	/*
+	 * Write out the results that are ready, in order. Only one
+	 * thread does so at a time, and it drops the lock while
+	 * writing, so that the others can go on grepping; whatever
+	 * they finish meanwhile is picked up by the next round.
+	 */
+	while (!writing_output &&
+	       todo[todo_done].done && todo_done != todo_start) {
+		int end = todo_done, i;
+
+		do {
+			end = (end + 1) % todo_size;
+		} while (todo[end].done && end != todo_start);
+
+		writing_output = 1;
+		grep_unlock();
+		for (i = todo_done; i != end; i = (i + 1) % todo_size)
+			write_work(&todo[i]);
+		grep_lock();
+		writing_output = 0;
+
+		todo_done = end;
 		pthread_cond_signal(&cond_write);
+	}
 
 	if (all_work_added && todo_done == todo_end)
 		pthread_cond_signal(&cond_result);
@@ -168,6 +215,28 @@ static void work_done(struct work_item *w)
 	grep_unlock();
 }
 
+/*
+ * Remember the trigrams of the blob "oid", which "gs" was just searched
+ * as. For a working tree file, "sd" is what it looked like when it was
+ * found to have the contents of that blob. If it changed since then, we
+ * may have read other contents, which must not be recorded under that
+ * blob for good.
+ */
+static void remember_trigrams(struct grep_source *gs,
+			      const struct object_id *oid,
+			      const struct stat_data *sd)
+{
+	if (!gs->buf)
+		return;
+	if (sd) {
+		struct stat st;
+
+		if (lstat(gs->identifier, &st) || match_stat_data(sd, &st))
+			return;
+	}
+	grep_trigrams_add(trigrams, oid, gs->buf, gs->size);
+}
+
 static void *run(void *arg)
 {
 	int hit = 0;
@@ -180,6 +249,10 @@ static void *run(void *arg)
 
 		opt->output_priv = w;
 		hit |= grep_source(opt, &w->source);
+		if (w->add_trigrams)
+			remember_trigrams(&w->source, &w->trigram_oid,
+					  w->check_trigram_sd ?
+					  &w->trigram_sd : NULL);
 		grep_source_clear_data(&w->source);
 		work_done(w);
 	}
@@ -207,7 +280,11 @@ static void start_threads(struct grep_opt *opt)
 	grep_use_locks = 1;
 	enable_obj_read_lock();
 
-	for (i = 0; i < ARRAY_SIZE(todo); i++) {
+	todo_size = TODO_SIZE;
+	if (todo_size < st_mult(num_threads, TODO_PER_THREAD))
+		todo_size = st_mult(num_threads, TODO_PER_THREAD);
+	todo = xcalloc(todo_size, sizeof(*todo));
+	for (i = 0; i < todo_size; i++) {
 		strbuf_init(&todo[i].out, 0);
 	}
 
@@ -256,6 +333,10 @@ static int wait_all(void)
 
 	free(threads);
 
+	for (i = 0; i < todo_size; i++)
+		strbuf_release(&todo[i].out);
+	FREE_AND_NULL(todo);
+
 	pthread_mutex_destroy(&grep_mutex);
 	pthread_mutex_destroy(&grep_attr_mutex);
 	pthread_cond_destroy(&cond_add);
@@ -289,6 +370,9 @@ static int grep_cmd_config(const char *var, const char *value, void *cb)
 		}
 	}
 
+	if (!strcmp(var, "grep.trigramindex"))
+		use_trigram_index = git_config_bool(var, value);
+
 	if (!strcmp(var, "submodule.recurse"))
 		recurse_submodules = git_config_bool(var, value);
 
@@ -327,58 +411,126 @@ static void grep_source_name(struct grep_opt *opt, const char *filename,
 		strbuf_insert(out, 0, filename, tree_name_len);
 }
 
-static int grep_oid(struct grep_opt *opt, const struct object_id *oid,
-		     const char *filename, int tree_name_len,
-		     const char *path)
+/*
+ * Ask the trigram index whether the blob "oid" can match at all.
+ * Returns 1 if it cannot; otherwise sets "*add" if the trigrams of
+ * the blob should be remembered after it has been searched.
+ */
+static int trigrams_rule_out(const struct object_id *oid, int *add)
 {
-	struct strbuf pathbuf = STRBUF_INIT;
-	struct grep_source gs;
+	*add = 0;
+	if (!trigrams || !oid)
+		return 0;
 
-	grep_source_name(opt, filename, tree_name_len, &pathbuf);
-	grep_source_init(&gs, GREP_SOURCE_OID, pathbuf.buf, path, oid);
-	strbuf_release(&pathbuf);
+	switch (grep_trigrams_check(trigrams, trigram_query, oid)) {
+	case 0:
+		trigram_skipped++;
+		return 1;
+	case -1:
+		*add = 1;
+		break;
+	}
+	return 0;
+}
 
+static int grep_source_or_add_work(struct grep_opt *opt,
+				   struct grep_source *gs,
+				   const struct object_id *trigram_oid,
+				   const struct stat_data *trigram_sd)
+{
 	if (num_threads > 1) {
 		/*
 		 * add_work() copies gs and thus assumes ownership of
 		 * its fields, so do not call grep_source_clear()
 		 */
-		add_work(opt, &gs);
+		add_work(opt, gs, trigram_oid, trigram_sd);
 		return 0;
 	} else {
 		int hit;
 
-		hit = grep_source(opt, &gs);
+		hit = grep_source(opt, gs);
 
-		grep_source_clear(&gs);
+		if (trigram_oid)
+			remember_trigrams(gs, trigram_oid, trigram_sd);
+		grep_source_clear(gs);
 		return hit;
 	}
 }
 
-static int grep_file(struct grep_opt *opt, const char *filename)
+static int grep_oid(struct grep_opt *opt, const struct object_id *oid,
+		     const char *filename, int tree_name_len,
+		     const char *path)
+{
+	struct strbuf pathbuf = STRBUF_INIT;
+	struct grep_source gs;
+	int add_trigrams;
+
+	if (trigrams_rule_out(oid, &add_trigrams))
+		return 0;
+
+	grep_source_name(opt, filename, tree_name_len, &pathbuf);
+	grep_source_init(&gs, GREP_SOURCE_OID, pathbuf.buf, path, oid);
+	strbuf_release(&pathbuf);
+
+	return grep_source_or_add_work(opt, &gs, add_trigrams ? oid : NULL,
+				       NULL);
+}
+
+/*
+ * "oid" is the blob the file is known to have the contents of, if any,
+ * and "sd" what the file looked like when that was found out.
+ */
+static int grep_file(struct grep_opt *opt, const char *filename,
+		     const struct object_id *oid, const struct stat_data *sd)
 {
 	struct strbuf buf = STRBUF_INIT;
 	struct grep_source gs;
+	int add_trigrams;
+
+	if (trigrams_rule_out(oid, &add_trigrams))
+		return 0;
 
 	grep_source_name(opt, filename, 0, &buf);
 	grep_source_init(&gs, GREP_SOURCE_FILE, buf.buf, filename, filename);
 	strbuf_release(&buf);
 
-	if (num_threads > 1) {
-		/*
-		 * add_work() copies gs and thus assumes ownership of
-		 * its fields, so do not call grep_source_clear()
-		 */
-		add_work(opt, &gs);
+	return grep_source_or_add_work(opt, &gs, add_trigrams ? oid : NULL,
+				       add_trigrams ? sd : NULL);
+}
+
+/*
+ * Does the working tree file "path" of "ce" have the contents of the
+ * blob the index records for it, up to line endings? That is needed
+ * to use the trigram index for it. If so, "sd" is filled with what the
+ * file looked like, so that a change made before it is read can be
+ * noticed.
+ */
+static int worktree_matches_index(struct index_state *istate,
+				  const struct cache_entry *ce,
+				  const char *path, struct stat_data *sd)
+{
+	struct conv_attrs ca;
+	struct stat st;
+	int ret;
+
+	if (lstat(path, &st))
 		return 0;
-	} else {
-		int hit;
 
-		hit = grep_source(opt, &gs);
+	/* comparing racily clean entries and conversion need attributes */
+	grep_attr_lock();
+	ret = !ie_match_stat(istate, ce, &st, 0);
+	if (ret) {
+		enum conv_attrs_classification class;
 
-		grep_source_clear(&gs);
-		return hit;
+		convert_attrs(istate, &ca, ce->name);
+		class = classify_conv_attrs(&ca);
+		ret = !ca.ident && !ca.working_tree_encoding &&
+		      (class == CA_CLASS_INCORE || class == CA_CLASS_STREAMABLE);
 	}
+	grep_attr_unlock();
+	if (ret)
+		fill_stat_data(sd, &st);
+	return ret;
 }
 
 static void append_path(struct grep_opt *opt, const void *data, size_t len)
@@ -527,7 +679,12 @@ static int grep_cache(struct grep_opt *opt,
 				hit |= grep_oid(opt, &ce->oid, name.buf,
 						 0, name.buf);
 			} else {
-				hit |= grep_file(opt, name.buf);
+				struct stat_data sd;
+
+				hit |= grep_file(opt, name.buf,
+						 trigrams &&
+						 worktree_matches_index(repo->index, ce, name.buf, &sd) ?
+						 &ce->oid : NULL, &sd);
 			}
 		} else if (recurse_submodules && S_ISGITLINK(ce->ce_mode) &&
 			   submodule_path_match(repo->index, pathspec, name.buf, NULL)) {
@@ -701,7 +858,7 @@ static int grep_directory(struct grep_opt *opt, const struct pathspec *pathspec,
 
 	fill_directory(&dir, opt->repo->index, pathspec);
 	for (i = 0; i < dir.nr; i++) {
-		hit |= grep_file(opt, dir.entries[i]->name);
+		hit |= grep_file(opt, dir.entries[i]->name, NULL, NULL);
 		if (hit && opt->status_only)
 			break;
 	}
@@ -1089,6 +1246,13 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	else if (num_threads == 0)
 		num_threads = HAVE_THREADS ? online_cpus() : 1;
 
+	if (use_trigram_index && use_index && !untracked &&
+	    startup_info->have_repository) {
+		trigram_query = grep_trigram_query_new(&opt);
+		if (trigram_query)
+			trigrams = grep_trigrams_load(the_repository);
+	}
+
 	if (num_threads > 1) {
 		if (!HAVE_THREADS)
 			BUG("Somebody got num_threads calculation wrong!");
@@ -1166,6 +1330,12 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 
 	if (num_threads > 1)
 		hit |= wait_all();
+	if (trigrams) {
+		trace2_data_intmax("grep", the_repository, "trigrams/skipped",
+				   trigram_skipped);
+		grep_trigrams_write_and_free(trigrams);
+		grep_trigram_query_free(trigram_query);
+	}
 	if (hit && show_in_pager)
 		run_pager(&opt, prefix);
 	clear_pathspec(&pathspec);
@@ -11,6 +11,7 @@
 #include "quote.h"
 #include "parse-options.h"
 #include "exec-cmd.h"
+#include "bulk-checkin.h"
 
 /*
  * This is to create corrupt objects for debugging and as such it
@@ -141,6 +142,14 @@ int cmd_hash_object(int argc, const char **argv, const char *prefix)
 		usage_with_options(hash_object_usage, hash_object_options);
 	}
 
+	/*
+	 * Callers may want to use an object as soon as we print its name,
+	 * which is only possible when it is not held back in a pack we
+	 * are still writing; only do that when asked to.
+	 */
+	if (core_bulk_checkin)
+		plug_bulk_checkin();
+
 	if (hashstdin)
 		hash_fd(0, type, vpath, flags, literally);
 
@@ -158,5 +167,6 @@ int cmd_hash_object(int argc, const char **argv, const char *prefix)
 	if (stdin_paths)
 		hash_stdin_paths(type, no_filters, flags, literally);
 
+	unplug_bulk_checkin();
 	return 0;
 }
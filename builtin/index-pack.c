@@ -17,7 +17,7 @@
 #include "promisor-remote.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--[no-]rev-index] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -47,8 +47,8 @@ struct base_data {
 	int retain_data;
 	/*
 	 * The number of direct children that have not been fully processed
-	 * (entered work_head, entered done_head, left done_head). When this
-	 * number reaches zero, this struct base_data can be freed.
+	 * (entered a work stack, entered done_head, left done_head). When
+	 * this number reaches zero, this struct base_data can be freed.
 	 */
 	int children_remaining;
 
@@ -58,15 +58,6 @@ struct base_data {
 	unsigned long size;
 };
 
-/*
- * Stack of struct base_data that have unprocessed children.
- * threaded_second_pass() uses this as a source of work (the other being the
- * objects array).
- *
- * Guarded by work_mutex.
- */
-static LIST_HEAD(work_head);
-
 /*
  * Stack of struct base_data that have children, all of whom have been
  * processed or are being processed, and at least one child is being processed.
@@ -86,9 +77,29 @@ static LIST_HEAD(done_head);
 static size_t base_cache_used;
 static size_t base_cache_limit;
 
+/*
+ * The number of threads that are resolving a delta (or inflating a base
+ * object) outside of work_mutex, and the number of threads waiting for
+ * them to come up with more work.
+ *
+ * Guarded by work_mutex.
+ */
+static int nr_resolving;
+static int nr_waiting;
+static pthread_cond_t work_cond;
+
 struct thread_local {
 	pthread_t thread;
 	int pack_fd;
+	/*
+	 * Stack of struct base_data that this thread resolved and that have
+	 * unprocessed children. threaded_second_pass() takes its work from
+	 * the top of its own stack, from the bottom of other threads'
+	 * stacks, and from the objects array, in this order.
+	 *
+	 * Guarded by work_mutex.
+	 */
+	struct list_head work;
 };
 
 /* Remember to update object flag allocation in object.h */
@@ -109,7 +120,9 @@ static struct object_entry *objects;
 static struct object_stat *obj_stat;
 static struct ofs_delta_entry *ofs_deltas;
 static struct ref_delta_entry *ref_deltas;
-static struct thread_local nothread_data;
+static struct thread_local nothread_data = {
+	.work = LIST_HEAD_INIT(nothread_data.work),
+};
 static int nr_objects;
 static int nr_ofs_deltas;
 static int nr_ref_deltas;
@@ -133,7 +146,6 @@ static unsigned char input_buffer[4096];
 static unsigned int input_offset, input_len;
 static off_t consumed_bytes;
 static off_t max_input_size;
-static unsigned deepest_delta;
 static git_hash_ctx input_ctx;
 static uint32_t input_crc32;
 static int input_fd, output_fd;
@@ -155,10 +167,6 @@ static pthread_mutex_t work_mutex;
 #define work_lock()		lock_mutex(&work_mutex)
 #define work_unlock()		unlock_mutex(&work_mutex)
 
-static pthread_mutex_t deepest_delta_mutex;
-#define deepest_delta_lock()	lock_mutex(&deepest_delta_mutex)
-#define deepest_delta_unlock()	unlock_mutex(&deepest_delta_mutex)
-
 static pthread_mutex_t type_cas_mutex;
 #define type_cas_lock()		lock_mutex(&type_cas_mutex)
 #define type_cas_unlock()	unlock_mutex(&type_cas_mutex)
@@ -187,14 +195,14 @@ static void init_thread(void)
 	pthread_mutex_init(&counter_mutex, NULL);
 	pthread_mutex_init(&work_mutex, NULL);
 	pthread_mutex_init(&type_cas_mutex, NULL);
-	if (show_stat)
-		pthread_mutex_init(&deepest_delta_mutex, NULL);
+	pthread_cond_init(&work_cond, NULL);
 	pthread_key_create(&key, NULL);
 	thread_data = xcalloc(nr_threads, sizeof(*thread_data));
 	for (i = 0; i < nr_threads; i++) {
 		thread_data[i].pack_fd = open(curr_pack, O_RDONLY);
 		if (thread_data[i].pack_fd == -1)
 			die_errno(_("unable to open %s"), curr_pack);
+		INIT_LIST_HEAD(&thread_data[i].work);
 	}
 
 	threads_active = 1;
@@ -210,8 +218,7 @@ static void cleanup_thread(void)
 	pthread_mutex_destroy(&counter_mutex);
 	pthread_mutex_destroy(&work_mutex);
 	pthread_mutex_destroy(&type_cas_mutex);
-	if (show_stat)
-		pthread_mutex_destroy(&deepest_delta_mutex);
+	pthread_cond_destroy(&work_cond);
 	for (i = 0; i < nr_threads; i++)
 		close(thread_data[i].pack_fd);
 	pthread_key_delete(key);
@@ -414,34 +421,43 @@ static void free_base_data(struct base_data *c)
 	}
 }
 
-static void prune_base_data(struct base_data *retain)
+/*
+ * Free the data of the bases on the list, oldest first, until we are
+ * within the delta base cache limit again. Returns 1 once we are.
+ */
+static int prune_base_list(struct list_head *head)
 {
 	struct list_head *pos;
 
-	if (base_cache_used <= base_cache_limit)
-		return;
-
-	list_for_each_prev(pos, &done_head) {
+	list_for_each_prev(pos, head) {
 		struct base_data *b = list_entry(pos, struct base_data, list);
-		if (b->retain_data || b == retain)
+		if (b->retain_data)
 			continue;
 		if (b->data) {
 			free_base_data(b);
 			if (base_cache_used <= base_cache_limit)
-				return;
+				return 1;
 		}
 	}
+	return 0;
+}
 
-	list_for_each_prev(pos, &work_head) {
-		struct base_data *b = list_entry(pos, struct base_data, list);
-		if (b->retain_data || b == retain)
-			continue;
-		if (b->data) {
-			free_base_data(b);
-			if (base_cache_used <= base_cache_limit)
-				return;
-		}
+static void prune_base_data(void)
+{
+	int i;
+
+	if (base_cache_used <= base_cache_limit)
+		return;
+
+	if (prune_base_list(&done_head))
+		return;
+	if (!threads_active) {
+		prune_base_list(&nothread_data.work);
+		return;
 	}
+	for (i = 0; i < nr_threads; i++)
+		if (prune_base_list(&thread_data[i].work))
+			return;
 }
 
 static int is_delta_type(enum object_type type)
@@ -893,57 +909,81 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 	free(new_data);
 }
 
+static void install_base_data(struct base_data *c, void *data,
+			      unsigned long size)
+{
+	if (c->data) {
+		/* another thread got there first */
+		free(data);
+		return;
+	}
+	c->data = data;
+	c->size = size;
+	base_cache_used += size;
+	prune_base_data();
+}
+
 /*
- * Walk from current node up
- * to top parent if necessary to deflate the node. In normal
- * situation, its parent node would be already deflated, so it just
- * needs to apply delta.
- *
- * In the worst case scenario, parent node is no longer deflated because
- * we're running out of delta_base_cache_limit; we need to re-deflate
- * parents, possibly up to the top base.
+ * Retain the data of "c" for patch_delta(), walking from it up to the
+ * first ancestor that still has data if it has to be re-inflated. In
+ * the normal situation, it still has its data. But if we are running
+ * out of delta_base_cache_limit, we may need to re-inflate the parents,
+ * possibly up to the top base.
  *
- * All deflated objects here are subject to be freed if we exceed
- * delta_base_cache_limit, just like in find_unresolved_deltas(), we
- * just need to make sure the last node is not freed.
+ * Must be called with work_mutex held. The mutex is released while we
+ * inflate and patch, so that other threads can go on taking work; the
+ * ancestors we need are retained meanwhile, and are released again
+ * one by one as soon as the next one down has its data.
  */
-static void *get_base_data(struct base_data *c)
+static void retain_base_data(struct base_data *c)
 {
-	if (!c->data) {
-		struct object_entry *obj = c->obj;
-		struct base_data **delta = NULL;
-		int delta_nr = 0, delta_alloc = 0;
-
-		while (is_delta_type(c->obj->type) && !c->data) {
-			ALLOC_GROW(delta, delta_nr + 1, delta_alloc);
-			delta[delta_nr++] = c;
-			c = c->base;
-		}
-		if (!delta_nr) {
-			c->data = get_data_from_pack(obj);
-			c->size = obj->size;
-			base_cache_used += c->size;
-			prune_base_data(c);
-		}
-		for (; delta_nr > 0; delta_nr--) {
-			void *base, *raw;
-			c = delta[delta_nr - 1];
-			obj = c->obj;
-			base = get_base_data(c->base);
-			raw = get_data_from_pack(obj);
-			c->data = patch_delta(
-				base, c->base->size,
-				raw, obj->size,
-				&c->size);
-			free(raw);
-			if (!c->data)
-				bad_object(obj->idx.offset, _("failed to apply delta"));
-			base_cache_used += c->size;
-			prune_base_data(c);
-		}
-		free(delta);
+	struct base_data **chain = NULL;
+	int chain_nr = 0, chain_alloc = 0;
+	int load_top;
+
+	for (;;) {
+		ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+		chain[chain_nr++] = c;
+		c->retain_data++;
+		if (c->data || !is_delta_type(c->obj->type))
+			break;
+		c = c->base;
+	}
+	load_top = !c->data;
+	if (chain_nr == 1 && !load_top) {
+		free(chain);
+		return;
+	}
+
+	work_unlock();
+	if (load_top) {
+		void *data = get_data_from_pack(c->obj);
+
+		work_lock();
+		install_base_data(c, data, c->obj->size);
+		work_unlock();
+	}
+	while (--chain_nr > 0) {
+		struct object_entry *obj;
+		void *raw, *data;
+		unsigned long size;
+
+		c = chain[chain_nr - 1];
+		obj = c->obj;
+		raw = get_data_from_pack(obj);
+		data = patch_delta(c->base->data, c->base->size,
+				   raw, obj->size, &size);
+		free(raw);
+		if (!data)
+			bad_object(obj->idx.offset, _("failed to apply delta"));
+
+		work_lock();
+		install_base_data(c, data, size);
+		c->base->retain_data--;
+		work_unlock();
 	}
-	return c->data;
+	work_lock();
+	free(chain);
 }
 
 static struct base_data *make_base(struct object_entry *obj,
@@ -972,10 +1012,6 @@ static struct base_data *resolve_delta(struct object_entry *delta_obj,
 		int i = delta_obj - objects;
 		int j = base->obj - objects;
 		obj_stat[i].delta_depth = obj_stat[j].delta_depth + 1;
-		deepest_delta_lock();
-		if (deepest_delta < obj_stat[i].delta_depth)
-			deepest_delta = obj_stat[i].delta_depth;
-		deepest_delta_unlock();
 		obj_stat[i].base_object_no = j;
 	}
 	delta_data = get_data_from_pack(delta_obj);
@@ -1019,36 +1055,82 @@ static int compare_ref_delta_entry(const void *a, const void *b)
 	return oidcmp(&delta_a->oid, &delta_b->oid);
 }
 
+/*
+ * Find a base that has children left to resolve: the most recent one on
+ * our own stack, or else the oldest one on another thread's stack. The
+ * latter is the closest to the root of its delta family, so the child
+ * we take from it tends to come with a large subtree of its own.
+ */
+static struct base_data *find_work(struct thread_local *self)
+{
+	int i;
+
+	if (!list_empty(&self->work))
+		return list_first_entry(&self->work, struct base_data, list);
+	if (!threads_active)
+		return NULL;
+	for (i = 1; i < nr_threads; i++) {
+		struct thread_local *victim =
+			thread_data + (self - thread_data + i) % nr_threads;
+
+		if (!list_empty(&victim->work))
+			return list_entry(victim->work.prev, struct base_data,
+					  list);
+	}
+	return NULL;
+}
+
 static void *threaded_second_pass(void *data)
 {
+	struct thread_local *self;
+
 	if (data)
 		set_thread_data(data);
+	self = get_thread_data();
 	for (;;) {
 		struct base_data *parent = NULL;
-		struct object_entry *child_obj;
+		struct object_entry *child_obj = NULL;
 		struct base_data *child;
 
 		work_lock();
-		if (list_empty(&work_head)) {
+		for (;;) {
+			parent = find_work(self);
+			if (parent)
+				break;
+
 			/*
 			 * Take an object from the object array.
 			 */
 			while (nr_dispatched < nr_objects &&
 			       is_delta_type(objects[nr_dispatched].type))
 				nr_dispatched++;
-			if (nr_dispatched >= nr_objects) {
-				work_unlock();
+			if (nr_dispatched < nr_objects) {
+				child_obj = &objects[nr_dispatched++];
 				break;
 			}
-			child_obj = &objects[nr_dispatched++];
-		} else {
+
 			/*
-			 * Peek at the top of the stack, and take a child from
-			 * it.
+			 * Nothing to do right now, but the deltas that
+			 * other threads are resolving may turn out to be
+			 * bases themselves; wait for them instead of
+			 * leaving the rest of their delta families to them.
 			 */
-			parent = list_first_entry(&work_head, struct base_data,
-						  list);
+			if (!nr_resolving)
+				break;
+			nr_waiting++;
+			pthread_cond_wait(&work_cond, &work_mutex);
+			nr_waiting--;
+		}
+		if (!parent && !child_obj) {
+			work_unlock();
+			break;
+		}
+		nr_resolving++;
 
+		if (parent) {
+			/*
+			 * Take a child from the base we found.
+			 */
 			if (parent->ref_first <= parent->ref_last) {
 				int offset = ref_deltas[parent->ref_first++].obj_no;
 				child_obj = objects + offset;
@@ -1076,17 +1158,10 @@ static void *threaded_second_pass(void *data)
 
 			/*
 			 * Ensure that the parent has data, since we will need
-			 * it later.
-			 *
-			 * NEEDSWORK: If parent data needs to be reloaded, this
-			 * prolongs the time that the current thread spends in
-			 * the mutex. A mitigating factor is that parent data
-			 * needs to be reloaded only if the delta base cache
-			 * limit is exceeded, so in the typical case, this does
-			 * not happen.
+			 * it later. This may drop the mutex for a while if
+			 * the data has to be reloaded.
 			 */
-			get_base_data(parent);
-			parent->retain_data++;
+			retain_base_data(parent);
 		}
 		work_unlock();
 
@@ -1110,16 +1185,17 @@ static void *threaded_second_pass(void *data)
 		}
 
 		work_lock();
+		nr_resolving--;
 		if (parent)
 			parent->retain_data--;
 		if (child->data) {
 			/*
 			 * This child has its own children, so add it to
-			 * work_head.
+			 * our work stack.
 			 */
-			list_add(&child->list, &work_head);
+			list_add(&child->list, &self->work);
 			base_cache_used += child->size;
-			prune_base_data(NULL);
+			prune_base_data();
 		} else {
 			/*
 			 * This child does not have its own children. It may be
@@ -1142,7 +1218,10 @@ static void *threaded_second_pass(void *data)
 
 				p = next_p;
 			}
+			FREE_AND_NULL(child);
 		}
+		if (nr_waiting && (child || !nr_resolving))
+			pthread_cond_broadcast(&work_cond);
 		work_unlock();
 	}
 	return NULL;
@@ -1441,15 +1520,15 @@ static void fix_unresolved_deltas(struct hashfile *f)
 	free(sorted_by_pos);
 }
 
-static const char *derive_filename(const char *pack_name, const char *suffix,
-				   struct strbuf *buf)
+static const char *derive_filename(const char *pack_name, const char *strip,
+				   const char *suffix, struct strbuf *buf)
 {
 	size_t len;
-	if (!strip_suffix(pack_name, ".pack", &len))
-		die(_("packfile name '%s' does not end with '.pack'"),
-		    pack_name);
+	if (!strip_suffix(pack_name, strip, &len) || !len ||
+	    pack_name[len - 1] != '.')
+		die(_("packfile name '%s' does not end with '.%s'"),
+		    pack_name, strip);
 	strbuf_add(buf, pack_name, len);
-	strbuf_addch(buf, '.');
 	strbuf_addstr(buf, suffix);
 	return buf->buf;
 }
@@ -1464,7 +1543,7 @@ static void write_special_file(const char *suffix, const char *msg,
 	int msg_len = strlen(msg);
 
 	if (pack_name)
-		filename = derive_filename(pack_name, suffix, &name_buf);
+		filename = derive_filename(pack_name, "pack", suffix, &name_buf);
 	else
 		filename = odb_pack_name(&name_buf, hash, suffix);
 
@@ -1489,12 +1568,14 @@ static void write_special_file(const char *suffix, const char *msg,
 
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *final_rev_index_name, const char *curr_rev_index_name,
 		  const char *keep_msg, const char *promisor_msg,
 		  unsigned char *hash)
 {
 	const char *report = "pack";
 	struct strbuf pack_name = STRBUF_INIT;
 	struct strbuf index_name = STRBUF_INIT;
+	struct strbuf rev_index_name = STRBUF_INIT;
 	int err;
 
 	if (!from_stdin) {
@@ -1521,6 +1602,16 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	} else if (from_stdin)
 		chmod(final_pack_name, 0444);
 
+	if (curr_rev_index_name) {
+		if (final_rev_index_name != curr_rev_index_name) {
+			if (!final_rev_index_name)
+				final_rev_index_name = odb_pack_name(&rev_index_name, hash, "rev");
+			if (finalize_object_file(curr_rev_index_name, final_rev_index_name))
+				die(_("cannot store reverse index file"));
+		} else
+			chmod(final_rev_index_name, 0444);
+	}
+
 	if (final_index_name != curr_index_name) {
 		if (!final_index_name)
 			final_index_name = odb_pack_name(&index_name, hash, "idx");
@@ -1559,6 +1650,7 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	}
 
 	strbuf_release(&index_name);
+	strbuf_release(&rev_index_name);
 	strbuf_release(&pack_name);
 }
 
@@ -1572,6 +1664,13 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 			die(_("bad pack.indexversion=%"PRIu32), opts->version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_REV;
+		else
+			opts->flags &= ~WRITE_REV;
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		nr_threads = git_config_int(k, v);
 		if (nr_threads < 0)
@@ -1657,8 +1756,13 @@ static void read_idx_option(struct pack_idx_option *opts, const char *pack_name)
 static void show_pack_info(int stat_only)
 {
 	int i, baseobjects = nr_objects - nr_ref_deltas - nr_ofs_deltas;
+	unsigned deepest_delta = 0;
 	unsigned long *chain_histogram = NULL;
 
+	for (i = 0; i < nr_objects; i++)
+		if (is_delta_type(objects[i].type) &&
+		    deepest_delta < obj_stat[i].delta_depth)
+			deepest_delta = obj_stat[i].delta_depth;
 	if (deepest_delta)
 		chain_histogram = xcalloc(deepest_delta, sizeof(unsigned long));
 
@@ -1700,12 +1804,14 @@ static void show_pack_info(int stat_only)
 
 int cmd_index_pack(int argc, const char **argv, const char *prefix)
 {
-	int i, fix_thin_pack = 0, verify = 0, stat_only = 0;
+	int i, fix_thin_pack = 0, verify = 0, stat_only = 0, rev_index;
 	const char *curr_index;
-	const char *index_name = NULL, *pack_name = NULL;
+	const char *curr_rev_index = NULL;
+	const char *index_name = NULL, *pack_name = NULL, *rev_index_name = NULL;
 	const char *keep_msg = NULL;
 	const char *promisor_msg = NULL;
 	struct strbuf index_name_buf = STRBUF_INIT;
+	struct strbuf rev_index_name_buf = STRBUF_INIT;
 	struct pack_idx_entry **idx_objects;
 	struct pack_idx_option opts;
 	unsigned char pack_hash[GIT_MAX_RAWSZ];
@@ -1729,6 +1835,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 
 	reset_pack_idx_option(&opts);
 	git_config(git_index_pack_config, &opts);
+	if (git_env_bool(GIT_TEST_WRITE_REV_INDEX, 0))
+		opts.flags |= WRITE_REV;
 	if (prefix && chdir(prefix))
 		die(_("Cannot come back to cwd"));
 
@@ -1803,6 +1911,10 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 					opts.off32_limit = strtoul(c+1, &c, 0);
 				if (*c || opts.off32_limit & 0x80000000)
 					die(_("bad %s"), arg);
+			} else if (!strcmp(arg, "--rev-index")) {
+				opts.flags |= WRITE_REV;
+			} else if (!strcmp(arg, "--no-rev-index")) {
+				opts.flags &= ~WRITE_REV;
 			} else if (skip_prefix(arg, "--max-input-size=", &arg)) {
 				max_input_size = strtoumax(arg, NULL, 10);
 			} else if (skip_prefix(arg, "--object-format=", &arg)) {
@@ -1829,13 +1941,22 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	if (from_stdin && hash_algo)
 		die(_("--object-format cannot be used with --stdin"));
 	if (!index_name && pack_name)
-		index_name = derive_filename(pack_name, "idx", &index_name_buf);
+		index_name = derive_filename(pack_name, "pack", "idx", &index_name_buf);
+
+	rev_index = !!(opts.flags & (WRITE_REV | WRITE_REV_VERIFY));
+	if (rev_index && index_name)
+		rev_index_name = derive_filename(index_name, "idx", "rev",
+						 &rev_index_name_buf);
 
 	if (verify) {
 		if (!index_name)
 			die(_("--verify with no packfile name given"));
 		read_idx_option(&opts, index_name);
 		opts.flags |= WRITE_IDX_VERIFY | WRITE_IDX_STRICT;
+		if (rev_index) {
+			opts.flags &= ~WRITE_REV;
+			opts.flags |= WRITE_REV_VERIFY;
+		}
 	}
 	if (strict)
 		opts.flags |= WRITE_IDX_STRICT;
@@ -1883,11 +2004,16 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_hash);
+	if (rev_index)
+		curr_rev_index = write_rev_file(rev_index_name, idx_objects,
+						nr_objects, pack_hash,
+						opts.flags);
 	free(idx_objects);
 
 	if (!verify)
 		final(pack_name, curr_pack,
 		      index_name, curr_index,
+		      rev_index_name, curr_rev_index,
 		      keep_msg, promisor_msg,
 		      pack_hash);
 	else
@@ -1898,10 +2024,13 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 
 	free(objects);
 	strbuf_release(&index_name_buf);
+	strbuf_release(&rev_index_name_buf);
 	if (pack_name == NULL)
 		free((void *) curr_pack);
 	if (index_name == NULL)
 		free((void *) curr_index);
+	if (rev_index_name == NULL)
+		free((void *) curr_rev_index);
 
 	/*
 	 * Let the caller know this pack is not self contained
@@ -9,6 +9,8 @@
 #include "strbuf.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "oidset.h"
+#include "tmp-objdir.h"
 
 static struct bulk_checkin_state {
 	unsigned plugged:1;
@@ -21,8 +23,40 @@ static struct bulk_checkin_state {
 	struct pack_idx_entry **written;
 	uint32_t alloc_written;
 	uint32_t nr_written;
+	struct oidset written_oids;
 } state;
 
+static struct tmp_objdir *bulk_fsync_objdir;
+
+static void finish_bulk_fsync(void)
+{
+	struct strbuf path = STRBUF_INIT;
+	int fd;
+
+	if (!bulk_fsync_objdir)
+		return;
+
+	/*
+	 * The objects have been written out, but may still sit in the
+	 * write cache of the disk. A full fsync() of a new file commits
+	 * the filesystem journal and flushes that cache for all of them
+	 * at once. Only then are they moved to their final names, so that
+	 * a crash cannot leave us with an object that never reached the
+	 * disk.
+	 */
+	strbuf_addf(&path, "%s/bulk_fsync_XXXXXX",
+		    tmp_objdir_path(bulk_fsync_objdir));
+	fd = xmkstemp(path.buf);
+	fsync_or_die(fd, path.buf);
+	close(fd);
+	unlink_or_warn(path.buf);
+	strbuf_release(&path);
+
+	if (tmp_objdir_migrate(bulk_fsync_objdir))
+		die(_("unable to move new objects to the object database"));
+	bulk_fsync_objdir = NULL;
+}
+
 static void finish_bulk_checkin(struct bulk_checkin_state *state)
 {
 	struct object_id oid;
@@ -55,7 +89,13 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 
 clear_exit:
 	free(state->written);
-	memset(state, 0, sizeof(*state));
+	oidset_clear(&state->written_oids);
+	state->pack_tmp_name = NULL;
+	state->f = NULL;
+	state->offset = 0;
+	state->written = NULL;
+	state->alloc_written = 0;
+	state->nr_written = 0;
 
 	strbuf_release(&packname);
 	/* Make objects we just wrote available to ourselves */
@@ -64,19 +104,20 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 
 static int already_written(struct bulk_checkin_state *state, struct object_id *oid)
 {
-	int i;
-
 	/* The object may already exist in the repository */
 	if (has_object_file(oid))
 		return 1;
 
-	/* Might want to keep the list sorted */
-	for (i = 0; i < state->nr_written; i++)
-		if (oideq(&state->written[i]->oid, oid))
-			return 1;
+	/* Or we may have written it to the current pack */
+	return oidset_contains(&state->written_oids, oid);
+}
 
-	/* This is a new object we need to keep */
-	return 0;
+static void record_written(struct bulk_checkin_state *state,
+			   struct pack_idx_entry *idx)
+{
+	ALLOC_GROW(state->written, state->nr_written + 1, state->alloc_written);
+	state->written[state->nr_written++] = idx;
+	oidset_insert(&state->written_oids, &idx->oid);
 }
 
 /*
@@ -249,14 +290,56 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 		free(idx);
 	} else {
 		oidcpy(&idx->oid, result_oid);
-		ALLOC_GROW(state->written,
-			   state->nr_written + 1,
-			   state->alloc_written);
-		state->written[state->nr_written++] = idx;
+		record_written(state, idx);
 	}
 	return 0;
 }
 
+static void write_buffer_to_pack(struct bulk_checkin_state *state,
+				 const struct object_id *oid,
+				 const void *buf, size_t size,
+				 enum object_type type)
+{
+	git_zstream s;
+	unsigned char hdr[MAX_PACK_OBJECT_HEADER];
+	unsigned hdrlen;
+	void *out;
+	unsigned long maxsize, datalen;
+	struct pack_idx_entry *idx;
+
+	git_deflate_init(&s, pack_compression_level);
+	maxsize = git_deflate_bound(&s, size);
+	out = xmalloc(maxsize);
+	s.next_in = (void *)buf;
+	s.avail_in = size;
+	s.next_out = out;
+	s.avail_out = maxsize;
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&s);
+	datalen = s.total_out;
+
+	hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr), type, size);
+
+	/* would we bust the size limit? */
+	if (state->nr_written && pack_size_limit_cfg &&
+	    pack_size_limit_cfg < state->offset + hdrlen + datalen)
+		finish_bulk_checkin(state);
+	prepare_to_stream(state, HASH_WRITE_OBJECT);
+
+	idx = xcalloc(1, sizeof(*idx));
+	oidcpy(&idx->oid, oid);
+	idx->offset = state->offset;
+	crc32_begin(state->f);
+	hashwrite(state->f, hdr, hdrlen);
+	hashwrite(state->f, out, datalen);
+	idx->crc32 = crc32_end(state->f);
+	state->offset += hdrlen + datalen;
+	record_written(state, idx);
+
+	free(out);
+}
+
 int index_bulk_checkin(struct object_id *oid,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags)
@@ -268,6 +351,48 @@ int index_bulk_checkin(struct object_id *oid,
 	return status;
 }
 
+int bulk_checkin_all_objects(void)
+{
+	return state.plugged && core_bulk_checkin;
+}
+
+int write_object_file_bulk_checkin(const void *buf, unsigned long len,
+				   enum object_type type,
+				   const struct object_id *oid)
+{
+	if (!bulk_checkin_all_objects())
+		BUG("write_object_file_bulk_checkin() without core.bulkCheckin");
+	if (!oidset_contains(&state.written_oids, oid))
+		write_buffer_to_pack(&state, oid, buf, len, type);
+	return 0;
+}
+
+const char *prepare_loose_object_bulk_checkin(void)
+{
+	if (!state.plugged || !fsync_object_files ||
+	    fsync_method != FSYNC_METHOD_BATCH)
+		return NULL;
+
+	if (!bulk_fsync_objdir) {
+		bulk_fsync_objdir = tmp_objdir_create();
+		if (!bulk_fsync_objdir)
+			return NULL;
+		/* Make objects we write there available to ourselves */
+		tmp_objdir_add_as_alternate(bulk_fsync_objdir);
+	}
+	return tmp_objdir_path(bulk_fsync_objdir);
+}
+
+void fsync_loose_object_bulk_checkin(int fd, const char *filename)
+{
+	/*
+	 * Fall back to a full fsync() where we cannot ask for the data
+	 * to be written out only.
+	 */
+	if (git_fsync(fd, FSYNC_WRITEOUT_ONLY) < 0)
+		fsync_or_die(fd, filename);
+}
+
 void plug_bulk_checkin(void)
 {
 	state.plugged = 1;
@@ -278,4 +403,5 @@ void unplug_bulk_checkin(void)
 	state.plugged = 0;
 	if (state.f)
 		finish_bulk_checkin(&state);
+	finish_bulk_fsync();
 }
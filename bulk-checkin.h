@@ -10,6 +10,36 @@ int index_bulk_checkin(struct object_id *oid,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags);
 
+/*
+ * Whether we are plugged with core.bulkCheckin, in which case all new
+ * objects are to be written to the pack with write_object_file_bulk_checkin()
+ * instead of as loose objects.
+ */
+int bulk_checkin_all_objects(void);
+
+/*
+ * Append an object, which must not already be in the repository, to the
+ * pack. Like the others in it, the object is only visible once the pack
+ * is finished by unplug_bulk_checkin().
+ */
+int write_object_file_bulk_checkin(const void *buf, unsigned long len,
+				   enum object_type type,
+				   const struct object_id *oid);
+
+/*
+ * While plugged with core.fsyncMethod=batch (and core.fsyncObjectFiles),
+ * loose objects are written to a temporary object directory, whose path
+ * this returns (creating it if need be); otherwise it returns NULL.
+ */
+const char *prepare_loose_object_bulk_checkin(void);
+
+/*
+ * Write out the data of a loose object written to the directory returned
+ * by prepare_loose_object_bulk_checkin(); it is made durable, and moved
+ * to the object database, by unplug_bulk_checkin().
+ */
+void fsync_loose_object_bulk_checkin(int fd, const char *filename);
+
 void plug_bulk_checkin(void);
 void unplug_bulk_checkin(void);
 
@@ -257,6 +257,18 @@ static int update_one(struct cache_tree *it,
 	if (0 <= it->entry_count && has_object_file(&it->oid))
 		return it->entry_count;
 
+	/*
+	 * A sparse directory entry for this very directory stands for
+	 * the whole tree.
+	 */
+	if (entries > 0 && S_ISSPARSEDIR(cache[0]->ce_mode) &&
+	    ce_namelen(cache[0]) == baselen &&
+	    !memcmp(cache[0]->name, base, baselen)) {
+		it->entry_count = 1;
+		oidcpy(&it->oid, &cache[0]->oid);
+		return 1;
+	}
+
 	/*
 	 * We first scan for subtrees and update them; we start by
 	 * marking existing subtrees -- the ones that are unmarked
@@ -793,6 +805,13 @@ static void verify_one(struct repository *r,
 
 	if (path->len) {
 		pos = index_name_pos(istate, path->buf, path->len);
+		if (pos >= 0) {
+			if (!S_ISSPARSEDIR(istate->cache[pos]->ce_mode) ||
+			    !oideq(&istate->cache[pos]->oid, &it->oid))
+				BUG("cache-tree for sparse directory %.*s does not match",
+				    len, path->buf);
+			return;
+		}
 		pos = -pos - 1;
 	} else {
 		pos = 0;
@@ -38,11 +38,13 @@ void git_test_write_commit_graph_or_die(void)
 #define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA 0x47444154 /* "GDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW 0x47444f56 /* "GDOV" */
 #define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
 #define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
 #define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
-#define MAX_NUM_CHUNKS 7
+#define MAX_NUM_CHUNKS 9
 
 #define GRAPH_DATA_WIDTH (the_hash_algo->rawsz + 16)
 
@@ -55,6 +57,8 @@ void git_test_write_commit_graph_or_die(void)
 
 #define GRAPH_LAST_EDGE 0x80000000
 
+#define CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW (1ULL << 31)
+
 #define GRAPH_HEADER_SIZE 8
 #define GRAPH_FANOUT_SIZE (4 * 256)
 #define GRAPH_CHUNKLOOKUP_WIDTH 12
@@ -99,7 +103,7 @@ uint32_t commit_graph_position(const struct commit *c)
 	return data ? data->graph_pos : COMMIT_NOT_FROM_GRAPH;
 }
 
-uint32_t commit_graph_generation(const struct commit *c)
+timestamp_t commit_graph_generation(const struct commit *c)
 {
 	struct commit_graph_data *data =
 		commit_graph_data_slab_peek(&commit_graph_data_slab, c);
@@ -144,8 +148,8 @@ static int commit_gen_cmp(const void *va, const void *vb)
 	const struct commit *a = *(const struct commit **)va;
 	const struct commit *b = *(const struct commit **)vb;
 
-	uint32_t generation_a = commit_graph_generation(a);
-	uint32_t generation_b = commit_graph_generation(b);
+	timestamp_t generation_a = commit_graph_generation(a);
+	timestamp_t generation_b = commit_graph_generation(b);
 	/* lower generation commits first */
 	if (generation_a < generation_b)
 		return -1;
@@ -231,6 +235,32 @@ int open_commit_graph(const char *graph_file, int *fd, struct stat *st)
 	return 1;
 }
 
+/*
+ * Corrected commit dates can only be compared with each other, so only
+ * use them if every layer of the chain has a Generation Data chunk, and
+ * fall back to the topological levels every layer has otherwise.
+ */
+static void validate_mixed_generation_chain(struct repository *r,
+					    struct commit_graph *g)
+{
+	int read_generation_data = 1;
+	struct commit_graph *p;
+
+	if (!g)
+		return;
+
+	prepare_repo_settings(r);
+	if (r->settings.commit_graph_generation_version < 2)
+		read_generation_data = 0;
+
+	for (p = g; read_generation_data && p; p = p->base_graph)
+		if (!p->chunk_generation_data)
+			read_generation_data = 0;
+
+	for (p = g; p; p = p->base_graph)
+		p->read_generation_data = read_generation_data;
+}
+
 struct commit_graph *load_commit_graph_one_fd_st(int fd, struct stat *st,
 						 struct object_directory *odb)
 {
@@ -249,9 +279,10 @@ struct commit_graph *load_commit_graph_one_fd_st(int fd, struct stat *st,
 	close(fd);
 	ret = parse_commit_graph(graph_map, graph_size);
 
-	if (ret)
+	if (ret) {
 		ret->odb = odb;
-	else
+		validate_mixed_generation_chain(the_repository, ret);
+	} else
 		munmap(graph_map, graph_size);
 
 	return ret;
@@ -384,6 +415,23 @@ struct commit_graph *parse_commit_graph(void *graph_map, size_t graph_size)
 				graph->chunk_commit_data = data + chunk_offset;
 			break;
 
+		case GRAPH_CHUNKID_GENERATION_DATA:
+			if (graph->chunk_generation_data)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW:
+			if (graph->chunk_generation_data_overflow)
+				chunk_repeated = 1;
+			else {
+				graph->chunk_generation_data_overflow = data + chunk_offset;
+				graph->num_generation_data_overflows =
+					(next_chunk_offset - chunk_offset) / sizeof(uint64_t);
+			}
+			break;
+
 		case GRAPH_CHUNKID_EXTRAEDGES:
 			if (graph->chunk_extra_edges)
 				chunk_repeated = 1;
@@ -592,6 +640,8 @@ struct commit_graph *read_commit_graph_one(struct repository *r,
 	if (!g)
 		g = load_commit_graph_chain(r, odb);
 
+	validate_mixed_generation_chain(r, g);
+
 	return g;
 }
 
@@ -667,6 +717,14 @@ int generation_numbers_enabled(struct repository *r)
 	return !!first_generation;
 }
 
+int corrected_commit_dates_enabled(struct repository *r)
+{
+	if (!prepare_commit_graph(r))
+		return 0;
+
+	return r->objects->commit_graph->read_generation_data;
+}
+
 static void close_commit_graph_one(struct commit_graph *g)
 {
 	if (!g)
@@ -731,17 +789,58 @@ static void fill_commit_graph_info(struct commit *item, struct commit_graph *g,
 {
 	const unsigned char *commit_data;
 	struct commit_graph_data *graph_data;
-	uint32_t lex_index;
+	uint32_t lex_index, offset_pos;
+	uint64_t date_high, date_low, offset;
 
 	while (pos < g->num_commits_in_base)
 		g = g->base_graph;
 
+	if (pos >= g->num_commits + g->num_commits_in_base)
+		die(_("invalid commit position. commit-graph is likely corrupt"));
+
 	lex_index = pos - g->num_commits_in_base;
 	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
 
 	graph_data = commit_graph_data_at(item);
 	graph_data->graph_pos = pos;
-	graph_data->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+
+	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
+	date_low = get_be32(commit_data + g->hash_len + 12);
+	item->date = (timestamp_t)((date_high << 32) | date_low);
+
+	if (g->read_generation_data) {
+		offset = (timestamp_t)get_be32(g->chunk_generation_data +
+					       sizeof(uint32_t) * lex_index);
+
+		if (offset & CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW) {
+			offset_pos = offset ^ CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW;
+			if (offset_pos >= g->num_generation_data_overflows)
+				die(_("commit-graph requires overflow generation data but has none"));
+			offset = get_be64(g->chunk_generation_data_overflow +
+					  sizeof(uint64_t) * offset_pos);
+		}
+		graph_data->generation = item->date + offset;
+	} else
+		graph_data->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+}
+
+/*
+ * Return the topological level of "c" stored in the Commit Data chunk,
+ * whatever kind of generation number commit_graph_generation() uses.
+ */
+static uint32_t commit_graph_topo_level(struct commit_graph *g,
+					const struct commit *c)
+{
+	uint32_t pos = commit_graph_position(c);
+
+	while (g && pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g || pos >= g->num_commits + g->num_commits_in_base)
+		return GENERATION_NUMBER_ZERO;
+
+	return get_be32(g->chunk_commit_data +
+			GRAPH_DATA_WIDTH * (pos - g->num_commits_in_base) +
+			g->hash_len + 8) >> 2;
 }
 
 static inline void set_commit_tree(struct commit *c, struct tree *t)
@@ -755,24 +854,19 @@ static int fill_commit_in_graph(struct repository *r,
 {
 	uint32_t edge_value;
 	uint32_t *parent_data_ptr;
-	uint64_t date_low, date_high;
 	struct commit_list **pptr;
-	struct commit_graph_data *graph_data;
 	const unsigned char *commit_data;
 	uint32_t lex_index;
 
+	/*
+	 * Fill the "full" position, date and generation number, but
+	 * then use the "local" position for the rest of the calculation.
+	 */
+	fill_commit_graph_info(item, g, pos);
+
 	while (pos < g->num_commits_in_base)
 		g = g->base_graph;
 
-	if (pos >= g->num_commits + g->num_commits_in_base)
-		die(_("invalid commit position. commit-graph is likely corrupt"));
-
-	/*
-	 * Store the "full" position, but then use the
-	 * "local" position for the rest of the calculation.
-	 */
-	graph_data = commit_graph_data_at(item);
-	graph_data->graph_pos = pos;
 	lex_index = pos - g->num_commits_in_base;
 
 	commit_data = g->chunk_commit_data + (g->hash_len + 16) * lex_index;
@@ -781,12 +875,6 @@ static int fill_commit_in_graph(struct repository *r,
 
 	set_commit_tree(item, NULL);
 
-	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
-	date_low = get_be32(commit_data + g->hash_len + 12);
-	item->date = (timestamp_t)((date_high << 32) | date_low);
-
-	graph_data->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
-
 	pptr = &item->parents;
 
 	edge_value = get_be32(commit_data + g->hash_len);
@@ -925,6 +1013,19 @@ struct packed_oid_list {
 	int alloc;
 };
 
+/*
+ * Both generation numbers of a commit being written: its topological
+ * level, stored in the Commit Data chunk for older readers, and its
+ * corrected commit date, stored in the Generation Data chunk. Zero
+ * means "not computed yet", as both are at least one.
+ */
+struct generation_info {
+	uint32_t topo_level;
+	timestamp_t corrected_commit_date;
+};
+
+define_commit_slab(generation_info_slab, struct generation_info);
+
 struct write_commit_graph_context {
 	struct repository *r;
 	struct object_directory *odb;
@@ -932,6 +1033,8 @@ struct write_commit_graph_context {
 	struct packed_oid_list oids;
 	struct packed_commit_list commits;
 	int num_extra_edges;
+	int num_generation_data_overflows;
+	struct generation_info_slab generations;
 	unsigned long approx_nr_objects;
 	struct progress *progress;
 	int progress_done;
@@ -950,7 +1053,8 @@ struct write_commit_graph_context {
 		 report_progress:1,
 		 split:1,
 		 changed_paths:1,
-		 order_by_pack:1;
+		 order_by_pack:1,
+		 write_generation_data:1;
 
 	const struct split_commit_graph_opts *split_opts;
 	size_t total_bloom_filter_data_size;
@@ -1093,7 +1197,7 @@ static int write_graph_chunk_data(struct hashfile *f,
 		else
 			packedDate[0] = 0;
 
-		packedDate[0] |= htonl(commit_graph_data_at(*list)->generation << 2);
+		packedDate[0] |= htonl(generation_info_slab_at(&ctx->generations, *list)->topo_level << 2);
 
 		packedDate[1] = htonl((*list)->date);
 		hashwrite(f, packedDate, 8);
@@ -1104,6 +1208,51 @@ static int write_graph_chunk_data(struct hashfile *f,
 	return 0;
 }
 
+static int write_graph_chunk_generation_data(struct hashfile *f,
+					     struct write_commit_graph_context *ctx)
+{
+	int i, num_generation_data_overflows = 0;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		timestamp_t offset;
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+
+		offset = generation_info_slab_at(&ctx->generations, c)->corrected_commit_date -
+			 c->date;
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX)
+			offset = CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW |
+				 num_generation_data_overflows++;
+
+		hashwrite_be32(f, offset);
+	}
+
+	return 0;
+}
+
+static int write_graph_chunk_generation_data_overflow(struct hashfile *f,
+						      struct write_commit_graph_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		timestamp_t offset;
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+
+		offset = generation_info_slab_at(&ctx->generations, c)->corrected_commit_date -
+			 c->date;
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX) {
+			hashwrite_be32(f, offset >> 32);
+			hashwrite_be32(f, (uint32_t)offset);
+		}
+	}
+
+	return 0;
+}
+
 static int write_graph_chunk_extra_edges(struct hashfile *f,
 					 struct write_commit_graph_context *ctx)
 {
@@ -1324,6 +1473,60 @@ static void close_reachable(struct write_commit_graph_context *ctx)
 	stop_progress(&ctx->progress);
 }
 
+/*
+ * Return the generation numbers of "c", reusing the ones stored in the
+ * commit-graph we are replacing or building upon when "c" is in it.
+ */
+static struct generation_info *get_generation_info(struct write_commit_graph_context *ctx,
+						   struct commit *c)
+{
+	struct generation_info *info = generation_info_slab_at(&ctx->generations, c);
+	struct commit_graph *g = ctx->r->objects->commit_graph;
+	uint32_t pos = commit_graph_position(c);
+	uint32_t lex_index;
+	uint64_t offset;
+	const unsigned char *commit_data;
+
+	if (info->topo_level || !g || pos == COMMIT_NOT_FROM_GRAPH)
+		return info;
+
+	while (g && pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g || pos >= g->num_commits + g->num_commits_in_base)
+		return info;
+
+	lex_index = pos - g->num_commits_in_base;
+	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
+
+	if (g->chunk_generation_data) {
+		/*
+		 * A layer is only written with a Generation Data chunk
+		 * when all of the layers below it have one, so its
+		 * corrected commit dates can be trusted even when the
+		 * layers above it lack them.
+		 */
+		offset = get_be32(g->chunk_generation_data + sizeof(uint32_t) * lex_index);
+		if (offset & CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW) {
+			uint32_t offset_pos = offset ^ CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW;
+
+			if (offset_pos >= g->num_generation_data_overflows)
+				return info;
+			offset = get_be64(g->chunk_generation_data_overflow +
+					  sizeof(uint64_t) * offset_pos);
+		}
+	} else if (ctx->write_generation_data) {
+		/* Compute the corrected commit date from scratch. */
+		return info;
+	} else {
+		/* Corrected commit dates are not written; any value will do. */
+		offset = 0;
+	}
+
+	info->topo_level = get_be32(commit_data + g->hash_len + 8) >> 2;
+	info->corrected_commit_date = c->date + offset;
+	return info;
+}
+
 static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 {
 	int i;
@@ -1334,11 +1537,11 @@ static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 					_("Computing commit graph generation numbers"),
 					ctx->commits.nr);
 	for (i = 0; i < ctx->commits.nr; i++) {
-		uint32_t generation = commit_graph_data_at(ctx->commits.list[i])->generation;
+		struct generation_info *info =
+			get_generation_info(ctx, ctx->commits.list[i]);
 
 		display_progress(ctx->progress, i + 1);
-		if (generation != GENERATION_NUMBER_INFINITY &&
-		    generation != GENERATION_NUMBER_ZERO)
+		if (info->topo_level)
 			continue;
 
 		commit_list_insert(ctx->commits.list[i], &list);
@@ -1346,32 +1549,47 @@ static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 			struct commit *current = list->item;
 			struct commit_list *parent;
 			int all_parents_computed = 1;
-			uint32_t max_generation = 0;
+			uint32_t max_level = 0;
+			timestamp_t max_corrected_commit_date = 0;
 
 			for (parent = current->parents; parent; parent = parent->next) {
-				generation = commit_graph_data_at(parent->item)->generation;
+				info = get_generation_info(ctx, parent->item);
 
-				if (generation == GENERATION_NUMBER_INFINITY ||
-				    generation == GENERATION_NUMBER_ZERO) {
+				if (!info->topo_level) {
 					all_parents_computed = 0;
 					commit_list_insert(parent->item, &list);
 					break;
-				} else if (generation > max_generation) {
-					max_generation = generation;
 				}
+
+				if (info->topo_level > max_level)
+					max_level = info->topo_level;
+				if (info->corrected_commit_date > max_corrected_commit_date)
+					max_corrected_commit_date = info->corrected_commit_date;
 			}
 
 			if (all_parents_computed) {
-				struct commit_graph_data *data = commit_graph_data_at(current);
+				info = generation_info_slab_at(&ctx->generations, current);
 
-				data->generation = max_generation + 1;
-				pop_commit(&list);
+				info->topo_level = max_level + 1;
+				if (info->topo_level > GENERATION_NUMBER_V1_MAX)
+					info->topo_level = GENERATION_NUMBER_V1_MAX;
 
-				if (data->generation > GENERATION_NUMBER_MAX)
-					data->generation = GENERATION_NUMBER_MAX;
+				info->corrected_commit_date = max_corrected_commit_date + 1;
+				if (current->date > info->corrected_commit_date)
+					info->corrected_commit_date = current->date;
+
+				pop_commit(&list);
 			}
 		}
 	}
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		struct generation_info *info = generation_info_slab_at(&ctx->generations, c);
+
+		if (info->corrected_commit_date - c->date > GENERATION_NUMBER_V2_OFFSET_MAX)
+			ctx->num_generation_data_overflows++;
+	}
 	stop_progress(&ctx->progress);
 }
 
@@ -1709,6 +1927,18 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	chunks[2].id = GRAPH_CHUNKID_DATA;
 	chunks[2].size = (hashsz + 16) * ctx->commits.nr;
 	chunks[2].write_fn = write_graph_chunk_data;
+	if (ctx->write_generation_data) {
+		chunks[num_chunks].id = GRAPH_CHUNKID_GENERATION_DATA;
+		chunks[num_chunks].size = sizeof(uint32_t) * ctx->commits.nr;
+		chunks[num_chunks].write_fn = write_graph_chunk_generation_data;
+		num_chunks++;
+	}
+	if (ctx->write_generation_data && ctx->num_generation_data_overflows) {
+		chunks[num_chunks].id = GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW;
+		chunks[num_chunks].size = sizeof(uint64_t) * ctx->num_generation_data_overflows;
+		chunks[num_chunks].write_fn = write_graph_chunk_generation_data_overflow;
+		num_chunks++;
+	}
 	if (ctx->num_extra_edges) {
 		chunks[num_chunks].id = GRAPH_CHUNKID_EXTRAEDGES;
 		chunks[num_chunks].size = 4 * ctx->num_extra_edges;
@@ -2112,6 +2342,10 @@ int write_commit_graph(struct object_directory *odb,
 	ctx->split = flags & COMMIT_GRAPH_WRITE_SPLIT ? 1 : 0;
 	ctx->split_opts = split_opts;
 	ctx->total_bloom_filter_data_size = 0;
+	init_generation_info_slab(&ctx->generations);
+
+	prepare_repo_settings(ctx->r);
+	ctx->write_generation_data = ctx->r->settings.commit_graph_generation_version == 2;
 
 	if (flags & COMMIT_GRAPH_WRITE_BLOOM_FILTERS)
 		ctx->changed_paths = 1;
@@ -2226,6 +2460,19 @@ int write_commit_graph(struct object_directory *odb,
 	} else
 		ctx->num_commit_graphs_after = 1;
 
+	/*
+	 * Corrected commit dates of the new layer build upon those of the
+	 * layers it is written on top of, so only write them when all of
+	 * those layers have them.
+	 */
+	if (ctx->write_generation_data) {
+		struct commit_graph *g;
+
+		for (g = ctx->new_base_graph; g; g = g->base_graph)
+			if (!g->chunk_generation_data)
+				ctx->write_generation_data = 0;
+	}
+
 	compute_generation_numbers(ctx);
 
 	if (ctx->changed_paths)
@@ -2242,6 +2489,7 @@ int write_commit_graph(struct object_directory *odb,
 	free(ctx->graph_name);
 	free(ctx->commits.list);
 	free(ctx->oids.list);
+	clear_generation_info_slab(&ctx->generations);
 
 	if (ctx->commit_graph_filenames_after) {
 		for (i = 0; i < ctx->num_commit_graphs_after; i++) {
@@ -2354,8 +2602,10 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 	for (i = 0; i < g->num_commits; i++) {
 		struct commit *graph_commit, *odb_commit;
 		struct commit_list *graph_parents, *odb_parents;
-		uint32_t max_generation = 0;
-		uint32_t generation;
+		timestamp_t max_generation = 0;
+		timestamp_t generation;
+		uint32_t max_level = 0;
+		uint32_t level;
 
 		display_progress(progress, i + 1);
 		hashcpy(cur_oid.hash, g->chunk_oid_lookup + g->hash_len * i);
@@ -2394,6 +2644,10 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 					     oid_to_hex(&graph_parents->item->object.oid),
 					     oid_to_hex(&odb_parents->item->object.oid));
 
+			level = commit_graph_topo_level(g, graph_parents->item);
+			if (level > max_level)
+				max_level = level;
+
 			generation = commit_graph_generation(graph_parents->item);
 			if (generation > max_generation)
 				max_generation = generation;
@@ -2406,7 +2660,8 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 			graph_report(_("commit-graph parent list for commit %s terminates early"),
 				     oid_to_hex(&cur_oid));
 
-		if (!commit_graph_generation(graph_commit)) {
+		level = commit_graph_topo_level(g, graph_commit);
+		if (!level) {
 			if (generation_zero == GENERATION_NUMBER_EXISTS)
 				graph_report(_("commit-graph has generation number zero for commit %s, but non-zero elsewhere"),
 					     oid_to_hex(&cur_oid));
@@ -2419,19 +2674,32 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 			continue;
 
 		/*
-		 * If one of our parents has generation GENERATION_NUMBER_MAX, then
-		 * our generation is also GENERATION_NUMBER_MAX. Decrement to avoid
+		 * If one of our parents has generation GENERATION_NUMBER_V1_MAX, then
+		 * our generation is also GENERATION_NUMBER_V1_MAX. Decrement to avoid
 		 * extra logic in the following condition.
 		 */
-		if (max_generation == GENERATION_NUMBER_MAX)
-			max_generation--;
+		if (max_level == GENERATION_NUMBER_V1_MAX)
+			max_level--;
 
-		generation = commit_graph_generation(graph_commit);
-		if (generation != max_generation + 1)
+		if (level != max_level + 1)
 			graph_report(_("commit-graph generation for commit %s is %u != %u"),
 				     oid_to_hex(&cur_oid),
-				     generation,
-				     max_generation + 1);
+				     level,
+				     max_level + 1);
+
+		if (g->read_generation_data) {
+			timestamp_t corrected_commit_date = max_generation + 1;
+
+			if (graph_commit->date > corrected_commit_date)
+				corrected_commit_date = graph_commit->date;
+
+			generation = commit_graph_generation(graph_commit);
+			if (generation != corrected_commit_date)
+				graph_report(_("commit-graph corrected commit date for commit %s is %"PRItime" != %"PRItime),
+					     oid_to_hex(&cur_oid),
+					     generation,
+					     corrected_commit_date);
+		}
 
 		if (graph_commit->date != odb_commit->date)
 			graph_report(_("commit date for commit %s in commit-graph is %"PRItime" != %"PRItime),
@@ -0,0 +1,243 @@
+#include "cache.h"
+#include "dir.h"
+#include "fsm-listen.h"
+#include <sys/inotify.h>
+
+/*
+ * inotify watches single directories, so we add a watch for every
+ * directory of the working tree, and for every directory that is
+ * created (or moved into it) later on.
+ */
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+		    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+		    IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+struct fsm_listen {
+	int fd;
+	struct strbuf worktree; /* with a trailing slash */
+	int root_wd;
+
+	/*
+	 * The directory each watch descriptor is for, relative to the
+	 * working tree ("" or ending in a slash), indexed by descriptor.
+	 */
+	char **wd_path;
+	int wd_nr, wd_alloc;
+};
+
+static const char *wd_to_path(struct fsm_listen *l, int wd)
+{
+	if (wd < 0 || wd >= l->wd_nr)
+		return NULL;
+	return l->wd_path[wd];
+}
+
+static void forget_wd(struct fsm_listen *l, int wd)
+{
+	if (wd < 0 || wd >= l->wd_nr)
+		return;
+	FREE_AND_NULL(l->wd_path[wd]);
+}
+
+/*
+ * Stop watching "dir" (relative, ending in a slash) and everything
+ * below it, e.g. because it was moved away.
+ */
+static void remove_watches(struct fsm_listen *l, const char *dir)
+{
+	int wd;
+
+	for (wd = 0; wd < l->wd_nr; wd++) {
+		if (!l->wd_path[wd] || !starts_with(l->wd_path[wd], dir))
+			continue;
+		inotify_rm_watch(l->fd, wd);
+		forget_wd(l, wd);
+	}
+}
+
+/*
+ * Watch "dir" (relative, "" or ending in a slash) and all directories
+ * below it. If "cb" is given, everything found is reported to it.
+ */
+static int add_watches(struct fsm_listen *l, const char *dir,
+		       fsm_listen_cb cb, void *data)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	DIR *d;
+	int wd, ret = 0;
+
+	strbuf_addbuf(&path, &l->worktree);
+	strbuf_addstr(&path, dir);
+	wd = inotify_add_watch(l->fd, path.buf, WATCH_MASK);
+	if (wd < 0) {
+		/* It may have gone away again in the meantime */
+		if (errno != ENOENT && errno != ENOTDIR) {
+			if (errno == ENOSPC)
+				ret = error(_("cannot watch '%s': too many inotify watches "
+					      "(see fs.inotify.max_user_watches)"),
+					    path.buf);
+			else
+				ret = error_errno(_("cannot watch '%s'"), path.buf);
+		}
+		strbuf_release(&path);
+		return ret;
+	}
+	if (wd >= l->wd_nr) {
+		ALLOC_GROW(l->wd_path, wd + 1, l->wd_alloc);
+		memset(l->wd_path + l->wd_nr, 0,
+		       (wd + 1 - l->wd_nr) * sizeof(*l->wd_path));
+		l->wd_nr = wd + 1;
+	}
+	free(l->wd_path[wd]);
+	l->wd_path[wd] = xstrdup(dir);
+
+	d = opendir(path.buf);
+	if (!d) {
+		strbuf_release(&path);
+		return 0;
+	}
+	while (!ret && (de = readdir(d))) {
+		struct strbuf sub = STRBUF_INIT;
+		int is_dir = DTYPE(de) == DT_DIR;
+
+		if (is_dot_or_dotdot(de->d_name) ||
+		    (!*dir && !strcmp(de->d_name, ".git")))
+			continue;
+		strbuf_addf(&sub, "%s%s", dir, de->d_name);
+		if (DTYPE(de) == DT_UNKNOWN) {
+			struct stat st;
+			struct strbuf full = STRBUF_INIT;
+
+			strbuf_addf(&full, "%s%s", l->worktree.buf, sub.buf);
+			is_dir = !lstat(full.buf, &st) && S_ISDIR(st.st_mode);
+			strbuf_release(&full);
+		}
+		if (is_dir) {
+			strbuf_addch(&sub, '/');
+			if (cb)
+				cb(sub.buf, data);
+			ret = add_watches(l, sub.buf, cb, data);
+		} else if (cb) {
+			cb(sub.buf, data);
+		}
+		strbuf_release(&sub);
+	}
+	closedir(d);
+	strbuf_release(&path);
+	return ret;
+}
+
+struct fsm_listen *fsm_listen_init(const char *worktree)
+{
+	struct fsm_listen *l = xcalloc(1, sizeof(*l));
+
+	l->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (l->fd < 0) {
+		error_errno(_("inotify_init1 failed"));
+		free(l);
+		return NULL;
+	}
+	strbuf_init(&l->worktree, 0);
+	strbuf_addstr(&l->worktree, worktree);
+	strbuf_complete(&l->worktree, '/');
+
+	if (add_watches(l, "", NULL, NULL) < 0) {
+		fsm_listen_free(l);
+		return NULL;
+	}
+	l->root_wd = 0;
+	while (l->root_wd < l->wd_nr &&
+	       (!l->wd_path[l->root_wd] || *l->wd_path[l->root_wd]))
+		l->root_wd++;
+	return l;
+}
+
+int fsm_listen_fd(struct fsm_listen *l)
+{
+	return l->fd;
+}
+
+int fsm_listen_drain(struct fsm_listen *l, fsm_listen_cb cb, void *data)
+{
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct strbuf path = STRBUF_INIT;
+	int lost = 0;
+
+	for (;;) {
+		ssize_t len = read(l->fd, buf, sizeof(buf));
+		const char *p;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			strbuf_release(&path);
+			return error_errno(_("failed to read inotify events"));
+		}
+		if (!len)
+			break;
+
+		for (p = buf; p < buf + len; ) {
+			const struct inotify_event *ev = (const void *)p;
+			const char *dir = wd_to_path(l, ev->wd);
+
+			p += sizeof(*ev) + ev->len;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				lost = 1;
+				continue;
+			}
+			if (ev->wd == l->root_wd &&
+			    (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF |
+					 IN_IGNORED))) {
+				strbuf_release(&path);
+				return -1;
+			}
+			if (ev->mask & IN_IGNORED) {
+				forget_wd(l, ev->wd);
+				continue;
+			}
+			if (!dir || !ev->len)
+				continue;
+			if (!*dir && !strcmp(ev->name, ".git"))
+				continue;
+
+			strbuf_reset(&path);
+			strbuf_addf(&path, "%s%s", dir, ev->name);
+			if (!(ev->mask & IN_ISDIR)) {
+				cb(path.buf, data);
+				continue;
+			}
+
+			strbuf_addch(&path, '/');
+			if (ev->mask & (IN_MOVED_FROM | IN_DELETE)) {
+				remove_watches(l, path.buf);
+				cb(path.buf, data);
+			} else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+				cb(path.buf, data);
+				if (add_watches(l, path.buf, cb, data) < 0)
+					lost = 1;
+			}
+		}
+	}
+
+	strbuf_release(&path);
+	return lost;
+}
+
+void fsm_listen_free(struct fsm_listen *l)
+{
+	int i;
+
+	if (!l)
+		return;
+	close(l->fd);
+	for (i = 0; i < l->wd_nr; i++)
+		free(l->wd_path[i]);
+	free(l->wd_path);
+	strbuf_release(&l->worktree);
+	free(l);
+}
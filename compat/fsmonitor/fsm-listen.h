@@ -0,0 +1,39 @@
+#ifndef FSM_LISTEN_H
+#define FSM_LISTEN_H
+
+/*
+ * Platform-specific part of the builtin filesystem monitor daemon:
+ * watches a working tree and reports the paths that changed in it.
+ *
+ * Paths are reported relative to the root of the working tree. A path
+ * ending in a slash stands for a directory that appeared, disappeared
+ * or moved, i.e. for everything below it. The contents of a directory
+ * that appears are reported as well. Nothing inside the repository's
+ * .git directory is reported.
+ */
+
+struct fsm_listen;
+
+typedef void (*fsm_listen_cb)(const char *path, void *data);
+
+/*
+ * Start watching the working tree at "worktree" (an absolute path).
+ * Returns NULL (after reporting an error) if that is not possible.
+ */
+struct fsm_listen *fsm_listen_init(const char *worktree);
+
+/* The file descriptor that becomes readable when events are pending. */
+int fsm_listen_fd(struct fsm_listen *l);
+
+/*
+ * Report the changes seen since the last call without blocking.
+ * Returns 0 if all changes were reported, 1 if some were lost (e.g.
+ * because the kernel queue overflowed) and the caller has to assume
+ * that anything might have changed, and -1 if the working tree went
+ * away.
+ */
+int fsm_listen_drain(struct fsm_listen *l, fsm_listen_cb cb, void *data);
+
+void fsm_listen_free(struct fsm_listen *l);
+
+#endif /* FSM_LISTEN_H */
@@ -0,0 +1,208 @@
+#include "../git-compat-util.h"
+#include "../config.h"
+#include "sha-ni.h"
+
+#ifdef HAVE_SHA_NI
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHA_NI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+int sha_ni_available(void)
+{
+	static int available = -1;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (available >= 0)
+		return available;
+
+	available = 0;
+	if (!git_env_bool("GIT_TEST_SHA_NI", 1))
+		return available;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return available;
+	__cpuid(1, eax, ebx, ecx, edx);
+	if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+		return available;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	if (ebx & (1U << 29))
+		available = 1;
+	return available;
+}
+
+/*
+ * Four rounds of SHA-1 with the message words of group "g" (0..19),
+ * which use the round function "f" (g / 5). The message schedule for
+ * later groups is worked out in "msg" alongside, and "e" alternates
+ * between the E of this group and that of the next. The registers hold
+ * four words each, in reverse order.
+ */
+#define SHA1_ROUNDS4(g, f) do { \
+	if ((g) < 4) \
+		msg[(g) & 3] = _mm_shuffle_epi8(_mm_loadu_si128( \
+			(const __m128i *)(p + 16 * (g))), bswap); \
+	if ((g) == 0) \
+		e[0] = _mm_add_epi32(e[0], msg[0]); \
+	else \
+		e[(g) & 1] = _mm_sha1nexte_epu32(e[(g) & 1], msg[(g) & 3]); \
+	e[((g) + 1) & 1] = abcd; \
+	if (W) \
+		_mm_storeu_si128((__m128i *)(W + 4 * (g)), \
+				 _mm_shuffle_epi32(msg[(g) & 3], 0x1b)); \
+	if ((g) >= 3 && (g) < 19) \
+		msg[((g) + 1) & 3] = _mm_sha1msg2_epu32(msg[((g) + 1) & 3], \
+							msg[(g) & 3]); \
+	abcd = _mm_sha1rnds4_epu32(abcd, e[(g) & 1], (f)); \
+	if ((g) >= 1 && (g) < 17) \
+		msg[((g) + 3) & 3] = _mm_sha1msg1_epu32(msg[((g) + 3) & 3], \
+							msg[(g) & 3]); \
+	if ((g) >= 2 && (g) < 18) \
+		msg[((g) + 2) & 3] = _mm_xor_si128(msg[((g) + 2) & 3], \
+						   msg[(g) & 3]); \
+} while (0)
+
+SHA_NI_TARGET __attribute__((always_inline))
+static inline void sha1_blocks(uint32_t state[5], const void *data, size_t nr, uint32_t *W)
+{
+	const unsigned char *p = data;
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL,
+					     0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e_save, e[2], msg[4];
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+	e[0] = _mm_set_epi32(state[4], 0, 0, 0);
+
+	for (; nr; nr--, p += 64) {
+		abcd_save = abcd;
+		e_save = e[0];
+
+		SHA1_ROUNDS4(0, 0);
+		SHA1_ROUNDS4(1, 0);
+		SHA1_ROUNDS4(2, 0);
+		SHA1_ROUNDS4(3, 0);
+		SHA1_ROUNDS4(4, 0);
+		SHA1_ROUNDS4(5, 1);
+		SHA1_ROUNDS4(6, 1);
+		SHA1_ROUNDS4(7, 1);
+		SHA1_ROUNDS4(8, 1);
+		SHA1_ROUNDS4(9, 1);
+		SHA1_ROUNDS4(10, 2);
+		SHA1_ROUNDS4(11, 2);
+		SHA1_ROUNDS4(12, 2);
+		SHA1_ROUNDS4(13, 2);
+		SHA1_ROUNDS4(14, 2);
+		SHA1_ROUNDS4(15, 3);
+		SHA1_ROUNDS4(16, 3);
+		SHA1_ROUNDS4(17, 3);
+		SHA1_ROUNDS4(18, 3);
+		SHA1_ROUNDS4(19, 3);
+
+		e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+	state[4] = _mm_extract_epi32(e[0], 3);
+}
+
+SHA_NI_TARGET
+void sha_ni_sha1_blocks(uint32_t state[5], const void *data, size_t nr)
+{
+	sha1_blocks(state, data, nr, NULL);
+}
+
+SHA_NI_TARGET
+void sha_ni_sha1_block_expand(uint32_t state[5], const void *block,
+			      uint32_t W[80])
+{
+	sha1_blocks(state, block, 1, W);
+}
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/*
+ * Four rounds of SHA-256 with the message words of group "g" (0..15),
+ * working out the message schedule for later groups in "msg".
+ */
+#define SHA256_ROUNDS4(g) do { \
+	__m128i wk; \
+	if ((g) < 4) \
+		msg[(g) & 3] = _mm_shuffle_epi8(_mm_loadu_si128( \
+			(const __m128i *)(p + 16 * (g))), bswap); \
+	wk = _mm_add_epi32(msg[(g) & 3], \
+			   _mm_loadu_si128((const __m128i *)(sha256_k + 4 * (g)))); \
+	cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk); \
+	if ((g) >= 3 && (g) < 15) { \
+		msg[((g) + 1) & 3] = _mm_add_epi32(msg[((g) + 1) & 3], \
+			_mm_alignr_epi8(msg[(g) & 3], msg[((g) + 3) & 3], 4)); \
+		msg[((g) + 1) & 3] = _mm_sha256msg2_epu32(msg[((g) + 1) & 3], \
+							  msg[(g) & 3]); \
+	} \
+	abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0e)); \
+	if ((g) >= 1 && (g) < 13) \
+		msg[((g) + 3) & 3] = _mm_sha256msg1_epu32(msg[((g) + 3) & 3], \
+							  msg[(g) & 3]); \
+} while (0)
+
+SHA_NI_TARGET
+void sha_ni_sha256_blocks(uint32_t state[8], const void *data, size_t nr)
+{
+	const unsigned char *p = data;
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					     0x0405060700010203ULL);
+	__m128i abef, cdgh, abef_save, cdgh_save, tmp, msg[4];
+
+	/* the instructions want the state as ABEF and CDGH */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0xb1);
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(state + 4)), 0x1b);
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);
+
+	for (; nr; nr--, p += 64) {
+		abef_save = abef;
+		cdgh_save = cdgh;
+
+		SHA256_ROUNDS4(0);
+		SHA256_ROUNDS4(1);
+		SHA256_ROUNDS4(2);
+		SHA256_ROUNDS4(3);
+		SHA256_ROUNDS4(4);
+		SHA256_ROUNDS4(5);
+		SHA256_ROUNDS4(6);
+		SHA256_ROUNDS4(7);
+		SHA256_ROUNDS4(8);
+		SHA256_ROUNDS4(9);
+		SHA256_ROUNDS4(10);
+		SHA256_ROUNDS4(11);
+		SHA256_ROUNDS4(12);
+		SHA256_ROUNDS4(13);
+		SHA256_ROUNDS4(14);
+		SHA256_ROUNDS4(15);
+
+		abef = _mm_add_epi32(abef, abef_save);
+		cdgh = _mm_add_epi32(cdgh, cdgh_save);
+	}
+
+	tmp = _mm_shuffle_epi32(abef, 0x1b);
+	cdgh = _mm_shuffle_epi32(cdgh, 0xb1);
+	_mm_storeu_si128((__m128i *)state, _mm_blend_epi16(tmp, cdgh, 0xf0));
+	_mm_storeu_si128((__m128i *)(state + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+}
+#endif /* HAVE_SHA_NI */
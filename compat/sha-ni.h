@@ -0,0 +1,41 @@
+#ifndef COMPAT_SHA_NI_H
+#define COMPAT_SHA_NI_H
+
+/*
+ * Block functions for SHA-1 and SHA-256 that use the SHA extensions of
+ * x86 processors. They are built where the compiler can generate the
+ * instructions; whether the processor running us has them is found out
+ * at runtime with sha_ni_available().
+ */
+#if !defined(NO_SHA_NI) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define HAVE_SHA_NI 1
+#endif
+
+#ifdef HAVE_SHA_NI
+/*
+ * Whether the processor has the SHA extensions, and we have not been
+ * told not to use them with GIT_TEST_SHA_NI=false.
+ */
+int sha_ni_available(void);
+
+/*
+ * Run "nr" 64-byte blocks from "data" through the compression function,
+ * updating "state" (which is in the layout of the usual C code, i.e.
+ * A, B, C, ... in that order).
+ */
+void sha_ni_sha1_blocks(uint32_t state[5], const void *data, size_t nr);
+void sha_ni_sha256_blocks(uint32_t state[8], const void *data, size_t nr);
+
+/*
+ * Run one block through the SHA-1 compression function, and also store
+ * the 80 words of its message schedule in "W".
+ */
+void sha_ni_sha1_block_expand(uint32_t state[5], const void *block,
+			      uint32_t W[80]);
+#else
+#define sha_ni_available() 0
+#endif
+
+#endif /* COMPAT_SHA_NI_H */
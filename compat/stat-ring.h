@@ -0,0 +1,41 @@
+#ifndef COMPAT_STAT_RING_H
+#define COMPAT_STAT_RING_H
+
+/*
+ * lstat() many paths with one system call, by queueing statx requests
+ * on an io_uring. The kernel works on them in parallel, so that a
+ * single thread can have many stat calls waiting for the disk at once.
+ *
+ * stat_ring_new() returns NULL where io_uring is not available, either
+ * because we were built without HAVE_IO_URING or because the kernel
+ * refuses it; callers then lstat() the paths one by one.
+ */
+struct stat_ring;
+
+#ifdef HAVE_IO_URING
+/*
+ * Set up a ring on which up to "depth" paths can be queued at once,
+ * or return NULL.
+ */
+struct stat_ring *stat_ring_new(unsigned int depth);
+
+/*
+ * lstat() the "nr" paths (at most the depth of the ring), relative to
+ * the current directory, storing the results in "st". "res" gets 0 for
+ * the paths that could be stat'ed and -1 for the others, like lstat()
+ * would return, but errno is not set.
+ *
+ * Returns -1 if the kernel cannot stat paths through the ring at all,
+ * in which case the results are to be ignored and the ring freed.
+ */
+int stat_ring_lstat(struct stat_ring *ring, unsigned int nr,
+		    const char **paths, struct stat *st, int *res);
+
+void stat_ring_free(struct stat_ring *ring);
+#else
+#define stat_ring_new(depth) NULL
+#define stat_ring_lstat(ring, nr, paths, st, res) (-1)
+#define stat_ring_free(ring) do { } while (0)
+#endif
+
+#endif /* COMPAT_STAT_RING_H */
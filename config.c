@@ -20,6 +20,7 @@
 #include "dir.h"
 #include "color.h"
 #include "refs.h"
+#include "fsmonitor-ipc.h"
 
 struct config_source {
 	struct config_source *prev;
@@ -1359,6 +1360,23 @@ static int git_default_core_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.bulkcheckin")) {
+		core_bulk_checkin = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.fsyncmethod")) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (!strcmp(value, "fsync"))
+			fsync_method = FSYNC_METHOD_FSYNC;
+		else if (!strcmp(value, "batch"))
+			fsync_method = FSYNC_METHOD_BATCH;
+		else
+			die(_("invalid value for core.fsyncMethod: %s"), value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.preloadindex")) {
 		core_preload_index = git_config_bool(var, value);
 		return 0;
@@ -2347,6 +2365,18 @@ int git_config_get_max_percent_split_change(void)
 
 int git_config_get_fsmonitor(void)
 {
+	int use_builtin;
+
+	if (fsmonitor_ipc__is_supported() &&
+	    !git_config_get_bool("core.usebuiltinfsmonitor", &use_builtin) &&
+	    use_builtin) {
+		core_use_builtin_fsmonitor = 1;
+		/* only checked for being set; there is no hook to run */
+		core_fsmonitor = "(builtin)";
+		return 1;
+	}
+	core_use_builtin_fsmonitor = 0;
+
 	if (git_config_get_pathname("core.fsmonitor", &core_fsmonitor))
 		core_fsmonitor = getenv("GIT_TEST_FSMONITOR");
 
@@ -13,6 +13,7 @@
 #include "submodule.h"
 #include "dir.h"
 #include "fsmonitor.h"
+#include "sparse-index.h"
 
 /*
  * diff-files
@@ -377,6 +378,27 @@ static int show_modified(struct rev_info *revs,
 	return 0;
 }
 
+/*
+ * A sparse directory entry of the index (see sparse-index.h) against
+ * the same directory of the tree, or against nothing: compare the two
+ * trees, which is what comparing the entries below them would give.
+ */
+static void show_sparse_directory(struct rev_info *revs,
+				  const struct cache_entry *idx,
+				  const struct cache_entry *tree)
+{
+	struct diff_options *opt = &revs->diffopt;
+	int recursive = opt->flags.recursive;
+
+	if (idx && tree && oideq(&idx->oid, &tree->oid))
+		return;
+
+	opt->flags.recursive = 1;
+	diff_tree_oid(tree ? &tree->oid : NULL, idx ? &idx->oid : NULL,
+		      idx ? idx->name : tree->name, opt);
+	opt->flags.recursive = recursive;
+}
+
 /*
  * This gets a mix of an existing index and a tree, one pathname entry
  * at a time. The index entry may be a single stage-0 one, but it could
@@ -390,6 +412,12 @@ static void do_oneway_diff(struct unpack_trees_options *o,
 	struct rev_info *revs = o->unpack_data;
 	int match_missing, cached;
 
+	if ((idx && S_ISSPARSEDIR(idx->ce_mode)) ||
+	    (tree && S_ISSPARSEDIR(tree->ce_mode))) {
+		show_sparse_directory(revs, idx, tree);
+		return;
+	}
+
 	/*
 	 * i-t-a entries do not actually exist in the index (if we're
 	 * looking at its content)
@@ -495,6 +523,14 @@ static int diff_cache(struct rev_info *revs,
 	if (!tree)
 		return error("bad tree object %s",
 			     tree_name ? tree_name : oid_to_hex(tree_oid));
+
+	/*
+	 * The tree diff used for sparse directory entries cannot
+	 * apply all kinds of pathspecs.
+	 */
+	if (revs->prune_data.nr)
+		ensure_full_index(revs->diffopt.repo->index);
+
 	memset(&opts, 0, sizeof(opts));
 	opts.head_idx = 1;
 	opts.index_only = cached;
@@ -26,6 +26,7 @@
 #include "parse-options.h"
 #include "help.h"
 #include "promisor-remote.h"
+#include "streaming.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -545,6 +546,7 @@ struct emit_callback {
 	struct diff_words_data *diff_words;
 	struct diff_options *opt;
 	struct strbuf *header;
+	long lno_offset;
 };
 
 static int count_lines(const char *data, int size)
@@ -3400,6 +3402,471 @@ struct userdiff_driver *get_textconv(struct repository *r,
 	return userdiff_get_textconv(r, one->driver);
 }
 
+static int reuse_worktree_file(struct index_state *istate,
+			       const char *name,
+			       const struct object_id *oid,
+			       int want_file);
+
+/*
+ * xdiff wants to see both sides of a diff in full, which for two big
+ * blobs that are diffed as text means having both in core.  When they
+ * differ only in a small part, as large generated files tend to, we
+ * instead stream them to find where they start and stop differing,
+ * and hand xdiff only what lies in between, with enough common lines
+ * around it to get the same context lines, hunk headers and line
+ * numbers as a diff of the whole blobs would.
+ */
+#define STREAM_DIFF_CHUNK (128 * 1024)
+
+/*
+ * Common lines kept on both sides of the part that differs beyond
+ * those shown as context, so that xdiff has the same room to slide
+ * the changes around as it would with the whole blobs.
+ */
+#define STREAM_DIFF_MARGIN 100
+
+/* Do not stream if we are asked for more context than this. */
+#define STREAM_DIFF_MAX_CONTEXT 10000
+
+/* How much of a line we look at to see if it is a function header. */
+#define STREAM_DIFF_FUNC_LINE 1024
+
+struct diff_stream {
+	struct repository *r;
+	struct diff_filespec *spec;
+	struct git_istream *st;
+	int fd;
+	unsigned long size;
+	char *buf;
+	size_t pos, len;
+};
+
+static int diff_stream_open(struct diff_stream *ds)
+{
+	struct diff_filespec *s = ds->spec;
+
+	ds->pos = ds->len = 0;
+	if (!s->oid_valid ||
+	    reuse_worktree_file(ds->r->index, s->path, &s->oid, 0)) {
+		struct stat st;
+
+		if (would_convert_to_git(ds->r->index, s->path))
+			return -1;
+		ds->fd = open(s->path, O_RDONLY);
+		if (ds->fd < 0)
+			return -1;
+		if (fstat(ds->fd, &st) || !S_ISREG(st.st_mode)) {
+			close(ds->fd);
+			ds->fd = -1;
+			return -1;
+		}
+		ds->size = xsize_t(st.st_size);
+	} else {
+		enum object_type type;
+
+		ds->st = open_istream(ds->r, &s->oid, &type, &ds->size, NULL);
+		if (!ds->st)
+			return -1;
+	}
+	return 0;
+}
+
+static void diff_stream_close(struct diff_stream *ds)
+{
+	if (ds->st)
+		close_istream(ds->st);
+	else if (ds->fd >= 0)
+		close(ds->fd);
+	ds->st = NULL;
+	ds->fd = -1;
+}
+
+static void diff_stream_rewind(struct diff_stream *ds)
+{
+	unsigned long size = ds->size;
+
+	if (ds->fd >= 0) {
+		ds->pos = ds->len = 0;
+		if (lseek(ds->fd, 0, SEEK_SET))
+			die_errno("unable to read %s", ds->spec->path);
+		return;
+	}
+	diff_stream_close(ds);
+	if (diff_stream_open(ds) || ds->size != size)
+		die("unable to read %s", oid_to_hex(&ds->spec->oid));
+}
+
+/* Return how many bytes are ready at ds->buf + ds->pos; 0 at the end. */
+static size_t diff_stream_fill(struct diff_stream *ds)
+{
+	if (ds->pos == ds->len) {
+		ssize_t n;
+
+		if (ds->st)
+			n = read_istream(ds->st, ds->buf, STREAM_DIFF_CHUNK);
+		else
+			n = xread(ds->fd, ds->buf, STREAM_DIFF_CHUNK);
+		if (n < 0)
+			die("unable to read %s", ds->spec->path);
+		ds->pos = 0;
+		ds->len = n;
+	}
+	return ds->len - ds->pos;
+}
+
+static void diff_stream_skip(struct diff_stream *ds, unsigned long n)
+{
+	if (ds->fd >= 0 && ds->pos == ds->len) {
+		if (lseek(ds->fd, n, SEEK_CUR) < 0)
+			die_errno("unable to read %s", ds->spec->path);
+		return;
+	}
+	while (n) {
+		size_t avail = diff_stream_fill(ds);
+
+		if (!avail)
+			die("unexpected end of %s", ds->spec->path);
+		if (avail > n)
+			avail = n;
+		ds->pos += avail;
+		n -= avail;
+	}
+}
+
+/*
+ * Append "n" bytes to "sb", but stop after "lines" complete lines if
+ * that is non-zero.  Return how many bytes were appended.
+ */
+static unsigned long diff_stream_read(struct diff_stream *ds, struct strbuf *sb,
+				      unsigned long n, unsigned long lines)
+{
+	unsigned long done = 0;
+
+	while (done < n) {
+		size_t avail = diff_stream_fill(ds);
+		const char *p = ds->buf + ds->pos;
+
+		if (!avail)
+			die("unexpected end of %s", ds->spec->path);
+		if (avail > n - done)
+			avail = n - done;
+		if (lines) {
+			const char *eol = p, *end = p + avail;
+
+			while ((eol = memchr(eol, '\n', end - eol))) {
+				eol++;
+				if (!--lines) {
+					avail = eol - p;
+					n = done + avail;
+					break;
+				}
+			}
+		}
+		strbuf_add(sb, p, avail);
+		ds->pos += avail;
+		done += avail;
+	}
+	return done;
+}
+
+static int stream_diff_is_func(const xdemitconf_t *xecfg,
+			       const char *line, long len)
+{
+	char dummy[1];
+
+	if (xecfg->find_func)
+		return xecfg->find_func(line, len, dummy, sizeof(dummy),
+					xecfg->find_func_priv) >= 0;
+	/* the same test as xdiff's default */
+	return len > 0 &&
+	       (isalpha((unsigned char)*line) || *line == '_' || *line == '$');
+}
+
+/* The starts of the last few lines seen, oldest first. */
+struct stream_diff_lines {
+	struct stream_diff_line {
+		unsigned long start, nr;
+		struct strbuf func;
+	} *line;
+	size_t alloc, nr, newest;
+	/* the last function header line that fell off the front */
+	struct strbuf func;
+};
+
+static void stream_diff_add_line(struct stream_diff_lines *lines,
+				 unsigned long start, unsigned long nr)
+{
+	struct stream_diff_line *l;
+
+	lines->newest = (lines->newest + 1) % lines->alloc;
+	l = &lines->line[lines->newest];
+	if (lines->nr == lines->alloc) {
+		if (l->func.len) {
+			strbuf_swap(&lines->func, &l->func);
+			strbuf_reset(&l->func);
+		}
+	} else
+		lines->nr++;
+	l->start = start;
+	l->nr = nr;
+}
+
+struct stream_diff_window {
+	/* offset of the window in both blobs, and lines before it */
+	unsigned long start, lines;
+	/* the common tail of the blobs, and how much of it is in the window */
+	unsigned long suffix, suffix_shown;
+	/* a function header line from before the window, if any */
+	struct strbuf func;
+};
+
+/*
+ * Read "a" and "b" up to the first byte in which they differ, return
+ * its offset, and pick where the window starts.
+ */
+static unsigned long stream_diff_prefix(struct diff_stream *a,
+					struct diff_stream *b,
+					const xdemitconf_t *xecfg,
+			      struct stream_diff_window *w)
+{
+	struct stream_diff_lines lines = { NULL };
+	struct strbuf line = STRBUF_INIT;
+	unsigned long off = 0, nr = 0;
+	size_t i;
+
+	lines.alloc = xecfg->ctxlen + STREAM_DIFF_MARGIN + 1;
+	lines.line = xcalloc(lines.alloc, sizeof(*lines.line));
+	for (i = 0; i < lines.alloc; i++)
+		strbuf_init(&lines.line[i].func, 0);
+	strbuf_init(&lines.func, 0);
+	lines.nr = 1;
+
+	for (;;) {
+		size_t na = diff_stream_fill(a), nb = diff_stream_fill(b);
+		size_t n = na < nb ? na : nb, k = 0;
+		const char *pa = a->buf + a->pos, *pb = b->buf + b->pos;
+		const char *p, *end;
+
+		if (!n)
+			break;
+		if (memcmp(pa, pb, n))
+			while (pa[k] == pb[k])
+				k++;
+		else
+			k = n;
+
+		for (p = pa, end = pa + k; p < end; ) {
+			const char *eol = memchr(p, '\n', end - p);
+			const char *next = eol ? eol + 1 : end;
+
+			size_t len = next - p;
+
+			/*
+			 * Lines that are split between two reads are
+			 * collected in "line" to be looked at.
+			 */
+			if (line.len || !eol) {
+				if (len > STREAM_DIFF_FUNC_LINE - line.len)
+					len = STREAM_DIFF_FUNC_LINE - line.len;
+				strbuf_add(&line, p, len);
+				p = line.buf;
+				len = line.len;
+			} else if (len > STREAM_DIFF_FUNC_LINE)
+				len = STREAM_DIFF_FUNC_LINE;
+			if (eol) {
+				struct stream_diff_line *l;
+
+				l = &lines.line[lines.newest];
+				if (stream_diff_is_func(xecfg, p, len))
+					strbuf_add(&l->func, p, len);
+				strbuf_reset(&line);
+				nr++;
+				stream_diff_add_line(&lines, off + (next - pa), nr);
+			}
+			p = next;
+		}
+		a->pos += k;
+		b->pos += k;
+		off += k;
+		if (k < n)
+			break;
+	}
+
+	i = (lines.newest + lines.alloc + 1 - lines.nr) % lines.alloc;
+	w->start = lines.line[i].start;
+	w->lines = lines.line[i].nr;
+	strbuf_swap(&w->func, &lines.func);
+
+	for (i = 0; i < lines.alloc; i++)
+		strbuf_release(&lines.line[i].func);
+	free(lines.line);
+	strbuf_release(&lines.func);
+	strbuf_release(&line);
+	return off;
+}
+
+/*
+ * Find how long a tail "a" and "b" have in common, starting no earlier
+ * than "prefix" bytes into the shorter one.
+ */
+static unsigned long stream_diff_suffix(struct diff_stream *a,
+					struct diff_stream *b,
+					unsigned long prefix)
+{
+	unsigned long compared = 0, last = 0, len;
+
+	diff_stream_rewind(a);
+	diff_stream_rewind(b);
+	if (a->size < b->size) {
+		len = a->size - prefix;
+		diff_stream_skip(a, prefix);
+		diff_stream_skip(b, prefix + (b->size - a->size));
+	} else {
+		len = b->size - prefix;
+		diff_stream_skip(a, prefix + (a->size - b->size));
+		diff_stream_skip(b, prefix);
+	}
+
+	for (;;) {
+		size_t na = diff_stream_fill(a), nb = diff_stream_fill(b);
+		size_t n = na < nb ? na : nb;
+		const char *pa = a->buf + a->pos, *pb = b->buf + b->pos;
+
+		if (!n)
+			break;
+		if (memcmp(pa, pb, n)) {
+			size_t k = n;
+
+			while (pa[k - 1] == pb[k - 1])
+				k--;
+			last = compared + k;
+		}
+		a->pos += n;
+		b->pos += n;
+		compared += n;
+	}
+	return len - last;
+}
+
+/*
+ * Fill "mf1" and "mf2" with the parts of "one" and "two" xdiff needs
+ * to see, if they are big enough to be worth streaming; "w" says where
+ * the parts are.  Return -1 if the blobs are not to be streamed, and 1
+ * if they do not differ at all.
+ *
+ * The parts are held in core, so they are not allowed to grow beyond
+ * core.bigFileThreshold either, be it because the blobs differ all
+ * over or because the lines around the change are very long; we then
+ * give up and let the caller diff the whole blobs as before.
+ */
+static int stream_diff_fill(struct repository *r,
+			    struct diff_filespec *one, struct diff_filespec *two,
+			    const xdemitconf_t *xecfg,
+			    mmfile_t *mf1, mmfile_t *mf2,
+			    struct stream_diff_window *w)
+{
+	struct diff_stream a = { r, one, NULL, -1 };
+	struct diff_stream b = { r, two, NULL, -1 };
+	struct strbuf sb1 = STRBUF_INIT, sb2 = STRBUF_INIT;
+	unsigned long prefix, tail, len1, len2, room;
+	int ret = -1;
+
+	if (!DIFF_FILE_VALID(one) || !DIFF_FILE_VALID(two) ||
+	    !S_ISREG(one->mode) || !S_ISREG(two->mode) ||
+	    one->data || two->data ||
+	    xecfg->ctxlen > STREAM_DIFF_MAX_CONTEXT ||
+	    (xecfg->flags & XDL_EMIT_FUNCCONTEXT))
+		return -1;
+	if (diff_stream_open(&a) || diff_stream_open(&b) ||
+	    (a.size <= big_file_threshold && b.size <= big_file_threshold))
+		goto out;
+
+	trace2_region_enter("diff", "stream", r);
+	a.buf = xmalloc(STREAM_DIFF_CHUNK);
+	b.buf = xmalloc(STREAM_DIFF_CHUNK);
+	strbuf_init(&w->func, 0);
+	prefix = stream_diff_prefix(&a, &b, xecfg, w);
+	if (prefix == a.size && prefix == b.size) {
+		ret = 1;
+		goto done;
+	}
+	w->suffix = stream_diff_suffix(&a, &b, prefix);
+
+	len1 = a.size - w->suffix - w->start;
+	len2 = b.size - w->suffix - w->start;
+	if (len1 > big_file_threshold || len2 > big_file_threshold)
+		goto give_up;
+	room = big_file_threshold - (len1 > len2 ? len1 : len2);
+
+	/*
+	 * Both windows end the same number of bytes into the common
+	 * tail, after the lines of it that may be shown as context.
+	 */
+	if (w->func.len && w->func.buf[w->func.len - 1] != '\n')
+		strbuf_addch(&w->func, '\n');
+	strbuf_addbuf(&sb1, &w->func);
+	strbuf_addbuf(&sb2, &w->func);
+	diff_stream_rewind(&a);
+	diff_stream_skip(&a, w->start);
+	diff_stream_read(&a, &sb1, len1, 0);
+	tail = diff_stream_read(&a, &sb1,
+				w->suffix <= room ? w->suffix : room + 1,
+				xecfg->ctxlen + STREAM_DIFF_MARGIN + 1);
+	if (tail > room)
+		goto give_up;
+	w->suffix_shown = tail;
+	diff_stream_rewind(&b);
+	diff_stream_skip(&b, w->start);
+	diff_stream_read(&b, &sb2, len2 + tail, 0);
+
+	mf1->size = sb1.len;
+	mf1->ptr = strbuf_detach(&sb1, NULL);
+	mf2->size = sb2.len;
+	mf2->ptr = strbuf_detach(&sb2, NULL);
+	ret = 0;
+	goto done;
+give_up:
+	trace2_data_string("diff", r, "stream/give-up", one->path);
+	strbuf_release(&sb1);
+	strbuf_release(&sb2);
+	strbuf_release(&w->func);
+done:
+	trace2_region_leave("diff", "stream", r);
+	free(a.buf);
+	free(b.buf);
+out:
+	diff_stream_close(&a);
+	diff_stream_close(&b);
+	return ret;
+}
+
+static void fn_out_stream_hunk(void *priv,
+			       long old_begin, long old_nr,
+			       long new_begin, long new_nr,
+			       const char *func, long funclen)
+{
+	struct emit_callback *ecbdata = priv;
+	struct strbuf sb = STRBUF_INIT;
+
+	/* the same as what xdiff would have said, with our line numbers */
+	strbuf_addf(&sb, "@@ -%ld", old_begin + ecbdata->lno_offset);
+	if (old_nr != 1)
+		strbuf_addf(&sb, ",%ld", old_nr);
+	strbuf_addf(&sb, " +%ld", new_begin + ecbdata->lno_offset);
+	if (new_nr != 1)
+		strbuf_addf(&sb, ",%ld", new_nr);
+	strbuf_addstr(&sb, " @@");
+	if (func && funclen) {
+		strbuf_addch(&sb, ' ');
+		if (funclen > 127 - (long)sb.len)
+			funclen = 127 - sb.len;
+		strbuf_add(&sb, func, funclen);
+	}
+	strbuf_addch(&sb, '\n');
+	fn_out_consume(ecbdata, sb.buf, sb.len);
+	strbuf_release(&sb);
+}
+
 static void builtin_diff(const char *name_a,
 			 const char *name_b,
 			 struct diff_filespec *one,
@@ -3559,6 +4026,8 @@ static void builtin_diff(const char *name_a,
 		xdemitconf_t xecfg;
 		struct emit_callback ecbdata;
 		const struct userdiff_funcname *pe;
+		struct stream_diff_window window;
+		int streamed = -1;
 
 		if (must_show_header) {
 			emit_diff_symbol(o, DIFF_SYMBOL_HEADER,
@@ -3566,9 +4035,6 @@ static void builtin_diff(const char *name_a,
 			strbuf_reset(&header);
 		}
 
-		mf1.size = fill_textconv(o->repo, textconv_one, one, &mf1.ptr);
-		mf2.size = fill_textconv(o->repo, textconv_two, two, &mf2.ptr);
-
 		pe = diff_funcname_pattern(o, one);
 		if (!pe)
 			pe = diff_funcname_pattern(o, two);
@@ -3581,8 +4047,6 @@ static void builtin_diff(const char *name_a,
 		ecbdata.label_path = lbl;
 		ecbdata.color_diff = want_color(o->use_color);
 		ecbdata.ws_rule = whitespace_rule(o->repo->index, name_b);
-		if (ecbdata.ws_rule & WS_BLANK_AT_EOF)
-			check_blank_at_eof(&mf1, &mf2, &ecbdata);
 		ecbdata.opt = o;
 		if (header.len && !o->flags.suppress_diff_headers)
 			ecbdata.header = &header;
@@ -3605,17 +4069,56 @@ static void builtin_diff(const char *name_a,
 		else if (skip_prefix(diffopts, "-u", &v))
 			xecfg.ctxlen = strtoul(v, NULL, 10);
 
-		if (o->word_diff)
-			init_diff_words_data(&ecbdata, o, one, two);
-		if (xdi_diff_outf(&mf1, &mf2, NULL, fn_out_consume,
-				  &ecbdata, &xpp, &xecfg))
-			die("unable to generate diff for %s", one->path);
-		if (o->word_diff)
-			free_diff_words_data(&ecbdata);
-		if (textconv_one)
+		if (!textconv_one && !textconv_two)
+			streamed = stream_diff_fill(o->repo, one, two, &xecfg,
+						    &mf1, &mf2, &window);
+		if (streamed < 0) {
+			mf1.size = fill_textconv(o->repo, textconv_one, one, &mf1.ptr);
+			mf2.size = fill_textconv(o->repo, textconv_two, two, &mf2.ptr);
+			if (ecbdata.ws_rule & WS_BLANK_AT_EOF)
+				check_blank_at_eof(&mf1, &mf2, &ecbdata);
+		} else if (!streamed) {
+			/*
+			 * Line numbers in the window are off by the lines
+			 * before it, less the function header line we put
+			 * in front.
+			 */
+			ecbdata.lno_offset = window.lines;
+			if (window.func.len)
+				ecbdata.lno_offset--;
+			if ((ecbdata.ws_rule & WS_BLANK_AT_EOF) &&
+			    window.suffix_shown == window.suffix) {
+				long off = ecbdata.lno_offset;
+
+				check_blank_at_eof(&mf1, &mf2, &ecbdata);
+				if (ecbdata.blank_at_eof_in_preimage) {
+					ecbdata.blank_at_eof_in_preimage += off;
+					ecbdata.blank_at_eof_in_postimage += off;
+				}
+			}
+		}
+
+		if (streamed <= 0) {
+			if (o->word_diff)
+				init_diff_words_data(&ecbdata, o, one, two);
+			if (xdi_diff_outf(&mf1, &mf2,
+					  streamed ? NULL : fn_out_stream_hunk,
+					  fn_out_consume, &ecbdata, &xpp, &xecfg))
+				die("unable to generate diff for %s", one->path);
+			if (o->word_diff)
+				free_diff_words_data(&ecbdata);
+		}
+		if (!streamed) {
 			free(mf1.ptr);
-		if (textconv_two)
 			free(mf2.ptr);
+		} else if (streamed < 0) {
+			if (textconv_one)
+				free(mf1.ptr);
+			if (textconv_two)
+				free(mf2.ptr);
+		}
+		if (streamed >= 0)
+			strbuf_release(&window.func);
 		xdiff_clear_find_func(&xecfg);
 	}
 
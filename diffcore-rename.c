@@ -412,6 +412,130 @@ static int find_exact_renames(struct diff_options *options)
 	return renames;
 }
 
+static const char *get_basename(const char *filename)
+{
+	const char *base = strrchr(filename, '/');
+	return base ? base + 1 : filename;
+}
+
+/*
+ * Collect the basenames that occur exactly once in "all" into
+ * "unique", with the index of the item as util.
+ */
+static void unique_basenames(struct string_list *all, struct string_list *unique)
+{
+	int i;
+
+	string_list_sort(all);
+	for (i = 0; i < all->nr; i++) {
+		if (i + 1 < all->nr &&
+		    !strcmp(all->items[i].string, all->items[i + 1].string)) {
+			/* skip the whole run of duplicates */
+			const char *dup = all->items[i].string;
+			while (i + 1 < all->nr &&
+			       !strcmp(dup, all->items[i + 1].string))
+				i++;
+			continue;
+		}
+		string_list_append(unique, all->items[i].string)->util =
+			all->items[i].util;
+	}
+}
+
+/*
+ * Pair up the remaining sources and destinations that have the same
+ * basename, when that basename is unique among both the remaining
+ * sources and the remaining destinations. This is what happens when a
+ * directory is moved or renamed, and lets us find those renames by
+ * comparing a single pair of files each, instead of every source with
+ * every destination.
+ *
+ * Since a wrong pairing here is not corrected by the full matrix, the
+ * similarity has to be well above the minimum score: halfway between
+ * it and an exact match.
+ */
+static int find_basename_matches(struct diff_options *options,
+				 int minimum_score)
+{
+	struct string_list all_src = STRING_LIST_INIT_NODUP;
+	struct string_list all_dst = STRING_LIST_INIT_NODUP;
+	struct string_list src = STRING_LIST_INIT_NODUP;
+	struct string_list dst = STRING_LIST_INIT_NODUP;
+	int basename_score = minimum_score + (MAX_SCORE - minimum_score) / 2;
+	int i, j, renames = 0;
+
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if (one->rename_used)
+			continue;
+		string_list_append(&all_src, get_basename(one->path))->util =
+			(void *)(intptr_t)i;
+	}
+	for (i = 0; i < rename_dst_nr; i++) {
+		if (rename_dst[i].pair)
+			continue;
+		string_list_append(&all_dst,
+				   get_basename(rename_dst[i].two->path))->util =
+			(void *)(intptr_t)i;
+	}
+	unique_basenames(&all_src, &src);
+	unique_basenames(&all_dst, &dst);
+
+	for (i = j = 0; i < src.nr && j < dst.nr; ) {
+		int cmp = strcmp(src.items[i].string, dst.items[j].string);
+		int src_index, dst_index, score;
+		struct diff_filespec *one, *two;
+
+		if (cmp < 0) {
+			i++;
+			continue;
+		}
+		if (cmp > 0) {
+			j++;
+			continue;
+		}
+
+		src_index = (intptr_t)src.items[i++].util;
+		dst_index = (intptr_t)dst.items[j++].util;
+		one = rename_src[src_index].p->one;
+		two = rename_dst[dst_index].two;
+
+		score = estimate_similarity(options->repo, one, two,
+					    minimum_score, 0);
+		diff_free_filespec_blob(one);
+		diff_free_filespec_blob(two);
+		if (score < basename_score)
+			continue;
+		record_rename_pair(dst_index, src_index, score);
+		renames++;
+	}
+
+	string_list_clear(&all_src, 0);
+	string_list_clear(&all_dst, 0);
+	string_list_clear(&src, 0);
+	string_list_clear(&dst, 0);
+	return renames;
+}
+
+/*
+ * Without copy detection, a source can only be renamed once. Drop the
+ * sources that have already been used (by exact or basename matches,
+ * or as the remaining half of a broken pair) so that they neither
+ * count against the rename limit nor get compared again.
+ */
+static void remove_used_sources(void)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < rename_src_nr; i++) {
+		if (rename_src[i].p->one->rename_used)
+			continue;
+		rename_src[nr++] = rename_src[i];
+	}
+	rename_src_nr = nr;
+}
+
 #define NUM_CANDIDATE_PER_DST 4
 static void record_if_better(struct diff_score m[], struct diff_score *o)
 {
@@ -576,6 +700,18 @@ void diffcore_rename(struct diff_options *options)
 	if (!num_create)
 		goto cleanup;
 
+	if (detect_rename == DIFF_DETECT_RENAME) {
+		int found = find_basename_matches(options, minimum_score);
+
+		rename_count += found;
+		num_create -= found;
+		if (!num_create)
+			goto cleanup;
+		remove_used_sources();
+		if (!rename_src_nr)
+			goto cleanup;
+	}
+
 	switch (too_many_rename_candidates(num_create, options)) {
 	case 1:
 		goto cleanup;
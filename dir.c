@@ -45,6 +45,9 @@ struct cached_dir {
 	int d_type;
 	const char *file;
 	struct untracked_cache_dir *ucd;
+
+	/* the cached contents are outdated, read the directory next time */
+	int stale;
 };
 
 static enum path_treatment read_directory_recursive(struct dir_struct *dir,
@@ -1420,9 +1423,17 @@ static struct path_pattern *last_matching_pattern_from_lists(
 	for (i = EXC_CMDL; i <= EXC_FILE; i++) {
 		group = &dir->exclude_list_group[i];
 		for (j = group->nr - 1; j >= 0; j--) {
+			struct pattern_list *pl = &group->pl[j];
+
+			if (pl->deferred) {
+				pl->deferred = 0;
+				add_patterns(pl->src, pl->src,
+					     pl->deferred_baselen, pl,
+					     istate, NULL);
+			}
 			pattern = last_matching_pattern_from_list(
 				pathname, pathlen, basename, dtype_p,
-				&group->pl[j], istate);
+				pl, istate);
 			if (pattern)
 				return pattern;
 		}
@@ -1487,6 +1498,7 @@ static void prep_exclude(struct dir_struct *dir,
 	while (current < baselen) {
 		const char *cp;
 		struct oid_stat oid_stat;
+		int trusted;
 
 		stk = xcalloc(1, sizeof(*stk));
 		if (current < 0) {
@@ -1510,8 +1522,22 @@ static void prep_exclude(struct dir_struct *dir,
 		strbuf_add(&dir->basebuf, base + current, stk->baselen - current);
 		assert(stk->baselen == dir->basebuf.len);
 
+		/*
+		 * With fsmonitor, an untracked cache entry that is still
+		 * valid tells us that nothing in the directory changed,
+		 * its .gitignore included. A change to the .gitignore of a
+		 * parent directory, $GIT_DIR/info/exclude or
+		 * core.excludesfile would have invalidated it, too, so the
+		 * directory was not excluded when it was cached and is not
+		 * now, and its .gitignore can wait until a pattern of it is
+		 * needed (i.e. if a subdirectory has to be read again).
+		 */
+		trusted = untracked && untracked->valid &&
+			  dir->untracked->use_fsmonitor &&
+			  istate && istate->fsmonitor_has_run_once;
+
 		/* Abort if the directory is excluded */
-		if (stk->baselen) {
+		if (stk->baselen && !trusted) {
 			int dt = DT_DIR;
 			dir->basebuf.buf[stk->baselen - 1] = 0;
 			dir->pattern = last_matching_pattern_from_lists(dir,
@@ -1557,22 +1583,26 @@ static void prep_exclude(struct dir_struct *dir,
 			strbuf_addbuf(&sb, &dir->basebuf);
 			strbuf_addstr(&sb, dir->exclude_per_dir);
 			pl->src = strbuf_detach(&sb, NULL);
-			add_patterns(pl->src, pl->src, stk->baselen, pl, istate,
-				     untracked ? &oid_stat : NULL);
+			if (trusted) {
+				pl->deferred = 1;
+				pl->deferred_baselen = stk->baselen;
+				oidcpy(&oid_stat.oid, &untracked->exclude_oid);
+			} else
+				add_patterns(pl->src, pl->src, stk->baselen,
+					     pl, istate,
+					     untracked ? &oid_stat : NULL);
 		}
 		/*
-		 * NEEDSWORK: when untracked cache is enabled, prep_exclude()
-		 * will first be called in valid_cached_dir() then maybe many
-		 * times more in last_matching_pattern(). When the cache is
-		 * used, last_matching_pattern() will not be called and
-		 * reading .gitignore content will be a waste.
+		 * NEEDSWORK: without fsmonitor, prep_exclude() will first
+		 * be called in valid_cached_dir() then maybe many times
+		 * more in last_matching_pattern(). When the cache is used,
+		 * last_matching_pattern() will not be called and reading
+		 * .gitignore content will be a waste.
 		 *
 		 * So when it's called by valid_cached_dir() and we can get
 		 * .gitignore SHA-1 from the index (i.e. .gitignore is not
-		 * modified on work tree), we could delay reading the
-		 * .gitignore content until we absolutely need it in
-		 * last_matching_pattern(). Be careful about ignore rule
-		 * order, though, if you do that.
+		 * modified on work tree), we could defer reading the
+		 * .gitignore content as we do with fsmonitor above.
 		 */
 		if (untracked &&
 		    !oideq(&oid_stat.oid, &untracked->exclude_oid)) {
@@ -2104,6 +2134,29 @@ static int resolve_dtype(int dtype, struct index_state *istate,
 	return dtype;
 }
 
+/*
+ * Without DIR_SHOW_OTHER_DIRECTORIES, treat_directory() lists a nested
+ * repository as a whole but recurses into any other untracked
+ * directory. Running "git init" in such a directory (or removing its
+ * .git) does not change the mtime of the parent whose cached contents
+ * we are replaying, so the decision has to be made again. "path" is
+ * the directory name with a trailing slash.
+ */
+static int cached_dir_is_nested_repo(struct dir_struct *dir,
+				     struct index_state *istate,
+				     struct strbuf *path)
+{
+	if (dir->flags & DIR_SHOW_OTHER_DIRECTORIES)
+		return -1;
+	if (!(dir->flags & DIR_SKIP_NESTED_GIT) &&
+	    (dir->flags & DIR_NO_GITLINKS))
+		return -1;
+	if (directory_exists_in_index(istate, path->buf, path->len - 1) !=
+	    index_nonexistent)
+		return -1;
+	return is_nonbare_repository_dir(path);
+}
+
 static enum path_treatment treat_path_fast(struct dir_struct *dir,
 					   struct untracked_cache_dir *untracked,
 					   struct cached_dir *cdir,
@@ -2120,11 +2173,24 @@ static enum path_treatment treat_path_fast(struct dir_struct *dir,
 	strbuf_setlen(path, baselen);
 	if (!cdir->ucd) {
 		strbuf_addstr(path, cdir->file);
+		/* A nested repository that is no longer one */
+		if (ends_with(cdir->file, "/") &&
+		    !cached_dir_is_nested_repo(dir, istate, path)) {
+			cdir->stale = 1;
+			dir->untracked->dir_invalidated++;
+			return path_recurse;
+		}
 		return path_untracked;
 	}
 	strbuf_addstr(path, cdir->ucd->name);
 	/* treat_one_path() does this before it calls treat_directory() */
 	strbuf_complete(path, '/');
+	if (cached_dir_is_nested_repo(dir, istate, path) > 0) {
+		cdir->stale = 1;
+		dir->untracked->dir_invalidated++;
+		return (dir->flags & DIR_SKIP_NESTED_GIT) ?
+			path_none : path_untracked;
+	}
 	if (cdir->ucd->check_only)
 		/*
 		 * check_only is set as a result of treat_directory() getting
@@ -2356,7 +2422,7 @@ static void close_cached_dir(struct cached_dir *cdir)
 	 * entries. Mark it valid.
 	 */
 	if (cdir->untracked) {
-		cdir->untracked->valid = 1;
+		cdir->untracked->valid = !cdir->stale;
 		cdir->untracked->recurse = 1;
 	}
 }
@@ -2632,13 +2698,27 @@ static void set_untracked_ident(struct untracked_cache *uc)
 	strbuf_addch(&uc->ident, 0);
 }
 
-static void new_untracked_cache(struct index_state *istate)
+/*
+ * The flags git-status reads the working tree with, in the mode
+ * configured by status.showUntrackedFiles. The untracked cache is
+ * kept for these flags.
+ */
+static unsigned new_untracked_cache_flags(void)
+{
+	const char *val;
+
+	if (!git_config_get_string_tmp("status.showuntrackedfiles", &val) &&
+	    !strcmp(val, "all"))
+		return 0;
+	return DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES;
+}
+
+static void new_untracked_cache(struct index_state *istate, unsigned flags)
 {
 	struct untracked_cache *uc = xcalloc(1, sizeof(*uc));
 	strbuf_init(&uc->ident, 100);
 	uc->exclude_per_dir = ".gitignore";
-	/* should be the same flags used by git-status */
-	uc->dir_flags = DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES;
+	uc->dir_flags = flags;
 	set_untracked_ident(uc);
 	istate->untracked = uc;
 	istate->cache_changed |= UNTRACKED_CHANGED;
@@ -2647,11 +2727,11 @@ static void new_untracked_cache(struct index_state *istate)
 void add_untracked_cache(struct index_state *istate)
 {
 	if (!istate->untracked) {
-		new_untracked_cache(istate);
+		new_untracked_cache(istate, new_untracked_cache_flags());
 	} else {
 		if (!ident_in_untracked(istate->untracked)) {
 			free_untracked_cache(istate->untracked);
-			new_untracked_cache(istate);
+			new_untracked_cache(istate, new_untracked_cache_flags());
 		}
 	}
 }
@@ -2666,6 +2746,7 @@ void remove_untracked_cache(struct index_state *istate)
 }
 
 static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *dir,
+						      struct index_state *istate,
 						      int base_len,
 						      const struct pathspec *pathspec)
 {
@@ -2698,17 +2779,9 @@ static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *d
 	if (base_len || (pathspec && pathspec->nr))
 		return NULL;
 
-	/* Different set of flags may produce different results */
-	if (dir->flags != dir->untracked->dir_flags ||
-	    /*
-	     * See treat_directory(), case index_nonexistent. Without
-	     * this flag, we may need to also cache .git file content
-	     * for the resolve_gitlink_ref() call, which we don't.
-	     */
-	    !(dir->flags & DIR_SHOW_OTHER_DIRECTORIES) ||
-	    /* We don't support collecting ignore files */
-	    (dir->flags & (DIR_SHOW_IGNORED | DIR_SHOW_IGNORED_TOO |
-			   DIR_COLLECT_IGNORED)))
+	/* We don't support collecting ignore files */
+	if (dir->flags & (DIR_SHOW_IGNORED | DIR_SHOW_IGNORED_TOO |
+			  DIR_COLLECT_IGNORED))
 		return NULL;
 
 	/*
@@ -2731,6 +2804,24 @@ static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *d
 		return NULL;
 	}
 
+	/*
+	 * Different set of flags may produce different results, e.g.
+	 * "git status -uall" lists the files in untracked directories
+	 * where "git status" only lists the directories. The cache is
+	 * kept for the flags status.showUntrackedFiles asks for: if it
+	 * was made for others (that setting changed), start over with
+	 * the flags of this run, and otherwise do without it for this
+	 * run.
+	 */
+	if (dir->flags != dir->untracked->dir_flags) {
+		if (dir->untracked != istate->untracked ||
+		    dir->flags != new_untracked_cache_flags())
+			return NULL;
+		free_untracked_cache(istate->untracked);
+		new_untracked_cache(istate, dir->flags);
+		dir->untracked = istate->untracked;
+	}
+
 	if (!dir->untracked->root) {
 		const int len = sizeof(*dir->untracked->root);
 		dir->untracked->root = xmalloc(len);
@@ -2767,7 +2858,7 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		return dir->nr;
 	}
 
-	untracked = validate_untracked_cache(dir, len, pathspec);
+	untracked = validate_untracked_cache(dir, istate, len, pathspec);
 	if (!untracked)
 		/*
 		 * make sure untracked cache code path is disabled,
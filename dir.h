@@ -94,6 +94,15 @@ struct pattern_list {
 	/* origin of list, e.g. path to filename, or descriptive string */
 	const char *src;
 
+	/*
+	 * A per-directory exclude file that the untracked cache knows to
+	 * be unchanged is only read when its patterns are first needed;
+	 * until then "deferred" is set, and "src" is the file to read,
+	 * with its base being the first "deferred_baselen" bytes.
+	 */
+	unsigned deferred;
+	int deferred_baselen;
+
 	struct path_pattern **patterns;
 
 	/*
@@ -191,7 +200,9 @@ struct untracked_cache {
 	struct strbuf ident;
 	/*
 	 * dir_struct#flags must match dir_flags or the untracked
-	 * cache is ignored.
+	 * cache is ignored (or, if they are the flags that
+	 * status.showUntrackedFiles asks for, thrown away and made
+	 * again for them).
 	 */
 	unsigned dir_flags;
 	struct untracked_cache_dir *root;
@@ -0,0 +1,90 @@
+#include "cache.h"
+#include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
+#include "unix-socket.h"
+
+#ifdef HAVE_FSMONITOR_DAEMON_BACKEND
+
+int fsmonitor_ipc__is_supported(void)
+{
+	return 1;
+}
+
+const char *fsmonitor_ipc__get_path(void)
+{
+	static char *path;
+
+	if (!path)
+		path = git_pathdup("fsmonitor--daemon.ipc");
+	return path;
+}
+
+int fsmonitor_ipc__send_command(const char *command, struct strbuf *answer)
+{
+	int fd = unix_stream_connect(fsmonitor_ipc__get_path());
+
+	if (fd < 0)
+		return -1;
+
+	if (write_in_full(fd, command, strlen(command)) < 0 ||
+	    write_in_full(fd, "\n", 1) < 0) {
+		int saved_errno = errno;
+
+		close(fd);
+		errno = saved_errno;
+		return -1;
+	}
+	shutdown(fd, SHUT_WR);
+
+	if (strbuf_read(answer, fd, 0) < 0 && errno != ECONNRESET) {
+		int saved_errno = errno;
+
+		close(fd);
+		errno = saved_errno;
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+int fsmonitor_ipc__send_query(const char *since_token, struct strbuf *answer)
+{
+	struct strbuf command = STRBUF_INIT;
+	int ret;
+
+	strbuf_addf(&command, "query %s", since_token ? since_token : "");
+	ret = fsmonitor_ipc__send_command(command.buf, answer);
+	strbuf_release(&command);
+
+	if (ret)
+		trace_printf_key(&trace_fsmonitor,
+				 "fsmonitor--daemon is not running: %s",
+				 strerror(errno));
+	return ret;
+}
+
+#else
+
+int fsmonitor_ipc__is_supported(void)
+{
+	return 0;
+}
+
+const char *fsmonitor_ipc__get_path(void)
+{
+	return NULL;
+}
+
+int fsmonitor_ipc__send_command(const char *command, struct strbuf *answer)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int fsmonitor_ipc__send_query(const char *since_token, struct strbuf *answer)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif /* HAVE_FSMONITOR_DAEMON_BACKEND */
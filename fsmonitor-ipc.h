@@ -0,0 +1,30 @@
+#ifndef FSMONITOR_IPC_H
+#define FSMONITOR_IPC_H
+
+/*
+ * Talking to the builtin filesystem monitor daemon
+ * (git-fsmonitor--daemon), which listens on a Unix socket in the
+ * repository's (per-worktree) git directory.
+ *
+ * A request is a single line of text; the daemon answers and closes
+ * the connection. A "query <token>" is answered like version 2 of the
+ * fsmonitor hook: a new token, then the NUL-separated list of paths
+ * that changed since <token> (or "/" if that is not known).
+ */
+
+/* Whether this build of Git has the daemon at all. */
+int fsmonitor_ipc__is_supported(void);
+
+/* The path of the daemon's socket for the current repository. */
+const char *fsmonitor_ipc__get_path(void);
+
+/*
+ * Send a request to the daemon and collect its answer. Returns -1 if
+ * the daemon cannot be reached (errno is set), 0 otherwise.
+ */
+int fsmonitor_ipc__send_command(const char *command, struct strbuf *answer);
+
+/* Ask the daemon what changed since "since_token". */
+int fsmonitor_ipc__send_query(const char *since_token, struct strbuf *answer);
+
+#endif /* FSMONITOR_IPC_H */
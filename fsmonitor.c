@@ -3,6 +3,7 @@
 #include "dir.h"
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
 #include "run-command.h"
 #include "strbuf.h"
 
@@ -157,11 +158,25 @@ static int query_fsmonitor(int version, const char *last_update, struct strbuf *
 
 static void fsmonitor_refresh_callback(struct index_state *istate, const char *name)
 {
-	int pos = index_name_pos(istate, name, strlen(name));
+	int len = strlen(name);
+	int pos = index_name_pos(istate, name, len);
 
 	if (pos >= 0) {
 		struct cache_entry *ce = istate->cache[pos];
 		ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	} else if (len && name[len - 1] == '/') {
+		/*
+		 * A directory appeared, disappeared or was moved: everything
+		 * below it may have changed.
+		 */
+		for (pos = -pos - 1; pos < istate->cache_nr; pos++) {
+			struct cache_entry *ce = istate->cache[pos];
+
+			if (strncmp(ce->name, name, len))
+				break;
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+		}
+		len--;
 	}
 
 	/*
@@ -169,7 +184,14 @@ static void fsmonitor_refresh_callback(struct index_state *istate, const char *n
 	 * as it could be a new untracked file.
 	 */
 	trace_printf_key(&trace_fsmonitor, "fsmonitor_refresh_callback '%s'", name);
-	untracked_cache_invalidate_path(istate, name, 0);
+	if (len == strlen(name)) {
+		untracked_cache_invalidate_path(istate, name, 0);
+	} else {
+		char *dir = xmemdupz(name, len);
+
+		untracked_cache_invalidate_path(istate, dir, 0);
+		free(dir);
+	}
 }
 
 void refresh_fsmonitor(struct index_state *istate)
@@ -185,7 +207,8 @@ void refresh_fsmonitor(struct index_state *istate)
 	if (!core_fsmonitor || istate->fsmonitor_has_run_once)
 		return;
 
-	hook_version = fsmonitor_hook_version();
+	if (!core_use_builtin_fsmonitor)
+		hook_version = fsmonitor_hook_version();
 
 	istate->fsmonitor_has_run_once = 1;
 
@@ -203,7 +226,34 @@ void refresh_fsmonitor(struct index_state *istate)
 	 * changes since that token, else assume everything is possibly dirty
 	 * and check it all.
 	 */
-	if (istate->fsmonitor_last_update) {
+	if (istate->fsmonitor_last_update && core_use_builtin_fsmonitor) {
+		query_success = !fsmonitor_ipc__send_query(
+			istate->fsmonitor_last_update, &query_result);
+
+		if (query_success) {
+			/* Same format as version 2 of the hook interface */
+			strbuf_addstr(&last_update_token, query_result.buf);
+			if (!last_update_token.len) {
+				warning("Empty last update token.");
+				query_success = 0;
+			} else {
+				bol = last_update_token.len + 1;
+			}
+		}
+		if (!query_success) {
+			/*
+			 * The daemon does not know about the timestamp, and
+			 * will answer with "everything" when asked about it
+			 * once it is running again.
+			 */
+			strbuf_reset(&last_update_token);
+			strbuf_addf(&last_update_token, "%"PRIu64"", last_update);
+		}
+
+		trace_performance_since(last_update, "fsmonitor--daemon query");
+		trace_printf_key(&trace_fsmonitor, "fsmonitor--daemon query returned %s",
+			query_success ? "success" : "failure");
+	} else if (istate->fsmonitor_last_update) {
 		if (hook_version == -1 || hook_version == HOOK_INTERFACE_VERSION2) {
 			query_success = !query_fsmonitor(HOOK_INTERFACE_VERSION2,
 				istate->fsmonitor_last_update, &query_result);
@@ -868,6 +868,19 @@ FILE *xfopen(const char *path, const char *mode);
 FILE *xfdopen(int fd, const char *mode);
 int xmkstemp(char *temp_filename);
 int xmkstemp_mode(char *temp_filename, int mode);
+
+enum fsync_action {
+	/* write the data out of our cache, but do not flush the disk's */
+	FSYNC_WRITEOUT_ONLY,
+	/* make the data durable, i.e. plain fsync() */
+	FSYNC_HARDWARE_FLUSH
+};
+
+/*
+ * Returns 0 on success, or -1 with errno set; ENOSYS means that the
+ * platform cannot do the requested action.
+ */
+int git_fsync(int fd, enum fsync_action action);
 char *xgetcwd(void);
 FILE *fopen_for_writing(const char *path);
 FILE *fopen_or_warn(const char *path, const char *mode);
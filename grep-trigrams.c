@@ -0,0 +1,504 @@
+#include "cache.h"
+#include "repository.h"
+#include "object-store.h"
+#include "grep.h"
+#include "grep-trigrams.h"
+#include "lockfile.h"
+#include "csum-file.h"
+#include "thread-utils.h"
+
+/*
+ * The file consists of
+ *
+ *   - a 12-byte header: the signature "GTRI", a version byte, the
+ *     hash function id, two reserved bytes and the number N of blobs;
+ *   - the N blob object names in sorted order;
+ *   - N 4-byte network order offsets, each the end of the bitmap of
+ *     the corresponding blob in the bitmap data;
+ *   - the bitmap data;
+ *   - a trailing checksum.
+ *
+ * A bitmap has a power-of-two size between BITMAP_MIN and BITMAP_MAX
+ * bytes, and a bit set for trigram_hash() of every trigram of the blob,
+ * modulo the number of bits. An empty bitmap means that the blob has
+ * too many different trigrams for a bitmap to be useful.
+ */
+#define GREP_TRIGRAMS_SIGNATURE 0x47545249 /* "GTRI" */
+#define GREP_TRIGRAMS_VERSION 1
+#define GREP_TRIGRAMS_HEADER_SIZE 12
+
+#define BITMAP_MIN 64
+#define BITMAP_MAX 2048
+
+/* Do not hold on to more new bitmaps than this during one search. */
+#define MAX_ADDED_BYTES (64 * 1024 * 1024)
+
+struct trigram_bitmap {
+	struct object_id oid;
+	const unsigned char *bits;
+	uint32_t len;
+};
+
+struct grep_trigrams {
+	char *filename;
+
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t nr;
+	const unsigned char *oids;
+	const unsigned char *offsets;
+	const unsigned char *bitmaps;
+	size_t bitmaps_len;
+
+	pthread_mutex_t mutex;
+	struct trigram_bitmap *added;
+	size_t added_nr, added_alloc, added_bytes;
+};
+
+struct trigram_alternative {
+	uint32_t *hash;
+	size_t nr, alloc;
+};
+
+struct grep_trigram_query {
+	struct trigram_alternative *alt;
+	size_t nr, alloc;
+};
+
+static uint32_t trigram_hash(unsigned char a, unsigned char b, unsigned char c)
+{
+	uint32_t v = (tolower(a) << 16) | (tolower(b) << 8) | tolower(c);
+
+	/* 14 bits, enough for BITMAP_MAX bytes */
+	return (v * 0x9e3779b1) >> 18;
+}
+
+static void add_run(struct trigram_alternative *alt, const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 2 < len; i++) {
+		ALLOC_GROW(alt->hash, alt->nr + 1, alt->alloc);
+		alt->hash[alt->nr++] = trigram_hash(s[i], s[i + 1], s[i + 2]);
+	}
+}
+
+static size_t skip_bracket(const char *s, size_t len, size_t i)
+{
+	i++;
+	if (i < len && s[i] == '^')
+		i++;
+	if (i < len && s[i] == ']')
+		i++;
+	while (i < len && s[i] != ']') {
+		if (s[i] == '[' && i + 1 < len &&
+		    (s[i + 1] == ':' || s[i + 1] == '.' || s[i + 1] == '=')) {
+			char delim = s[i + 1];
+
+			/* [:class:], [.coll.] or [=equiv=] */
+			for (i += 2; i + 1 < len; i++)
+				if (s[i] == delim && s[i + 1] == ']')
+					break;
+			i += 2;
+			continue;
+		}
+		i++;
+	}
+	return i;
+}
+
+/*
+ * Collect the trigrams of the literal runs of the pattern that every
+ * match must contain. This errs on the side of collecting too little:
+ * what looks like a quantifier takes the preceding character out of
+ * the run, and patterns with escapes, groups or alternatives are not
+ * looked into at all.
+ */
+static int pattern_trigrams(const struct grep_opt *opt,
+			    const struct grep_pat *p,
+			    struct trigram_alternative *alt)
+{
+	const char *s = p->pattern;
+	size_t len = p->patternlen, start = 0, i;
+
+	if (!opt->fixed && memchr(s, '\\', len))
+		return -1;
+
+	for (i = 0; i < len; i++) {
+		unsigned char c = s[i];
+
+		/*
+		 * Line endings may differ between a blob and its
+		 * working tree file, and case-insensitive matching may
+		 * match these with non-ASCII characters (e.g. "k" with
+		 * the Kelvin sign).
+		 */
+		if (c == '\r' || c == '\n' ||
+		    (opt->ignore_case &&
+		     (c >= 0x80 || tolower(c) == 'k' || tolower(c) == 's'))) {
+			add_run(alt, s + start, i - start);
+			start = i + 1;
+			continue;
+		}
+		if (opt->fixed)
+			continue;
+
+		switch (c) {
+		case '|':
+		case '(':
+		case ')':
+			return -1;
+		case '*':
+		case '?':
+		case '+':
+		case '{':
+			if (i > start)
+				add_run(alt, s + start, i - 1 - start);
+			if (c == '{') {
+				while (i < len && s[i] != '}')
+					i++;
+				if (i == len)
+					return -1;
+			}
+			start = i + 1;
+			break;
+		case '[':
+			add_run(alt, s + start, i - start);
+			i = skip_bracket(s, len, i);
+			if (i >= len)
+				return -1;
+			start = i + 1;
+			break;
+		case '.':
+		case '^':
+		case '$':
+			add_run(alt, s + start, i - start);
+			start = i + 1;
+			break;
+		}
+	}
+	add_run(alt, s + start, len - start);
+	return alt->nr ? 0 : -1;
+}
+
+struct grep_trigram_query *grep_trigram_query_new(const struct grep_opt *opt)
+{
+	struct grep_trigram_query *q;
+	struct grep_pat *p;
+
+	if (opt->invert || opt->unmatch_name_only || opt->all_match ||
+	    opt->allow_textconv || !opt->pattern_list)
+		return NULL;
+
+	q = xcalloc(1, sizeof(*q));
+	for (p = opt->pattern_list; p; p = p->next) {
+		struct trigram_alternative *alt;
+
+		if (p->token != GREP_PATTERN)
+			goto fail;
+		ALLOC_GROW(q->alt, q->nr + 1, q->alloc);
+		alt = &q->alt[q->nr++];
+		memset(alt, 0, sizeof(*alt));
+		if (pattern_trigrams(opt, p, alt))
+			goto fail;
+	}
+	return q;
+
+fail:
+	grep_trigram_query_free(q);
+	return NULL;
+}
+
+void grep_trigram_query_free(struct grep_trigram_query *q)
+{
+	size_t i;
+
+	if (!q)
+		return;
+	for (i = 0; i < q->nr; i++)
+		free(q->alt[i].hash);
+	free(q->alt);
+	free(q);
+}
+
+static int load_trigrams_file(struct grep_trigrams *gt)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+	struct stat st;
+	size_t tables;
+	int fd;
+
+	fd = git_open(gt->filename);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) ||
+	    xsize_t(st.st_size) < GREP_TRIGRAMS_HEADER_SIZE + rawsz) {
+		close(fd);
+		return -1;
+	}
+	gt->data_len = xsize_t(st.st_size);
+	gt->data = xmmap(NULL, gt->data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(gt->data) != GREP_TRIGRAMS_SIGNATURE ||
+	    gt->data[4] != GREP_TRIGRAMS_VERSION ||
+	    gt->data[5] != hash_algo_by_ptr(the_hash_algo))
+		goto fail;
+
+	gt->nr = get_be32(gt->data + 8);
+	tables = st_mult(gt->nr, rawsz + 4);
+	if (gt->data_len - GREP_TRIGRAMS_HEADER_SIZE - rawsz < tables)
+		goto fail;
+	gt->oids = gt->data + GREP_TRIGRAMS_HEADER_SIZE;
+	gt->offsets = gt->oids + st_mult(gt->nr, rawsz);
+	gt->bitmaps = gt->offsets + st_mult(gt->nr, 4);
+	gt->bitmaps_len = gt->data_len - GREP_TRIGRAMS_HEADER_SIZE - rawsz - tables;
+	if (gt->nr &&
+	    get_be32(gt->offsets + st_mult(gt->nr - 1, 4)) != gt->bitmaps_len)
+		goto fail;
+	return 0;
+
+fail:
+	munmap((void *)gt->data, gt->data_len);
+	gt->data = NULL;
+	gt->data_len = 0;
+	gt->nr = 0;
+	return -1;
+}
+
+struct grep_trigrams *grep_trigrams_load(struct repository *r)
+{
+	struct grep_trigrams *gt = xcalloc(1, sizeof(*gt));
+
+	gt->filename = xstrfmt("%s/info/grep-trigrams", r->objects->odb->path);
+	load_trigrams_file(gt);
+	pthread_mutex_init(&gt->mutex, NULL);
+	return gt;
+}
+
+static int find_blob(struct grep_trigrams *gt, const struct object_id *oid,
+		     uint32_t *pos)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+	uint32_t lo = 0, hi = gt->nr;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		int cmp = hashcmp(oid->hash, gt->oids + st_mult(mid, rawsz));
+
+		if (!cmp) {
+			*pos = mid;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	*pos = lo;
+	return 0;
+}
+
+static int bitmap_has(const unsigned char *bits, uint32_t len, uint32_t hash)
+{
+	hash &= len * 8 - 1;
+	return bits[hash >> 3] & (1 << (hash & 7));
+}
+
+int grep_trigrams_check(struct grep_trigrams *gt,
+			const struct grep_trigram_query *q,
+			const struct object_id *oid)
+{
+	const unsigned char *bits;
+	uint32_t pos, start, end, len;
+	size_t i, j;
+
+	if (!find_blob(gt, oid, &pos))
+		return -1;
+
+	start = pos ? get_be32(gt->offsets + st_mult(pos - 1, 4)) : 0;
+	end = get_be32(gt->offsets + st_mult(pos, 4));
+	if (end < start || end > gt->bitmaps_len)
+		return 1;
+	len = end - start;
+	if (len < BITMAP_MIN || len > BITMAP_MAX || (len & (len - 1)))
+		return 1;
+	bits = gt->bitmaps + start;
+
+	for (i = 0; i < q->nr; i++) {
+		const struct trigram_alternative *alt = &q->alt[i];
+
+		for (j = 0; j < alt->nr; j++)
+			if (!bitmap_has(bits, len, alt->hash[j]))
+				break;
+		if (j == alt->nr)
+			return 1;
+	}
+	return 0;
+}
+
+static unsigned popcount(const unsigned char *bits, uint32_t len)
+{
+	unsigned n = 0;
+	uint32_t i;
+
+	for (i = 0; i < len; i++) {
+		unsigned char c = bits[i];
+
+		for (; c; c &= c - 1)
+			n++;
+	}
+	return n;
+}
+
+void grep_trigrams_add(struct grep_trigrams *gt, const struct object_id *oid,
+		       const char *buf, unsigned long size)
+{
+	unsigned char bits[BITMAP_MAX], folded[BITMAP_MAX / 2];
+	uint32_t len = BITMAP_MAX;
+	unsigned long i;
+	struct trigram_bitmap *b;
+
+	memset(bits, 0, sizeof(bits));
+	for (i = 0; i + 2 < size; i++) {
+		uint32_t hash = trigram_hash(buf[i], buf[i + 1], buf[i + 2]);
+		bits[hash >> 3] |= 1 << (hash & 7);
+	}
+
+	/*
+	 * Fold the bitmap in half as long as at most a quarter of the
+	 * bits end up set; give up on blobs that set more than half of
+	 * the bits of the largest bitmap.
+	 */
+	if (popcount(bits, len) * 2 > len * 8) {
+		len = 0;
+	} else {
+		while (len > BITMAP_MIN) {
+			uint32_t half = len / 2;
+
+			for (i = 0; i < half; i++)
+				folded[i] = bits[i] | bits[i + half];
+			if (popcount(folded, half) * 4 > half * 8)
+				break;
+			memcpy(bits, folded, half);
+			len = half;
+		}
+	}
+
+	pthread_mutex_lock(&gt->mutex);
+	if (gt->added_bytes + len <= MAX_ADDED_BYTES) {
+		ALLOC_GROW(gt->added, gt->added_nr + 1, gt->added_alloc);
+		b = &gt->added[gt->added_nr++];
+		oidcpy(&b->oid, oid);
+		b->bits = xmemdupz(bits, len);
+		b->len = len;
+		gt->added_bytes += len;
+	}
+	pthread_mutex_unlock(&gt->mutex);
+}
+
+static int compare_bitmaps(const void *a_, const void *b_)
+{
+	const struct trigram_bitmap *a = a_, *b = b_;
+
+	return oidcmp(&a->oid, &b->oid);
+}
+
+static void write_trigrams_file(struct grep_trigrams *gt)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+	struct trigram_bitmap *all = NULL;
+	size_t all_nr = 0, all_alloc = 0, i, j;
+	uint64_t total;
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	uint32_t offset;
+	unsigned char reserved[2] = { 0, 0 };
+
+	QSORT(gt->added, gt->added_nr, compare_bitmaps);
+
+	/* merge what is already on disk with the new bitmaps */
+	for (i = j = 0; i < gt->nr || j < gt->added_nr; ) {
+		struct trigram_bitmap *b;
+		int cmp;
+
+		if (i == gt->nr)
+			cmp = 1;
+		else if (j == gt->added_nr)
+			cmp = -1;
+		else
+			cmp = hashcmp(gt->oids + st_mult(i, rawsz),
+				      gt->added[j].oid.hash);
+
+		ALLOC_GROW(all, all_nr + 1, all_alloc);
+		b = &all[all_nr];
+		if (cmp <= 0) {
+			uint32_t start, end;
+
+			start = i ? get_be32(gt->offsets + st_mult(i - 1, 4)) : 0;
+			end = get_be32(gt->offsets + st_mult(i, 4));
+			if (end < start || end > gt->bitmaps_len)
+				goto out;
+			hashcpy(b->oid.hash, gt->oids + st_mult(i, rawsz));
+			b->bits = gt->bitmaps + start;
+			b->len = end - start;
+			i++;
+			if (!cmp)
+				j++;
+		} else {
+			*b = gt->added[j++];
+			/* the same blob may have been added more than once */
+			if (all_nr && oideq(&all[all_nr - 1].oid, &b->oid))
+				continue;
+		}
+		all_nr++;
+	}
+	for (i = total = 0; i < all_nr; i++)
+		total += all[i].len;
+	if (all_nr > UINT32_MAX || total > UINT32_MAX)
+		goto out;
+
+	if (safe_create_leading_directories_const(gt->filename) ||
+	    hold_lock_file_for_update(&lk, gt->filename, 0) < 0)
+		goto out;
+
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	hashwrite_be32(f, GREP_TRIGRAMS_SIGNATURE);
+	hashwrite_u8(f, GREP_TRIGRAMS_VERSION);
+	hashwrite_u8(f, hash_algo_by_ptr(the_hash_algo));
+	hashwrite(f, reserved, sizeof(reserved));
+	hashwrite_be32(f, all_nr);
+	for (i = 0; i < all_nr; i++)
+		hashwrite(f, all[i].oid.hash, rawsz);
+	for (i = offset = 0; i < all_nr; i++) {
+		offset += all[i].len;
+		hashwrite_be32(f, offset);
+	}
+	for (i = 0; i < all_nr; i++)
+		hashwrite(f, all[i].bits, all[i].len);
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM);
+	commit_lock_file(&lk);
+
+out:
+	free(all);
+}
+
+void grep_trigrams_write_and_free(struct grep_trigrams *gt)
+{
+	size_t i;
+
+	if (!gt)
+		return;
+
+	if (gt->added_nr)
+		write_trigrams_file(gt);
+
+	for (i = 0; i < gt->added_nr; i++)
+		free((void *)gt->added[i].bits);
+	free(gt->added);
+	if (gt->data)
+		munmap((void *)gt->data, gt->data_len);
+	pthread_mutex_destroy(&gt->mutex);
+	free(gt->filename);
+	free(gt);
+}
@@ -0,0 +1,51 @@
+#ifndef GREP_TRIGRAMS_H
+#define GREP_TRIGRAMS_H
+
+#include "hash.h"
+
+struct repository;
+struct grep_opt;
+
+/*
+ * The trigram index remembers, for each blob "git grep" has searched,
+ * which three-byte sequences occur in it, as a small bitmap that may
+ * have false positives but no false negatives. A later search for a
+ * pattern that needs certain literal strings can skip the blobs that
+ * cannot contain them without reading them.
+ *
+ * The index lives in $GIT_DIR/objects/info/grep-trigrams and is keyed
+ * by blob object name; it is extended by every search that reads
+ * blobs it does not know yet. It can be removed at any time.
+ */
+struct grep_trigrams;
+
+/*
+ * The literal strings the patterns of "opt" require. NULL if the
+ * patterns are not simple enough to tell, in which case the index is
+ * of no use.
+ */
+struct grep_trigram_query;
+struct grep_trigram_query *grep_trigram_query_new(const struct grep_opt *opt);
+void grep_trigram_query_free(struct grep_trigram_query *q);
+
+struct grep_trigrams *grep_trigrams_load(struct repository *r);
+
+/*
+ * Returns 0 if the blob "oid" cannot match the query, 1 if it may,
+ * and -1 if the blob is not in the index.
+ */
+int grep_trigrams_check(struct grep_trigrams *gt,
+			const struct grep_trigram_query *q,
+			const struct object_id *oid);
+
+/*
+ * Remember the trigrams of the blob "oid", whose contents are "buf".
+ * This may be called from several threads at once.
+ */
+void grep_trigrams_add(struct grep_trigrams *gt, const struct object_id *oid,
+		       const char *buf, unsigned long size);
+
+/* Write out the blobs that were added, if any, and free "gt". */
+void grep_trigrams_write_and_free(struct grep_trigrams *gt);
+
+#endif /* GREP_TRIGRAMS_H */
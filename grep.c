@@ -1528,18 +1528,6 @@ int grep_use_locks;
  */
 pthread_mutex_t grep_attr_mutex;
 
-static inline void grep_attr_lock(void)
-{
-	if (grep_use_locks)
-		pthread_mutex_lock(&grep_attr_mutex);
-}
-
-static inline void grep_attr_unlock(void)
-{
-	if (grep_use_locks)
-		pthread_mutex_unlock(&grep_attr_mutex);
-}
-
 static int match_funcname(struct grep_opt *opt, struct grep_source *gs, char *bol, char *eol)
 {
 	xdemitconf_t *xecfg = opt->priv;
@@ -221,4 +221,16 @@ int grep_threads_ok(const struct grep_opt *opt);
 extern int grep_use_locks;
 extern pthread_mutex_t grep_attr_mutex;
 
+static inline void grep_attr_lock(void)
+{
+	if (grep_use_locks)
+		pthread_mutex_lock(&grep_attr_mutex);
+}
+
+static inline void grep_attr_unlock(void)
+{
+	if (grep_use_locks)
+		pthread_mutex_unlock(&grep_attr_mutex);
+}
+
 #endif
@@ -0,0 +1,1934 @@
+/*
+ * "Ostensibly Recursive's Twin" merge strategy, or "ort" for short.
+ *
+ * Like merge-recursive, this performs a three-way merge with rename
+ * detection and recursive consolidation of multiple merge bases. The
+ * difference is that the whole merge is computed on trees in memory:
+ * the per-path information is collected by walking the three trees in
+ * parallel, conflicts are resolved into new blobs and trees that are
+ * written to the object store, and the index and working tree are
+ * only touched once, by merge_switch_to_result(), after the result is
+ * known.
+ *
+ * Directory renames are detected and applied as merge-recursive does,
+ * following merge.directoryRenames, and conflicts are recorded in the
+ * index with the same stages.
+ */
+#include "cache.h"
+#include "merge-ort.h"
+
+#include "alloc.h"
+#include "blob.h"
+#include "commit.h"
+#include "commit-reach.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "ll-merge.h"
+#include "object-store.h"
+#include "submodule.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "unpack-trees.h"
+#include "xdiff-interface.h"
+
+/* Indices of the three versions of a path */
+#define MERGE_BASE 0
+#define MERGE_SIDE1 1
+#define MERGE_SIDE2 2
+
+struct version_info {
+	struct object_id oid;
+	unsigned short mode; /* 0 if the path does not exist */
+};
+
+/*
+ * Everything we know about a path that is not trivially resolved: its
+ * version in the merge base and on both sides, and, once processed,
+ * the merged result and the stages to record in the index if the
+ * merge of this path is not clean.
+ */
+struct merged_path {
+	struct hashmap_entry ent;
+
+	struct version_info stages[3];
+	/* Path each version was found at (differs if it was renamed) */
+	const char *pathnames[3];
+	/* Which of the three trees have a directory at this path */
+	unsigned dirmask;
+
+	struct version_info result; /* mode 0 if the path is deleted */
+	struct version_info conflict[3];
+	/*
+	 * Where the conflict stages go in the index, if not at "path":
+	 * like merge-recursive, a file moved aside for a directory is
+	 * recorded at its original path.
+	 */
+	const char *index_path;
+	/*
+	 * Set to the side that added the path if it is to be recorded
+	 * as unmerged even when its contents merge cleanly, so that the
+	 * user confirms where a directory rename put it.
+	 */
+	unsigned location_side:2;
+
+	unsigned processed:1,
+		 clean:1;
+	struct strbuf messages;
+	char path[FLEX_ARRAY];
+};
+
+/*
+ * Renames found on one side of a merge, as a sorted list of source
+ * paths with the destination path as util.
+ */
+struct rename_info {
+	struct string_list pairs;
+};
+
+/*
+ * The renames found on side1 of the last merge of a sequence of
+ * picks, together with what is needed to tell whether they are still
+ * valid for the next one: the next merge must use the side2 tree of
+ * this one as merge base and its result as side1.
+ */
+struct rename_cache {
+	struct object_id side2;
+	struct object_id result;
+	struct string_list renames;
+};
+
+struct merge_ort_state {
+	struct merge_options *opt;
+	int call_depth;
+
+	/* Paths that are not trivially resolved; struct merged_path */
+	struct hashmap paths;
+	/*
+	 * Paths (blobs or whole directories) that are the same in all
+	 * three trees; util is a struct version_info.
+	 */
+	struct string_list unchanged;
+
+	struct rename_info renames[3];
+	struct rename_cache cache;
+
+	/* Output that is not about a specific path */
+	struct strbuf messages;
+	int needed_rename_limit;
+};
+
+static int merged_path_cmp(const void *unused_cmp_data,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *keydata)
+{
+	const struct merged_path *a, *b;
+
+	a = container_of(eptr, const struct merged_path, ent);
+	b = container_of(entry_or_key, const struct merged_path, ent);
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static struct merged_path *get_path(struct merge_ort_state *st,
+				    const char *path)
+{
+	return hashmap_get_entry_from_hash(&st->paths, strhash(path), path,
+					   struct merged_path, ent);
+}
+
+static struct merged_path *add_path(struct merge_ort_state *st,
+				    const char *path)
+{
+	struct merged_path *e = get_path(st, path);
+	int i;
+
+	if (e)
+		return e;
+	FLEX_ALLOC_STR(e, path, path);
+	hashmap_entry_init(&e->ent, strhash(path));
+	for (i = 0; i < 3; i++)
+		e->pathnames[i] = e->path;
+	e->clean = 1;
+	strbuf_init(&e->messages, 0);
+	hashmap_add(&st->paths, &e->ent);
+	return e;
+}
+
+static int show(struct merge_ort_state *st, int v)
+{
+	return (!st->call_depth && st->opt->verbosity >= v) ||
+		st->opt->verbosity >= 5;
+}
+
+__attribute__((format (printf, 3, 4)))
+static void global_msg(struct merge_ort_state *st, int v, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!show(st, v))
+		return;
+	strbuf_addchars(&st->messages, ' ', st->call_depth * 2);
+	va_start(ap, fmt);
+	strbuf_vaddf(&st->messages, fmt, ap);
+	va_end(ap);
+	strbuf_addch(&st->messages, '\n');
+}
+
+__attribute__((format (printf, 4, 5)))
+static void path_msg(struct merge_ort_state *st, struct merged_path *e,
+		     int v, const char *fmt, ...)
+{
+	struct strbuf *sb = st->call_depth ? &st->messages : &e->messages;
+	va_list ap;
+
+	if (!show(st, v))
+		return;
+	strbuf_addchars(sb, ' ', st->call_depth * 2);
+	va_start(ap, fmt);
+	strbuf_vaddf(sb, fmt, ap);
+	va_end(ap);
+	strbuf_addch(sb, '\n');
+}
+
+static const char *side_name(struct merge_ort_state *st, int side)
+{
+	return side == MERGE_SIDE1 ? st->opt->branch1 : st->opt->branch2;
+}
+
+static int version_eq(const struct version_info *a,
+		      const struct version_info *b)
+{
+	return a->mode == b->mode && (!a->mode || oideq(&a->oid, &b->oid));
+}
+
+static void set_version(struct version_info *vi, const struct name_entry *n)
+{
+	oidcpy(&vi->oid, &n->oid);
+	vi->mode = n->mode;
+}
+
+/*** Collecting the paths of the three trees ***/
+
+static int collect_merge_info(struct merge_ort_state *st,
+			      struct traverse_info *info,
+			      struct tree_desc *t);
+
+static int collect_merge_info_callback(int n,
+				       unsigned long mask,
+				       unsigned long dirmask,
+				       struct name_entry *names,
+				       struct traverse_info *info)
+{
+	struct merge_ort_state *st = info->data;
+	unsigned long filemask = mask & ~dirmask;
+	struct name_entry *p = names;
+	size_t len;
+	char *fullpath;
+	int i;
+
+	while (!p->mode)
+		p++;
+	len = traverse_path_len(info, p->pathlen);
+	fullpath = xmallocz(len);
+	make_traverse_path(fullpath, len + 1, info, p->path, p->pathlen);
+
+	/*
+	 * A blob or a whole directory that is the same in all three
+	 * trees needs no further attention. This is the shortcut that
+	 * makes the merge proportional to the size of the changes, not
+	 * to the size of the trees.
+	 */
+	if (mask == 7 && names[0].mode == names[1].mode &&
+	    names[0].mode == names[2].mode &&
+	    oideq(&names[0].oid, &names[1].oid) &&
+	    oideq(&names[0].oid, &names[2].oid)) {
+		struct version_info *vi = xmalloc(sizeof(*vi));
+
+		set_version(vi, &names[0]);
+		string_list_append_nodup(&st->unchanged, fullpath)->util = vi;
+		return mask;
+	}
+
+	if (filemask) {
+		struct merged_path *e = add_path(st, fullpath);
+
+		for (i = 0; i < 3; i++)
+			if (filemask & (1ul << i))
+				set_version(&e->stages[i], &names[i]);
+		e->dirmask = dirmask;
+	}
+
+	if (dirmask) {
+		struct traverse_info newinfo = *info;
+		struct tree_desc t[3];
+		void *buf[3];
+		int ret;
+
+		newinfo.prev = info;
+		newinfo.name = p->path;
+		newinfo.namelen = p->pathlen;
+		newinfo.mode = p->mode;
+		newinfo.pathlen = st_add3(newinfo.pathlen, p->pathlen, 1);
+
+		for (i = 0; i < 3; i++) {
+			const struct object_id *oid = NULL;
+
+			if (dirmask & (1ul << i))
+				oid = &names[i].oid;
+			buf[i] = fill_tree_descriptor(st->opt->repo, t + i, oid);
+		}
+		ret = collect_merge_info(st, &newinfo, t);
+		for (i = 0; i < 3; i++)
+			free(buf[i]);
+		if (ret < 0) {
+			free(fullpath);
+			return -1;
+		}
+	}
+
+	free(fullpath);
+	return mask;
+}
+
+static int collect_merge_info(struct merge_ort_state *st,
+			      struct traverse_info *info,
+			      struct tree_desc *t)
+{
+	info->fn = collect_merge_info_callback;
+	info->data = st;
+	info->show_all_errors = 1;
+	return traverse_trees(NULL, 3, t, info);
+}
+
+/*** Rename detection ***/
+
+static int merge_detect_rename(struct merge_options *opt)
+{
+	return (opt->detect_renames >= 0) ? opt->detect_renames : 1;
+}
+
+static int cached_renames_usable(struct merge_ort_state *st,
+				 struct tree *base, struct tree *side1)
+{
+	return st->cache.renames.nr &&
+		oideq(&st->cache.side2, &base->object.oid) &&
+		oideq(&st->cache.result, &side1->object.oid);
+}
+
+/*
+ * Find the renames between base and side, and store them in
+ * st->renames[side_idx]. If "cached" is given, the renames it lists
+ * are taken as is, provided the queue still shows the source as
+ * deleted and the destination as added, and are not fed to diffcore.
+ */
+static void detect_renames(struct merge_ort_state *st,
+			   struct tree *base, struct tree *side, int side_idx,
+			   struct string_list *cached)
+{
+	struct merge_options *opt = st->opt;
+	struct string_list *out = &st->renames[side_idx].pairs;
+	struct string_list deleted = STRING_LIST_INIT_NODUP;
+	struct string_list added = STRING_LIST_INIT_NODUP;
+	struct string_list reused = STRING_LIST_INIT_NODUP;
+	struct string_list reused_dst = STRING_LIST_INIT_NODUP;
+	struct diff_queue_struct *q = &diff_queued_diff;
+	struct diff_options opts;
+	int i, j;
+
+	repo_diff_setup(opt->repo, &opts);
+	opts.flags.recursive = 1;
+	opts.flags.rename_empty = 0;
+	opts.detect_rename = merge_detect_rename(opt);
+	/* Copies make no sense for a merge; see merge-recursive.c */
+	if (opts.detect_rename > DIFF_DETECT_RENAME)
+		opts.detect_rename = DIFF_DETECT_RENAME;
+	opts.rename_limit = (opt->rename_limit >= 0) ? opt->rename_limit : 1000;
+	opts.rename_score = opt->rename_score;
+	opts.show_rename_progress = opt->show_rename_progress;
+	opts.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opts);
+	diff_tree_oid(&base->object.oid, &side->object.oid, "", &opts);
+
+	if (cached) {
+		for (i = 0; i < q->nr; i++) {
+			struct diff_filepair *p = q->queue[i];
+
+			if (!DIFF_FILE_VALID(p->two))
+				string_list_append(&deleted, p->one->path);
+			else if (!DIFF_FILE_VALID(p->one))
+				string_list_append(&added, p->two->path);
+		}
+		string_list_sort(&deleted);
+		string_list_sort(&added);
+		for (i = 0; i < cached->nr; i++) {
+			const char *src = cached->items[i].string;
+			const char *dst = cached->items[i].util;
+
+			if (!string_list_has_string(&deleted, src) ||
+			    !string_list_has_string(&added, dst))
+				continue;
+			string_list_append(&reused, src);
+			string_list_append(&reused_dst, dst);
+			string_list_append(out, src)->util = xstrdup(dst);
+		}
+		string_list_sort(&reused);
+		string_list_sort(&reused_dst);
+
+		/* Keep only what diffcore still has to pair up */
+		for (i = j = 0; i < q->nr; i++) {
+			struct diff_filepair *p = q->queue[i];
+			int drop = 0;
+
+			if (!DIFF_FILE_VALID(p->two))
+				drop = string_list_has_string(&reused, p->one->path);
+			else if (!DIFF_FILE_VALID(p->one))
+				drop = string_list_has_string(&reused_dst,
+							      p->two->path);
+			if (drop)
+				diff_free_filepair(p);
+			else
+				q->queue[j++] = p;
+		}
+		q->nr = j;
+		string_list_clear(&deleted, 0);
+		string_list_clear(&added, 0);
+		string_list_clear(&reused, 0);
+		string_list_clear(&reused_dst, 0);
+	}
+
+	diffcore_std(&opts);
+	if (opts.needed_rename_limit > st->needed_rename_limit)
+		st->needed_rename_limit = opts.needed_rename_limit;
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+
+		if (p->status == DIFF_STATUS_RENAMED)
+			string_list_append(out, p->one->path)->util =
+				xstrdup(p->two->path);
+	}
+	string_list_sort(out);
+	diff_flush(&opts);
+}
+
+/*
+ * Take the versions that lived at "src" in the base and on the other
+ * side over to "dst", where "side" renamed the path to. The source is
+ * then left with nothing and resolves as deleted.
+ */
+static void move_stages(struct merged_path *src, struct merged_path *dst,
+			int other)
+{
+	dst->stages[MERGE_BASE] = src->stages[MERGE_BASE];
+	dst->pathnames[MERGE_BASE] = src->path;
+	src->stages[MERGE_BASE].mode = 0;
+	if (other >= 0) {
+		dst->stages[other] = src->stages[other];
+		dst->pathnames[other] = src->path;
+		src->stages[other].mode = 0;
+	}
+}
+
+static void mark_conflict(struct merged_path *e)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		e->conflict[i] = e->stages[i];
+	e->clean = 0;
+}
+
+static int merge_blobs(struct merge_ort_state *st, struct merged_path *e,
+		       const struct version_info *stages,
+		       const char **pathnames,
+		       struct version_info *result);
+
+static void apply_one_rename(struct merge_ort_state *st, int side,
+			     const char *src_path, const char *dst_path)
+{
+	int other = (side == MERGE_SIDE1) ? MERGE_SIDE2 : MERGE_SIDE1;
+	struct merged_path *src = get_path(st, src_path);
+	struct merged_path *dst = get_path(st, dst_path);
+
+	if (!src || !dst || dst->processed ||
+	    !src->stages[MERGE_BASE].mode || !dst->stages[side].mode)
+		return;
+
+	if (src->stages[other].mode && !dst->stages[other].mode) {
+		/* Modified (or kept) on the other side: merge at dst */
+		move_stages(src, dst, other);
+	} else if (src->stages[other].mode) {
+		/*
+		 * The other side kept the source but also added a file
+		 * at the destination: merge the renamed file with the
+		 * source, then treat it as an add/add at the
+		 * destination.
+		 */
+		struct version_info stages[3], merged;
+		const char *pathnames[3];
+
+		stages[MERGE_BASE] = src->stages[MERGE_BASE];
+		stages[side] = dst->stages[side];
+		stages[other] = src->stages[other];
+		pathnames[MERGE_BASE] = src->path;
+		pathnames[side] = dst->path;
+		pathnames[other] = src->path;
+		if (merge_blobs(st, dst, stages, pathnames, &merged) < 0)
+			merged = dst->stages[side];
+
+		dst->stages[side] = merged;
+		src->stages[MERGE_BASE].mode = 0;
+		src->stages[other].mode = 0;
+		path_msg(st, dst, 1,
+			 _("CONFLICT (rename/add): Rename %s->%s in %s. "
+			   "%s added in %s"),
+			 src->path, dst->path, side_name(st, side),
+			 dst->path, side_name(st, other));
+		dst->clean = 0;
+	} else if (!dst->stages[other].mode) {
+		/* Deleted on the other side */
+		dst->result = dst->stages[side];
+		dst->conflict[side] = dst->stages[side];
+		dst->processed = 1;
+		dst->clean = 0;
+		src->stages[MERGE_BASE].mode = 0;
+		path_msg(st, dst, 1,
+			 _("CONFLICT (rename/delete): %s deleted in %s and "
+			   "renamed to %s in %s. Version %s of %s left in tree."),
+			 src->path, side_name(st, other), dst->path,
+			 side_name(st, side), side_name(st, side), dst->path);
+	}
+}
+
+static void apply_renames(struct merge_ort_state *st)
+{
+	struct string_list *r1 = &st->renames[MERGE_SIDE1].pairs;
+	struct string_list *r2 = &st->renames[MERGE_SIDE2].pairs;
+	int i;
+
+	for (i = 0; i < r1->nr; i++) {
+		const char *src_path = r1->items[i].string;
+		const char *dst1 = r1->items[i].util;
+		struct string_list_item *item;
+		struct merged_path *src, *d1, *d2;
+		char *dst2;
+
+		item = string_list_lookup(r2, src_path);
+		if (!item) {
+			apply_one_rename(st, MERGE_SIDE1, src_path, dst1);
+			continue;
+		}
+
+		/* Make the loop over side2's renames skip this one */
+		dst2 = item->util;
+		item->util = NULL;
+
+		src = get_path(st, src_path);
+		d1 = get_path(st, dst1);
+		d2 = get_path(st, dst2);
+		if (!src || !d1 || !d2) {
+			free(dst2);
+			continue;
+		}
+		if (!strcmp(dst1, dst2)) {
+			/* Both sides agree: a three-way merge at dst */
+			move_stages(src, d1, -1);
+			free(dst2);
+			continue;
+		}
+
+		/*
+		 * rename/rename(1to2): keep both, unresolved. As with
+		 * merge-recursive, the index has the base version at
+		 * the source and each side's version at its destination.
+		 */
+		d1->result = d1->stages[MERGE_SIDE1];
+		d1->conflict[MERGE_SIDE1] = d1->stages[MERGE_SIDE1];
+		d1->conflict[MERGE_SIDE2] = d1->stages[MERGE_SIDE2];
+		d2->result = d2->stages[MERGE_SIDE2];
+		d2->conflict[MERGE_SIDE1] = d2->stages[MERGE_SIDE1];
+		d2->conflict[MERGE_SIDE2] = d2->stages[MERGE_SIDE2];
+		src->conflict[MERGE_BASE] = src->stages[MERGE_BASE];
+		src->result.mode = 0;
+		d1->processed = d2->processed = src->processed = 1;
+		d1->clean = d2->clean = src->clean = 0;
+		src->stages[MERGE_BASE].mode = 0;
+		path_msg(st, d1, 1,
+			 _("CONFLICT (rename/rename): Rename \"%s\"->\"%s\" in "
+			   "branch \"%s\" rename \"%s\"->\"%s\" in \"%s\""),
+			 src_path, dst1, st->opt->branch1,
+			 src_path, dst2, st->opt->branch2);
+		free(dst2);
+	}
+
+	for (i = 0; i < r2->nr; i++)
+		if (r2->items[i].util)
+			apply_one_rename(st, MERGE_SIDE2, r2->items[i].string,
+					 r2->items[i].util);
+}
+
+/*** Directory renames ***/
+
+/*
+ * A directory one side renamed, and where most of its files went.
+ * If there is a tie between several new locations the rename is not
+ * applied, as there is no telling which one was meant.
+ */
+struct dir_rename {
+	char *new_dir;
+	unsigned non_unique_new_dir:1;
+};
+
+/*
+ * Find the directories that differ between old_path and new_path once
+ * the part the two paths end with is dropped, e.g.
+ *    "a/b/c/d/e/foo.c" -> "a/b/some/thing/else/e/foo.c"
+ * gives "a/b/c/d" and "a/b/some/thing/else". Both are set to NULL if
+ * only the basename changed; new_dir is "" for a rename into the root.
+ */
+static void get_renamed_dir_portion(const char *old_path, const char *new_path,
+				    char **old_dir, char **new_dir)
+{
+	const char *end_of_old, *end_of_new;
+
+	*old_dir = NULL;
+	*new_dir = NULL;
+
+	end_of_old = strrchr(old_path, '/');
+	end_of_new = strrchr(new_path, '/');
+	/* The root directory always exists, so it is never renamed */
+	if (!end_of_old)
+		return;
+	if (!end_of_new) {
+		*old_dir = xstrndup(old_path, end_of_old - old_path);
+		*new_dir = xstrdup("");
+		return;
+	}
+
+	while (*--end_of_new == *--end_of_old &&
+	       end_of_old != old_path && end_of_new != new_path)
+		; /* find the first differing character from the end */
+
+	if (end_of_old == old_path && end_of_new == new_path &&
+	    *end_of_old == *end_of_new)
+		return;
+	if (end_of_new == new_path &&
+	    end_of_old != old_path && end_of_old[-1] == '/') {
+		*old_dir = xstrndup(old_path, --end_of_old - old_path);
+		*new_dir = xstrdup("");
+		return;
+	}
+
+	/* Extend both to the end of the first differing component */
+	end_of_old = strchr(++end_of_old, '/');
+	end_of_new = strchr(++end_of_new, '/');
+	*old_dir = xstrndup(old_path, end_of_old - old_path);
+	*new_dir = xstrndup(new_path, end_of_new - new_path);
+}
+
+static void free_dir_renames(struct string_list *dirs)
+{
+	int i;
+
+	for (i = 0; i < dirs->nr; i++) {
+		struct dir_rename *dr = dirs->items[i].util;
+
+		if (dr)
+			free(dr->new_dir);
+	}
+	string_list_clear(dirs, 1);
+}
+
+/*
+ * Turn the file renames of one side into directory renames: each
+ * directory goes where the majority of its renamed files went. The
+ * result is a sorted list of old directories, with a struct
+ * dir_rename as util.
+ */
+static void compute_dir_renames(struct string_list *renames,
+				struct string_list *dirs)
+{
+	struct string_list counts = STRING_LIST_INIT_DUP;
+	int i, j;
+
+	for (i = 0; i < renames->nr; i++) {
+		struct string_list_item *item;
+		struct string_list *targets;
+		char *old_dir, *new_dir;
+
+		get_renamed_dir_portion(renames->items[i].string,
+					renames->items[i].util,
+					&old_dir, &new_dir);
+		if (!old_dir)
+			continue;
+		item = string_list_insert(&counts, old_dir);
+		if (!item->util) {
+			targets = xcalloc(1, sizeof(*targets));
+			string_list_init(targets, 1);
+			item->util = targets;
+		}
+		targets = item->util;
+		item = string_list_insert(targets, new_dir);
+		item->util = (void *)((intptr_t)item->util + 1);
+		free(old_dir);
+		free(new_dir);
+	}
+
+	for (i = 0; i < counts.nr; i++) {
+		struct string_list *targets = counts.items[i].util;
+		struct dir_rename *dr = xcalloc(1, sizeof(*dr));
+		intptr_t max = 0;
+
+		for (j = 0; j < targets->nr; j++) {
+			intptr_t count = (intptr_t)targets->items[j].util;
+
+			if (count == max) {
+				dr->non_unique_new_dir = 1;
+			} else if (count > max) {
+				max = count;
+				free(dr->new_dir);
+				dr->new_dir = xstrdup(targets->items[j].string);
+				dr->non_unique_new_dir = 0;
+			}
+		}
+		string_list_append(dirs, counts.items[i].string)->util = dr;
+		string_list_clear(targets, 0);
+		free(targets);
+	}
+	string_list_clear(&counts, 0);
+}
+
+static int tree_has_path(struct repository *r, struct tree *tree,
+			 const char *path)
+{
+	struct object_id oid;
+	unsigned short mode;
+
+	return !get_tree_entry(r, &tree->object.oid, path, &oid, &mode);
+}
+
+/*
+ * Drop the directory renames that are not renames at all: the old
+ * directory is still there on the renaming side, or both sides made
+ * the same rename. Both sides renaming a directory to different
+ * places is reported and neither rename is applied.
+ */
+static void prune_dir_renames(struct merge_ort_state *st,
+			      struct string_list *dirs, struct tree **trees)
+{
+	struct string_list *d1 = &dirs[MERGE_SIDE1];
+	struct string_list *d2 = &dirs[MERGE_SIDE2];
+	int side, i;
+
+	for (side = MERGE_SIDE1; side <= MERGE_SIDE2; side++)
+		for (i = 0; i < dirs[side].nr; i++) {
+			struct string_list_item *item = &dirs[side].items[i];
+
+			if (tree_has_path(st->opt->repo, trees[side],
+					  item->string))
+				FREE_AND_NULL(((struct dir_rename *)item->util)->new_dir);
+		}
+
+	for (i = 0; i < d1->nr; i++) {
+		struct dir_rename *r1 = d1->items[i].util, *r2;
+		struct string_list_item *item;
+
+		item = string_list_lookup(d2, d1->items[i].string);
+		if (!item)
+			continue;
+		r2 = item->util;
+		if (r1->new_dir && r2->new_dir &&
+		    !r1->non_unique_new_dir && !r2->non_unique_new_dir &&
+		    strcmp(r1->new_dir, r2->new_dir))
+			global_msg(st, 1,
+				   _("CONFLICT (rename/rename): Rename directory %s->%s in %s. "
+				     "Rename directory %s->%s in %s"),
+				   d1->items[i].string, r1->new_dir,
+				   side_name(st, MERGE_SIDE1),
+				   d1->items[i].string, r2->new_dir,
+				   side_name(st, MERGE_SIDE2));
+		FREE_AND_NULL(r1->new_dir);
+		FREE_AND_NULL(r2->new_dir);
+	}
+}
+
+/*
+ * Find the innermost directory of "path" that was renamed in "dirs".
+ */
+static struct dir_rename *check_dir_renamed(struct string_list *dirs,
+					    const char *path,
+					    const char **old_dir)
+{
+	struct strbuf dir = STRBUF_INIT;
+	struct dir_rename *dr = NULL;
+	char *slash;
+
+	strbuf_addstr(&dir, path);
+	while (!dr && (slash = strrchr(dir.buf, '/'))) {
+		struct string_list_item *item;
+
+		strbuf_setlen(&dir, slash - dir.buf);
+		item = string_list_lookup(dirs, dir.buf);
+		if (item && ((struct dir_rename *)item->util)->new_dir) {
+			dr = item->util;
+			*old_dir = item->string;
+		}
+	}
+	strbuf_release(&dir);
+	return dr;
+}
+
+static char *apply_dir_rename(const char *old_dir, struct dir_rename *dr,
+			      const char *path)
+{
+	size_t oldlen = strlen(old_dir);
+
+	/* A rename into the root drops the slash as well */
+	if (!*dr->new_dir)
+		oldlen++;
+	return xstrfmt("%s%s", dr->new_dir, path + oldlen);
+}
+
+struct dir_rename_move {
+	struct merged_path *e;
+	char *new_path;
+	int side; /* the side that added (or renamed) the file */
+	const char *old_dir, *new_dir;
+};
+
+/*
+ * Move a file that one side added to (or renamed into) a directory
+ * that the other side renamed along with that directory, following
+ * merge.directoryRenames. In "conflict" mode the file is moved but
+ * left unmerged for the user to confirm.
+ */
+static void apply_dir_renames(struct merge_ort_state *st, struct tree **trees)
+{
+	struct string_list dirs[3] = {
+		STRING_LIST_INIT_NODUP,
+		STRING_LIST_INIT_DUP,
+		STRING_LIST_INIT_DUP
+	};
+	struct string_list moves = STRING_LIST_INIT_NODUP;
+	struct hashmap_iter iter;
+	struct merged_path *e;
+	int i, j, side;
+
+	compute_dir_renames(&st->renames[MERGE_SIDE1].pairs,
+			    &dirs[MERGE_SIDE1]);
+	compute_dir_renames(&st->renames[MERGE_SIDE2].pairs,
+			    &dirs[MERGE_SIDE2]);
+	prune_dir_renames(st, dirs, trees);
+
+	hashmap_for_each_entry(&st->paths, &iter, e, ent) {
+		struct dir_rename_move *m;
+		struct string_list_item *item;
+		struct dir_rename *dr;
+		const char *old_dir;
+		int other;
+
+		/* Only paths that exist on one side alone */
+		if (e->stages[MERGE_BASE].mode ||
+		    !e->stages[MERGE_SIDE1].mode == !e->stages[MERGE_SIDE2].mode)
+			continue;
+		side = e->stages[MERGE_SIDE1].mode ? MERGE_SIDE1 : MERGE_SIDE2;
+		other = (side == MERGE_SIDE1) ? MERGE_SIDE2 : MERGE_SIDE1;
+		dr = check_dir_renamed(&dirs[other], e->path, &old_dir);
+		if (!dr)
+			continue;
+		if (dr->non_unique_new_dir) {
+			path_msg(st, e, 1,
+				 _("CONFLICT (directory rename split): Unclear where to "
+				   "place %s because directory %s was renamed to "
+				   "multiple other directories, with no destination "
+				   "getting a majority of the files."),
+				 e->path, old_dir);
+			e->location_side = side;
+			continue;
+		}
+		item = string_list_lookup(&dirs[side], dr->new_dir);
+		if (item && ((struct dir_rename *)item->util)->new_dir) {
+			path_msg(st, e, 1,
+				 _("WARNING: Avoiding applying %s -> %s rename "
+				   "to %s, because %s itself was renamed."),
+				 old_dir, dr->new_dir, e->path, dr->new_dir);
+			continue;
+		}
+
+		m = xcalloc(1, sizeof(*m));
+		m->e = e;
+		m->new_path = apply_dir_rename(old_dir, dr, e->path);
+		m->side = side;
+		m->old_dir = old_dir;
+		m->new_dir = dr->new_dir;
+		string_list_append(&moves, m->new_path)->util = m;
+	}
+	string_list_sort(&moves);
+
+	for (i = 0; i < moves.nr; i = j) {
+		struct dir_rename_move *m = moves.items[i].util;
+		struct merged_path *dst;
+		const char *renamed_from = NULL;
+		int other = (m->side == MERGE_SIDE1) ? MERGE_SIDE2 : MERGE_SIDE1;
+		int k;
+
+		for (j = i + 1; j < moves.nr; j++)
+			if (strcmp(moves.items[j].string, m->new_path))
+				break;
+		if (j - i > 1) {
+			struct strbuf sources = STRBUF_INIT;
+
+			for (k = i; k < j; k++) {
+				struct dir_rename_move *mk = moves.items[k].util;
+
+				strbuf_addf(&sources, "%s%s", k > i ? ", " : "",
+					    mk->e->path);
+				mk->e->location_side = mk->side;
+			}
+			path_msg(st, m->e, 1,
+				 _("CONFLICT (implicit dir rename): Cannot map more "
+				   "than one path to %s; implicit directory renames "
+				   "tried to put these paths there: %s"),
+				 m->new_path, sources.buf);
+			strbuf_release(&sources);
+			continue;
+		}
+		if (tree_has_path(st->opt->repo, trees[m->side], m->new_path)) {
+			path_msg(st, m->e, 1,
+				 _("CONFLICT (implicit dir rename): Existing "
+				   "file/dir at %s in the way of implicit directory "
+				   "rename(s) putting the following path(s) there: %s."),
+				 m->new_path, m->e->path);
+			m->e->location_side = m->side;
+			continue;
+		}
+
+		for (k = 0; k < st->renames[m->side].pairs.nr; k++) {
+			struct string_list_item *r =
+				&st->renames[m->side].pairs.items[k];
+
+			if (!strcmp(r->util, m->e->path)) {
+				renamed_from = r->string;
+				free(r->util);
+				r->util = xstrdup(m->new_path);
+				break;
+			}
+		}
+
+		dst = add_path(st, m->new_path);
+		dst->stages[m->side] = m->e->stages[m->side];
+		dst->pathnames[m->side] = m->e->path;
+		m->e->stages[m->side].mode = 0;
+
+		if (st->opt->detect_directory_renames ==
+		    MERGE_DIRECTORY_RENAMES_TRUE) {
+			if (renamed_from)
+				path_msg(st, dst, 1,
+					 _("Path updated: %s renamed to %s in %s, "
+					   "inside a directory that was renamed in %s; "
+					   "moving it to %s."),
+					 renamed_from, m->e->path,
+					 side_name(st, m->side),
+					 side_name(st, other), m->new_path);
+			else
+				path_msg(st, dst, 1,
+					 _("Path updated: %s added in %s inside a "
+					   "directory that was renamed in %s; moving "
+					   "it to %s."),
+					 m->e->path, side_name(st, m->side),
+					 side_name(st, other), m->new_path);
+		} else {
+			if (renamed_from)
+				path_msg(st, dst, 1,
+					 _("CONFLICT (file location): %s renamed to %s "
+					   "in %s, inside a directory that was renamed "
+					   "in %s, suggesting it should perhaps be "
+					   "moved to %s."),
+					 renamed_from, m->e->path,
+					 side_name(st, m->side),
+					 side_name(st, other), m->new_path);
+			else
+				path_msg(st, dst, 1,
+					 _("CONFLICT (file location): %s added in %s "
+					   "inside a directory that was renamed in %s, "
+					   "suggesting it should perhaps be moved to "
+					   "%s."),
+					 m->e->path, side_name(st, m->side),
+					 side_name(st, other), m->new_path);
+			dst->location_side = m->side;
+		}
+	}
+
+	for (i = 0; i < moves.nr; i++)
+		free(((struct dir_rename_move *)moves.items[i].util)->new_path);
+	string_list_clear(&moves, 1);
+	free_dir_renames(&dirs[MERGE_SIDE1]);
+	free_dir_renames(&dirs[MERGE_SIDE2]);
+}
+
+/*** Resolving each path ***/
+
+static int merge_3way(struct merge_ort_state *st, const char *path,
+		      const struct version_info *stages,
+		      const char **pathnames,
+		      mmbuffer_t *result_buf)
+{
+	struct merge_options *opt = st->opt;
+	struct ll_merge_options ll_opts = {0};
+	mmfile_t orig, src1, src2;
+	char *base, *name1, *name2;
+	const char *o = pathnames[MERGE_BASE];
+	const char *a = pathnames[MERGE_SIDE1];
+	const char *b = pathnames[MERGE_SIDE2];
+	int merge_status;
+
+	ll_opts.renormalize = opt->renormalize;
+	ll_opts.extra_marker_size = st->call_depth * 2;
+	ll_opts.xdl_opts = opt->xdl_opts;
+
+	if (st->call_depth) {
+		ll_opts.virtual_ancestor = 1;
+		ll_opts.variant = 0;
+	} else {
+		switch (opt->recursive_variant) {
+		case MERGE_VARIANT_OURS:
+			ll_opts.variant = XDL_MERGE_FAVOR_OURS;
+			break;
+		case MERGE_VARIANT_THEIRS:
+			ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
+			break;
+		default:
+			ll_opts.variant = 0;
+			break;
+		}
+	}
+
+	if (strcmp(a, b) || strcmp(a, o)) {
+		base  = mkpathdup("%s:%s", opt->ancestor, o);
+		name1 = mkpathdup("%s:%s", opt->branch1, a);
+		name2 = mkpathdup("%s:%s", opt->branch2, b);
+	} else {
+		base  = mkpathdup("%s", opt->ancestor);
+		name1 = mkpathdup("%s", opt->branch1);
+		name2 = mkpathdup("%s", opt->branch2);
+	}
+
+	read_mmblob(&orig, stages[MERGE_BASE].mode ?
+		    &stages[MERGE_BASE].oid : &null_oid);
+	read_mmblob(&src1, &stages[MERGE_SIDE1].oid);
+	read_mmblob(&src2, &stages[MERGE_SIDE2].oid);
+
+	merge_status = ll_merge(result_buf, path, &orig, base,
+				&src1, name1, &src2, name2,
+				opt->repo->index, &ll_opts);
+
+	free(base);
+	free(name1);
+	free(name2);
+	free(orig.ptr);
+	free(src1.ptr);
+	free(src2.ptr);
+	return merge_status;
+}
+
+/*
+ * Submodules are merged by fast-forwarding to whichever side contains
+ * the other, as merge-recursive does. Returns 1 if clean, 0 if not;
+ * on failure "result" is side1's commit, or the merge base's in a
+ * virtual merge base.
+ */
+static int merge_submodule(struct merge_ort_state *st, struct merged_path *e,
+			   struct object_id *result,
+			   const struct version_info *o,
+			   const struct version_info *a,
+			   const struct version_info *b)
+{
+	struct repository *r = st->opt->repo;
+	struct commit *commit_o, *commit_a, *commit_b;
+
+	if (st->call_depth && o->mode)
+		oidcpy(result, &o->oid);
+	else
+		oidcpy(result, &a->oid);
+
+	/* we can not handle deletion conflicts */
+	if (!S_ISGITLINK(o->mode))
+		return 0;
+
+	if (add_submodule_odb(e->path)) {
+		path_msg(st, e, 1,
+			 _("Failed to merge submodule %s (not checked out)"),
+			 e->path);
+		return 0;
+	}
+
+	if (!(commit_o = lookup_commit_reference(r, &o->oid)) ||
+	    !(commit_a = lookup_commit_reference(r, &a->oid)) ||
+	    !(commit_b = lookup_commit_reference(r, &b->oid))) {
+		path_msg(st, e, 1,
+			 _("Failed to merge submodule %s (commits not present)"),
+			 e->path);
+		return 0;
+	}
+
+	/* check whether both changes are forward */
+	if (!in_merge_bases(commit_o, commit_a) ||
+	    !in_merge_bases(commit_o, commit_b)) {
+		path_msg(st, e, 1,
+			 _("Failed to merge submodule %s (commits don't follow merge-base)"),
+			 e->path);
+		return 0;
+	}
+
+	if (in_merge_bases(commit_a, commit_b)) {
+		oidcpy(result, &b->oid);
+		path_msg(st, e, 2, _("Fast-forwarding submodule %s"), e->path);
+		return 1;
+	}
+	if (in_merge_bases(commit_b, commit_a)) {
+		oidcpy(result, &a->oid);
+		path_msg(st, e, 2, _("Fast-forwarding submodule %s"), e->path);
+		return 1;
+	}
+
+	path_msg(st, e, 1, _("Failed to merge submodule %s (not fast-forward)"),
+		 e->path);
+	return 0;
+}
+
+/*
+ * Merge two versions of a path that both exist, with or without a
+ * merge base. Returns 1 if clean, 0 if not, -1 on error; "result" is
+ * what goes in the tree either way.
+ */
+static int merge_blobs(struct merge_ort_state *st, struct merged_path *e,
+		       const struct version_info *stages,
+		       const char **pathnames,
+		       struct version_info *result)
+{
+	const char *path = e->path;
+	const struct version_info *o = &stages[MERGE_BASE];
+	const struct version_info *a = &stages[MERGE_SIDE1];
+	const struct version_info *b = &stages[MERGE_SIDE2];
+	int clean = 1;
+
+	if ((S_IFMT & a->mode) != (S_IFMT & b->mode)) {
+		/* Nothing sensible to merge; keep side1's version */
+		*result = *a;
+		return 0;
+	}
+
+	if (a->mode == b->mode || (o->mode && a->mode == o->mode))
+		result->mode = b->mode;
+	else {
+		result->mode = a->mode;
+		if (!o->mode || b->mode != o->mode)
+			clean = 0;
+	}
+
+	if (oideq(&a->oid, &b->oid))
+		oidcpy(&result->oid, &a->oid);
+	else if (o->mode && oideq(&a->oid, &o->oid))
+		oidcpy(&result->oid, &b->oid);
+	else if (o->mode && oideq(&b->oid, &o->oid))
+		oidcpy(&result->oid, &a->oid);
+	else if (S_ISREG(a->mode)) {
+		mmbuffer_t buf;
+		int merge_status;
+
+		merge_status = merge_3way(st, path, stages, pathnames, &buf);
+		if (merge_status < 0 || !buf.ptr)
+			return error(_("failed to execute internal merge"));
+		if (write_object_file(buf.ptr, buf.size, blob_type,
+				      &result->oid)) {
+			free(buf.ptr);
+			return error(_("unable to add %s to database"), path);
+		}
+		free(buf.ptr);
+		if (merge_status)
+			clean = 0;
+	} else if (S_ISGITLINK(a->mode)) {
+		clean = merge_submodule(st, e, &result->oid, o, a, b);
+	} else if (S_ISLNK(a->mode) && !st->call_depth &&
+		   st->opt->recursive_variant != MERGE_VARIANT_NORMAL) {
+		if (st->opt->recursive_variant == MERGE_VARIANT_OURS)
+			oidcpy(&result->oid, &a->oid);
+		else
+			oidcpy(&result->oid, &b->oid);
+	} else {
+		/*
+		 * Symlinks cannot be merged; in a virtual merge base keep
+		 * the common ancestor if there is one.
+		 */
+		if (st->call_depth && o->mode)
+			oidcpy(&result->oid, &o->oid);
+		else
+			oidcpy(&result->oid, &a->oid);
+		clean = 0;
+	}
+	return clean;
+}
+
+static int process_entry(struct merge_ort_state *st, struct merged_path *e)
+{
+	struct version_info *o = &e->stages[MERGE_BASE];
+	struct version_info *a = &e->stages[MERGE_SIDE1];
+	struct version_info *b = &e->stages[MERGE_SIDE2];
+
+	if (e->processed)
+		return 0;
+	e->processed = 1;
+
+	if (version_eq(a, b))
+		e->result = *a;
+	else if (version_eq(o, a))
+		e->result = *b;
+	else if (version_eq(o, b))
+		e->result = *a;
+	else if (a->mode && b->mode) {
+		int clean;
+
+		if (S_ISREG(a->mode) && S_ISREG(b->mode) &&
+		    !oideq(&a->oid, &b->oid))
+			path_msg(st, e, 2, _("Auto-merging %s"), e->path);
+		clean = merge_blobs(st, e, e->stages, e->pathnames,
+				    &e->result);
+		if (clean < 0)
+			return -1;
+		if (!clean) {
+			const char *reason = _("content");
+
+			if (!o->mode)
+				reason = _("add/add");
+			else if (S_ISGITLINK(a->mode))
+				reason = _("submodule");
+			path_msg(st, e, 1,
+				 _("CONFLICT (%s): Merge conflict in %s"),
+				 reason, e->path);
+			mark_conflict(e);
+		} else if (!e->clean) {
+			/* rename/add already reported */
+			mark_conflict(e);
+		}
+	} else {
+		/* modify/delete */
+		int modified = a->mode ? MERGE_SIDE1 : MERGE_SIDE2;
+		int deleted = a->mode ? MERGE_SIDE2 : MERGE_SIDE1;
+
+		if (st->call_depth)
+			e->result = *o;
+		else
+			e->result = e->stages[modified];
+		path_msg(st, e, 1,
+			 _("CONFLICT (modify/delete): %s deleted in %s and "
+			   "modified in %s. Version %s of %s left in tree."),
+			 e->path, side_name(st, deleted),
+			 side_name(st, modified), side_name(st, modified),
+			 e->path);
+		mark_conflict(e);
+	}
+
+	if (e->location_side && e->clean) {
+		e->conflict[e->location_side] = e->result;
+		e->clean = 0;
+	}
+	return 0;
+}
+
+/*** Directory/file conflicts ***/
+
+static void add_leading_dirs(struct string_list *dirs, const char *path)
+{
+	struct strbuf dir = STRBUF_INIT;
+	char *slash;
+
+	strbuf_addstr(&dir, path);
+	while ((slash = strrchr(dir.buf, '/'))) {
+		strbuf_setlen(&dir, slash - dir.buf);
+		if (string_list_has_string(dirs, dir.buf))
+			break;
+		string_list_insert(dirs, dir.buf);
+	}
+	strbuf_release(&dir);
+}
+
+static char *unique_path(struct merge_ort_state *st, struct string_list *dirs,
+			 const char *path, const char *branch)
+{
+	struct strbuf newpath = STRBUF_INIT;
+	size_t base_len;
+	int suffix = 0;
+
+	strbuf_addf(&newpath, "%s~", path);
+	strbuf_addstr(&newpath, branch);
+	strbuf_strip_suffix(&newpath, "/");
+	for (base_len = strlen(path) + 1; base_len < newpath.len; base_len++)
+		if (newpath.buf[base_len] == '/')
+			newpath.buf[base_len] = '_';
+
+	base_len = newpath.len;
+	while (get_path(st, newpath.buf) ||
+	       string_list_has_string(&st->unchanged, newpath.buf) ||
+	       string_list_has_string(dirs, newpath.buf)) {
+		strbuf_setlen(&newpath, base_len);
+		strbuf_addf(&newpath, "_%d", suffix++);
+	}
+	return strbuf_detach(&newpath, NULL);
+}
+
+/*
+ * A file of the result that is in the way of a directory of the
+ * result is moved aside to a new, unique path.
+ */
+static void resolve_df_conflicts(struct merge_ort_state *st)
+{
+	struct string_list dirs = STRING_LIST_INIT_DUP;
+	struct string_list moved = STRING_LIST_INIT_NODUP;
+	struct hashmap_iter iter;
+	struct merged_path *e;
+	int i;
+
+	for (i = 0; i < st->unchanged.nr; i++) {
+		struct version_info *vi = st->unchanged.items[i].util;
+
+		add_leading_dirs(&dirs, st->unchanged.items[i].string);
+		if (S_ISDIR(vi->mode))
+			string_list_insert(&dirs, st->unchanged.items[i].string);
+	}
+	hashmap_for_each_entry(&st->paths, &iter, e, ent)
+		if (e->result.mode)
+			add_leading_dirs(&dirs, e->path);
+
+	hashmap_for_each_entry(&st->paths, &iter, e, ent)
+		if (e->result.mode && string_list_has_string(&dirs, e->path))
+			string_list_append(&moved, e->path)->util = e;
+	string_list_sort(&moved);
+
+	for (i = 0; i < moved.nr; i++) {
+		struct merged_path *old = moved.items[i].util;
+		struct merged_path *new;
+		int side = version_eq(&old->result, &old->stages[MERGE_SIDE1]) ?
+			MERGE_SIDE1 : MERGE_SIDE2;
+		char *newpath = unique_path(st, &dirs, old->path,
+					    side_name(st, side));
+
+		new = add_path(st, newpath);
+		new->index_path = old->path;
+		new->processed = 1;
+		new->clean = 0;
+		new->result = old->result;
+		if (old->clean)
+			new->conflict[side] = old->result;
+		else
+			memcpy(new->conflict, old->conflict,
+			       sizeof(new->conflict));
+		memset(old->conflict, 0, sizeof(old->conflict));
+		old->clean = 1;
+		old->result.mode = 0;
+		path_msg(st, new, 1,
+			 _("CONFLICT (file/directory): There is a directory with "
+			   "name %s in %s. Adding %s as %s"),
+			 old->path, side_name(st, side == MERGE_SIDE1 ?
+						  MERGE_SIDE2 : MERGE_SIDE1),
+			 old->path, newpath);
+		free(newpath);
+	}
+
+	string_list_clear(&moved, 0);
+	string_list_clear(&dirs, 0);
+}
+
+/*** Writing the result tree ***/
+
+struct result_entry {
+	const char *path;
+	int len;
+	unsigned mode;
+	const struct object_id *oid;
+};
+
+static int result_entry_cmp(const void *va, const void *vb)
+{
+	const struct result_entry *a = va, *b = vb;
+
+	return base_name_compare(a->path, a->len, a->mode,
+				 b->path, b->len, b->mode);
+}
+
+/*
+ * Write the tree for the directory "prefix" (which is either empty or
+ * ends in a slash) from the sorted entries starting at *pos, and
+ * advance *pos past them.
+ */
+static int write_tree_level(struct result_entry *entries, size_t nr,
+			    size_t *pos, const char *prefix, size_t prefix_len,
+			    struct object_id *oid)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int ret = 0;
+
+	while (*pos < nr && !strncmp(entries[*pos].path, prefix, prefix_len)) {
+		struct result_entry *e = &entries[*pos];
+		const char *name = e->path + prefix_len;
+		const char *slash = strchr(name, '/');
+
+		if (slash) {
+			struct object_id subtree;
+
+			ret = write_tree_level(entries, nr, pos, e->path,
+					       slash + 1 - e->path, &subtree);
+			if (ret)
+				break;
+			strbuf_addf(&buf, "%o %.*s%c", S_IFDIR,
+				    (int)(slash - name), name, '\0');
+			strbuf_add(&buf, subtree.hash, the_hash_algo->rawsz);
+		} else {
+			strbuf_addf(&buf, "%o %s%c", e->mode, name, '\0');
+			strbuf_add(&buf, e->oid->hash, the_hash_algo->rawsz);
+			(*pos)++;
+		}
+	}
+
+	if (!ret && write_object_file(buf.buf, buf.len, tree_type, oid))
+		ret = error(_("unable to write tree object"));
+	strbuf_release(&buf);
+	return ret;
+}
+
+static int write_result_tree(struct merge_ort_state *st, struct object_id *oid)
+{
+	struct result_entry *entries;
+	size_t nr = 0, pos = 0;
+	struct hashmap_iter iter;
+	struct merged_path *e;
+	int i, ret;
+
+	ALLOC_ARRAY(entries, st_add(st->unchanged.nr,
+				    hashmap_get_size(&st->paths)));
+	for (i = 0; i < st->unchanged.nr; i++) {
+		struct version_info *vi = st->unchanged.items[i].util;
+
+		entries[nr].path = st->unchanged.items[i].string;
+		entries[nr].len = strlen(entries[nr].path);
+		entries[nr].mode = vi->mode;
+		entries[nr].oid = &vi->oid;
+		nr++;
+	}
+	hashmap_for_each_entry(&st->paths, &iter, e, ent) {
+		if (!e->result.mode)
+			continue;
+		entries[nr].path = e->path;
+		entries[nr].len = strlen(e->path);
+		entries[nr].mode = e->result.mode;
+		entries[nr].oid = &e->result.oid;
+		nr++;
+	}
+	QSORT(entries, nr, result_entry_cmp);
+
+	ret = write_tree_level(entries, nr, &pos, "", 0, oid);
+	free(entries);
+	return ret;
+}
+
+/*** The merge itself ***/
+
+static void clear_merge_data(struct merge_ort_state *st)
+{
+	struct hashmap_iter iter;
+	struct merged_path *e;
+	int i;
+
+	hashmap_for_each_entry(&st->paths, &iter, e, ent)
+		strbuf_release(&e->messages);
+	hashmap_free_entries(&st->paths, struct merged_path, ent);
+	hashmap_init(&st->paths, merged_path_cmp, NULL, 0);
+	string_list_clear(&st->unchanged, 1);
+	for (i = 0; i < 3; i++)
+		string_list_clear(&st->renames[i].pairs, 1);
+	strbuf_reset(&st->messages);
+	st->needed_rename_limit = 0;
+}
+
+static struct merge_ort_state *get_state(struct merge_options *opt,
+					 struct merge_result *result)
+{
+	struct merge_ort_state *st = result->priv;
+	int i;
+
+	if (!st) {
+		st = xcalloc(1, sizeof(*st));
+		hashmap_init(&st->paths, merged_path_cmp, NULL, 0);
+		string_list_init(&st->unchanged, 1);
+		for (i = 0; i < 3; i++)
+			string_list_init(&st->renames[i].pairs, 1);
+		string_list_init(&st->cache.renames, 1);
+		strbuf_init(&st->messages, 0);
+		result->priv = st;
+	}
+	st->opt = opt;
+	return st;
+}
+
+/*
+ * Remember the renames side1 went through so that the next merge of a
+ * sequence of picks, whose side1 is this result, need not detect them
+ * again. Only renames that made it into the result as such are kept.
+ */
+static void update_rename_cache(struct merge_ort_state *st,
+				struct tree *side2, struct object_id *result)
+{
+	struct string_list *renames = &st->renames[MERGE_SIDE1].pairs;
+	int i;
+
+	string_list_clear(&st->cache.renames, 1);
+	oidcpy(&st->cache.side2, &side2->object.oid);
+	oidcpy(&st->cache.result, result);
+
+	for (i = 0; i < renames->nr; i++) {
+		struct merged_path *src = get_path(st, renames->items[i].string);
+		struct merged_path *dst = get_path(st, renames->items[i].util);
+
+		if (!src || !dst || src->result.mode ||
+		    !dst->result.mode || !dst->clean)
+			continue;
+		string_list_append(&st->cache.renames,
+				   renames->items[i].string)->util =
+			xstrdup(renames->items[i].util);
+	}
+}
+
+static struct tree *shift_tree_object(struct repository *repo,
+				      struct tree *one, struct tree *two,
+				      const char *subtree_shift)
+{
+	struct object_id shifted;
+
+	if (!*subtree_shift) {
+		shift_tree(repo, &one->object.oid, &two->object.oid, &shifted, 0);
+	} else {
+		shift_tree_by(repo, &one->object.oid, &two->object.oid, &shifted,
+			      subtree_shift);
+	}
+	if (oideq(&two->object.oid, &shifted))
+		return two;
+	return lookup_tree(repo, &shifted);
+}
+
+static void merge_ort_nonrecursive_internal(struct merge_ort_state *st,
+					    struct tree *merge_base,
+					    struct tree *side1,
+					    struct tree *side2,
+					    struct merge_result *result)
+{
+	struct merge_options *opt = st->opt;
+	struct traverse_info info;
+	struct tree_desc t[3];
+	struct hashmap_iter iter;
+	struct merged_path *e;
+	struct object_id result_oid;
+	int clean = 1;
+
+	if (opt->subtree_shift) {
+		side2 = shift_tree_object(opt->repo, side1, side2,
+					  opt->subtree_shift);
+		merge_base = shift_tree_object(opt->repo, side1, merge_base,
+					       opt->subtree_shift);
+	}
+
+	if (parse_tree(merge_base) < 0 || parse_tree(side1) < 0 ||
+	    parse_tree(side2) < 0) {
+		result->clean = -1;
+		return;
+	}
+
+	if (oideq(&merge_base->object.oid, &side2->object.oid)) {
+		global_msg(st, 3, _("Already up to date!"));
+		result->tree = side1;
+		result->clean = 1;
+		return;
+	}
+
+	init_tree_desc(t + 0, merge_base->buffer, merge_base->size);
+	init_tree_desc(t + 1, side1->buffer, side1->size);
+	init_tree_desc(t + 2, side2->buffer, side2->size);
+	setup_traverse_info(&info, "");
+	if (collect_merge_info(st, &info, t) < 0) {
+		result->clean = -1;
+		return;
+	}
+
+	if (merge_detect_rename(opt)) {
+		int reuse = !st->call_depth &&
+			cached_renames_usable(st, merge_base, side1);
+
+		detect_renames(st, merge_base, side1, MERGE_SIDE1,
+			       reuse ? &st->cache.renames : NULL);
+		detect_renames(st, merge_base, side2, MERGE_SIDE2, NULL);
+		if (opt->detect_directory_renames) {
+			struct tree *trees[3] = { merge_base, side1, side2 };
+
+			apply_dir_renames(st, trees);
+		}
+		apply_renames(st);
+	}
+
+	hashmap_for_each_entry(&st->paths, &iter, e, ent)
+		if (process_entry(st, e) < 0) {
+			result->clean = -1;
+			return;
+		}
+	resolve_df_conflicts(st);
+
+	hashmap_for_each_entry(&st->paths, &iter, e, ent)
+		if (!e->clean)
+			clean = 0;
+
+	if (write_result_tree(st, &result_oid) < 0) {
+		result->clean = -1;
+		return;
+	}
+	result->tree = lookup_tree(opt->repo, &result_oid);
+	result->clean = clean;
+
+	if (!st->call_depth)
+		update_rename_cache(st, side2, &result_oid);
+}
+
+static struct commit_list *reverse_commit_list(struct commit_list *list)
+{
+	struct commit_list *next = NULL, *current, *backup;
+	for (current = list; current; current = backup) {
+		backup = current->next;
+		current->next = next;
+		next = current;
+	}
+	return next;
+}
+
+static struct commit *make_virtual_commit(struct repository *repo,
+					  struct tree *tree,
+					  const char *comment)
+{
+	struct commit *commit = alloc_commit_node(repo);
+
+	set_merge_remote_desc(commit, comment, (struct object *)commit);
+	commit->maybe_tree = tree;
+	commit->object.parsed = 1;
+	return commit;
+}
+
+static void merge_ort_internal(struct merge_options *opt,
+			       int call_depth,
+			       struct commit_list *merge_bases,
+			       struct commit *h1,
+			       struct commit *h2,
+			       struct merge_result *result)
+{
+	struct commit_list *iter;
+	struct commit *merged_merge_bases;
+	const char *ancestor_name, *saved_ancestor = opt->ancestor;
+	struct strbuf merge_base_abbrev = STRBUF_INIT;
+	struct merge_ort_state *st;
+
+	if (!merge_bases) {
+		merge_bases = get_merge_bases(h1, h2);
+		merge_bases = reverse_commit_list(merge_bases);
+	}
+
+	merged_merge_bases = pop_commit(&merge_bases);
+	if (merged_merge_bases == NULL) {
+		/* if there is no common ancestor, use an empty tree */
+		struct tree *tree;
+
+		tree = lookup_tree(opt->repo, opt->repo->hash_algo->empty_tree);
+		merged_merge_bases = make_virtual_commit(opt->repo, tree,
+							 "ancestor");
+		ancestor_name = "empty tree";
+	} else if (opt->ancestor && !call_depth) {
+		ancestor_name = opt->ancestor;
+	} else if (merge_bases) {
+		ancestor_name = "merged common ancestors";
+	} else {
+		strbuf_add_unique_abbrev(&merge_base_abbrev,
+					 &merged_merge_bases->object.oid,
+					 DEFAULT_ABBREV);
+		ancestor_name = merge_base_abbrev.buf;
+	}
+
+	for (iter = merge_bases; iter; iter = iter->next) {
+		const char *saved_b1, *saved_b2;
+		struct merge_result inner = { 0 };
+		struct commit *prev = merged_merge_bases;
+
+		/*
+		 * The result of merging the merge bases may have
+		 * conflicts; they are committed as they are (with
+		 * conflict markers) into the virtual merge base.
+		 */
+		saved_b1 = opt->branch1;
+		saved_b2 = opt->branch2;
+		opt->branch1 = "Temporary merge branch 1";
+		opt->branch2 = "Temporary merge branch 2";
+		merge_ort_internal(opt, call_depth + 1, NULL,
+				   prev, iter->item, &inner);
+		opt->branch1 = saved_b1;
+		opt->branch2 = saved_b2;
+
+		if (inner.clean < 0) {
+			merge_finalize(opt, &inner);
+			result->clean = -1;
+			goto out;
+		}
+		merged_merge_bases = make_virtual_commit(opt->repo, inner.tree,
+							 "merged tree");
+		commit_list_insert(prev, &merged_merge_bases->parents);
+		commit_list_insert(iter->item,
+				   &merged_merge_bases->parents->next);
+		merge_finalize(opt, &inner);
+	}
+
+	st = get_state(opt, result);
+	st->call_depth = call_depth;
+	opt->ancestor = ancestor_name;
+	merge_ort_nonrecursive_internal(st,
+					repo_get_commit_tree(opt->repo,
+							     merged_merge_bases),
+					repo_get_commit_tree(opt->repo, h1),
+					repo_get_commit_tree(opt->repo, h2),
+					result);
+out:
+	opt->ancestor = saved_ancestor;
+	strbuf_release(&merge_base_abbrev);
+	free_commit_list(merge_bases);
+}
+
+void merge_incore_nonrecursive(struct merge_options *opt,
+			       struct tree *merge_base,
+			       struct tree *side1,
+			       struct tree *side2,
+			       struct merge_result *result)
+{
+	struct merge_ort_state *st;
+
+	assert(opt->ancestor != NULL);
+
+	st = get_state(opt, result);
+	clear_merge_data(st);
+	st->call_depth = 0;
+	result->tree = NULL;
+	merge_ort_nonrecursive_internal(st, merge_base, side1, side2, result);
+}
+
+void merge_incore_recursive(struct merge_options *opt,
+			    struct commit_list *merge_bases,
+			    struct commit *side1,
+			    struct commit *side2,
+			    struct merge_result *result)
+{
+	assert(opt->ancestor == NULL ||
+	       !strcmp(opt->ancestor, "constructed merge base"));
+
+	if (result->priv)
+		clear_merge_data(result->priv);
+	result->tree = NULL;
+	merge_ort_internal(opt, 0, merge_bases, side1, side2, result);
+}
+
+static int record_conflicts(struct index_state *istate,
+			    struct merged_path **conflicted, size_t nr)
+{
+	size_t i;
+	int j;
+
+	for (i = 0; i < nr; i++) {
+		struct merged_path *e = conflicted[i];
+		const char *path = e->index_path ? e->index_path : e->path;
+		int options = ADD_CACHE_OK_TO_ADD | ADD_CACHE_OK_TO_REPLACE;
+
+		/*
+		 * Stages recorded at the original path of a file moved
+		 * aside sit next to the directory that took its place.
+		 */
+		if (e->index_path)
+			options |= ADD_CACHE_SKIP_DFCHECK;
+		remove_file_from_index(istate, e->path);
+		for (j = 0; j < 3; j++) {
+			struct cache_entry *ce;
+
+			if (!e->conflict[j].mode)
+				continue;
+			ce = make_cache_entry(istate, e->conflict[j].mode,
+					      &e->conflict[j].oid, path,
+					      j + 1, 0);
+			if (!ce)
+				return error(_("addinfo_cache failed for path '%s'"),
+					     path);
+			if (add_index_entry(istate, ce, options))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int switch_worktree(struct merge_options *opt, struct tree *head,
+			   struct tree *merged)
+{
+	struct unpack_trees_options unpack_opts;
+	struct tree_desc trees[2];
+	struct strbuf sb = STRBUF_INIT;
+	int ret;
+
+	/* Sanity check on repo state; index must match head */
+	if (repo_index_has_changes(opt->repo, head, &sb)) {
+		error(_("Your local changes to the following files would be overwritten by merge:\n  %s"),
+		      sb.buf);
+		strbuf_release(&sb);
+		return -1;
+	}
+
+	if (parse_tree(head) < 0 || parse_tree(merged) < 0)
+		return -1;
+
+	memset(&unpack_opts, 0, sizeof(unpack_opts));
+	unpack_opts.head_idx = 1;
+	unpack_opts.src_index = opt->repo->index;
+	unpack_opts.dst_index = opt->repo->index;
+	unpack_opts.update = 1;
+	unpack_opts.merge = 1;
+	unpack_opts.fn = twoway_merge;
+	init_checkout_metadata(&unpack_opts.meta, NULL,
+			       &merged->object.oid, NULL);
+	setup_unpack_trees_porcelain(&unpack_opts, "merge");
+
+	init_tree_desc(&trees[0], head->buffer, head->size);
+	init_tree_desc(&trees[1], merged->buffer, merged->size);
+	ret = unpack_trees(2, trees, &unpack_opts);
+	clear_unpack_trees_porcelain(&unpack_opts);
+	return ret ? -1 : 0;
+}
+
+static int path_entry_cmp(const void *va, const void *vb)
+{
+	const struct merged_path *a = *(const struct merged_path **)va;
+	const struct merged_path *b = *(const struct merged_path **)vb;
+
+	return strcmp(a->path, b->path);
+}
+
+int merge_switch_to_result(struct merge_options *opt,
+			   struct tree *head,
+			   struct merge_result *result,
+			   int update_worktree_and_index,
+			   int display_update_msgs)
+{
+	struct merge_ort_state *st = result->priv;
+	struct merged_path **sorted, *e;
+	struct hashmap_iter iter;
+	size_t nr = 0, i;
+	int ret = 0;
+
+	if (!st)
+		BUG("merge_switch_to_result() called without a merge");
+	if (result->clean < 0)
+		return -1;
+
+	ALLOC_ARRAY(sorted, hashmap_get_size(&st->paths));
+	hashmap_for_each_entry(&st->paths, &iter, e, ent)
+		if (!e->clean || e->messages.len)
+			sorted[nr++] = e;
+	QSORT(sorted, nr, path_entry_cmp);
+
+	if (update_worktree_and_index) {
+		size_t conflicted = 0;
+
+		for (i = 0; i < nr; i++)
+			if (!sorted[i]->clean)
+				conflicted++;
+		if (switch_worktree(opt, head, result->tree)) {
+			ret = -1;
+			goto out;
+		}
+		if (conflicted) {
+			struct merged_path **c;
+			size_t j = 0;
+
+			ALLOC_ARRAY(c, conflicted);
+			for (i = 0; i < nr; i++)
+				if (!sorted[i]->clean)
+					c[j++] = sorted[i];
+			ret = record_conflicts(opt->repo->index, c, j);
+			free(c);
+			if (ret)
+				goto out;
+		}
+	}
+
+	if (display_update_msgs) {
+		fputs(st->messages.buf, stdout);
+		for (i = 0; i < nr; i++)
+			fputs(sorted[i]->messages.buf, stdout);
+		fflush(stdout);
+		if (opt->verbosity >= 2)
+			diff_warn_rename_limit("merge.renamelimit",
+					       st->needed_rename_limit, 0);
+	}
+
+out:
+	free(sorted);
+	clear_merge_data(st);
+	return ret;
+}
+
+void merge_finalize(struct merge_options *opt,
+		    struct merge_result *result)
+{
+	struct merge_ort_state *st = result->priv;
+
+	if (!st)
+		return;
+	clear_merge_data(st);
+	hashmap_free(&st->paths);
+	string_list_clear(&st->cache.renames, 1);
+	strbuf_release(&st->messages);
+	FREE_AND_NULL(result->priv);
+}
+
+/*** Wrappers mimicking merge-recursive's API ***/
+
+int merge_ort_nonrecursive(struct merge_options *opt,
+			   struct tree *head,
+			   struct tree *merge,
+			   struct tree *merge_base)
+{
+	struct merge_result result = { 0 };
+
+	merge_incore_nonrecursive(opt, merge_base, head, merge, &result);
+	if (merge_switch_to_result(opt, head, &result, 1, 1))
+		result.clean = -1;
+	merge_finalize(opt, &result);
+
+	return result.clean;
+}
+
+int merge_ort_recursive(struct merge_options *opt,
+			struct commit *side1,
+			struct commit *side2,
+			struct commit_list *merge_bases,
+			struct commit **result)
+{
+	struct tree *head = repo_get_commit_tree(opt->repo, side1);
+	struct merge_result tmp = { 0 };
+
+	merge_incore_recursive(opt, merge_bases, side1, side2, &tmp);
+	if (merge_switch_to_result(opt, head, &tmp, 1, 1))
+		tmp.clean = -1;
+	else if (result) {
+		*result = make_virtual_commit(opt->repo, tmp.tree,
+					      "merged tree");
+		commit_list_insert(side1, &(*result)->parents);
+		commit_list_insert(side2, &(*result)->parents->next);
+	}
+	merge_finalize(opt, &tmp);
+
+	return tmp.clean;
+}
@@ -0,0 +1,112 @@
+#ifndef MERGE_ORT_H
+#define MERGE_ORT_H
+
+#include "merge-recursive.h"
+
+struct commit;
+struct tree;
+
+/*
+ * "ort" ("Ostensibly Recursive's Twin") is a merge backend that
+ * performs the whole merge on trees in memory: it neither reads nor
+ * writes the index or the working tree until the caller switches to
+ * the result, and virtual merge bases are built as trees without
+ * going through unpack_trees(). It takes the same merge_options as
+ * merge-recursive.
+ */
+
+struct merge_result {
+	/*
+	 * Whether the merge is clean; possible values:
+	 *    1: clean
+	 *    0: not clean (merge conflicts)
+	 *   <0: operation aborted prematurely. (object database
+	 *       unreadable, disk full, etc.) Worktree may be left in an
+	 *       inconsistent state if operation failed near the end.
+	 */
+	int clean;
+
+	/*
+	 * Result of merge.  If !clean, represents what would go in the
+	 * working tree (thus possibly including files containing
+	 * conflict markers).
+	 */
+	struct tree *tree;
+
+	/*
+	 * Additional metadata used by merge_switch_to_result() or future
+	 * calls to merge_incore_*(). Includes data needed to update the
+	 * index (if !clean) and to print "CONFLICT" messages, as well as
+	 * the renames detected by this merge, which a subsequent merge
+	 * can reuse. Not for external use.
+	 */
+	void *priv;
+};
+
+/*
+ * rename-detecting three-way merge with recursive ancestor
+ * consolidation. working tree and index are untouched.
+ *
+ * merge_bases will be consumed (emptied) so make a copy if you need
+ * it.
+ */
+void merge_incore_recursive(struct merge_options *opt,
+			    struct commit_list *merge_bases,
+			    struct commit *side1,
+			    struct commit *side2,
+			    struct merge_result *result);
+
+/*
+ * rename-detecting three-way merge, no recursion. working tree and
+ * index are untouched.
+ *
+ * If result->priv is left over from a previous merge that was not
+ * finalized yet, and this merge continues a sequence of picks (that
+ * is, merge_base is the previous side2 and side1 is the previous
+ * result, as for consecutive commits replayed by the sequencer), the
+ * renames that the previous merge found on side1 are reused instead
+ * of being detected again.
+ */
+void merge_incore_nonrecursive(struct merge_options *opt,
+			       struct tree *merge_base,
+			       struct tree *side1,
+			       struct tree *side2,
+			       struct merge_result *result);
+
+/*
+ * Update the working tree and index from head to result after
+ * incore merge. Returns 0 on success, -1 if the working tree could
+ * not be updated (e.g. because of local changes); the index and
+ * working tree are left untouched in that case.
+ *
+ * The index is updated in opt->repo->index but not written out.
+ * Unless merge_finalize() is called, result->priv is kept so that it
+ * can be passed on to the next merge.
+ */
+int merge_switch_to_result(struct merge_options *opt,
+			   struct tree *head,
+			   struct merge_result *result,
+			   int update_worktree_and_index,
+			   int display_update_msgs);
+
+/* Do needed cleanup when not calling merge_switch_to_result() */
+void merge_finalize(struct merge_options *opt,
+		    struct merge_result *result);
+
+/*
+ * Drop-in replacements for merge_trees() and merge_recursive() (see
+ * merge-recursive.h for the return values): they merge in core and
+ * then update the index and working tree.
+ */
+int merge_ort_nonrecursive(struct merge_options *opt,
+			   struct tree *head,
+			   struct tree *merge,
+			   struct tree *merge_base);
+
+int merge_ort_recursive(struct merge_options *opt,
+			struct commit *h1,
+			struct commit *h2,
+			struct commit_list *merge_bases,
+			struct commit **result);
+
+#endif
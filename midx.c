@@ -10,6 +10,11 @@
 #include "progress.h"
 #include "trace2.h"
 #include "run-command.h"
+#include "revision.h"
+#include "refs.h"
+#include "tag.h"
+#include "pack-objects.h"
+#include "pack-bitmap.h"
 
 #define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
 #define MIDX_VERSION 1
@@ -20,17 +25,19 @@
 #define MIDX_HEADER_SIZE 12
 #define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + the_hash_algo->rawsz)
 
-#define MIDX_MAX_CHUNKS 5
+#define MIDX_MAX_CHUNKS 6
 #define MIDX_CHUNK_ALIGNMENT 4
 #define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
 #define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
 #define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+#define MIDX_CHUNKID_REVINDEX 0x52494458 /* "RIDX" */
 #define MIDX_CHUNKLOOKUP_WIDTH (sizeof(uint32_t) + sizeof(uint64_t))
 #define MIDX_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
 #define MIDX_CHUNK_OFFSET_WIDTH (2 * sizeof(uint32_t))
 #define MIDX_CHUNK_LARGE_OFFSET_WIDTH (sizeof(uint64_t))
+#define MIDX_CHUNK_REVINDEX_WIDTH (sizeof(uint32_t))
 #define MIDX_LARGE_OFFSET_NEEDED 0x80000000
 
 #define PACK_EXPIRED UINT_MAX
@@ -52,6 +59,23 @@ static char *get_midx_filename(const char *object_dir)
 	return xstrfmt("%s/pack/multi-pack-index", object_dir);
 }
 
+const unsigned char *get_midx_checksum(struct multi_pack_index *m)
+{
+	return m->data + m->data_len - the_hash_algo->rawsz;
+}
+
+static char *midx_bitmap_filename(const char *object_dir,
+				  const unsigned char *hash)
+{
+	return xstrfmt("%s/pack/multi-pack-index-%s.bitmap",
+		       object_dir, hash_to_hex(hash));
+}
+
+char *get_midx_bitmap_filename(struct multi_pack_index *m)
+{
+	return midx_bitmap_filename(m->object_dir, get_midx_checksum(m));
+}
+
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
 {
 	struct multi_pack_index *m = NULL;
@@ -142,6 +166,10 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 				m->chunk_large_offsets = m->data + chunk_offset;
 				break;
 
+			case MIDX_CHUNKID_REVINDEX:
+				m->chunk_revindex = m->data + chunk_offset;
+				break;
+
 			case 0:
 				die(_("terminating multi-pack-index chunk id appears earlier than expected"));
 				break;
@@ -166,6 +194,15 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 
 	m->num_objects = ntohl(m->chunk_oid_fanout[255]);
 
+	if (m->chunk_revindex) {
+		if (m->chunk_revindex + m->num_objects * MIDX_CHUNK_REVINDEX_WIDTH >
+		    m->data + m->data_len - the_hash_algo->rawsz)
+			die(_("multi-pack-index revindex chunk is too small"));
+		if (m->num_objects)
+			m->preferred_pack = nth_midxed_pack_int_id(m,
+						pack_pos_to_midx(m, 0));
+	}
+
 	m->pack_names = xcalloc(m->num_packs, sizeof(*m->pack_names));
 	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
 
@@ -259,7 +296,7 @@ struct object_id *nth_midxed_object_oid(struct object_id *oid,
 	return oid;
 }
 
-static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 {
 	const unsigned char *offset_data;
 	uint32_t offset32;
@@ -278,11 +315,76 @@ static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 	return offset32;
 }
 
-static uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
 {
 	return get_be32(m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH);
 }
 
+uint32_t pack_pos_to_midx(struct multi_pack_index *m, uint32_t pos)
+{
+	if (!m->chunk_revindex)
+		BUG("pack_pos_to_midx: multi-pack-index has no revindex chunk");
+	if (pos >= m->num_objects)
+		BUG("pack_pos_to_midx: out-of-bounds object at %"PRIu32, pos);
+
+	return get_be32(m->chunk_revindex + pos * MIDX_CHUNK_REVINDEX_WIDTH);
+}
+
+/*
+ * Compare the pseudo-pack positions of the objects at multi-pack-index
+ * positions "a" and "b": objects from the preferred pack sort first,
+ * everything else by pack-int-id and then by offset.
+ */
+static int midx_pack_order_cmp(struct multi_pack_index *m, uint32_t a, uint32_t b)
+{
+	uint32_t pack_a = nth_midxed_pack_int_id(m, a);
+	uint32_t pack_b = nth_midxed_pack_int_id(m, b);
+	off_t ofs_a, ofs_b;
+
+	if (pack_a != pack_b) {
+		if (pack_a == m->preferred_pack)
+			return -1;
+		if (pack_b == m->preferred_pack)
+			return 1;
+		return pack_a < pack_b ? -1 : 1;
+	}
+
+	ofs_a = nth_midxed_offset(m, a);
+	ofs_b = nth_midxed_offset(m, b);
+	if (ofs_a != ofs_b)
+		return ofs_a < ofs_b ? -1 : 1;
+	return 0;
+}
+
+int midx_to_pack_pos(struct multi_pack_index *m, uint32_t at, uint32_t *pos)
+{
+	uint32_t lo = 0, hi;
+
+	if (!m->chunk_revindex)
+		BUG("midx_to_pack_pos: multi-pack-index has no revindex chunk");
+	if (at >= m->num_objects)
+		return error(_("object at position %"PRIu32" is not in the multi-pack-index"),
+			     at);
+
+	hi = m->num_objects;
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = midx_pack_order_cmp(m, at, pack_pos_to_midx(m, mi));
+
+		if (!cmp) {
+			*pos = mi;
+			return 0;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+
+	return error(_("multi-pack-index revindex has no entry for position %"PRIu32),
+		     at);
+}
+
 static int nth_midxed_pack_entry(struct repository *r,
 				 struct multi_pack_index *m,
 				 struct pack_entry *e,
@@ -507,6 +609,7 @@ struct pack_midx_entry {
 	uint32_t pack_int_id;
 	time_t pack_mtime;
 	uint64_t offset;
+	unsigned preferred : 1;
 };
 
 static int midx_oid_compare(const void *_a, const void *_b)
@@ -518,6 +621,12 @@ static int midx_oid_compare(const void *_a, const void *_b)
 	if (cmp)
 		return cmp;
 
+	/* Sort objects in the preferred pack ahead of any duplicates. */
+	if (a->preferred > b->preferred)
+		return -1;
+	if (a->preferred < b->preferred)
+		return 1;
+
 	if (a->pack_mtime > b->pack_mtime)
 		return -1;
 	else if (a->pack_mtime < b->pack_mtime)
@@ -539,13 +648,15 @@ static int nth_midxed_pack_midx_entry(struct multi_pack_index *m,
 
 	/* consider objects in midx to be from "old" packs */
 	e->pack_mtime = 0;
+	e->preferred = 0;
 	return 0;
 }
 
 static void fill_pack_entry(uint32_t pack_int_id,
 			    struct packed_git *p,
 			    uint32_t cur_object,
-			    struct pack_midx_entry *entry)
+			    struct pack_midx_entry *entry,
+			    int preferred)
 {
 	if (nth_packed_object_id(&entry->oid, p, cur_object) < 0)
 		die(_("failed to locate object %d in packfile"), cur_object);
@@ -554,6 +665,7 @@ static void fill_pack_entry(uint32_t pack_int_id,
 	entry->pack_mtime = p->mtime;
 
 	entry->offset = nth_packed_object_offset(p, cur_object);
+	entry->preferred = !!preferred;
 }
 
 /*
@@ -565,12 +677,14 @@ static void fill_pack_entry(uint32_t pack_int_id,
  * tables to group the data, copy to a local array, then sort.
  *
  * Copy only the de-duplicated entries (selected by most-recent modified time
- * of a packfile containing the object).
+ * of a packfile containing the object, unless the object is also in the
+ * preferred pack, which always wins).
  */
 static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 						  struct pack_info *info,
 						  uint32_t nr_packs,
-						  uint32_t *nr_objects)
+						  uint32_t *nr_objects,
+						  int preferred_pack)
 {
 	uint32_t cur_fanout, cur_pack, cur_object;
 	uint32_t alloc_fanout, alloc_objects, total_objects = 0;
@@ -620,7 +734,9 @@ static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 
 			for (cur_object = start; cur_object < end; cur_object++) {
 				ALLOC_GROW(entries_by_fanout, nr_fanout + 1, alloc_fanout);
-				fill_pack_entry(cur_pack, info[cur_pack].p, cur_object, &entries_by_fanout[nr_fanout]);
+				fill_pack_entry(cur_pack, info[cur_pack].p, cur_object,
+						&entries_by_fanout[nr_fanout],
+						cur_pack == preferred_pack);
 				nr_fanout++;
 			}
 		}
@@ -800,8 +916,249 @@ static size_t write_midx_large_offsets(struct hashfile *f, uint32_t nr_large_off
 	return written;
 }
 
+struct midx_pack_order_data {
+	uint32_t nr;
+	uint32_t pack;
+	off_t offset;
+};
+
+static int midx_pack_order_data_cmp(const void *va, const void *vb)
+{
+	const struct midx_pack_order_data *a = va, *b = vb;
+
+	if (a->pack < b->pack)
+		return -1;
+	if (a->pack > b->pack)
+		return 1;
+	if (a->offset < b->offset)
+		return -1;
+	if (a->offset > b->offset)
+		return 1;
+	return 0;
+}
+
+/*
+ * Compute the pseudo-pack order of the objects: pack_order[i] is the
+ * position in "entries" of the i-th object in that order.
+ */
+static uint32_t *midx_pack_order(struct pack_midx_entry *entries,
+				 uint32_t nr_entries,
+				 uint32_t *pack_perm)
+{
+	struct midx_pack_order_data *data;
+	uint32_t *pack_order;
+	uint32_t i;
+
+	ALLOC_ARRAY(data, nr_entries);
+	for (i = 0; i < nr_entries; i++) {
+		struct pack_midx_entry *e = &entries[i];
+
+		data[i].nr = i;
+		data[i].pack = pack_perm[e->pack_int_id];
+		if (!e->preferred)
+			data[i].pack |= (1U << 31);
+		data[i].offset = e->offset;
+	}
+
+	QSORT(data, nr_entries, midx_pack_order_data_cmp);
+
+	ALLOC_ARRAY(pack_order, nr_entries);
+	for (i = 0; i < nr_entries; i++)
+		pack_order[i] = data[i].nr;
+
+	free(data);
+	return pack_order;
+}
+
+static size_t write_midx_revindex(struct hashfile *f, uint32_t *pack_order,
+				  uint32_t nr_objects)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, pack_order[i]);
+
+	return nr_objects * MIDX_CHUNK_REVINDEX_WIDTH;
+}
+
+static int midx_entries_contain(struct pack_midx_entry *entries,
+				uint32_t nr_entries,
+				const struct object_id *oid)
+{
+	uint32_t lo = 0, hi = nr_entries;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = oidcmp(oid, &entries[mi].oid);
+
+		if (!cmp)
+			return 1;
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+
+	return 0;
+}
+
+struct bitmap_tips_data {
+	struct rev_info *revs;
+	struct pack_midx_entry *entries;
+	uint32_t nr_entries;
+};
+
+static int add_ref_to_pending(const char *refname,
+			      const struct object_id *oid,
+			      int flag, void *cb_data)
+{
+	struct bitmap_tips_data *data = cb_data;
+	struct object *object;
+
+	if (!midx_entries_contain(data->entries, data->nr_entries, oid))
+		return 0;
+
+	object = parse_object(the_repository, oid);
+	object = deref_tag(the_repository, object, refname, 0);
+	if (!object || object->type != OBJ_COMMIT)
+		return 0;
+
+	add_pending_object(data->revs, object, refname);
+	return 0;
+}
+
+/*
+ * Collect the commits reachable from the refs whose tips are in the
+ * multi-pack-index; these are the candidates for bitmaps.
+ */
+static struct commit **find_midx_bitmap_commits(struct pack_midx_entry *entries,
+						uint32_t nr_entries,
+						uint32_t *commits_nr)
+{
+	struct rev_info revs;
+	struct bitmap_tips_data data;
+	struct commit **commits = NULL;
+	struct commit *c;
+	uint32_t commits_alloc = 0;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+
+	data.revs = &revs;
+	data.entries = entries;
+	data.nr_entries = nr_entries;
+	for_each_ref(add_ref_to_pending, &data);
+
+	*commits_nr = 0;
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+	while ((c = get_revision(&revs))) {
+		ALLOC_GROW(commits, *commits_nr + 1, commits_alloc);
+		commits[(*commits_nr)++] = c;
+	}
+
+	reset_revision_walk();
+	return commits;
+}
+
+static void write_midx_bitmap(const char *object_dir,
+			      const unsigned char *midx_hash,
+			      struct pack_midx_entry *entries,
+			      uint32_t nr_entries,
+			      uint32_t *pack_order,
+			      unsigned flags)
+{
+	struct packing_data pdata;
+	struct pack_idx_entry **index;
+	struct commit **commits;
+	uint32_t i, commits_nr;
+	uint16_t options = 0;
+	int lookup_table = 0;
+	char *bitmap_name = midx_bitmap_filename(object_dir, midx_hash);
+
+	trace2_region_enter("midx", "write_midx_bitmap", the_repository);
+
+	/*
+	 * Bitmap positions are positions in the pseudo-pack order, so
+	 * build the object list the bitmap writer works on in that order.
+	 */
+	memset(&pdata, 0, sizeof(pdata));
+	prepare_packing_data(the_repository, &pdata);
+	for (i = 0; i < nr_entries; i++)
+		packlist_alloc(&pdata, &entries[pack_order[i]].oid);
+
+	ALLOC_ARRAY(index, nr_entries);
+	for (i = 0; i < nr_entries; i++)
+		index[i] = &pdata.objects[i].idx;
+
+	commits = find_midx_bitmap_commits(entries, nr_entries, &commits_nr);
+
+	bitmap_writer_show_progress(flags & MIDX_PROGRESS);
+	bitmap_writer_build_type_index(&pdata, index, nr_entries);
+	bitmap_writer_select_commits(commits, commits_nr, -1);
+	bitmap_writer_build(&pdata);
+
+	/* bitmap_writer_finish() wants the objects in object ID order */
+	for (i = 0; i < nr_entries; i++)
+		index[pack_order[i]] = &pdata.objects[i].idx;
+
+	bitmap_writer_set_checksum((unsigned char *)midx_hash);
+	if (!git_config_get_bool("pack.writebitmaplookuptable", &lookup_table) &&
+	    lookup_table)
+		options |= BITMAP_OPT_LOOKUP_TABLE;
+	bitmap_writer_finish(index, nr_entries, bitmap_name, options);
+
+	trace2_region_leave("midx", "write_midx_bitmap", the_repository);
+
+	free(index);
+	free(commits);
+	free(bitmap_name);
+	free(pdata.objects);
+	free(pdata.index);
+	free(pdata.in_pack_pos);
+	free(pdata.in_pack_by_idx);
+	free(pdata.in_pack);
+}
+
+struct clear_midx_bitmaps_data {
+	char *keep;
+};
+
+static void clear_midx_bitmap(const char *full_path, size_t full_path_len,
+			      const char *file_name, void *_data)
+{
+	struct clear_midx_bitmaps_data *data = _data;
+
+	if (!starts_with(file_name, "multi-pack-index-") ||
+	    !ends_with(file_name, ".bitmap"))
+		return;
+	if (data->keep && !strcmp(data->keep, file_name))
+		return;
+
+	unlink_or_warn(full_path);
+}
+
+/*
+ * Remove the bitmaps of all multi-pack-indexes in "object_dir", except
+ * the one belonging to the multi-pack-index with checksum "keep_hash"
+ * (if any).
+ */
+static void clear_midx_bitmaps(const char *object_dir,
+			       const unsigned char *keep_hash)
+{
+	struct clear_midx_bitmaps_data data = { NULL };
+
+	if (keep_hash)
+		data.keep = xstrfmt("multi-pack-index-%s.bitmap",
+				    hash_to_hex(keep_hash));
+
+	for_each_file_in_pack_dir(object_dir, clear_midx_bitmap, &data);
+	free(data.keep);
+}
+
 static int write_midx_internal(const char *object_dir, struct multi_pack_index *m,
-			       struct string_list *packs_to_drop, unsigned flags)
+			       struct string_list *packs_to_drop,
+			       const char *preferred_pack_name,
+			       unsigned flags)
 {
 	unsigned char cur_chunk, num_chunks = 0;
 	char *midx_name;
@@ -819,6 +1176,9 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	int large_offsets_needed = 0;
 	int pack_name_concat_len = 0;
 	int dropped_packs = 0;
+	int preferred_pack = -1;
+	uint32_t *pack_order = NULL;
+	unsigned char midx_hash[GIT_MAX_RAWSZ];
 	int result = 0;
 
 	midx_name = get_midx_filename(object_dir);
@@ -828,8 +1188,16 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 
 	if (m)
 		packs.m = m;
-	else
+	else if (!(flags & MIDX_WRITE_BITMAP) && !preferred_pack_name)
 		packs.m = load_multi_pack_index(object_dir, 1);
+	else
+		/*
+		 * Read every pack from scratch rather than reusing the
+		 * de-duplicated entries of the existing multi-pack-index,
+		 * so that the preferred pack is credited with all of its
+		 * objects.
+		 */
+		packs.m = NULL;
 
 	packs.nr = 0;
 	packs.alloc = packs.m ? packs.m->num_packs : 16;
@@ -860,7 +1228,36 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	if (packs.m && packs.nr == packs.m->num_packs && !packs_to_drop)
 		goto cleanup;
 
-	entries = get_sorted_entries(packs.m, packs.info, packs.nr, &nr_entries);
+	if (preferred_pack_name) {
+		for (i = 0; i < packs.nr; i++) {
+			if (!cmp_idx_or_pack_name(preferred_pack_name,
+						  packs.info[i].pack_name)) {
+				preferred_pack = i;
+				break;
+			}
+		}
+
+		if (preferred_pack < 0) {
+			error(_("unknown preferred pack: '%s'"),
+			      preferred_pack_name);
+			result = 1;
+			goto cleanup;
+		}
+	} else if (flags & MIDX_WRITE_BITMAP) {
+		/* Default to the oldest pack that has any objects. */
+		for (i = 0; i < packs.nr; i++) {
+			struct packed_git *p = packs.info[i].p;
+
+			if (!p || !p->num_objects)
+				continue;
+			if (preferred_pack < 0 ||
+			    p->mtime < packs.info[preferred_pack].p->mtime)
+				preferred_pack = i;
+		}
+	}
+
+	entries = get_sorted_entries(packs.m, packs.info, packs.nr, &nr_entries,
+				     preferred_pack);
 
 	for (i = 0; i < nr_entries; i++) {
 		if (entries[i].offset > 0x7fffffff)
@@ -920,6 +1317,9 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 			pack_name_concat_len += strlen(packs.info[i].pack_name) + 1;
 	}
 
+	if (flags & MIDX_WRITE_BITMAP)
+		pack_order = midx_pack_order(entries, nr_entries, pack_perm);
+
 	if (pack_name_concat_len % MIDX_CHUNK_ALIGNMENT)
 		pack_name_concat_len += MIDX_CHUNK_ALIGNMENT -
 					(pack_name_concat_len % MIDX_CHUNK_ALIGNMENT);
@@ -933,6 +1333,8 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 
 	cur_chunk = 0;
 	num_chunks = large_offsets_needed ? 5 : 4;
+	if (flags & MIDX_WRITE_BITMAP)
+		num_chunks++;
 
 	if (packs.nr - dropped_packs == 0) {
 		error(_("no pack files to index."));
@@ -967,6 +1369,14 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 					   num_large_offsets * MIDX_CHUNK_LARGE_OFFSET_WIDTH;
 	}
 
+	if (flags & MIDX_WRITE_BITMAP) {
+		chunk_ids[cur_chunk] = MIDX_CHUNKID_REVINDEX;
+
+		cur_chunk++;
+		chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1] +
+					   nr_entries * MIDX_CHUNK_REVINDEX_WIDTH;
+	}
+
 	chunk_ids[cur_chunk] = 0;
 
 	for (i = 0; i <= num_chunks; i++) {
@@ -1017,6 +1427,10 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 				written += write_midx_large_offsets(f, num_large_offsets, entries, nr_entries);
 				break;
 
+			case MIDX_CHUNKID_REVINDEX:
+				written += write_midx_revindex(f, pack_order, nr_entries);
+				break;
+
 			default:
 				BUG("trying to write unknown chunk id %"PRIx32,
 				    chunk_ids[i]);
@@ -1031,9 +1445,17 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		    written,
 		    chunk_offsets[num_chunks]);
 
-	finalize_hashfile(f, NULL, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
+	finalize_hashfile(f, midx_hash, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
+
+	if (flags & MIDX_WRITE_BITMAP)
+		write_midx_bitmap(object_dir, midx_hash, entries, nr_entries,
+				  pack_order, flags);
+
 	commit_lock_file(&lk);
 
+	clear_midx_bitmaps(object_dir,
+			   (flags & MIDX_WRITE_BITMAP) ? midx_hash : NULL);
+
 cleanup:
 	for (i = 0; i < packs.nr; i++) {
 		if (packs.info[i].p) {
@@ -1046,13 +1468,16 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	free(packs.info);
 	free(entries);
 	free(pack_perm);
+	free(pack_order);
 	free(midx_name);
 	return result;
 }
 
-int write_midx_file(const char *object_dir, unsigned flags)
+int write_midx_file(const char *object_dir, const char *preferred_pack_name,
+		    unsigned flags)
 {
-	return write_midx_internal(object_dir, NULL, NULL, flags);
+	return write_midx_internal(object_dir, NULL, NULL, preferred_pack_name,
+				   flags);
 }
 
 void clear_midx_file(struct repository *r)
@@ -1067,6 +1492,8 @@ void clear_midx_file(struct repository *r)
 	if (remove_path(midx))
 		die(_("failed to clear multi-pack-index at %s"), midx);
 
+	clear_midx_bitmaps(r->objects->odb->path, NULL);
+
 	free(midx);
 }
 
@@ -1287,7 +1714,7 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 	free(count);
 
 	if (packs_to_drop.nr)
-		result = write_midx_internal(object_dir, m, &packs_to_drop, flags);
+		result = write_midx_internal(object_dir, m, &packs_to_drop, NULL, flags);
 
 	string_list_clear(&packs_to_drop, 0);
 	return result;
@@ -1476,7 +1903,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 		goto cleanup;
 	}
 
-	result = write_midx_internal(object_dir, m, NULL, flags);
+	result = write_midx_internal(object_dir, m, NULL, NULL, flags);
 	m = NULL;
 
 cleanup:
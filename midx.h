@@ -29,6 +29,13 @@ struct multi_pack_index {
 	const unsigned char *chunk_oid_lookup;
 	const unsigned char *chunk_object_offsets;
 	const unsigned char *chunk_large_offsets;
+	const unsigned char *chunk_revindex;
+
+	/*
+	 * The pack whose objects come first in the pseudo-pack order of
+	 * the revindex chunk. Only meaningful when chunk_revindex is set.
+	 */
+	uint32_t preferred_pack;
 
 	const char **pack_names;
 	struct packed_git **packs;
@@ -36,6 +43,7 @@ struct multi_pack_index {
 };
 
 #define MIDX_PROGRESS     (1 << 0)
+#define MIDX_WRITE_BITMAP (1 << 1)
 
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id);
@@ -43,11 +51,27 @@ int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m, uint32
 struct object_id *nth_midxed_object_oid(struct object_id *oid,
 					struct multi_pack_index *m,
 					uint32_t n);
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos);
+const unsigned char *get_midx_checksum(struct multi_pack_index *m);
+char *get_midx_bitmap_filename(struct multi_pack_index *m);
+
+/*
+ * A multi-pack-index written with a bitmap orders its objects in a
+ * "pseudo-pack": all objects from the preferred pack in pack order,
+ * followed by the objects of the remaining packs ordered by pack-int-id
+ * and then by offset. These functions translate between positions in
+ * that order and positions in the multi-pack-index (which is sorted by
+ * object ID). Both require the revindex chunk to be present.
+ */
+uint32_t pack_pos_to_midx(struct multi_pack_index *m, uint32_t pos);
+int midx_to_pack_pos(struct multi_pack_index *m, uint32_t at, uint32_t *pos);
 int fill_midx_entry(struct repository *r, const struct object_id *oid, struct pack_entry *e, struct multi_pack_index *m);
 int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name);
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local);
 
-int write_midx_file(const char *object_dir, unsigned flags);
+int write_midx_file(const char *object_dir, const char *preferred_pack_name,
+		    unsigned flags);
 void clear_midx_file(struct repository *r);
 int verify_midx_file(struct repository *r, const char *object_dir, unsigned flags);
 int expire_midx_packs(struct repository *r, const char *object_dir, unsigned flags);
@@ -571,11 +571,155 @@ static void threaded_lazy_init_name_hash(
 	free(lazy_entries);
 }
 
+/*
+ * The name hash as read from the index extension: the hash of each
+ * entry, in index order, optionally followed by the directories with
+ * their hash, the hash of their parent, and their ref-count.
+ */
+struct name_hash_ext {
+	unsigned int flags;
+	unsigned int nr;
+	size_t size;
+	char data[FLEX_ARRAY];
+};
+
+#define NAME_HASH_EXT_DIRS (1 << 0)
+#define NAME_HASH_EXT_HDR_SIZE (2 * sizeof(uint32_t))
+
+struct name_hash_ext *read_name_hash_extension(const void *data,
+					       unsigned long sz)
+{
+	struct name_hash_ext *ext;
+	unsigned int nr;
+
+	if (sz < NAME_HASH_EXT_HDR_SIZE) {
+		warning(_("corrupt name hash extension (too short)"));
+		return NULL;
+	}
+	nr = get_be32((const char *)data + sizeof(uint32_t));
+	if ((sz - NAME_HASH_EXT_HDR_SIZE) / sizeof(uint32_t) < nr) {
+		warning(_("corrupt name hash extension (%u entries)"), nr);
+		return NULL;
+	}
+
+	FLEX_ALLOC_MEM(ext, data, data, sz);
+	ext->flags = get_be32(data);
+	ext->nr = nr;
+	ext->size = sz;
+	return ext;
+}
+
+static void discard_name_hash_ext(struct index_state *istate)
+{
+	FREE_AND_NULL(istate->name_hash_ext);
+}
+
+static int dir_entry_namelen_cmp(const void *a_, const void *b_)
+{
+	const struct dir_entry *a = *(const struct dir_entry **)a_;
+	const struct dir_entry *b = *(const struct dir_entry **)b_;
+
+	return a->namelen < b->namelen ? -1 : a->namelen > b->namelen;
+}
+
+/*
+ * Rebuild the hash tables from the extension. "skip" is an entry that
+ * was added to the index since it was read, and is hashed by the
+ * caller. Returns -1 (with the tables left uninitialized) if the
+ * extension does not describe the index.
+ */
+static int load_name_hash_ext(struct index_state *istate,
+			      struct cache_entry *skip)
+{
+	struct name_hash_ext *ext = istate->name_hash_ext;
+	const char *hashes = ext->data + NAME_HASH_EXT_HDR_SIZE;
+	const char *p, *end = ext->data + ext->size;
+	unsigned int i, j, dir_nr;
+
+	istate->name_hash_ext = NULL;
+	if (ext->nr != istate->cache_nr - !!skip ||
+	    (ignore_case && !(ext->flags & NAME_HASH_EXT_DIRS))) {
+		free(ext);
+		return -1;
+	}
+
+	trace_performance_enter();
+	hashmap_init(&istate->name_hash, cache_entry_cmp, NULL, istate->cache_nr);
+	hashmap_init(&istate->dir_hash, dir_entry_cmp, NULL, istate->cache_nr);
+
+	for (i = j = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce == skip)
+			continue;
+		ce->ce_flags |= CE_HASHED;
+		hashmap_entry_init(&ce->ent, get_be32(hashes + j++ * sizeof(uint32_t)));
+		hashmap_add(&istate->name_hash, &ce->ent);
+	}
+	if (!ignore_case)
+		goto done;
+
+	/* parents come before their subdirectories */
+	p = hashes + ext->nr * sizeof(uint32_t);
+	if (end - p < (ptrdiff_t)sizeof(uint32_t))
+		goto corrupt;
+	dir_nr = get_be32(p);
+	p += sizeof(uint32_t);
+	for (i = 0; i < dir_nr; i++) {
+		struct dir_entry *dir;
+		const char *name = p + 3 * sizeof(uint32_t);
+		const char *nul;
+		unsigned int namelen;
+		int len;
+
+		if (end - name < 1 || !(nul = memchr(name, '\0', end - name)))
+			goto corrupt;
+		namelen = nul - name;
+
+		FLEX_ALLOC_MEM(dir, name, name, namelen);
+		hashmap_entry_init(&dir->ent, get_be32(p));
+		dir->namelen = namelen;
+		dir->nr = get_be32(p + 2 * sizeof(uint32_t));
+
+		for (len = namelen - 1; len >= 0 && !is_dir_sep(name[len]); len--)
+			; /* find the parent */
+		if (len >= 0) {
+			dir->parent = find_dir_entry__hash(istate, name, len,
+							   get_be32(p + sizeof(uint32_t)));
+			if (!dir->parent) {
+				free(dir);
+				goto corrupt;
+			}
+		}
+		hashmap_add(&istate->dir_hash, &dir->ent);
+		p = nul + 1;
+	}
+
+done:
+	free(ext);
+	istate->name_hash_initialized = 1;
+	trace2_data_intmax("index", the_repository, "name_hash/loaded", j);
+	trace_performance_leave("load name hash");
+	return 0;
+
+corrupt:
+	warning(_("corrupt name hash extension (bad directories)"));
+	free(ext);
+	for (i = 0; i < istate->cache_nr; i++)
+		istate->cache[i]->ce_flags &= ~CE_HASHED;
+	hashmap_free(&istate->name_hash);
+	hashmap_free_entries(&istate->dir_hash, struct dir_entry, ent);
+	trace_performance_leave("load name hash");
+	return -1;
+}
+
 static void lazy_init_name_hash(struct index_state *istate)
 {
 
 	if (istate->name_hash_initialized)
 		return;
+	if (istate->name_hash_ext && !load_name_hash_ext(istate, NULL))
+		return;
 	trace_performance_enter();
 	hashmap_init(&istate->name_hash, cache_entry_cmp, NULL, istate->cache_nr);
 	hashmap_init(&istate->dir_hash, dir_entry_cmp, NULL, istate->cache_nr);
@@ -614,19 +758,93 @@ int test_lazy_init_name_hash(struct index_state *istate, int try_threaded)
 	lazy_nr_dir_threads = 0;
 	lazy_try_threaded = try_threaded;
 
+	discard_name_hash_ext(istate);
 	lazy_init_name_hash(istate);
 
 	return lazy_nr_dir_threads;
 }
 
+/*
+ * A test routine for t/helper/ sources.
+ *
+ * Returns 0 when the name hash was loaded from
+ * the index extension, -1 otherwise.
+ */
+int test_load_name_hash(struct index_state *istate)
+{
+	if (istate->name_hash_initialized || !istate->name_hash_ext)
+		return -1;
+	return load_name_hash_ext(istate, NULL);
+}
+
+void write_name_hash_extension(struct strbuf *sb, struct index_state *istate)
+{
+	struct hashmap_iter iter;
+	struct dir_entry *dir, **dirs;
+	unsigned int i, dir_nr;
+	uint32_t val;
+
+	/* nothing was added or removed since the index was read */
+	if (!istate->name_hash_initialized && istate->name_hash_ext &&
+	    istate->name_hash_ext->nr == istate->cache_nr &&
+	    (!ignore_case || istate->name_hash_ext->flags & NAME_HASH_EXT_DIRS)) {
+		strbuf_add(sb, istate->name_hash_ext->data,
+			   istate->name_hash_ext->size);
+		return;
+	}
+
+	lazy_init_name_hash(istate);
+
+	put_be32(&val, ignore_case ? NAME_HASH_EXT_DIRS : 0);
+	strbuf_add(sb, &val, sizeof(val));
+	put_be32(&val, istate->cache_nr);
+	strbuf_add(sb, &val, sizeof(val));
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		put_be32(&val, ce->ce_flags & CE_HASHED ? ce->ent.hash :
+			 memihash(ce->name, ce_namelen(ce)));
+		strbuf_add(sb, &val, sizeof(val));
+	}
+	if (!ignore_case)
+		return;
+
+	dir_nr = hashmap_get_size(&istate->dir_hash);
+	ALLOC_ARRAY(dirs, dir_nr);
+	i = 0;
+	hashmap_for_each_entry(&istate->dir_hash, &iter, dir, ent)
+		dirs[i++] = dir;
+	QSORT(dirs, dir_nr, dir_entry_namelen_cmp);
+
+	put_be32(&val, dir_nr);
+	strbuf_add(sb, &val, sizeof(val));
+	for (i = 0; i < dir_nr; i++) {
+		dir = dirs[i];
+		put_be32(&val, dir->ent.hash);
+		strbuf_add(sb, &val, sizeof(val));
+		put_be32(&val, dir->parent ? dir->parent->ent.hash : 0);
+		strbuf_add(sb, &val, sizeof(val));
+		put_be32(&val, dir->nr);
+		strbuf_add(sb, &val, sizeof(val));
+		strbuf_add(sb, dir->name, dir->namelen);
+		strbuf_addch(sb, '\0');
+	}
+	free(dirs);
+}
+
 void add_name_hash(struct index_state *istate, struct cache_entry *ce)
 {
+	/* "ce" is already in the index, but not in the extension */
+	if (!istate->name_hash_initialized && istate->name_hash_ext)
+		load_name_hash_ext(istate, ce);
 	if (istate->name_hash_initialized)
 		hash_index_entry(istate, ce);
 }
 
 void remove_name_hash(struct index_state *istate, struct cache_entry *ce)
 {
+	if (!istate->name_hash_initialized && istate->name_hash_ext)
+		load_name_hash_ext(istate, NULL);
 	if (!istate->name_hash_initialized || !(ce->ce_flags & CE_HASHED))
 		return;
 	ce->ce_flags &= ~CE_HASHED;
@@ -722,6 +940,7 @@ struct cache_entry *index_file_exists(struct index_state *istate, const char *na
 
 void free_name_hash(struct index_state *istate)
 {
+	discard_name_hash_ext(istate);
 	if (!istate->name_hash_initialized)
 		return;
 	istate->name_hash_initialized = 0;
@@ -11,8 +11,10 @@
 #include "pack-objects.h"
 #include "packfile.h"
 #include "repository.h"
+#include "midx.h"
 #include "object-store.h"
 #include "list-objects-filter-options.h"
+#include "config.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -28,14 +30,21 @@ struct stored_bitmap {
 /*
  * The active bitmap index for a repository. By design, repositories only have
  * a single bitmap index available (the index for the biggest packfile in
- * the repository), since bitmap indexes need full closure.
+ * the repository, or the one for the multi-pack-index), since bitmap indexes
+ * need full closure.
  *
  * If there is more than one bitmap index available (e.g. because of alternates),
  * the active bitmap index is the largest one.
  */
 struct bitmap_index {
-	/* Packfile to which this bitmap index belongs to */
+	/*
+	 * The bitmap either belongs to a single packfile ("pack"), or to
+	 * a multi-pack-index ("midx"), in which case bit positions refer
+	 * to the pseudo-pack order of its revindex chunk. Exactly one of
+	 * them is set.
+	 */
 	struct packed_git *pack;
+	struct multi_pack_index *midx;
 
 	/*
 	 * Mark the first `reuse_objects` in the packfile as reused:
@@ -70,6 +79,13 @@ struct bitmap_index {
 	/* If not NULL, this is a name-hash cache pointing into map. */
 	uint32_t *hashes;
 
+	/*
+	 * If not NULL, this points into map at the lookup table (see
+	 * BITMAP_OPT_LOOKUP_TABLE), and commit bitmaps are only read
+	 * from disk when they are first needed.
+	 */
+	const unsigned char *table_lookup;
+
 	/*
 	 * Extended index.
 	 *
@@ -94,6 +110,49 @@ struct bitmap_index {
 	unsigned int version;
 };
 
+static uint32_t bitmap_num_objects(struct bitmap_index *index)
+{
+	if (index->midx)
+		return index->midx->num_objects;
+	return index->pack->num_objects;
+}
+
+/* Object ID of the object at position "index_pos" of the .idx or MIDX. */
+static void nth_bitmap_object_oid(struct bitmap_index *index,
+				  struct object_id *oid,
+				  uint32_t index_pos)
+{
+	if (index->midx)
+		nth_midxed_object_oid(oid, index->midx, index_pos);
+	else
+		nth_packed_object_id(oid, index->pack, index_pos);
+}
+
+/* Position in the .idx or MIDX of the object at bit position "pos". */
+static uint32_t bitmap_pos_to_index(struct bitmap_index *index, uint32_t pos)
+{
+	if (index->midx)
+		return pack_pos_to_midx(index->midx, pos);
+	return pack_pos_to_index(index->pack, pos);
+}
+
+/* The pack and offset of the object at bit position "pos". */
+static struct packed_git *bitmap_pos_to_pack(struct bitmap_index *index,
+					     uint32_t pos, off_t *offset)
+{
+	struct multi_pack_index *m = index->midx;
+	uint32_t midx_pos;
+
+	if (!m) {
+		*offset = pack_pos_to_offset(index->pack, pos);
+		return index->pack;
+	}
+
+	midx_pos = pack_pos_to_midx(m, pos);
+	*offset = nth_midxed_offset(m, midx_pos);
+	return m->packs[nth_midxed_pack_int_id(m, midx_pos)];
+}
+
 static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 {
 	struct ewah_bitmap *parent;
@@ -149,22 +208,35 @@ static int load_bitmap_header(struct bitmap_index *index)
 	if (index->version != 1)
 		return error("Unsupported version for bitmap index file (%d)", index->version);
 
+	index->entry_count = ntohl(header->entry_count);
+	index->map_pos += sizeof(*header) - GIT_MAX_RAWSZ + the_hash_algo->rawsz;
+
 	/* Parse known bitmap format options */
 	{
 		uint32_t flags = ntohs(header->options);
+		unsigned char *end = index->map + index->map_size - the_hash_algo->rawsz;
 
 		if ((flags & BITMAP_OPT_FULL_DAG) == 0)
 			return error("Unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
 		if (flags & BITMAP_OPT_HASH_CACHE) {
-			unsigned char *end = index->map + index->map_size - the_hash_algo->rawsz;
-			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
+			index->hashes = ((uint32_t *)end) - bitmap_num_objects(index);
+			end = (unsigned char *)index->hashes;
+		}
+
+		if (flags & BITMAP_OPT_LOOKUP_TABLE &&
+		    git_env_bool("GIT_TEST_READ_COMMIT_TABLE", 1)) {
+			size_t table_size = st_mult(index->entry_count,
+						    BITMAP_LOOKUP_TABLE_TRIPLET_WIDTH);
+
+			if (end < index->map + index->map_pos ||
+			    table_size > end - (index->map + index->map_pos))
+				return error("Corrupted bitmap index file (too short to fit lookup table)");
+			index->table_lookup = end - table_size;
 		}
 	}
 
-	index->entry_count = ntohl(header->entry_count);
-	index->map_pos += sizeof(*header) - GIT_MAX_RAWSZ + the_hash_algo->rawsz;
 	return 0;
 }
 
@@ -228,7 +300,7 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		xor_offset = read_u8(index->map, &index->map_pos);
 		flags = read_u8(index->map, &index->map_pos);
 
-		nth_packed_object_id(&oid, index->pack, commit_idx_pos);
+		nth_bitmap_object_oid(index, &oid, commit_idx_pos);
 
 		bitmap = read_bitmap_1(index);
 		if (!bitmap)
@@ -251,6 +323,212 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	return 0;
 }
 
+/* Position of "oid" in the .idx or MIDX the bitmap belongs to. */
+static int bitmap_index_pos(struct bitmap_index *index,
+			    const struct object_id *oid, uint32_t *pos)
+{
+	if (index->midx)
+		return bsearch_midx(oid, index->midx, pos);
+	return bsearch_pack(oid, index->pack, pos);
+}
+
+struct bitmap_lookup_table_triplet {
+	uint32_t commit_pos;
+	uint64_t offset;
+	uint32_t xor_row;
+};
+
+static int bitmap_lookup_table_get_triplet(struct bitmap_index *bitmap_git,
+					   uint32_t row,
+					   struct bitmap_lookup_table_triplet *triplet)
+{
+	const unsigned char *p;
+
+	if (row >= bitmap_git->entry_count)
+		return error("Corrupted bitmap lookup table (row %"PRIu32" out of range)",
+			     row);
+
+	p = bitmap_git->table_lookup + st_mult(row, BITMAP_LOOKUP_TABLE_TRIPLET_WIDTH);
+	triplet->commit_pos = get_be32(p);
+	triplet->offset = get_be64(p + sizeof(uint32_t));
+	triplet->xor_row = get_be32(p + sizeof(uint32_t) + sizeof(uint64_t));
+	return 0;
+}
+
+/*
+ * Binary search the lookup table for the row of the commit at index
+ * position "commit_pos". Returns 1 and fills in "row" if the commit has
+ * a bitmap, or 0 otherwise.
+ */
+static int bitmap_lookup_table_find(struct bitmap_index *bitmap_git,
+				    uint32_t commit_pos, uint32_t *row)
+{
+	uint32_t lo = 0, hi = bitmap_git->entry_count;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *p = bitmap_git->table_lookup +
+			st_mult(mi, BITMAP_LOOKUP_TABLE_TRIPLET_WIDTH);
+		uint32_t pos = get_be32(p);
+
+		if (pos == commit_pos) {
+			*row = mi;
+			return 1;
+		}
+		if (pos > commit_pos)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+
+	return 0;
+}
+
+static struct stored_bitmap *load_lookup_table_row(struct bitmap_index *bitmap_git,
+						   struct bitmap_lookup_table_triplet *triplet,
+						   struct stored_bitmap *xor_bitmap)
+{
+	struct ewah_bitmap *bitmap;
+	struct object_id oid;
+	uint32_t commit_idx_pos;
+	int flags;
+
+	if (triplet->offset > bitmap_git->map_size ||
+	    bitmap_git->map_size - triplet->offset < sizeof(uint32_t) + 2) {
+		error("Corrupted bitmap lookup table (offset out of range)");
+		return NULL;
+	}
+
+	bitmap_git->map_pos = triplet->offset;
+	commit_idx_pos = read_be32(bitmap_git->map, &bitmap_git->map_pos);
+	read_u8(bitmap_git->map, &bitmap_git->map_pos); /* XOR offset, unused */
+	flags = read_u8(bitmap_git->map, &bitmap_git->map_pos);
+
+	if (commit_idx_pos != triplet->commit_pos) {
+		error("Corrupted bitmap lookup table (commit position mismatch)");
+		return NULL;
+	}
+
+	bitmap = read_bitmap_1(bitmap_git);
+	if (!bitmap)
+		return NULL;
+
+	nth_bitmap_object_oid(bitmap_git, &oid, commit_idx_pos);
+	return store_bitmap(bitmap_git, bitmap, &oid, xor_bitmap, flags);
+}
+
+/*
+ * Load the bitmap of the commit in lookup table row "row", along with
+ * any XOR bases it needs that have not been loaded yet.
+ */
+static struct stored_bitmap *lazy_bitmap_for_row(struct bitmap_index *bitmap_git,
+						 uint32_t row)
+{
+	struct bitmap_lookup_table_triplet triplet;
+	struct stored_bitmap *xor_bitmap = NULL;
+	uint32_t *chain = NULL;
+	size_t chain_nr = 0, chain_alloc = 0;
+
+	/*
+	 * Follow the XOR chain until we reach either a bitmap without an
+	 * XOR base, or one that has already been loaded.
+	 */
+	for (;;) {
+		struct object_id oid;
+		khiter_t hash_pos;
+
+		if (bitmap_lookup_table_get_triplet(bitmap_git, row, &triplet) < 0)
+			goto corrupt;
+
+		nth_bitmap_object_oid(bitmap_git, &oid, triplet.commit_pos);
+		hash_pos = kh_get_oid_map(bitmap_git->bitmaps, oid);
+		if (hash_pos < kh_end(bitmap_git->bitmaps)) {
+			xor_bitmap = kh_value(bitmap_git->bitmaps, hash_pos);
+			break;
+		}
+
+		ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+		chain[chain_nr++] = row;
+
+		if (triplet.xor_row == BITMAP_LOOKUP_TABLE_NO_XOR)
+			break;
+		if (chain_nr > bitmap_git->entry_count) {
+			error("Corrupted bitmap lookup table (XOR cycle)");
+			goto corrupt;
+		}
+		row = triplet.xor_row;
+	}
+
+	/* Now load the chain, starting from its base. */
+	while (chain_nr) {
+		if (bitmap_lookup_table_get_triplet(bitmap_git, chain[--chain_nr],
+						    &triplet) < 0)
+			goto corrupt;
+		xor_bitmap = load_lookup_table_row(bitmap_git, &triplet, xor_bitmap);
+		if (!xor_bitmap)
+			goto corrupt;
+	}
+
+	free(chain);
+	return xor_bitmap;
+
+corrupt:
+	free(chain);
+	return NULL;
+}
+
+/*
+ * Return the bitmap of the given commit, or NULL if it has none. With a
+ * lookup table, the bitmap is read from disk on first use.
+ */
+static struct ewah_bitmap *find_bitmap_for_commit(struct bitmap_index *bitmap_git,
+						  const struct object_id *oid)
+{
+	khiter_t hash_pos = kh_get_oid_map(bitmap_git->bitmaps, *oid);
+	struct stored_bitmap *stored;
+	uint32_t commit_pos, row;
+
+	if (hash_pos < kh_end(bitmap_git->bitmaps))
+		return lookup_stored_bitmap(kh_value(bitmap_git->bitmaps, hash_pos));
+
+	if (!bitmap_git->table_lookup ||
+	    !bitmap_index_pos(bitmap_git, oid, &commit_pos) ||
+	    !bitmap_lookup_table_find(bitmap_git, commit_pos, &row))
+		return NULL;
+
+	stored = lazy_bitmap_for_row(bitmap_git, row);
+	if (!stored)
+		return NULL;
+	return lookup_stored_bitmap(stored);
+}
+
+/*
+ * Make sure that all commit bitmaps are loaded, for callers that need
+ * to iterate over them.
+ */
+static int load_all_commit_bitmaps(struct bitmap_index *bitmap_git)
+{
+	uint32_t row;
+
+	if (!bitmap_git->table_lookup)
+		return 0;
+
+	for (row = 0; row < bitmap_git->entry_count; row++) {
+		struct bitmap_lookup_table_triplet triplet;
+		struct object_id oid;
+
+		if (bitmap_lookup_table_get_triplet(bitmap_git, row, &triplet) < 0)
+			return -1;
+		nth_bitmap_object_oid(bitmap_git, &oid, triplet.commit_pos);
+		if (kh_get_oid_map(bitmap_git->bitmaps, oid) < kh_end(bitmap_git->bitmaps))
+			continue;
+		if (!lazy_bitmap_for_row(bitmap_git, row))
+			return -1;
+	}
+
+	return 0;
+}
+
 static char *pack_bitmap_filename(struct packed_git *p)
 {
 	size_t len;
@@ -260,6 +538,59 @@ static char *pack_bitmap_filename(struct packed_git *p)
 	return xstrfmt("%.*s.bitmap", (int)len, p->pack_name);
 }
 
+static int open_midx_bitmap_1(struct bitmap_index *bitmap_git,
+			      struct multi_pack_index *midx)
+{
+	int fd;
+	struct stat st;
+	char *bitmap_name = get_midx_bitmap_filename(midx);
+
+	fd = git_open(bitmap_name);
+	if (fd < 0) {
+		free(bitmap_name);
+		return -1;
+	}
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(bitmap_name);
+		return -1;
+	}
+
+	if (!midx->chunk_revindex) {
+		warning(_("multi-pack bitmap %s has no revindex chunk to go with it"),
+			bitmap_name);
+		close(fd);
+		free(bitmap_name);
+		return -1;
+	}
+	free(bitmap_name);
+
+	bitmap_git->midx = midx;
+	bitmap_git->map_size = xsize_t(st.st_size);
+	bitmap_git->map = xmmap(NULL, bitmap_git->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	bitmap_git->map_pos = 0;
+	close(fd);
+
+	if (load_bitmap_header(bitmap_git) < 0)
+		goto cleanup;
+
+	if (!hasheq(get_midx_checksum(midx),
+		    ((struct bitmap_disk_header *)bitmap_git->map)->checksum)) {
+		warning(_("ignoring multi-pack bitmap, checksum mismatch"));
+		goto cleanup;
+	}
+
+	return 0;
+
+cleanup:
+	munmap(bitmap_git->map, bitmap_git->map_size);
+	bitmap_git->map = NULL;
+	bitmap_git->map_size = 0;
+	bitmap_git->midx = NULL;
+	return -1;
+}
+
 static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git *packfile)
 {
 	int fd;
@@ -309,7 +640,16 @@ static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 
 	bitmap_git->bitmaps = kh_init_oid_map();
 	bitmap_git->ext_index.positions = kh_init_oid_pos();
-	if (load_pack_revindex(bitmap_git->pack))
+
+	if (bitmap_git->midx) {
+		struct multi_pack_index *m = bitmap_git->midx;
+		uint32_t i;
+
+		for (i = 0; i < m->num_packs; i++) {
+			if (prepare_midx_pack(the_repository, m, i))
+				goto failed;
+		}
+	} else if (load_pack_revindex(bitmap_git->pack))
 		goto failed;
 
 	if (!(bitmap_git->commits = read_bitmap_1(bitmap_git)) ||
@@ -318,7 +658,11 @@ static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 		!(bitmap_git->tags = read_bitmap_1(bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(bitmap_git) < 0)
+	/*
+	 * With a lookup table, commit bitmaps are loaded on demand by
+	 * find_bitmap_for_commit().
+	 */
+	if (!bitmap_git->table_lookup && load_bitmap_entries_v1(bitmap_git) < 0)
 		goto failed;
 
 	return 0;
@@ -353,11 +697,28 @@ static int open_pack_bitmap(struct repository *r,
 	return ret;
 }
 
+static int open_bitmap(struct repository *r,
+		       struct bitmap_index *bitmap_git)
+{
+	struct multi_pack_index *m;
+
+	/*
+	 * A bitmap for the local multi-pack-index covers all of its packs,
+	 * so prefer it over any single-pack bitmap.
+	 */
+	for (m = get_multi_pack_index(r); m; m = m->next) {
+		if (m->local && !open_midx_bitmap_1(bitmap_git, m))
+			return 0;
+	}
+
+	return open_pack_bitmap(r, bitmap_git);
+}
+
 struct bitmap_index *prepare_bitmap_git(struct repository *r)
 {
 	struct bitmap_index *bitmap_git = xcalloc(1, sizeof(*bitmap_git));
 
-	if (!open_pack_bitmap(r, bitmap_git) && !load_pack_bitmap(bitmap_git))
+	if (!open_bitmap(r, bitmap_git) && !load_pack_bitmap(bitmap_git))
 		return bitmap_git;
 
 	free_bitmap_index(bitmap_git);
@@ -378,7 +739,7 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_git->pack->num_objects;
+		return bitmap_pos + bitmap_num_objects(bitmap_git);
 	}
 
 	return -1;
@@ -387,17 +748,38 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 static inline int bitmap_position_packfile(struct bitmap_index *bitmap_git,
 					   const struct object_id *oid)
 {
+	uint32_t pos;
 	off_t offset = find_pack_entry_one(oid->hash, bitmap_git->pack);
 	if (!offset)
 		return -1;
 
-	return find_revindex_position(bitmap_git->pack, offset);
+	if (offset_to_pack_pos(bitmap_git->pack, offset, &pos) < 0)
+		return -1;
+	return pos;
+}
+
+static inline int bitmap_position_midx(struct bitmap_index *bitmap_git,
+				       const struct object_id *oid)
+{
+	uint32_t want, got;
+
+	if (!bsearch_midx(oid, bitmap_git->midx, &want))
+		return -1;
+
+	if (midx_to_pack_pos(bitmap_git->midx, want, &got) < 0)
+		return -1;
+	return got;
 }
 
 static int bitmap_position(struct bitmap_index *bitmap_git,
 			   const struct object_id *oid)
 {
-	int pos = bitmap_position_packfile(bitmap_git, oid);
+	int pos;
+
+	if (bitmap_git->midx)
+		pos = bitmap_position_midx(bitmap_git, oid);
+	else
+		pos = bitmap_position_packfile(bitmap_git, oid);
 	return (pos >= 0) ? pos : bitmap_position_extended(bitmap_git, oid);
 }
 
@@ -427,7 +809,7 @@ static int ext_index_add_object(struct bitmap_index *bitmap_git,
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_git->pack->num_objects;
+	return bitmap_pos + bitmap_num_objects(bitmap_git);
 }
 
 struct bitmap_show_data {
@@ -458,7 +840,7 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 			      const struct object_id *oid,
 			      int bitmap_pos)
 {
-	khiter_t hash_pos;
+	struct ewah_bitmap *partial;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -466,10 +848,9 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	hash_pos = kh_get_oid_map(bitmap_git->bitmaps, *oid);
-	if (hash_pos < kh_end(bitmap_git->bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git->bitmaps, hash_pos);
-		bitmap_or_ewah(data->base, lookup_stored_bitmap(st));
+	partial = find_bitmap_for_commit(bitmap_git, oid);
+	if (partial) {
+		bitmap_or_ewah(data->base, partial);
 		return 0;
 	}
 
@@ -527,12 +908,10 @@ static struct bitmap *find_objects(struct bitmap_index *bitmap_git,
 		roots = roots->next;
 
 		if (object->type == OBJ_COMMIT) {
-			khiter_t pos = kh_get_oid_map(bitmap_git->bitmaps, object->oid);
-
-			if (pos < kh_end(bitmap_git->bitmaps)) {
-				struct stored_bitmap *st = kh_value(bitmap_git->bitmaps, pos);
-				struct ewah_bitmap *or_with = lookup_stored_bitmap(st);
+			struct ewah_bitmap *or_with =
+				find_bitmap_for_commit(bitmap_git, &object->oid);
 
+			if (or_with) {
 				if (base == NULL)
 					base = ewah_to_bitmap(or_with);
 				else
@@ -619,7 +998,7 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, bitmap_git->pack->num_objects + i))
+		if (!bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			continue;
 
 		obj = eindex->objects[i];
@@ -684,21 +1063,23 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			struct object_id oid;
-			struct revindex_entry *entry;
-			uint32_t hash = 0;
+			struct packed_git *pack;
+			uint32_t hash = 0, index_pos;
+			off_t ofs;
 
 			if ((word >> offset) == 0)
 				break;
 
 			offset += ewah_bit_ctz64(word >> offset);
 
-			entry = &bitmap_git->pack->revindex[pos + offset];
-			nth_packed_object_id(&oid, bitmap_git->pack, entry->nr);
+			index_pos = bitmap_pos_to_index(bitmap_git, pos + offset);
+			nth_bitmap_object_oid(bitmap_git, &oid, index_pos);
+			pack = bitmap_pos_to_pack(bitmap_git, pos + offset, &ofs);
 
 			if (bitmap_git->hashes)
-				hash = get_be32(bitmap_git->hashes + entry->nr);
+				hash = get_be32(bitmap_git->hashes + index_pos);
 
-			show_reach(&oid, object_type, 0, hash, bitmap_git->pack, entry->offset);
+			show_reach(&oid, object_type, 0, hash, pack, ofs);
 		}
 	}
 }
@@ -710,7 +1091,11 @@ static int in_bitmapped_pack(struct bitmap_index *bitmap_git,
 		struct object *object = roots->item;
 		roots = roots->next;
 
-		if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
+		if (bitmap_git->midx) {
+			uint32_t pos;
+			if (bsearch_midx(&object->oid, bitmap_git->midx, &pos))
+				return 1;
+		} else if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
 			return 1;
 	}
 
@@ -779,7 +1164,7 @@ static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
 	 * individually.
 	 */
 	for (i = 0; i < eindex->count; i++) {
-		uint32_t pos = i + bitmap_git->pack->num_objects;
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
 		if (eindex->objects[i]->type == type &&
 		    bitmap_get(to_filter, pos) &&
 		    !bitmap_get(tips, pos))
@@ -800,23 +1185,24 @@ static void filter_bitmap_blob_none(struct bitmap_index *bitmap_git,
 static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
 				     uint32_t pos)
 {
-	struct packed_git *pack = bitmap_git->pack;
+	uint32_t num_objects = bitmap_num_objects(bitmap_git);
 	unsigned long size;
 	struct object_info oi = OBJECT_INFO_INIT;
 
 	oi.sizep = &size;
 
-	if (pos < pack->num_objects) {
-		struct revindex_entry *entry = &pack->revindex[pos];
-		if (packed_object_info(the_repository, pack,
-				       entry->offset, &oi) < 0) {
+	if (pos < num_objects) {
+		off_t ofs;
+		struct packed_git *pack = bitmap_pos_to_pack(bitmap_git, pos, &ofs);
+		if (packed_object_info(the_repository, pack, ofs, &oi) < 0) {
 			struct object_id oid;
-			nth_packed_object_id(&oid, pack, entry->nr);
+			nth_bitmap_object_oid(bitmap_git, &oid,
+					      bitmap_pos_to_index(bitmap_git, pos));
 			die(_("unable to get size of %s"), oid_to_hex(&oid));
 		}
 	} else {
 		struct eindex *eindex = &bitmap_git->ext_index;
-		struct object *obj = eindex->objects[pos - pack->num_objects];
+		struct object *obj = eindex->objects[pos - num_objects];
 		if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
 			die(_("unable to get size of %s"), oid_to_hex(&obj->oid));
 	}
@@ -858,7 +1244,7 @@ static void filter_bitmap_blob_limit(struct bitmap_index *bitmap_git,
 	}
 
 	for (i = 0; i < eindex->count; i++) {
-		uint32_t pos = i + bitmap_git->pack->num_objects;
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
 		if (eindex->objects[i]->type == OBJ_BLOB &&
 		    bitmap_get(to_filter, pos) &&
 		    !bitmap_get(tips, pos) &&
@@ -951,7 +1337,7 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	/* try to open a bitmapped pack, but don't parse it yet
 	 * because we may not need to use it */
 	bitmap_git = xcalloc(1, sizeof(*bitmap_git));
-	if (open_pack_bitmap(revs->repo, bitmap_git) < 0)
+	if (open_bitmap(revs->repo, bitmap_git) < 0)
 		goto cleanup;
 
 	for (i = 0; i < revs->pending.nr; ++i) {
@@ -1036,28 +1422,26 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	return NULL;
 }
 
-static void try_partial_reuse(struct bitmap_index *bitmap_git,
+static void try_partial_reuse(struct packed_git *pack,
 			      size_t pos,
 			      struct bitmap *reuse,
 			      struct pack_window **w_curs)
 {
-	struct revindex_entry *revidx;
-	off_t offset;
+	off_t offset, header;
 	enum object_type type;
 	unsigned long size;
 
-	if (pos >= bitmap_git->pack->num_objects)
+	if (pos >= pack->num_objects)
 		return; /* not actually in the pack */
 
-	revidx = &bitmap_git->pack->revindex[pos];
-	offset = revidx->offset;
-	type = unpack_object_header(bitmap_git->pack, w_curs, &offset, &size);
+	offset = header = pack_pos_to_offset(pack, pos);
+	type = unpack_object_header(pack, w_curs, &offset, &size);
 	if (type < 0)
 		return; /* broken packfile, punt */
 
 	if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA) {
 		off_t base_offset;
-		int base_pos;
+		uint32_t base_pos;
 
 		/*
 		 * Find the position of the base object so we can look it up
@@ -1067,12 +1451,11 @@ static void try_partial_reuse(struct bitmap_index *bitmap_git,
 		 * and the normal slow path will complain about it in
 		 * more detail.
 		 */
-		base_offset = get_delta_base(bitmap_git->pack, w_curs,
-					     &offset, type, revidx->offset);
+		base_offset = get_delta_base(pack, w_curs,
+					     &offset, type, header);
 		if (!base_offset)
 			return;
-		base_pos = find_revindex_position(bitmap_git->pack, base_offset);
-		if (base_pos < 0)
+		if (offset_to_pack_pos(pack, base_offset, &base_pos) < 0)
 			return;
 
 		/*
@@ -1113,17 +1496,31 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 	struct bitmap *result = bitmap_git->result;
 	struct bitmap *reuse;
 	struct pack_window *w_curs = NULL;
+	struct packed_git *pack;
 	size_t i = 0;
 	uint32_t offset;
 
 	assert(result);
 
+	/*
+	 * With a multi-pack bitmap, only objects from the preferred pack
+	 * can be reused verbatim: they come first in the pseudo-pack order
+	 * and in the same order as in the pack itself, so their bit
+	 * positions are also their positions in that pack.
+	 */
+	if (bitmap_git->midx) {
+		pack = bitmap_git->midx->packs[bitmap_git->midx->preferred_pack];
+		if (load_pack_revindex(pack))
+			return -1;
+	} else
+		pack = bitmap_git->pack;
+
 	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
 		i++;
 
 	/* Don't mark objects not in the packfile */
-	if (i > bitmap_git->pack->num_objects / BITS_IN_EWORD)
-		i = bitmap_git->pack->num_objects / BITS_IN_EWORD;
+	if (i > pack->num_objects / BITS_IN_EWORD)
+		i = pack->num_objects / BITS_IN_EWORD;
 
 	reuse = bitmap_word_alloc(i);
 	memset(reuse->words, 0xFF, i * sizeof(eword_t));
@@ -1132,12 +1529,15 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 		eword_t word = result->words[i];
 		size_t pos = (i * BITS_IN_EWORD);
 
+		if (pos >= pack->num_objects)
+			break;
+
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			if ((word >> offset) == 0)
 				break;
 
 			offset += ewah_bit_ctz64(word >> offset);
-			try_partial_reuse(bitmap_git, pos + offset, reuse, &w_curs);
+			try_partial_reuse(pack, pos + offset, reuse, &w_curs);
 		}
 	}
 
@@ -1154,7 +1554,7 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 	 * need to be handled separately.
 	 */
 	bitmap_and_not(result, reuse);
-	*packfile_out = bitmap_git->pack;
+	*packfile_out = pack;
 	*reuse_out = reuse;
 	return 0;
 }
@@ -1207,7 +1607,7 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_git->pack->num_objects + i))
+			bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			count++;
 	}
 
@@ -1272,7 +1672,7 @@ void test_bitmap_walk(struct rev_info *revs)
 {
 	struct object *root;
 	struct bitmap *result = NULL;
-	khiter_t pos;
+	struct ewah_bitmap *bm;
 	size_t result_popcnt;
 	struct bitmap_test_data tdata;
 	struct bitmap_index *bitmap_git;
@@ -1287,12 +1687,9 @@ void test_bitmap_walk(struct rev_info *revs)
 		bitmap_git->version, bitmap_git->entry_count);
 
 	root = revs->pending.objects[0].item;
-	pos = kh_get_oid_map(bitmap_git->bitmaps, root->oid);
-
-	if (pos < kh_end(bitmap_git->bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git->bitmaps, pos);
-		struct ewah_bitmap *bm = lookup_stored_bitmap(st);
+	bm = find_bitmap_for_commit(bitmap_git, &root->oid);
 
+	if (bm) {
 		fprintf(stderr, "Found bitmap for %s. %d bits / %08x checksum\n",
 			oid_to_hex(&root->oid), (int)bm->bit_size, ewah_checksum(bm));
 
@@ -1373,16 +1770,18 @@ int rebuild_existing_bitmaps(struct bitmap_index *bitmap_git,
 	khiter_t hash_pos;
 	int hash_ret;
 
-	num_objects = bitmap_git->pack->num_objects;
+	if (load_all_commit_bitmaps(bitmap_git) < 0)
+		return -1;
+
+	num_objects = bitmap_num_objects(bitmap_git);
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
 		struct object_id oid;
-		struct revindex_entry *entry;
 		struct object_entry *oe;
 
-		entry = &bitmap_git->pack->revindex[i];
-		nth_packed_object_id(&oid, bitmap_git->pack, entry->nr);
+		nth_bitmap_object_oid(bitmap_git, &oid,
+				      bitmap_pos_to_index(bitmap_git, i));
 		oe = packlist_find(mapping, &oid);
 
 		if (oe)
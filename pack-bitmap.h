@@ -26,8 +26,16 @@ struct bitmap_disk_header {
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_LOOKUP_TABLE = 16,
 };
 
+/*
+ * Each row of the lookup table is a (commit position, bitmap offset,
+ * XOR row) triplet of 4 + 8 + 4 bytes.
+ */
+#define BITMAP_LOOKUP_TABLE_TRIPLET_WIDTH (sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t))
+#define BITMAP_LOOKUP_TABLE_NO_XOR 0xffffffff
+
 enum pack_bitmap_flags {
 	BITMAP_FLAG_REUSE = 0x1
 };
@@ -0,0 +1,465 @@
+#include "cache.h"
+#include "config.h"
+#include "object-store.h"
+#include "parallel-checkout.h"
+#include "progress.h"
+#include "streaming.h"
+#include "thread-utils.h"
+#include "trace2.h"
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	/*
+	 * The entry could not be written because there was another file
+	 * already present in its path or leading directories. Since
+	 * checkout_entry() removes such files before queueing an entry,
+	 * this means there is a path collision among the entries being
+	 * written.
+	 */
+	PC_ITEM_COLLIDED,
+	PC_ITEM_FAILED,
+};
+
+struct parallel_checkout_item {
+	struct cache_entry *ce;
+	struct conv_attrs ca;
+	enum pc_item_status status;
+	unsigned fstat_done : 1;
+	struct stat st;
+};
+
+struct parallel_checkout {
+	enum pc_status status;
+	struct parallel_checkout_item *items;
+	size_t nr, alloc;
+
+	/* Only used while the worker threads are running. */
+	size_t next_item, nr_done;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static struct parallel_checkout parallel_checkout;
+
+enum pc_status parallel_checkout_status(void)
+{
+	return parallel_checkout.status;
+}
+
+#define DEFAULT_THRESHOLD_FOR_PARALLELISM 100
+
+void get_parallel_checkout_configs(int *num_workers, int *threshold)
+{
+	char *env_workers = getenv("GIT_TEST_CHECKOUT_WORKERS");
+
+	if (env_workers && *env_workers) {
+		if (strtol_i(env_workers, 10, num_workers))
+			die(_("invalid value for '%s': '%s'"),
+			    "GIT_TEST_CHECKOUT_WORKERS", env_workers);
+		if (*num_workers < 1)
+			*num_workers = online_cpus();
+
+		*threshold = 0;
+	} else {
+		if (git_config_get_int("checkout.workers", num_workers))
+			*num_workers = 1;
+		else if (*num_workers < 1)
+			*num_workers = online_cpus();
+
+		if (git_config_get_int("checkout.thresholdforparallelism",
+				       threshold))
+			*threshold = DEFAULT_THRESHOLD_FOR_PARALLELISM;
+	}
+
+	if (!HAVE_THREADS)
+		*num_workers = 1;
+}
+
+void init_parallel_checkout(void)
+{
+	if (parallel_checkout.status != PC_UNINITIALIZED)
+		BUG("parallel checkout already initialized");
+
+	parallel_checkout.status = PC_ACCEPTING_ENTRIES;
+}
+
+static void finish_parallel_checkout(void)
+{
+	if (parallel_checkout.status == PC_UNINITIALIZED)
+		BUG("cannot finish parallel checkout: not initialized yet");
+
+	free(parallel_checkout.items);
+	memset(&parallel_checkout, 0, sizeof(parallel_checkout));
+}
+
+static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
+					     const struct conv_attrs *ca)
+{
+	/*
+	 * Symlinks cannot be checked out in parallel as, in case of path
+	 * collision, they could racily replace leading directories of other
+	 * entries being checked out. Submodules are checked out by child
+	 * processes which need the main thread.
+	 */
+	if (!S_ISREG(ce->ce_mode))
+		return 0;
+
+	switch (classify_conv_attrs(ca)) {
+	case CA_CLASS_INCORE:
+	case CA_CLASS_STREAMABLE:
+		return 1;
+	case CA_CLASS_INCORE_FILTER:
+		/*
+		 * Single-file smudge filters might well be safe to run
+		 * concurrently, but we cannot assume that of every filter.
+		 */
+		return 0;
+	case CA_CLASS_INCORE_PROCESS:
+		/*
+		 * A long-running process filter may want to delay the
+		 * entry, and the delayed queue is handled by the main
+		 * thread. There should also be only one instance of such a
+		 * filter, talking to the main thread only.
+		 */
+		return 0;
+	default:
+		BUG("unsupported conv_attrs classification");
+	}
+}
+
+int enqueue_checkout(struct cache_entry *ce, struct conv_attrs *ca)
+{
+	struct parallel_checkout_item *pc_item;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES ||
+	    !is_eligible_for_parallel_checkout(ce, ca))
+		return -1;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+
+	pc_item = &parallel_checkout.items[parallel_checkout.nr++];
+	memset(pc_item, 0, sizeof(*pc_item));
+	pc_item->ce = ce;
+	memcpy(&pc_item->ca, ca, sizeof(pc_item->ca));
+
+	return 0;
+}
+
+size_t pc_queue_size(void)
+{
+	return parallel_checkout.nr;
+}
+
+static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
+			       const struct checkout *state, const char *path)
+{
+	struct cache_entry *ce = pc_item->ce;
+	struct checkout_metadata meta;
+	struct strbuf buf = STRBUF_INIT;
+	unsigned long size;
+	size_t newsize;
+	ssize_t wrote;
+	void *blob;
+
+	if (classify_conv_attrs(&pc_item->ca) == CA_CLASS_STREAMABLE &&
+	    oid_object_info(the_repository, &ce->oid, &size) == OBJ_BLOB &&
+	    size > big_file_threshold) {
+		struct stream_filter *filter;
+		int ret;
+
+		/*
+		 * Streaming is not covered by the object read lock, so
+		 * large blobs are streamed one at a time. This keeps the
+		 * memory usage bounded, which is the point of streaming.
+		 */
+		filter = get_stream_filter_ca(&pc_item->ca, &ce->oid);
+		obj_read_lock();
+		ret = stream_blob_to_fd(fd, &ce->oid, filter, 1);
+		obj_read_unlock();
+		if (filter)
+			free_stream_filter(filter);
+		if (ret)
+			return error("unable to stream blob %s to '%s'",
+				     oid_to_hex(&ce->oid), path);
+		return 0;
+	}
+
+	blob = read_blob_entry(ce, &size);
+	if (!blob)
+		return error("unable to read sha1 file of %s (%s)",
+			     path, oid_to_hex(&ce->oid));
+
+	clone_checkout_metadata(&meta, &state->meta, &ce->oid);
+	if (convert_to_working_tree_ca(&pc_item->ca, ce->name, blob, size,
+				       &buf, &meta)) {
+		free(blob);
+		blob = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+
+	wrote = write_in_full(fd, blob, size);
+	free(blob);
+	if (wrote < 0)
+		return error("unable to write file '%s'", path);
+
+	return 0;
+}
+
+static void write_pc_item(struct parallel_checkout_item *pc_item,
+			  const struct checkout *state, struct cache_def *cache)
+{
+	unsigned int mode = (pc_item->ce->ce_mode & 0100) ? 0777 : 0666;
+	struct strbuf path = STRBUF_INIT;
+	const char *slash;
+	int fd;
+
+	strbuf_add(&path, state->base_dir, state->base_dir_len);
+	strbuf_add(&path, pc_item->ce->name, pc_item->ce->ce_namelen);
+
+	/*
+	 * The leading directories were created by the main thread, but an
+	 * entry that collides with them (e.g. on a case-insensitive file
+	 * system) may have replaced them since, possibly by a symlink. Do
+	 * not write through anything that is not a real directory.
+	 */
+	slash = strrchr(path.buf, '/');
+	if (slash && !threaded_has_dirs_only_path(cache, path.buf,
+						  slash - path.buf,
+						  state->base_dir_len)) {
+		pc_item->status = PC_ITEM_COLLIDED;
+		goto out;
+	}
+
+	fd = open(path.buf, O_WRONLY | O_CREAT | O_EXCL, mode);
+	if (fd < 0) {
+		if (errno == EEXIST || errno == EISDIR || errno == ENOENT ||
+		    errno == ENOTDIR) {
+			/* Leave it to the sequential retry to sort out. */
+			pc_item->status = PC_ITEM_COLLIDED;
+		} else {
+			error_errno("failed to open file '%s'", path.buf);
+			pc_item->status = PC_ITEM_FAILED;
+		}
+		goto out;
+	}
+
+	if (write_pc_item_to_fd(pc_item, fd, state, path.buf)) {
+		close(fd);
+		unlink(path.buf);
+		pc_item->status = PC_ITEM_FAILED;
+		goto out;
+	}
+
+	pc_item->fstat_done = fstat_checkout_output(fd, state, &pc_item->st);
+
+	if (close(fd)) {
+		error_errno("unable to close file '%s'", path.buf);
+		unlink(path.buf);
+		pc_item->status = PC_ITEM_FAILED;
+		goto out;
+	}
+
+	pc_item->status = PC_ITEM_WRITTEN;
+
+out:
+	strbuf_release(&path);
+}
+
+struct pc_worker {
+	pthread_t thread;
+	const struct checkout *state;
+};
+
+static void *pc_worker_proc(void *data)
+{
+	struct pc_worker *worker = data;
+	struct cache_def cache = CACHE_DEF_INIT;
+
+	for (;;) {
+		struct parallel_checkout_item *pc_item;
+
+		pthread_mutex_lock(&parallel_checkout.mutex);
+		if (parallel_checkout.next_item >= parallel_checkout.nr) {
+			pthread_mutex_unlock(&parallel_checkout.mutex);
+			break;
+		}
+		pc_item = &parallel_checkout.items[parallel_checkout.next_item++];
+		pthread_mutex_unlock(&parallel_checkout.mutex);
+
+		write_pc_item(pc_item, worker->state, &cache);
+
+		pthread_mutex_lock(&parallel_checkout.mutex);
+		parallel_checkout.nr_done++;
+		pthread_cond_signal(&parallel_checkout.cond);
+		pthread_mutex_unlock(&parallel_checkout.mutex);
+	}
+
+	cache_def_clear(&cache);
+	return NULL;
+}
+
+static void write_items_in_parallel(const struct checkout *state,
+				    int num_workers, struct progress *progress,
+				    unsigned int *progress_cnt)
+{
+	struct pc_worker *workers;
+	size_t last_done = 0;
+	int i, err;
+
+	pthread_mutex_init(&parallel_checkout.mutex, NULL);
+	pthread_cond_init(&parallel_checkout.cond, NULL);
+	enable_obj_read_lock();
+
+	workers = xcalloc(num_workers, sizeof(*workers));
+	for (i = 0; i < num_workers; i++) {
+		workers[i].state = state;
+		err = pthread_create(&workers[i].thread, NULL, pc_worker_proc,
+				     &workers[i]);
+		if (err)
+			die(_("unable to create parallel checkout thread: %s"),
+			    strerror(err));
+	}
+
+	/* Progress is only ever displayed from the main thread. */
+	pthread_mutex_lock(&parallel_checkout.mutex);
+	while (last_done < parallel_checkout.nr) {
+		while (parallel_checkout.nr_done == last_done)
+			pthread_cond_wait(&parallel_checkout.cond,
+					  &parallel_checkout.mutex);
+		*progress_cnt += parallel_checkout.nr_done - last_done;
+		last_done = parallel_checkout.nr_done;
+		pthread_mutex_unlock(&parallel_checkout.mutex);
+		display_progress(progress, *progress_cnt);
+		pthread_mutex_lock(&parallel_checkout.mutex);
+	}
+	pthread_mutex_unlock(&parallel_checkout.mutex);
+
+	for (i = 0; i < num_workers; i++) {
+		err = pthread_join(workers[i].thread, NULL);
+		if (err)
+			die(_("unable to join parallel checkout thread: %s"),
+			    strerror(err));
+	}
+
+	free(workers);
+	disable_obj_read_lock();
+	pthread_cond_destroy(&parallel_checkout.cond);
+	pthread_mutex_destroy(&parallel_checkout.mutex);
+}
+
+static void write_items_sequentially(const struct checkout *state,
+				     struct progress *progress,
+				     unsigned int *progress_cnt)
+{
+	struct cache_def cache = CACHE_DEF_INIT;
+	size_t i;
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		write_pc_item(&parallel_checkout.items[i], state, &cache);
+		display_progress(progress, ++*progress_cnt);
+	}
+
+	cache_def_clear(&cache);
+}
+
+static int handle_results(struct checkout *state)
+{
+	int ret = 0;
+	size_t i;
+	int have_pending = 0;
+
+	/*
+	 * Fill in the stat data of the written entries first, so that
+	 * mark_colliding_entries() can find them by their inode while
+	 * retrying the collided ones below.
+	 */
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+		switch (pc_item->status) {
+		case PC_ITEM_WRITTEN:
+			if (!state->refresh_cache)
+				break;
+			if (!pc_item->fstat_done &&
+			    lstat(pc_item->ce->name, &pc_item->st) < 0) {
+				ret |= error_errno("unable to stat just-written file '%s'",
+						   pc_item->ce->name);
+				break;
+			}
+			update_ce_after_write(state, pc_item->ce, &pc_item->st);
+			break;
+		case PC_ITEM_COLLIDED:
+			have_pending = 1;
+			break;
+		case PC_ITEM_FAILED:
+			ret = -1;
+			break;
+		case PC_ITEM_PENDING:
+			BUG("parallel checkout finished with pending entries");
+		default:
+			BUG("unknown checkout item status in parallel checkout");
+		}
+	}
+
+	if (!have_pending)
+		return ret;
+
+	/*
+	 * The collided entries are checked out again one at a time. Since
+	 * parallel checkout is no longer accepting entries, checkout_entry()
+	 * writes them right away, removing (and, for clones, reporting)
+	 * whatever is in their way. Note that this means the last entry to
+	 * be written wins, which is not necessarily the last one in index
+	 * order as it would be with a sequential checkout.
+	 */
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+		if (pc_item->status == PC_ITEM_COLLIDED)
+			ret |= checkout_entry_ca(pc_item->ce, &pc_item->ca,
+						 state, NULL, NULL);
+	}
+
+	return ret;
+}
+
+int run_parallel_checkout(struct checkout *state, int num_workers,
+			  int threshold, struct progress *progress,
+			  unsigned int *progress_cnt)
+{
+	unsigned int cnt = 0;
+	int ret;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES)
+		BUG("cannot run parallel checkout: uninitialized or already running");
+
+	if (!progress_cnt)
+		progress_cnt = &cnt;
+
+	trace2_region_enter("checkout", "parallel-checkout", the_repository);
+	parallel_checkout.status = PC_RUNNING;
+
+	if (parallel_checkout.nr < num_workers)
+		num_workers = parallel_checkout.nr;
+	if (parallel_checkout.nr < threshold)
+		num_workers = 1;
+
+	trace2_data_intmax("checkout", the_repository,
+			   "parallel-checkout/workers", num_workers);
+	trace2_data_intmax("checkout", the_repository,
+			   "parallel-checkout/entries", parallel_checkout.nr);
+
+	if (num_workers <= 1)
+		write_items_sequentially(state, progress, progress_cnt);
+	else
+		write_items_in_parallel(state, num_workers, progress,
+					progress_cnt);
+
+	ret = handle_results(state);
+
+	finish_parallel_checkout();
+	trace2_region_leave("checkout", "parallel-checkout", the_repository);
+	return ret;
+}
@@ -0,0 +1,60 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+struct cache_entry;
+struct checkout;
+struct conv_attrs;
+struct progress;
+
+/*
+ * Parallel checkout lets checkout_entry() queue regular files instead of
+ * writing them right away. The queued entries are later read, smudged
+ * and written to the working tree by a pool of worker threads, while
+ * everything that needs the main thread (directory creation, removal of
+ * existing paths, filters with a driver, symlinks and submodules) keeps
+ * happening sequentially.
+ */
+
+enum pc_status {
+	PC_UNINITIALIZED = 0,
+	PC_ACCEPTING_ENTRIES,
+	PC_RUNNING,
+};
+
+enum pc_status parallel_checkout_status(void);
+
+/*
+ * Read the "checkout.workers" and "checkout.thresholdForParallelism"
+ * settings. "num_workers" is always at least 1; a value of 1 means that
+ * parallel checkout should not be used.
+ */
+void get_parallel_checkout_configs(int *num_workers, int *threshold);
+
+/*
+ * Put parallel checkout into the PC_ACCEPTING_ENTRIES state. Should be
+ * used only when num_workers > 1.
+ */
+void init_parallel_checkout(void);
+
+/*
+ * Return -1 if parallel checkout is not accepting entries or if the
+ * entry is not eligible for it (the caller must then check it out
+ * itself), or 0 if the entry was queued.
+ */
+int enqueue_checkout(struct cache_entry *ce, struct conv_attrs *ca);
+size_t pc_queue_size(void);
+
+/*
+ * Write all queued entries, using up to "num_workers" threads when the
+ * number of entries is at least "threshold", and leave parallel
+ * checkout in the PC_UNINITIALIZED state again. Entries that could not
+ * be written because of a path collision are retried sequentially. If
+ * "progress" is given, it is advanced by one for each entry, starting
+ * from *progress_cnt. Return 0 on success or non-zero if any entry
+ * failed.
+ */
+int run_parallel_checkout(struct checkout *state, int num_workers,
+			  int threshold, struct progress *progress,
+			  unsigned int *progress_cnt);
+
+#endif /* PARALLEL_CHECKOUT_H */
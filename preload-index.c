@@ -9,6 +9,7 @@
 #include "progress.h"
 #include "thread-utils.h"
 #include "repository.h"
+#include "compat/stat-ring.h"
 
 /*
  * Mostly randomly chosen maximum thread counts: we
@@ -19,6 +20,14 @@
 #define MAX_PARALLEL (20)
 #define THREAD_COST (500)
 
+/*
+ * Where io_uring is available, each thread queues this many statx
+ * requests at once, instead of waiting for one lstat at a time. The
+ * entries are sorted by path, so a batch mostly looks at files of the
+ * same directory.
+ */
+#define STAT_BATCH (64)
+
 struct progress_data {
 	unsigned long n;
 	struct progress *progress;
@@ -31,8 +40,46 @@ struct thread_data {
 	struct pathspec pathspec;
 	struct progress_data *progress;
 	int offset, nr;
+	int use_stat_ring;
+	int t2_nr_lstat;
+	int t2_used_stat_ring;
+};
+
+struct stat_batch {
+	struct stat_ring *ring;
+	int nr;
+	struct cache_entry *ce[STAT_BATCH];
+	const char *path[STAT_BATCH];
+	struct stat st[STAT_BATCH];
+	int res[STAT_BATCH];
 };
 
+static void preload_entry(struct index_state *index, struct cache_entry *ce,
+			  struct stat *st)
+{
+	if (ie_match_stat(index, ce, st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
+		return;
+	ce_mark_uptodate(ce);
+	mark_fsmonitor_valid(index, ce);
+}
+
+static void flush_stat_batch(struct index_state *index, struct stat_batch *b)
+{
+	int i;
+
+	if (stat_ring_lstat(b->ring, b->nr, b->path, b->st, b->res)) {
+		/* the kernel cannot do it; go back to lstat() */
+		stat_ring_free(b->ring);
+		b->ring = NULL;
+		for (i = 0; i < b->nr; i++)
+			b->res[i] = lstat(b->path[i], &b->st[i]);
+	}
+	for (i = 0; i < b->nr; i++)
+		if (!b->res[i])
+			preload_entry(index, b->ce[i], &b->st[i]);
+	b->nr = 0;
+}
+
 static void *preload_thread(void *_data)
 {
 	int nr, last_nr;
@@ -40,6 +87,11 @@ static void *preload_thread(void *_data)
 	struct index_state *index = p->index;
 	struct cache_entry **cep = index->cache + p->offset;
 	struct cache_def cache = CACHE_DEF_INIT;
+	struct stat_batch batch;
+
+	batch.nr = 0;
+	batch.ring = p->use_stat_ring ? stat_ring_new(STAT_BATCH) : NULL;
+	p->t2_used_stat_ring = !!batch.ring;
 
 	nr = p->nr;
 	if (nr + p->offset > index->cache_nr)
@@ -73,13 +125,21 @@ static void *preload_thread(void *_data)
 			continue;
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
 			continue;
-		if (lstat(ce->name, &st))
+		p->t2_nr_lstat++;
+		if (batch.ring) {
+			batch.ce[batch.nr] = ce;
+			batch.path[batch.nr] = ce->name;
+			if (++batch.nr == STAT_BATCH)
+				flush_stat_batch(index, &batch);
 			continue;
-		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
+		}
+		if (lstat(ce->name, &st))
 			continue;
-		ce_mark_uptodate(ce);
-		mark_fsmonitor_valid(index, ce);
+		preload_entry(index, ce, &st);
 	} while (--nr > 0);
+	if (batch.nr)
+		flush_stat_batch(index, &batch);
+	stat_ring_free(batch.ring);
 	if (p->progress) {
 		struct progress_data *pd = p->progress;
 
@@ -98,6 +158,7 @@ void preload_index(struct index_state *index,
 	int threads, i, work, offset;
 	struct thread_data data[MAX_PARALLEL];
 	struct progress_data pd;
+	int use_stat_ring, t2_sum_lstat = 0, t2_sum_stat_ring = 0;
 
 	if (!HAVE_THREADS || !core_preload_index)
 		return;
@@ -108,6 +169,8 @@ void preload_index(struct index_state *index,
 	if (threads < 2)
 		return;
 	trace_performance_enter();
+	trace2_region_enter("index", "preload", NULL);
+	use_stat_ring = git_env_bool("GIT_TEST_PRELOAD_IO_URING", 1);
 	if (threads > MAX_PARALLEL)
 		threads = MAX_PARALLEL;
 	offset = 0;
@@ -129,6 +192,7 @@ void preload_index(struct index_state *index,
 			copy_pathspec(&p->pathspec, pathspec);
 		p->offset = offset;
 		p->nr = work;
+		p->use_stat_ring = use_stat_ring;
 		if (pd.progress)
 			p->progress = &pd;
 		offset += work;
@@ -141,9 +205,15 @@ void preload_index(struct index_state *index,
 		struct thread_data *p = data+i;
 		if (pthread_join(p->pthread, NULL))
 			die("unable to join threaded lstat");
+		t2_sum_lstat += p->t2_nr_lstat;
+		t2_sum_stat_ring += p->t2_used_stat_ring;
 	}
 	stop_progress(&pd.progress);
 
+	trace2_data_intmax("index", NULL, "preload/sum_lstat", t2_sum_lstat);
+	trace2_data_intmax("index", NULL, "preload/io_uring_threads",
+			   t2_sum_stat_ring);
+	trace2_region_leave("index", "preload", NULL);
 	trace_performance_leave("preload index");
 }
 
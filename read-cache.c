@@ -25,6 +25,7 @@
 #include "fsmonitor.h"
 #include "thread-utils.h"
 #include "progress.h"
+#include "sparse-index.h"
 
 /* Mask for the name length in ce_flags in the on-disk index */
 
@@ -47,6 +48,9 @@
 #define CACHE_EXT_FSMONITOR 0x46534D4E	  /* "FSMN" */
 #define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
 #define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
+#define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
+#define CACHE_EXT_BLOCKCHECKSUMS 0x6273756D	  /* "bsum" */
+#define CACHE_EXT_NAMEHASH 0x4E414D48	  /* "NAMH" */
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
@@ -1525,6 +1529,7 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 						  istate->cache_nr);
 
 	trace_performance_enter();
+	trace2_region_enter("index", "refresh", NULL);
 	modified_fmt   = in_porcelain ? "M\t%s\n" : "%s: needs update\n";
 	deleted_fmt    = in_porcelain ? "D\t%s\n" : "%s: needs update\n";
 	typechange_fmt = in_porcelain ? "T\t%s\n" : "%s: needs update\n";
@@ -1606,6 +1611,7 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 		display_progress(progress, istate->cache_nr);
 		stop_progress(&progress);
 	}
+	trace2_region_leave("index", "refresh", NULL);
 	trace_performance_leave("refresh index");
 	return has_errors;
 }
@@ -1695,11 +1701,14 @@ int verify_index_checksum;
 /* Allow fsck to force verification of the cache entry order. */
 int verify_ce_order;
 
+static int verify_block_checksums(const char *mmap, size_t mmap_size,
+				  unsigned int nr_entries);
+
 static int verify_hdr(const struct cache_header *hdr, unsigned long size)
 {
 	git_hash_ctx c;
 	unsigned char hash[GIT_MAX_RAWSZ];
-	int hdr_version;
+	int hdr_version, ret;
 
 	if (hdr->hdr_signature != htonl(CACHE_SIGNATURE))
 		return error(_("bad signature 0x%08x"), hdr->hdr_signature);
@@ -1710,6 +1719,11 @@ static int verify_hdr(const struct cache_header *hdr, unsigned long size)
 	if (!verify_index_checksum)
 		return 0;
 
+	ret = verify_block_checksums((const char *)hdr, size,
+				     ntohl(hdr->hdr_entries));
+	if (ret <= 0)
+		return ret;
+
 	the_hash_algo->init_fn(&c);
 	the_hash_algo->update_fn(&c, hdr, size - the_hash_algo->rawsz);
 	the_hash_algo->final_fn(hash, &c);
@@ -1738,10 +1752,20 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_FSMONITOR:
 		read_fsmonitor_extension(istate, data, sz);
 		break;
+	case CACHE_EXT_NAMEHASH:
+		/* already handled in load_index_extensions() */
+		break;
 	case CACHE_EXT_ENDOFINDEXENTRIES:
 	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
 		/* already handled in do_read_index() */
 		break;
+	case CACHE_EXT_BLOCKCHECKSUMS:
+		/* already handled in verify_hdr() */
+		break;
+	case CACHE_EXT_SPARSE_DIRECTORIES:
+		/* no content, only an indication that this is a sparse index */
+		istate->sparse_index = 1;
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error(_("index uses %.4s extension, which we do not understand"),
@@ -1905,6 +1929,18 @@ static void post_read_index_from(struct index_state *istate)
 	tweak_untracked_cache(istate);
 	tweak_split_index(istate);
 	tweak_fsmonitor(istate);
+
+	/*
+	 * Only commands that know how to deal with sparse directory
+	 * entries get to see them.
+	 */
+	if (istate->sparse_index) {
+		if (!istate->repo)
+			istate->repo = the_repository;
+		prepare_repo_settings(istate->repo);
+		if (istate->repo->settings.command_requires_full_index)
+			ensure_full_index(istate);
+	}
 }
 
 static size_t estimate_cache_size_from_compressed(unsigned int entries)
@@ -1937,6 +1973,7 @@ struct index_entry_offset_table
 
 static struct index_entry_offset_table *read_ieot_extension(const char *mmap, size_t mmap_size, size_t offset);
 static void write_ieot_extension(struct strbuf *sb, struct index_entry_offset_table *ieot);
+static void write_block_checksums_extension(struct strbuf *sb);
 
 static size_t read_eoie_extension(const char *mmap, size_t mmap_size);
 static void write_eoie_extension(struct strbuf *sb, git_hash_ctx *eoie_context, size_t offset);
@@ -1948,6 +1985,12 @@ struct load_index_extensions
 	const char *mmap;
 	size_t mmap_size;
 	unsigned long src_offset;
+
+	/*
+	 * The stored name hash; the entries may still be loading, so it
+	 * is only attached to the index in do_read_index().
+	 */
+	struct name_hash_ext *name_hash_ext;
 };
 
 static void *load_index_extensions(void *_data)
@@ -1963,10 +2006,14 @@ static void *load_index_extensions(void *_data)
 		 * in 4-byte network byte order.
 		 */
 		uint32_t extsize = get_be32(p->mmap + src_offset + 4);
-		if (read_index_extension(p->istate,
-					 p->mmap + src_offset,
-					 p->mmap + src_offset + 8,
-					 extsize) < 0) {
+		if (CACHE_EXT((p->mmap + src_offset)) == CACHE_EXT_NAMEHASH) {
+			free(p->name_hash_ext);
+			p->name_hash_ext = read_name_hash_extension(
+					p->mmap + src_offset + 8, extsize);
+		} else if (read_index_extension(p->istate,
+						p->mmap + src_offset,
+						p->mmap + src_offset + 8,
+						extsize) < 0) {
 			munmap((void *)p->mmap, p->mmap_size);
 			die(_("index file corrupt"));
 		}
@@ -2187,6 +2234,7 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	p.istate = istate;
 	p.mmap = mmap;
 	p.mmap_size = mmap_size;
+	p.name_hash_ext = NULL;
 
 	src_offset = sizeof(*hdr);
 
@@ -2244,6 +2292,7 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 		p.src_offset = src_offset;
 		load_index_extensions(&p);
 	}
+	istate->name_hash_ext = p.name_hash_ext;
 	munmap((void *)mmap, mmap_size);
 
 	/*
@@ -2355,6 +2404,7 @@ int discard_index(struct index_state *istate)
 	cache_tree_free(&(istate->cache_tree));
 	istate->initialized = 0;
 	istate->fsmonitor_has_run_once = 0;
+	istate->sparse_index = 0;
 	FREE_AND_NULL(istate->cache);
 	istate->cache_alloc = 0;
 	discard_split_index(istate);
@@ -2451,11 +2501,70 @@ int repo_index_has_changes(struct repository *repo,
 static unsigned char write_buffer[WRITE_BUFFER_SIZE];
 static unsigned long write_buffer_len;
 
+/*
+ * With index.blockChecksums, what we write is hashed in blocks of about
+ * this size instead of as a whole; see the "bsum" extension.
+ */
+#define INDEX_BLOCK_SIZE (256 * 1024)
+
+struct index_block {
+	uint32_t end;	/* offset just past the block in the file */
+	unsigned char hash[GIT_MAX_RAWSZ];
+};
+
+static struct {
+	unsigned enabled:1,
+		 finished:1;	/* no more blocks; we are past them */
+	git_hash_ctx ctx;	/* of the current block, or of the tail */
+	uint32_t offset;	/* of the end of the data hashed so far */
+	uint32_t len;		/* of the current block */
+	struct index_block *block;
+	int nr, alloc;
+} index_blocks;
+
+static void index_blocks_add(uint32_t len, const unsigned char *hash)
+{
+	struct index_block *b;
+
+	ALLOC_GROW(index_blocks.block, index_blocks.nr + 1, index_blocks.alloc);
+	b = &index_blocks.block[index_blocks.nr++];
+	index_blocks.offset += len;
+	b->end = index_blocks.offset;
+	hashcpy(b->hash, hash);
+}
+
+static void index_blocks_end(void)
+{
+	unsigned char hash[GIT_MAX_RAWSZ];
+
+	if (!index_blocks.len)
+		return;
+	the_hash_algo->final_fn(hash, &index_blocks.ctx);
+	index_blocks_add(index_blocks.len, hash);
+	index_blocks.len = 0;
+	the_hash_algo->init_fn(&index_blocks.ctx);
+}
+
+static void hash_index_data(git_hash_ctx *context, const void *data,
+			    unsigned int len)
+{
+	if (!index_blocks.enabled) {
+		the_hash_algo->update_fn(context, data, len);
+		return;
+	}
+	the_hash_algo->update_fn(&index_blocks.ctx, data, len);
+	if (index_blocks.finished)
+		return;
+	index_blocks.len += len;
+	if (index_blocks.len >= INDEX_BLOCK_SIZE)
+		index_blocks_end();
+}
+
 static int ce_write_flush(git_hash_ctx *context, int fd)
 {
 	unsigned int buffered = write_buffer_len;
 	if (buffered) {
-		the_hash_algo->update_fn(context, write_buffer, buffered);
+		hash_index_data(context, write_buffer, buffered);
 		if (write_in_full(fd, write_buffer, buffered) < 0)
 			return -1;
 		write_buffer_len = 0;
@@ -2463,6 +2572,21 @@ static int ce_write_flush(git_hash_ctx *context, int fd)
 	return 0;
 }
 
+/*
+ * Write "len" bytes whose hash is already known, as a block of their own.
+ */
+static int ce_write_block(git_hash_ctx *context, int fd, const void *data,
+			  unsigned int len, const unsigned char *hash)
+{
+	if (ce_write_flush(context, fd))
+		return -1;
+	index_blocks_end();
+	if (write_in_full(fd, data, len) < 0)
+		return -1;
+	index_blocks_add(len, hash);
+	return 0;
+}
+
 static int ce_write(git_hash_ctx *context, int fd, void *data, unsigned int len)
 {
 	while (len) {
@@ -2504,7 +2628,7 @@ static int ce_flush(git_hash_ctx *context, int fd, unsigned char *hash)
 
 	if (left) {
 		write_buffer_len = 0;
-		the_hash_algo->update_fn(context, write_buffer, left);
+		hash_index_data(context, write_buffer, left);
 	}
 
 	/* Flush first if not enough space for hash signature */
@@ -2515,7 +2639,10 @@ static int ce_flush(git_hash_ctx *context, int fd, unsigned char *hash)
 	}
 
 	/* Append the hash signature at the end */
-	the_hash_algo->final_fn(write_buffer + left, context);
+	if (index_blocks.enabled)
+		the_hash_algo->final_fn(write_buffer + left, &index_blocks.ctx);
+	else
+		the_hash_algo->final_fn(write_buffer + left, context);
 	hashcpy(hash, write_buffer + left);
 	left += the_hash_algo->rawsz;
 	return (write_in_full(fd, write_buffer, left) < 0) ? -1 : 0;
@@ -2599,14 +2726,15 @@ static void copy_cache_entry_to_ondisk(struct ondisk_cache_entry *ondisk,
 	}
 }
 
-static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
-			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
+/* Append the on-disk form of "ce" to "sb" */
+static void ce_encode_entry(struct strbuf *sb, struct cache_entry *ce,
+			    struct strbuf *previous_name,
+			    struct ondisk_cache_entry *ondisk)
 {
 	int size;
-	int result;
 	unsigned int saved_namelen;
 	int stripped_name = 0;
-	static unsigned char padding[8] = { 0x00 };
+	static const unsigned char padding[8] = { 0x00 };
 
 	if (ce->ce_flags & CE_STRIP_NAME) {
 		saved_namelen = ce_namelen(ce);
@@ -2619,11 +2747,9 @@ static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
 	if (!previous_name) {
 		int len = ce_namelen(ce);
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		result = ce_write(c, fd, ondisk, size);
-		if (!result)
-			result = ce_write(c, fd, ce->name, len);
-		if (!result)
-			result = ce_write(c, fd, padding, align_padding_size(size, len));
+		strbuf_add(sb, ondisk, size);
+		strbuf_add(sb, ce->name, len);
+		strbuf_add(sb, padding, align_padding_size(size, len));
 	} else {
 		int common, to_remove, prefix_size;
 		unsigned char to_remove_vi[16];
@@ -2637,13 +2763,10 @@ static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
 		prefix_size = encode_varint(to_remove, to_remove_vi);
 
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		result = ce_write(c, fd, ondisk, size);
-		if (!result)
-			result = ce_write(c, fd, to_remove_vi, prefix_size);
-		if (!result)
-			result = ce_write(c, fd, ce->name + common, ce_namelen(ce) - common);
-		if (!result)
-			result = ce_write(c, fd, padding, 1);
+		strbuf_add(sb, ondisk, size);
+		strbuf_add(sb, to_remove_vi, prefix_size);
+		strbuf_add(sb, ce->name + common, ce_namelen(ce) - common);
+		strbuf_add(sb, padding, 1);
 
 		strbuf_splice(previous_name, common, to_remove,
 			      ce->name + common, ce_namelen(ce) - common);
@@ -2652,8 +2775,16 @@ static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
 		ce->ce_namelen = saved_namelen;
 		ce->ce_flags &= ~CE_STRIP_NAME;
 	}
+}
 
-	return result;
+static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
+			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
+{
+	static struct strbuf sb = STRBUF_INIT;
+
+	strbuf_reset(&sb);
+	ce_encode_entry(&sb, ce, previous_name, ondisk);
+	return ce_write(c, fd, sb.buf, sb.len);
 }
 
 /*
@@ -2754,6 +2885,249 @@ static int record_ieot(void)
 	return !git_config_get_index_threads(&val) && val != 1;
 }
 
+static int record_block_checksums(void)
+{
+	int val;
+
+	return !git_config_get_bool("index.blockchecksums", &val) && val;
+}
+
+static int record_name_hash(void)
+{
+	int val;
+
+	return !git_config_get_bool("index.recordnamehash", &val) && val;
+}
+
+/*
+ * When writing the index with threads, the entries are cut into chunks
+ * of this many, which worker threads encode into memory, while the main
+ * thread hashes and writes out those that are done, in order. At most
+ * WRITE_CHUNKS_AHEAD chunks per worker are kept in memory.
+ */
+#define WRITE_CHUNK_ENTRIES	(4096)
+#define WRITE_CHUNKS_AHEAD	(4)
+
+struct write_chunk {
+	int start, end;		/* range of istate->cache to encode */
+	int prev;		/* last entry written before start, or -1 */
+	int nr;			/* count of entries written */
+	unsigned new_block:1;	/* does an IEOT block start here? */
+	unsigned done:1;
+	struct strbuf sb;
+	unsigned char hash[GIT_MAX_RAWSZ];	/* of sb, with block checksums */
+};
+
+struct write_entries_data {
+	struct index_state *istate;
+	int version4;
+	int hash_blocks;
+	struct write_chunk *chunks;
+	int nr_chunks;
+	int next;		/* next chunk for a worker to encode */
+	int written;		/* count of chunks written out */
+	int ahead;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static void encode_chunk(struct write_entries_data *d, struct write_chunk *chunk,
+			 struct strbuf *previous_name,
+			 struct ondisk_cache_entry *ondisk)
+{
+	struct cache_entry **cache = d->istate->cache;
+	int i;
+
+	if (d->version4) {
+		/* Set up the prefix compression as if we had written chunk->prev */
+		strbuf_reset(previous_name);
+		if (chunk->prev >= 0)
+			strbuf_add(previous_name, cache[chunk->prev]->name,
+				   ce_namelen(cache[chunk->prev]));
+		if (chunk->new_block && previous_name->len)
+			previous_name->buf[0] = 0;
+	}
+
+	for (i = chunk->start; i < chunk->end; i++) {
+		if (cache[i]->ce_flags & CE_REMOVE)
+			continue;
+		ce_encode_entry(&chunk->sb, cache[i],
+				d->version4 ? previous_name : NULL, ondisk);
+	}
+
+	if (d->hash_blocks) {
+		git_hash_ctx c;
+
+		the_hash_algo->init_fn(&c);
+		the_hash_algo->update_fn(&c, chunk->sb.buf, chunk->sb.len);
+		the_hash_algo->final_fn(chunk->hash, &c);
+	}
+}
+
+static void *write_entries_thread(void *_data)
+{
+	struct write_entries_data *d = _data;
+	struct strbuf previous_name = STRBUF_INIT;
+	struct ondisk_cache_entry ondisk;
+	int k;
+
+	pthread_mutex_lock(&d->mutex);
+	for (;;) {
+		while (d->next < d->nr_chunks &&
+		       d->next >= d->written + d->ahead)
+			pthread_cond_wait(&d->cond, &d->mutex);
+		if (d->next >= d->nr_chunks)
+			break;
+		k = d->next++;
+		pthread_mutex_unlock(&d->mutex);
+
+		encode_chunk(d, &d->chunks[k], &previous_name, &ondisk);
+
+		pthread_mutex_lock(&d->mutex);
+		d->chunks[k].done = 1;
+		pthread_cond_broadcast(&d->cond);
+	}
+	pthread_mutex_unlock(&d->mutex);
+
+	strbuf_release(&previous_name);
+	return NULL;
+}
+
+/*
+ * Write the cache entries with "nr_threads" threads; the result is the
+ * same as that of the loop in do_write_index(). The entries are checked
+ * and cut into chunks upfront, and then encoded by nr_threads - 1
+ * workers while we hash and write them out, so that the hashing, which
+ * has to go over the whole file in order, overlaps with the encoding.
+ * With block checksums, the workers hash the chunks, too.
+ */
+static int write_entries_threaded(struct index_state *istate,
+				  git_hash_ctx *c, int fd, int nr_threads,
+				  struct index_entry_offset_table *ieot,
+				  int ieot_entries, off_t offset,
+				  int *drop_cache_tree)
+{
+	struct write_entries_data d;
+	struct write_chunk *chunk = NULL;
+	pthread_t *threads;
+	off_t block_offset = offset;
+	int alloc_chunks = 0, block_nr = 0, last = -1;
+	int i, k, err = 0;
+
+	memset(&d, 0, sizeof(d));
+	d.istate = istate;
+	d.version4 = istate->version == 4;
+	d.hash_blocks = index_blocks.enabled;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		int new_block;
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
+			ce_smudge_racily_clean_entry(istate, ce);
+		if (is_null_oid(&ce->oid)) {
+			static const char msg[] = "cache entry has null sha1: %s";
+			static int allow = -1;
+
+			if (allow < 0)
+				allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
+			if (allow)
+				warning(msg, ce->name);
+			else
+				err = error(msg, ce->name);
+
+			*drop_cache_tree = 1;
+		}
+		if (err)
+			break;
+
+		new_block = ieot && i && (i % ieot_entries == 0);
+		if (!chunk || new_block || chunk->nr == WRITE_CHUNK_ENTRIES) {
+			if (chunk)
+				chunk->end = i;
+			ALLOC_GROW(d.chunks, d.nr_chunks + 1, alloc_chunks);
+			chunk = &d.chunks[d.nr_chunks++];
+			memset(chunk, 0, sizeof(*chunk));
+			strbuf_init(&chunk->sb, 0);
+			chunk->start = i;
+			chunk->prev = last;
+			chunk->new_block = new_block;
+		}
+		chunk->nr++;
+		last = i;
+	}
+	if (chunk)
+		chunk->end = istate->cache_nr;
+	if (err) {
+		free(d.chunks);
+		return err;
+	}
+
+	nr_threads--;
+	if (nr_threads > d.nr_chunks)
+		nr_threads = d.nr_chunks;
+	d.ahead = nr_threads * WRITE_CHUNKS_AHEAD;
+	pthread_mutex_init(&d.mutex, NULL);
+	pthread_cond_init(&d.cond, NULL);
+
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++) {
+		err = pthread_create(&threads[i], NULL, write_entries_thread, &d);
+		if (err)
+			die(_("unable to create write_entries thread: %s"), strerror(err));
+	}
+
+	for (k = 0; k < d.nr_chunks; k++) {
+		chunk = &d.chunks[k];
+
+		pthread_mutex_lock(&d.mutex);
+		while (!chunk->done)
+			pthread_cond_wait(&d.cond, &d.mutex);
+		pthread_mutex_unlock(&d.mutex);
+
+		if (chunk->new_block) {
+			ieot->entries[ieot->nr].nr = block_nr;
+			ieot->entries[ieot->nr].offset = block_offset;
+			ieot->nr++;
+			block_nr = 0;
+			block_offset = offset;
+		}
+		if (err)
+			; /* keep going until the workers are done */
+		else if (d.hash_blocks)
+			err = ce_write_block(c, fd, chunk->sb.buf, chunk->sb.len,
+					     chunk->hash);
+		else
+			err = ce_write(c, fd, chunk->sb.buf, chunk->sb.len);
+		offset += chunk->sb.len;
+		block_nr += chunk->nr;
+		strbuf_release(&chunk->sb);
+
+		pthread_mutex_lock(&d.mutex);
+		d.written = k + 1;
+		pthread_cond_broadcast(&d.cond);
+		pthread_mutex_unlock(&d.mutex);
+	}
+	if (ieot && block_nr) {
+		ieot->entries[ieot->nr].nr = block_nr;
+		ieot->entries[ieot->nr].offset = block_offset;
+		ieot->nr++;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_join(threads[i], NULL);
+		if (ret)
+			die(_("unable to join write_entries thread: %s"), strerror(ret));
+	}
+	free(threads);
+	free(d.chunks);
+	pthread_cond_destroy(&d.cond);
+	pthread_mutex_destroy(&d.mutex);
+	return err;
+}
+
 /*
  * On success, `tempfile` is closed. If it is the temporary file
  * of a `struct lock_file`, we will therefore effectively perform
@@ -2808,6 +3182,13 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	hdr.hdr_version = htonl(hdr_version);
 	hdr.hdr_entries = htonl(entries - removed);
 
+	index_blocks.enabled = record_block_checksums();
+	index_blocks.finished = 0;
+	index_blocks.offset = 0;
+	index_blocks.len = 0;
+	index_blocks.nr = 0;
+	the_hash_algo->init_fn(&index_blocks.ctx);
+
 	the_hash_algo->init_fn(&c);
 	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
@@ -2854,55 +3235,68 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	nr = 0;
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
 
-	for (i = 0; i < entries; i++) {
-		struct cache_entry *ce = cache[i];
-		if (ce->ce_flags & CE_REMOVE)
-			continue;
-		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
-			ce_smudge_racily_clean_entry(istate, ce);
-		if (is_null_oid(&ce->oid)) {
-			static const char msg[] = "cache entry has null sha1: %s";
-			static int allow = -1;
+	if (!nr_threads) {
+		nr_threads = istate->cache_nr / THREAD_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+	}
 
-			if (allow < 0)
-				allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
-			if (allow)
-				warning(msg, ce->name);
-			else
-				err = error(msg, ce->name);
+	/* The threaded writer cannot strip names for the split index */
+	if (nr_threads > 1 && !istate->split_index) {
+		err = write_entries_threaded(istate, &c, newfd, nr_threads,
+					     ieot, ieot_entries, offset,
+					     &drop_cache_tree);
+	} else {
+		for (i = 0; i < entries; i++) {
+			struct cache_entry *ce = cache[i];
+			if (ce->ce_flags & CE_REMOVE)
+				continue;
+			if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
+				ce_smudge_racily_clean_entry(istate, ce);
+			if (is_null_oid(&ce->oid)) {
+				static const char msg[] = "cache entry has null sha1: %s";
+				static int allow = -1;
+
+				if (allow < 0)
+					allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
+				if (allow)
+					warning(msg, ce->name);
+				else
+					err = error(msg, ce->name);
+
+				drop_cache_tree = 1;
+			}
+			if (ieot && i && (i % ieot_entries == 0)) {
+				ieot->entries[ieot->nr].nr = nr;
+				ieot->entries[ieot->nr].offset = offset;
+				ieot->nr++;
+				/*
+				 * If we have a V4 index, set the first byte to an invalid
+				 * character to ensure there is nothing common with the previous
+				 * entry
+				 */
+				if (previous_name)
+					previous_name->buf[0] = 0;
+				nr = 0;
+				offset = lseek(newfd, 0, SEEK_CUR);
+				if (offset < 0) {
+					free(ieot);
+					return -1;
+				}
+				offset += write_buffer_len;
+			}
+			if (ce_write_entry(&c, newfd, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
+				err = -1;
 
-			drop_cache_tree = 1;
+			if (err)
+				break;
+			nr++;
 		}
-		if (ieot && i && (i % ieot_entries == 0)) {
+		if (ieot && nr) {
 			ieot->entries[ieot->nr].nr = nr;
 			ieot->entries[ieot->nr].offset = offset;
 			ieot->nr++;
-			/*
-			 * If we have a V4 index, set the first byte to an invalid
-			 * character to ensure there is nothing common with the previous
-			 * entry
-			 */
-			if (previous_name)
-				previous_name->buf[0] = 0;
-			nr = 0;
-			offset = lseek(newfd, 0, SEEK_CUR);
-			if (offset < 0) {
-				free(ieot);
-				return -1;
-			}
-			offset += write_buffer_len;
 		}
-		if (ce_write_entry(&c, newfd, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
-			err = -1;
-
-		if (err)
-			break;
-		nr++;
-	}
-	if (ieot && nr) {
-		ieot->entries[ieot->nr].nr = nr;
-		ieot->entries[ieot->nr].offset = offset;
-		ieot->nr++;
 	}
 	strbuf_release(&previous_name_buf);
 
@@ -2993,6 +3387,43 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		if (err)
 			return -1;
 	}
+	if (!strip_extensions && !istate->split_index && !removed &&
+	    record_name_hash()) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_name_hash_extension(&sb, istate);
+		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_NAMEHASH, sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (istate->sparse_index) {
+		if (write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0)
+			return -1;
+	}
+
+	/*
+	 * CACHE_EXT_BLOCKCHECKSUMS covers everything written so far, and the
+	 * trailing hash covers the rest, from its header on. It must come
+	 * last but for CACHE_EXT_ENDOFINDEXENTRIES, so that it can be found
+	 * from the end.
+	 */
+	if (index_blocks.enabled) {
+		struct strbuf sb = STRBUF_INIT;
+
+		if (ce_write_flush(&c, newfd))
+			return -1;
+		index_blocks_end();
+		index_blocks.finished = 1;
+
+		write_block_checksums_extension(&sb);
+		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_BLOCKCHECKSUMS, sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
 
 	/*
 	 * CACHE_EXT_ENDOFINDEXENTRIES must be written as the last entry before the SHA1
@@ -3213,8 +3644,9 @@ static int too_many_not_shared_entries(struct index_state *istate)
 int write_locked_index(struct index_state *istate, struct lock_file *lock,
 		       unsigned flags)
 {
-	int new_shared_index, ret;
+	int new_shared_index, ret, restore_full;
 	struct split_index *si = istate->split_index;
+	struct full_index full;
 
 	if (git_env_bool("GIT_TEST_CHECK_CACHE_TREE", 0))
 		cache_tree_verify(the_repository, istate);
@@ -3225,6 +3657,23 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 		return 0;
 	}
 
+	/*
+	 * Write a sparse index if so configured. Only commands that can
+	 * deal with sparse directory entries keep the index sparse in
+	 * memory (see post_read_index_from()); the others get back the
+	 * full index they had. A split index is never sparse.
+	 */
+	if (!istate->repo)
+		istate->repo = the_repository;
+	prepare_repo_settings(istate->repo);
+	restore_full = 0;
+	if (si)
+		ensure_full_index(istate);
+	else if (!istate->repo->settings.command_requires_full_index)
+		convert_to_sparse(istate);
+	else
+		restore_full = convert_to_sparse_for_write(istate, &full);
+
 	if (istate->fsmonitor_last_update)
 		fill_fsmonitor_bitmap(istate);
 
@@ -3280,6 +3729,8 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 out:
 	if (flags & COMMIT_LOCK)
 		rollback_lock_file(lock);
+	if (restore_full)
+		restore_full_index(istate, &full);
 	return ret;
 }
 
@@ -3635,3 +4086,187 @@ static void write_ieot_extension(struct strbuf *sb, struct index_entry_offset_ta
 		strbuf_add(sb, &buffer, sizeof(uint32_t));
 	}
 }
+
+/*
+ * The block checksums (bsum) extension records the hashes of consecutive
+ * blocks of the file, from its start up to the extension. The trailing
+ * hash of the file is then that of the rest of the file, from the
+ * extension header up to the trailer, instead of that of the whole file,
+ * so that the blocks can be hashed and verified in parallel. As that
+ * changes what the trailer means, the extension is a required one.
+ *
+ * "bsum"
+ * <4-byte length>
+ * for each block:
+ *	<4-byte offset of the end of the block>
+ *	<hash of the block>
+ * <4-byte number of blocks>
+ */
+static void write_block_checksums_extension(struct strbuf *sb)
+{
+	uint32_t buffer;
+	int i;
+
+	for (i = 0; i < index_blocks.nr; i++) {
+		put_be32(&buffer, index_blocks.block[i].end);
+		strbuf_add(sb, &buffer, sizeof(uint32_t));
+		strbuf_add(sb, index_blocks.block[i].hash, the_hash_algo->rawsz);
+	}
+	put_be32(&buffer, index_blocks.nr);
+	strbuf_add(sb, &buffer, sizeof(uint32_t));
+}
+
+/*
+ * Find the data of the bsum extension, which comes last but for EOIE,
+ * and check that its blocks cover everything before it. "start" is set
+ * to the offset of the extension header.
+ */
+static const char *find_block_checksums(const char *mmap, size_t mmap_size,
+					uint32_t *nr_blocks, size_t *ext_start)
+{
+	const unsigned int entry_size = sizeof(uint32_t) + the_hash_algo->rawsz;
+	size_t end = mmap_size - the_hash_algo->rawsz, start;
+	uint32_t nr, extsize, i, prev = 0;
+	const char *data;
+
+	if (read_eoie_extension(mmap, mmap_size))
+		end -= EOIE_SIZE_WITH_HEADER;
+	if (end < sizeof(struct cache_header) + 8 + sizeof(uint32_t))
+		return NULL;
+
+	nr = get_be32(mmap + end - sizeof(uint32_t));
+	if (!nr || nr > (end - sizeof(struct cache_header)) / entry_size)
+		return NULL;
+	extsize = nr * entry_size + sizeof(uint32_t);
+	if (end < sizeof(struct cache_header) + 8 + extsize)
+		return NULL;
+	start = end - extsize - 8;
+	data = mmap + start;
+	if (CACHE_EXT(data) != CACHE_EXT_BLOCKCHECKSUMS ||
+	    get_be32(data + 4) != extsize)
+		return NULL;
+
+	data += 8;
+	for (i = 0; i < nr; i++) {
+		uint32_t block_end = get_be32(data + i * entry_size);
+		if (block_end <= prev)
+			return NULL;
+		prev = block_end;
+	}
+	if (prev != start)
+		return NULL;
+
+	*nr_blocks = nr;
+	*ext_start = start;
+	return data;
+}
+
+struct verify_blocks_data {
+	pthread_t pthread;
+	const char *mmap;
+	const char *data;	/* of the bsum extension */
+	uint32_t first, nr;	/* range of blocks to verify */
+	int bad;
+};
+
+static void *verify_blocks_thread(void *_data)
+{
+	struct verify_blocks_data *p = _data;
+	const unsigned int entry_size = sizeof(uint32_t) + the_hash_algo->rawsz;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	uint32_t i;
+
+	for (i = p->first; i < p->first + p->nr; i++) {
+		const char *entry = p->data + i * entry_size;
+		uint32_t start = i ? get_be32(entry - entry_size) : 0;
+		uint32_t end = get_be32(entry);
+		git_hash_ctx c;
+
+		the_hash_algo->init_fn(&c);
+		the_hash_algo->update_fn(&c, p->mmap + start, end - start);
+		the_hash_algo->final_fn(hash, &c);
+		if (!hasheq(hash, (const unsigned char *)entry + sizeof(uint32_t))) {
+			p->bad = 1;
+			break;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Verify the checksums of an index with a bsum extension, with threads
+ * if index.threads allows. Returns 0 if they are good, -1 if not, or 1
+ * if the index has no bsum extension, in which case the caller is to
+ * verify the hash of the whole file.
+ */
+static int verify_block_checksums(const char *mmap, size_t mmap_size,
+				  unsigned int nr_entries)
+{
+	struct verify_blocks_data *data;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	const char *blocks;
+	uint32_t nr_blocks, first = 0;
+	size_t start;
+	int nr_threads, i, bad = 0;
+	git_hash_ctx c;
+
+	blocks = find_block_checksums(mmap, mmap_size, &nr_blocks, &start);
+	if (!blocks)
+		return 1;
+
+	the_hash_algo->init_fn(&c);
+	the_hash_algo->update_fn(&c, mmap + start,
+				 mmap_size - the_hash_algo->rawsz - start);
+	the_hash_algo->final_fn(hash, &c);
+	if (!hasheq(hash, (const unsigned char *)mmap + mmap_size - the_hash_algo->rawsz))
+		return error(_("bad index file sha1 signature"));
+
+	if (!HAVE_THREADS || git_config_get_index_threads(&nr_threads))
+		nr_threads = 1;
+	if (!nr_threads) {
+		nr_threads = nr_entries / THREAD_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+	}
+	if (nr_threads < 1)
+		nr_threads = 1;
+	if (nr_threads > nr_blocks)
+		nr_threads = nr_blocks;
+
+	data = xcalloc(nr_threads, sizeof(*data));
+	for (i = 0; i < nr_threads; i++) {
+		struct verify_blocks_data *p = &data[i];
+
+		p->mmap = mmap;
+		p->data = blocks;
+		p->first = first;
+		p->nr = (nr_blocks - first) / (nr_threads - i);
+		first += p->nr;
+
+		if (nr_threads == 1) {
+			verify_blocks_thread(p);
+		} else {
+			int err = pthread_create(&p->pthread, NULL,
+						 verify_blocks_thread, p);
+			if (err)
+				die(_("unable to create verify_blocks thread: %s"),
+				    strerror(err));
+		}
+	}
+	for (i = 0; i < nr_threads; i++) {
+		struct verify_blocks_data *p = &data[i];
+
+		if (nr_threads > 1) {
+			int err = pthread_join(p->pthread, NULL);
+			if (err)
+				die(_("unable to join verify_blocks thread: %s"),
+				    strerror(err));
+		}
+		bad |= p->bad;
+	}
+	free(data);
+
+	if (bad)
+		return error(_("bad index file block checksum"));
+	return 0;
+}
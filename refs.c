@@ -1752,9 +1752,10 @@ static struct ref_store *lookup_ref_store_map(struct hashmap *map,
  * gitdir.
  */
 static struct ref_store *ref_store_init(const char *gitdir,
+					const char *format,
 					unsigned int flags)
 {
-	const char *be_name = "files";
+	const char *be_name = format ? format : "files";
 	struct ref_storage_be *be = find_ref_storage_backend(be_name);
 	struct ref_store *refs;
 
@@ -1773,7 +1774,8 @@ struct ref_store *get_main_ref_store(struct repository *r)
 	if (!r->gitdir)
 		BUG("attempting to get main_ref_store outside of repository");
 
-	r->refs_private = ref_store_init(r->gitdir, REF_STORE_ALL_CAPS);
+	r->refs_private = ref_store_init(r->gitdir, r->ref_storage_format,
+					 REF_STORE_ALL_CAPS);
 	r->refs_private = maybe_debug_wrap_ref_store(r->gitdir, r->refs_private);
 	return r->refs_private;
 }
@@ -1797,9 +1799,21 @@ static void register_ref_store_map(struct hashmap *map,
 		BUG("%s ref_store '%s' initialized twice", type, name);
 }
 
+static void read_submodule_ref_storage_format(struct repository_format *format,
+					      const char *gitdir)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	get_common_dir_noenv(&sb, gitdir);
+	strbuf_addstr(&sb, "/config");
+	read_repository_format(format, sb.buf);
+	strbuf_release(&sb);
+}
+
 struct ref_store *get_submodule_ref_store(const char *submodule)
 {
 	struct strbuf submodule_sb = STRBUF_INIT;
+	struct repository_format format = REPOSITORY_FORMAT_INIT;
 	struct ref_store *refs;
 	char *to_free = NULL;
 	size_t len;
@@ -1828,13 +1842,17 @@ struct ref_store *get_submodule_ref_store(const char *submodule)
 	if (submodule_to_gitdir(&submodule_sb, submodule))
 		goto done;
 
+	/* The submodule may store its references in another format. */
+	read_submodule_ref_storage_format(&format, submodule_sb.buf);
+
 	/* assume that add_submodule_odb() has been called */
-	refs = ref_store_init(submodule_sb.buf,
+	refs = ref_store_init(submodule_sb.buf, format.ref_storage_format,
 			      REF_STORE_READ | REF_STORE_ODB);
 	register_ref_store_map(&submodule_ref_stores, "submodule",
 			       refs, submodule);
 
 done:
+	clear_repository_format(&format);
 	strbuf_release(&submodule_sb);
 	free(to_free);
 
@@ -1856,9 +1874,11 @@ struct ref_store *get_worktree_ref_store(const struct worktree *wt)
 
 	if (wt->id)
 		refs = ref_store_init(git_common_path("worktrees/%s", wt->id),
+				      the_repository->ref_storage_format,
 				      REF_STORE_ALL_CAPS);
 	else
 		refs = ref_store_init(get_git_common_dir(),
+				      the_repository->ref_storage_format,
 				      REF_STORE_ALL_CAPS);
 
 	if (refs)
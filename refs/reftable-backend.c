@@ -0,0 +1,1801 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "reftable.h"
+#include "../iterator.h"
+#include "../lockfile.h"
+#include "../object.h"
+#include "../chdir-notify.h"
+
+/*
+ * This backend stores references and reflogs in stacks of reftables
+ * (see reftable.h). The shared references live in
+ * "$GIT_COMMON_DIR/reftable"; the per-worktree references (HEAD,
+ * pseudorefs, refs/bisect/ etc.) of a linked worktree live in
+ * "$GIT_DIR/reftable".
+ *
+ * It uses the following flags in `ref_update::flags` for internal
+ * bookkeeping purposes. Their numerical values must not conflict with
+ * REF_NO_DEREF, REF_FORCE_CREATE_REFLOG, REF_HAVE_NEW, REF_HAVE_OLD or
+ * REF_LOG_ONLY, which are also stored in `ref_update::flags`.
+ */
+
+/*
+ * The update deletes the reference.
+ */
+#define REF_DELETING (1 << 5)
+
+/*
+ * The update writes a new value for the reference (and therefore
+ * needs a reflog entry).
+ */
+#define REF_NEEDS_COMMIT (1 << 6)
+
+/*
+ * Used as a flag in ref_update::flags when the ref_update was via an
+ * update to HEAD.
+ */
+#define REF_UPDATE_VIA_HEAD (1 << 8)
+
+struct reftable_ref_store {
+	struct ref_store base;
+	unsigned int store_flags;
+
+	char *gitcommondir;
+
+	/* The shared references: */
+	struct reftable_stack main_stack;
+
+	/* The per-worktree references of a linked worktree, or NULL: */
+	struct reftable_stack *worktree_stack;
+
+	/* Stacks of other worktrees, for "worktrees/<id>/<ref>": */
+	struct string_list other_stacks;
+};
+
+static void reparent_stack(const char *name, struct reftable_stack *st)
+{
+	chdir_notify_reparent(name, &st->dir);
+	chdir_notify_reparent(name, &st->list_path);
+}
+
+static struct ref_store *reftable_ref_store_create(const char *gitdir,
+						   unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+	int linked;
+
+	ref_store->gitdir = xstrdup(gitdir);
+	base_ref_store_init(ref_store, &refs_be_reftable);
+	refs->store_flags = flags;
+
+	linked = get_common_dir_noenv(&sb, gitdir);
+	refs->gitcommondir = strbuf_detach(&sb, NULL);
+
+	strbuf_addf(&sb, "%s/reftable", refs->gitcommondir);
+	reftable_stack_init(&refs->main_stack, sb.buf);
+	if (linked) {
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s/reftable", gitdir);
+		refs->worktree_stack = xmalloc(sizeof(*refs->worktree_stack));
+		reftable_stack_init(refs->worktree_stack, sb.buf);
+		reparent_stack("reftable-backend worktree stack",
+			       refs->worktree_stack);
+	}
+	strbuf_release(&sb);
+	string_list_init(&refs->other_stacks, 1);
+
+	chdir_notify_reparent("reftable-backend $GIT_DIR", &refs->base.gitdir);
+	chdir_notify_reparent("reftable-backend $GIT_COMMONDIR",
+			      &refs->gitcommondir);
+	reparent_stack("reftable-backend main stack", &refs->main_stack);
+
+	return ref_store;
+}
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store. required_flags is compared with ref_store's
+ * store_flags to ensure the ref_store has all required capabilities.
+ * "caller" is used in any necessary error messages.
+ */
+static struct reftable_ref_store *reftable_downcast(struct ref_store *ref_store,
+						    unsigned int required_flags,
+						    const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		BUG("ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		BUG("operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+/*
+ * Return the stack that holds `refname`, and set *name to the name of
+ * the reference within that stack.
+ */
+static struct reftable_stack *stack_for(struct reftable_ref_store *refs,
+					const char *refname, const char **name)
+{
+	struct string_list_item *item;
+	struct strbuf sb = STRBUF_INIT;
+	const char *id, *slash;
+
+	*name = refname;
+	switch (ref_type(refname)) {
+	case REF_TYPE_PER_WORKTREE:
+	case REF_TYPE_PSEUDOREF:
+		return refs->worktree_stack ?
+			refs->worktree_stack : &refs->main_stack;
+	case REF_TYPE_MAIN_PSEUDOREF:
+		skip_prefix(refname, "main-worktree/", name);
+		return &refs->main_stack;
+	case REF_TYPE_OTHER_PSEUDOREF:
+		id = refname + strlen("worktrees/");
+		slash = strchr(id, '/');
+		*name = slash + 1;
+
+		strbuf_add(&sb, id, slash - id);
+		item = string_list_insert(&refs->other_stacks, sb.buf);
+		if (!item->util) {
+			strbuf_reset(&sb);
+			strbuf_addf(&sb, "%s/worktrees/%.*s/reftable",
+				    refs->gitcommondir, (int)(slash - id), id);
+			item->util = xmalloc(sizeof(struct reftable_stack));
+			reftable_stack_init(item->util, sb.buf);
+		}
+		strbuf_release(&sb);
+		return item->util;
+	default:
+		return &refs->main_stack;
+	}
+}
+
+static int reftable_read_raw_ref(struct ref_store *ref_store,
+				 const char *refname, struct object_id *oid,
+				 struct strbuf *referent, unsigned int *type)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_stack *st;
+	struct reftable_record rec;
+	const char *name;
+	int ret = -1;
+
+	*type = 0;
+	st = stack_for(refs, refname, &name);
+
+	reftable_record_init(&rec);
+	if (!reftable_snapshot_lookup(reftable_stack_snapshot(st),
+				      REFTABLE_BLOCK_TYPE_REF,
+				      name, strlen(name), &rec) ||
+	    rec.value_type == REFTABLE_REF_DELETION) {
+		errno = ENOENT;
+		goto out;
+	}
+
+	if (rec.value_type == REFTABLE_REF_SYMREF) {
+		strbuf_reset(referent);
+		strbuf_addbuf(referent, &rec.target);
+		*type |= REF_ISSYMREF;
+	} else {
+		oidcpy(oid, &rec.oid);
+	}
+	ret = 0;
+
+out:
+	reftable_record_release(&rec);
+	return ret;
+}
+
+/* Reference iteration */
+
+enum worktree_filter {
+	FILTER_NONE,
+	FILTER_SHARED_ONLY,
+	FILTER_PER_WORKTREE_ONLY
+};
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+
+	struct reftable_ref_store *refs;
+	struct reftable_merged_iter it;
+	char *prefix;
+	unsigned int flags;
+	enum worktree_filter filter;
+
+	/* Scratch space for current values: */
+	struct object_id oid, peeled;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	while (!reftable_merged_iter_next(&iter->it)) {
+		struct reftable_record *rec = iter->it.rec;
+		const char *refname = rec->key.buf;
+		int is_per_worktree;
+
+		if (iter->prefix && !starts_with(refname, iter->prefix))
+			break;
+		if (rec->value_type == REFTABLE_REF_DELETION ||
+		    !starts_with(refname, "refs/"))
+			continue;
+
+		is_per_worktree = ref_type(refname) == REF_TYPE_PER_WORKTREE;
+		if ((iter->filter == FILTER_SHARED_ONLY && is_per_worktree) ||
+		    (iter->filter == FILTER_PER_WORKTREE_ONLY && !is_per_worktree) ||
+		    (iter->flags & DO_FOR_EACH_PER_WORKTREE_ONLY && !is_per_worktree))
+			continue;
+
+		iter->base.refname = refname;
+		iter->base.flags = 0;
+		oidclr(&iter->peeled);
+		if (rec->value_type == REFTABLE_REF_SYMREF) {
+			iter->base.flags |= REF_ISSYMREF;
+			if (!refs_resolve_ref_unsafe(&iter->refs->base, refname,
+						     RESOLVE_REF_READING,
+						     &iter->oid, NULL)) {
+				oidclr(&iter->oid);
+				iter->base.flags |= REF_ISBROKEN;
+			}
+		} else {
+			oidcpy(&iter->oid, &rec->oid);
+			if (rec->value_type == REFTABLE_REF_VAL2)
+				oidcpy(&iter->peeled, &rec->peeled);
+		}
+
+		if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+			if (!refname_is_safe(refname))
+				die("reftable refname is dangerous: %s", refname);
+			oidclr(&iter->oid);
+			iter->base.flags |= REF_BAD_NAME | REF_ISBROKEN;
+		}
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(refname, &iter->oid,
+					    iter->base.flags))
+			continue;
+
+		return ITER_OK;
+	}
+
+	return ref_iterator_abort(ref_iterator);
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	if (iter->base.flags & (REF_ISBROKEN | REF_ISSYMREF))
+		return -1;
+	if (!is_null_oid(&iter->peeled)) {
+		oidcpy(peeled, &iter->peeled);
+		return 0;
+	}
+	return !!peel_object(&iter->oid, peeled);
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_merged_iter_release(&iter->it);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	reftable_ref_iterator_advance,
+	reftable_ref_iterator_peel,
+	reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *stack_ref_iterator_begin(
+		struct reftable_ref_store *refs, struct reftable_stack *st,
+		const char *prefix, unsigned int flags,
+		enum worktree_filter filter)
+{
+	struct reftable_ref_iterator *iter = xcalloc(1, sizeof(*iter));
+	struct ref_iterator *ref_iterator = &iter->base;
+	struct reftable_snapshot *snap = reftable_stack_snapshot(st);
+
+	base_ref_iterator_init(ref_iterator, &reftable_ref_iterator_vtable, 1);
+	iter->refs = refs;
+	iter->flags = flags;
+	iter->filter = filter;
+	iter->base.oid = &iter->oid;
+	if (prefix && *prefix)
+		iter->prefix = xstrdup(prefix);
+	reftable_merged_iter_init(&iter->it, snap, 0,
+				  snap->nr ? snap->nr - 1 : 0,
+				  REFTABLE_BLOCK_TYPE_REF,
+				  prefix, prefix ? strlen(prefix) : 0);
+	return ref_iterator;
+}
+
+static struct ref_iterator *reftable_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_store *refs;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+	refs = reftable_downcast(ref_store, required_flags,
+				 "ref_iterator_begin");
+
+	if (!refs->worktree_stack)
+		return stack_ref_iterator_begin(refs, &refs->main_stack,
+						prefix, flags, FILTER_NONE);
+
+	/*
+	 * The per-worktree references of the main worktree live in
+	 * the main stack as well; hide them from linked worktrees.
+	 */
+	return overlay_ref_iterator_begin(
+			stack_ref_iterator_begin(refs, refs->worktree_stack,
+						 prefix, flags,
+						 FILTER_PER_WORKTREE_ONLY),
+			stack_ref_iterator_begin(refs, &refs->main_stack,
+						 prefix, flags,
+						 FILTER_SHARED_ONLY));
+}
+
+/* Reflog helpers */
+
+/*
+ * Call fn for each reflog record of `name` in `st`, newest first,
+ * including deletion records. Stop and return fn's return value if
+ * it is non-zero.
+ */
+static int for_each_log_record(struct reftable_stack *st, const char *name,
+			       int (*fn)(struct reftable_record *rec, void *cb_data),
+			       void *cb_data)
+{
+	struct reftable_snapshot *snap = reftable_stack_snapshot(st);
+	struct reftable_merged_iter it;
+	size_t len = strlen(name);
+	int ret = 0;
+
+	if (!snap->nr)
+		return 0;
+
+	reftable_merged_iter_init(&it, snap, 0, snap->nr - 1,
+				  REFTABLE_BLOCK_TYPE_LOG, name, len + 1);
+	while (!ret && !reftable_merged_iter_next(&it)) {
+		struct reftable_record *rec = it.rec;
+
+		if (rec->key.len != len + 9 || memcmp(rec->key.buf, name, len + 1))
+			break;
+		ret = fn(rec, cb_data);
+	}
+	reftable_merged_iter_release(&it);
+	return ret;
+}
+
+static int log_record_exists(struct reftable_record *rec, void *cb_data)
+{
+	return rec->value_type != REFTABLE_LOG_DELETION;
+}
+
+static int stack_reflog_exists(struct reftable_stack *st, const char *name)
+{
+	return for_each_log_record(st, name, log_record_exists, NULL);
+}
+
+/*
+ * A reflog without entries is represented by a record that has null
+ * old and new object names. It is never shown to callers.
+ */
+static int is_reflog_existence_marker(struct reftable_record *rec)
+{
+	return is_null_oid(&rec->old_oid) && is_null_oid(&rec->new_oid);
+}
+
+static void fill_log_record(struct reftable_record *rec, const char *name,
+			    uint64_t update_index,
+			    const struct object_id *old_oid,
+			    const struct object_id *new_oid,
+			    const char *committer, const char *msg)
+{
+	const char *email_end = strrchr(committer, '>');
+	char *tz;
+
+	reftable_log_key(rec, name, update_index);
+	rec->value_type = REFTABLE_LOG_UPDATE;
+	oidcpy(&rec->old_oid, old_oid);
+	oidcpy(&rec->new_oid, new_oid);
+
+	strbuf_reset(&rec->ident);
+	if (!email_end) {
+		strbuf_addstr(&rec->ident, committer);
+		rec->time = 0;
+		rec->tz = 0;
+	} else {
+		strbuf_add(&rec->ident, committer, email_end + 1 - committer);
+		rec->time = parse_timestamp(email_end + 1, &tz, 10);
+		rec->tz = strtol(tz, NULL, 10);
+	}
+
+	strbuf_reset(&rec->message);
+	if (msg)
+		strbuf_addstr(&rec->message, msg);
+}
+
+/* Building new tables */
+
+/*
+ * The records that an update of a single stack is going to write,
+ * along with the lock on the stack.
+ */
+struct stack_update {
+	struct reftable_stack *stack;
+	struct lock_file lock;
+	uint64_t update_index;
+
+	struct reftable_record *refs;
+	size_t refs_nr, refs_alloc;
+	struct reftable_record *logs;
+	size_t logs_nr, logs_alloc;
+};
+
+static struct reftable_record *add_ref_record(struct stack_update *u,
+					      const char *name,
+					      unsigned int value_type)
+{
+	struct reftable_record *rec;
+
+	ALLOC_GROW(u->refs, u->refs_nr + 1, u->refs_alloc);
+	rec = &u->refs[u->refs_nr++];
+	reftable_record_init(rec);
+	strbuf_addstr(&rec->key, name);
+	rec->value_type = value_type;
+	rec->update_index = u->update_index;
+	return rec;
+}
+
+static struct reftable_record *add_log_record(struct stack_update *u)
+{
+	struct reftable_record *rec;
+
+	ALLOC_GROW(u->logs, u->logs_nr + 1, u->logs_alloc);
+	rec = &u->logs[u->logs_nr++];
+	reftable_record_init(rec);
+	return rec;
+}
+
+static void set_ref_value(struct reftable_record *rec,
+			  const struct object_id *oid, int peel)
+{
+	oidcpy(&rec->oid, oid);
+	if (peel && peel_object(oid, &rec->peeled) == PEEL_PEELED)
+		rec->value_type = REFTABLE_REF_VAL2;
+	else
+		rec->value_type = REFTABLE_REF_VAL1;
+}
+
+static int add_log_tombstone(struct reftable_record *rec, void *cb_data)
+{
+	struct stack_update *u = cb_data;
+	struct reftable_record *tombstone;
+
+	if (rec->value_type == REFTABLE_LOG_DELETION)
+		return 0;
+	tombstone = add_log_record(u);
+	strbuf_addbuf(&tombstone->key, &rec->key);
+	tombstone->update_index = rec->update_index;
+	tombstone->value_type = REFTABLE_LOG_DELETION;
+	return 0;
+}
+
+/* Queue deletion records for all entries of the reflog of `name`. */
+static void delete_log_records(struct stack_update *u, const char *name)
+{
+	for_each_log_record(u->stack, name, add_log_tombstone, u);
+}
+
+static int stack_update_begin(struct stack_update *u,
+			      struct reftable_stack *st, struct strbuf *err)
+{
+	memset(u, 0, sizeof(*u));
+	u->stack = st;
+	if (reftable_stack_lock(st, &u->lock, err))
+		return -1;
+	u->update_index =
+		reftable_snapshot_max_update_index(st->snapshot) + 1;
+	return 0;
+}
+
+static int record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_record *a = va, *b = vb;
+	int cmp = memcmp(a->key.buf, b->key.buf,
+			 a->key.len < b->key.len ? a->key.len : b->key.len);
+
+	if (cmp)
+		return cmp;
+	return a->key.len < b->key.len ? -1 : a->key.len > b->key.len;
+}
+
+/*
+ * Sort the records by key. If a key was queued more than once, keep
+ * only the record that was queued last.
+ */
+static void sort_records(struct reftable_record *recs, size_t *nr)
+{
+	size_t i, j;
+
+	STABLE_QSORT(recs, *nr, record_cmp);
+	for (i = j = 0; i < *nr; i++) {
+		if (i + 1 < *nr && !record_cmp(&recs[i], &recs[i + 1])) {
+			reftable_record_release(&recs[i]);
+			continue;
+		}
+		if (i != j)
+			recs[j] = recs[i];
+		j++;
+	}
+	*nr = j;
+}
+
+static void stack_update_release(struct stack_update *u)
+{
+	size_t i;
+
+	rollback_lock_file(&u->lock);
+	for (i = 0; i < u->refs_nr; i++)
+		reftable_record_release(&u->refs[i]);
+	for (i = 0; i < u->logs_nr; i++)
+		reftable_record_release(&u->logs[i]);
+	FREE_AND_NULL(u->refs);
+	FREE_AND_NULL(u->logs);
+	u->refs_nr = u->logs_nr = 0;
+}
+
+static int auto_compaction_enabled(void)
+{
+	static int auto_compact = -1;
+
+	if (auto_compact < 0 &&
+	    git_config_get_bool("reftable.autocompaction", &auto_compact))
+		auto_compact = 1;
+	return auto_compact;
+}
+
+/*
+ * Write the queued records as a new table and release the lock. If
+ * nothing was queued, just release the lock.
+ */
+static int stack_update_commit(struct stack_update *u, struct strbuf *err)
+{
+	struct reftable_writer *w;
+	struct strbuf table = STRBUF_INIT;
+	size_t i;
+	int ret;
+
+	if (!u->refs_nr && !u->logs_nr) {
+		stack_update_release(u);
+		return 0;
+	}
+
+	sort_records(u->refs, &u->refs_nr);
+	sort_records(u->logs, &u->logs_nr);
+
+	w = reftable_writer_new(reftable_block_size(),
+				u->update_index, u->update_index);
+	for (i = 0; i < u->refs_nr; i++)
+		reftable_writer_add(w, REFTABLE_BLOCK_TYPE_REF, &u->refs[i]);
+	for (i = 0; i < u->logs_nr; i++)
+		reftable_writer_add(w, REFTABLE_BLOCK_TYPE_LOG, &u->logs[i]);
+	reftable_writer_finish(w, &table);
+
+	ret = reftable_stack_add(u->stack, &u->lock, &table,
+				 auto_compaction_enabled(), err);
+	strbuf_release(&table);
+	stack_update_release(u);
+	return ret;
+}
+
+/*
+ * Decide whether an update of the reference `refname` (stored as
+ * `name` in `st`) should be logged, in the same way as the files
+ * backend decides whether to append to a reflog file.
+ */
+static int should_write_log(struct reftable_stack *st, const char *refname,
+			    const char *name, unsigned int flags)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	return (flags & REF_FORCE_CREATE_REFLOG) ||
+		should_autocreate_reflog(refname) ||
+		stack_reflog_exists(st, name);
+}
+
+/*
+ * Check that `oid` can be stored in `refname`, as the files backend
+ * does before writing a loose reference.
+ */
+static int check_ref_value(const char *refname, const struct object_id *oid,
+			   struct strbuf *err)
+{
+	struct object *o = parse_object(the_repository, oid);
+
+	if (!o) {
+		strbuf_addf(err,
+			    "trying to write ref '%s' with nonexistent object %s",
+			    refname, oid_to_hex(oid));
+		return -1;
+	}
+	if (o->type != OBJ_COMMIT && is_branch(refname)) {
+		strbuf_addf(err,
+			    "trying to write non-commit object %s to branch '%s'",
+			    oid_to_hex(oid), refname);
+		return -1;
+	}
+	return 0;
+}
+
+/* Transactions */
+
+struct reftable_transaction_data {
+	struct stack_update **updates;
+	size_t nr, alloc;
+};
+
+/* The per-ref_update backend data: */
+struct reftable_update_data {
+	struct stack_update *stack_update;
+	const char *name; /* the name within the stack */
+	struct object_id old_oid;
+};
+
+static struct stack_update *transaction_stack_update(
+		struct reftable_transaction_data *data,
+		struct reftable_stack *st, struct strbuf *err)
+{
+	struct stack_update *u;
+	size_t i;
+
+	for (i = 0; i < data->nr; i++)
+		if (data->updates[i]->stack == st)
+			return data->updates[i];
+
+	u = xmalloc(sizeof(*u));
+	if (stack_update_begin(u, st, err)) {
+		free(u);
+		return NULL;
+	}
+	ALLOC_GROW(data->updates, data->nr + 1, data->alloc);
+	data->updates[data->nr++] = u;
+	return u;
+}
+
+static void reftable_transaction_cleanup(struct ref_transaction *transaction)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	size_t i;
+
+	for (i = 0; i < transaction->nr; i++)
+		FREE_AND_NULL(transaction->updates[i]->backend_data);
+
+	if (data) {
+		for (i = 0; i < data->nr; i++) {
+			stack_update_release(data->updates[i]);
+			free(data->updates[i]);
+		}
+		free(data->updates);
+		free(data);
+		transaction->backend_data = NULL;
+	}
+
+	transaction->state = REF_TRANSACTION_CLOSED;
+}
+
+/*
+ * If update is a direct update of head_ref (the reference pointed to
+ * by HEAD), then add an extra REF_LOG_ONLY update for HEAD.
+ */
+static int split_head_update(struct ref_update *update,
+			     struct ref_transaction *transaction,
+			     const char *head_ref,
+			     struct string_list *affected_refnames,
+			     struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+
+	if ((update->flags & REF_LOG_ONLY) ||
+	    (update->flags & REF_UPDATE_VIA_HEAD))
+		return 0;
+
+	if (strcmp(update->refname, head_ref))
+		return 0;
+
+	if (string_list_has_string(affected_refnames, "HEAD")) {
+		strbuf_addf(err,
+			    "multiple updates for 'HEAD' (including one "
+			    "via its referent '%s') are not allowed",
+			    update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_update = ref_transaction_add_update(
+			transaction, "HEAD",
+			update->flags | REF_LOG_ONLY | REF_NO_DEREF,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * update is for a symref that points at referent and doesn't have
+ * REF_NO_DEREF set. Split it into a REF_LOG_ONLY update of the symref
+ * and a separate update for the referent.
+ */
+static int split_symref_update(struct ref_update *update,
+			       const char *referent,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+	unsigned int new_flags;
+
+	if (string_list_has_string(affected_refnames, referent)) {
+		strbuf_addf(err,
+			    "multiple updates for '%s' (including one "
+			    "via symref '%s') are not allowed",
+			    referent, update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_flags = update->flags;
+	if (!strcmp(update->refname, "HEAD"))
+		new_flags |= REF_UPDATE_VIA_HEAD;
+
+	new_update = ref_transaction_add_update(
+			transaction, referent, new_flags,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+	new_update->parent_update = update;
+
+	update->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+	update->flags &= ~REF_HAVE_OLD;
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	if (item->util)
+		BUG("%s unexpectedly found in affected_refnames",
+		    new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * Return the refname under which update was originally requested.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   oideq(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+/*
+ * Prepare for carrying out update:
+ * - Lock the stack holding the reference and read its current value.
+ * - Check that its old OID value (if specified) is correct, and in
+ *   any case record it for later use when writing the reflog.
+ * - If it is a symref update without REF_NO_DEREF, split it up into a
+ *   REF_LOG_ONLY update of the symref and add a separate update for
+ *   the referent to transaction.
+ * - If it is an update of head_ref, add a corresponding REF_LOG_ONLY
+ *   update of HEAD.
+ * - Queue the new reference record.
+ */
+static int prepare_update(struct reftable_ref_store *refs,
+			  struct ref_update *update,
+			  struct ref_transaction *transaction,
+			  const char *head_ref,
+			  struct string_list *affected_refnames,
+			  struct strbuf *err)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	struct reftable_update_data *ud;
+	struct reftable_stack *st;
+	struct reftable_record rec;
+	struct ref_update *parent_update;
+	int exists, ret = 0;
+
+	if ((update->flags & REF_HAVE_NEW) && is_null_oid(&update->new_oid))
+		update->flags |= REF_DELETING;
+
+	if (head_ref) {
+		ret = split_head_update(update, transaction, head_ref,
+					affected_refnames, err);
+		if (ret)
+			return ret;
+	}
+
+	ud = xcalloc(1, sizeof(*ud));
+	update->backend_data = ud;
+	st = stack_for(refs, update->refname, &ud->name);
+	ud->stack_update = transaction_stack_update(data, st, err);
+	if (!ud->stack_update) {
+		char *reason = strbuf_detach(err, NULL);
+		strbuf_addf(err, "cannot lock ref '%s': %s",
+			    original_update_refname(update), reason);
+		free(reason);
+		return TRANSACTION_GENERIC_ERROR;
+	}
+
+	reftable_record_init(&rec);
+	exists = reftable_snapshot_lookup(st->snapshot,
+					  REFTABLE_BLOCK_TYPE_REF,
+					  ud->name, strlen(ud->name), &rec) &&
+		rec.value_type != REFTABLE_REF_DELETION;
+
+	if (!exists && (update->flags & REF_HAVE_NEW) &&
+	    !(update->flags & (REF_DELETING | REF_LOG_ONLY)) &&
+	    refs_verify_refname_available(&refs->base, update->refname,
+					  affected_refnames, NULL, err)) {
+		char *reason = strbuf_detach(err, NULL);
+		strbuf_addf(err, "cannot lock ref '%s': %s",
+			    original_update_refname(update), reason);
+		free(reason);
+		ret = TRANSACTION_NAME_CONFLICT;
+		goto out;
+	}
+
+	if (exists && rec.value_type == REFTABLE_REF_SYMREF) {
+		update->type |= REF_ISSYMREF;
+		if (update->flags & REF_NO_DEREF) {
+			/*
+			 * We won't be reading the referent as part of
+			 * the transaction, so we have to read it here
+			 * to record and possibly check old_oid:
+			 */
+			if (refs_read_ref_full(&refs->base, rec.target.buf, 0,
+					       &ud->old_oid, NULL)) {
+				if (update->flags & REF_HAVE_OLD) {
+					strbuf_addf(err, "cannot lock ref '%s': "
+						    "error reading reference",
+						    original_update_refname(update));
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto out;
+				}
+			} else if (check_old_oid(update, &ud->old_oid, err)) {
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+		} else {
+			ret = split_symref_update(update, rec.target.buf,
+						  transaction,
+						  affected_refnames, err);
+			goto out;
+		}
+	} else {
+		if (exists)
+			oidcpy(&ud->old_oid, &rec.oid);
+		if (check_old_oid(update, &ud->old_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+
+		/*
+		 * If this update is happening indirectly because of a
+		 * symref update, record the old OID in the parent
+		 * update:
+		 */
+		for (parent_update = update->parent_update;
+		     parent_update;
+		     parent_update = parent_update->parent_update) {
+			struct reftable_update_data *parent_ud =
+				parent_update->backend_data;
+			oidcpy(&parent_ud->old_oid, &ud->old_oid);
+		}
+	}
+
+	if (!(update->flags & REF_HAVE_NEW) || (update->flags & REF_LOG_ONLY))
+		goto out;
+
+	if (update->flags & REF_DELETING) {
+		if (exists)
+			add_ref_record(ud->stack_update, ud->name,
+				       REFTABLE_REF_DELETION);
+		delete_log_records(ud->stack_update, ud->name);
+	} else if (!(update->type & REF_ISSYMREF) &&
+		   oideq(&ud->old_oid, &update->new_oid)) {
+		/*
+		 * The reference already has the desired value, so we
+		 * don't need to write it.
+		 */
+	} else if (check_ref_value(update->refname, &update->new_oid, err)) {
+		char *write_err = strbuf_detach(err, NULL);
+		strbuf_addf(err, "cannot update ref '%s': %s",
+			    update->refname, write_err);
+		free(write_err);
+		ret = TRANSACTION_GENERIC_ERROR;
+	} else {
+		set_ref_value(add_ref_record(ud->stack_update, ud->name, 0),
+			      &update->new_oid, 1);
+		update->flags |= REF_NEEDS_COMMIT;
+	}
+
+out:
+	reftable_record_release(&rec);
+	return ret;
+}
+
+static int reftable_transaction_prepare(struct ref_store *ref_store,
+					struct ref_transaction *transaction,
+					struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_prepare");
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	const char *committer;
+	char *head_ref = NULL;
+	int head_type;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	if (!transaction->nr)
+		goto cleanup;
+
+	transaction->backend_data = xcalloc(1, sizeof(struct reftable_transaction_data));
+
+	/*
+	 * Fail if a refname appears more than once in the
+	 * transaction. (If we end up splitting up any updates using
+	 * split_symref_update() or split_head_update(), those
+	 * functions will check that the new updates don't have the
+	 * same refname as any existing ones.)
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct string_list_item *item =
+			string_list_append(&affected_refnames, update->refname);
+
+		item->util = update;
+	}
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/*
+	 * If HEAD is a symbolic reference, then record the name of
+	 * the reference that it points to, so that a direct update of
+	 * that reference is logged in HEAD's reflog, too (see the
+	 * files backend for the rationale).
+	 */
+	head_ref = refs_resolve_refdup(ref_store, "HEAD",
+				       RESOLVE_REF_NO_RECURSE,
+				       NULL, &head_type);
+	if (head_ref && !(head_type & REF_ISSYMREF))
+		FREE_AND_NULL(head_ref);
+
+	/*
+	 * Note that prepare_update() might append more updates to
+	 * the transaction.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		ret = prepare_update(refs, transaction->updates[i],
+				     transaction, head_ref,
+				     &affected_refnames, err);
+		if (ret)
+			goto cleanup;
+	}
+
+	/*
+	 * Now that the old values of all references (including those
+	 * reached via symrefs) are known, queue the reflog entries.
+	 */
+	committer = git_committer_info(0);
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update_data *ud = update->backend_data;
+		struct stack_update *u = ud->stack_update;
+
+		if (!(update->flags & (REF_NEEDS_COMMIT | REF_LOG_ONLY)) ||
+		    !should_write_log(u->stack, update->refname, ud->name,
+				      update->flags))
+			continue;
+		fill_log_record(add_log_record(u), ud->name, u->update_index,
+				&ud->old_oid, &update->new_oid,
+				committer, update->msg);
+	}
+
+cleanup:
+	free(head_ref);
+	string_list_clear(&affected_refnames, 0);
+
+	if (ret)
+		reftable_transaction_cleanup(transaction);
+	else
+		transaction->state = REF_TRANSACTION_PREPARED;
+
+	return ret;
+}
+
+static int reftable_transaction_finish(struct ref_store *ref_store,
+				       struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	size_t i;
+	int ret = 0;
+
+	reftable_downcast(ref_store, 0, "ref_transaction_finish");
+
+	for (i = 0; data && i < data->nr; i++) {
+		if (stack_update_commit(data->updates[i], err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			break;
+		}
+	}
+
+	reftable_transaction_cleanup(transaction);
+	return ret;
+}
+
+static int reftable_transaction_abort(struct ref_store *ref_store,
+				      struct ref_transaction *transaction,
+				      struct strbuf *err)
+{
+	reftable_downcast(ref_store, 0, "ref_transaction_abort");
+	reftable_transaction_cleanup(transaction);
+	return 0;
+}
+
+static int reftable_initial_transaction_commit(struct ref_store *ref_store,
+					       struct ref_transaction *transaction,
+					       struct strbuf *err)
+{
+	int ret;
+
+	if (transaction->state != REF_TRANSACTION_OPEN)
+		BUG("commit called for transaction that is not open");
+
+	/*
+	 * Unlike the files backend, which has to be careful about
+	 * existing loose references, there is nothing to gain from a
+	 * special code path here: the whole transaction ends up in a
+	 * single new table either way.
+	 */
+	ret = reftable_transaction_prepare(ref_store, transaction, err);
+	if (!ret)
+		ret = reftable_transaction_finish(ref_store, transaction, err);
+	return ret;
+}
+
+static int reftable_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				  "pack_refs");
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (reftable_stack_compact_all(&refs->main_stack, &err) ||
+	    (refs->worktree_stack &&
+	     reftable_stack_compact_all(refs->worktree_stack, &err)))
+		ret = error("%s", err.buf);
+
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_create_symref(struct ref_store *ref_store,
+				  const char *refname, const char *target,
+				  const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct strbuf err = STRBUF_INIT;
+	struct stack_update u;
+	struct reftable_record *rec;
+	struct object_id old_oid, new_oid;
+	const char *name;
+	int ret;
+
+	if (stack_update_begin(&u, stack_for(refs, refname, &name), &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	rec = add_ref_record(&u, name, REFTABLE_REF_SYMREF);
+	strbuf_addstr(&rec->target, target);
+
+	if (logmsg &&
+	    !refs_read_ref_full(&refs->base, target, RESOLVE_REF_READING,
+				&new_oid, NULL) &&
+	    should_write_log(u.stack, refname, name, 0)) {
+		if (refs_read_ref_full(&refs->base, refname, RESOLVE_REF_READING,
+				       &old_oid, NULL))
+			oidclr(&old_oid);
+		fill_log_record(add_log_record(&u), name, u.update_index,
+				&old_oid, &new_oid, git_committer_info(0),
+				logmsg);
+	}
+
+	ret = stack_update_commit(&u, &err);
+	if (ret)
+		error("unable to write symref for %s: %s", refname, err.buf);
+
+out:
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_delete_refs(struct ref_store *ref_store, const char *msg,
+				struct string_list *refnames, unsigned int flags)
+{
+	struct strbuf err = STRBUF_INIT;
+	struct ref_transaction *transaction;
+	struct string_list_item *item;
+	int ret;
+
+	reftable_downcast(ref_store, REF_STORE_WRITE, "delete_refs");
+
+	if (!refnames->nr)
+		return 0;
+
+	/*
+	 * Since we don't check the references' old_oids, the
+	 * individual updates can't fail, so we can pack all of the
+	 * updates into a single transaction.
+	 */
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		return -1;
+
+	for_each_string_list_item(item, refnames) {
+		if (ref_transaction_delete(transaction, item->string, NULL,
+					   flags, msg, &err)) {
+			warning(_("could not delete reference %s: %s"),
+				item->string, err.buf);
+			strbuf_reset(&err);
+		}
+	}
+
+	ret = ref_transaction_commit(transaction, &err);
+
+	if (ret) {
+		if (refnames->nr == 1)
+			error(_("could not delete reference %s: %s"),
+			      refnames->items[0].string, err.buf);
+		else
+			error(_("could not delete references: %s"), err.buf);
+	}
+
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret;
+}
+
+struct copy_log_cb {
+	struct stack_update *u;
+	const char *name;
+};
+
+static int copy_log_record(struct reftable_record *rec, void *cb_data)
+{
+	struct copy_log_cb *cb = cb_data;
+	struct reftable_record *copy;
+
+	if (rec->value_type == REFTABLE_LOG_DELETION)
+		return 0;
+	copy = add_log_record(cb->u);
+	reftable_record_copy(copy, rec);
+	reftable_log_key(copy, cb->name, rec->update_index);
+	return 0;
+}
+
+static int reftable_copy_or_rename_ref(struct ref_store *ref_store,
+				       const char *oldrefname,
+				       const char *newrefname,
+				       const char *logmsg, int copy)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	struct reftable_stack *st;
+	struct stack_update u;
+	struct strbuf err = STRBUF_INIT;
+	struct object_id orig_oid;
+	const char *oldname, *newname, *head_ref;
+	struct copy_log_cb cb;
+	int flag = 0, head_flag, log, ret = 0;
+
+	if (!refs_resolve_ref_unsafe(&refs->base, oldrefname,
+				     RESOLVE_REF_READING | RESOLVE_REF_NO_RECURSE,
+				     &orig_oid, &flag))
+		return error("refname %s not found", oldrefname);
+
+	if (flag & REF_ISSYMREF) {
+		if (copy)
+			return error("refname %s is a symbolic ref, copying it is not supported",
+				     oldrefname);
+		else
+			return error("refname %s is a symbolic ref, renaming it is not supported",
+				     oldrefname);
+	}
+	if (!refs_rename_ref_available(&refs->base, oldrefname, newrefname))
+		return 1;
+
+	st = stack_for(refs, oldrefname, &oldname);
+	if (stack_for(refs, newrefname, &newname) != st)
+		return error("cannot %s '%s' to '%s': they are stored in "
+			     "different worktrees", copy ? "copy" : "rename",
+			     oldrefname, newrefname);
+
+	if (stack_update_begin(&u, st, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+	if (check_ref_value(newrefname, &orig_oid, &err)) {
+		ret = error("unable to write current sha1 into %s: %s",
+			    newrefname, err.buf);
+		stack_update_release(&u);
+		goto out;
+	}
+
+	log = stack_reflog_exists(st, oldname);
+
+	/* The old reflog of newrefname goes away with the reference. */
+	delete_log_records(&u, newname);
+	if (!copy) {
+		add_ref_record(&u, oldname, REFTABLE_REF_DELETION);
+		delete_log_records(&u, oldname);
+	}
+	set_ref_value(add_ref_record(&u, newname, 0), &orig_oid, 1);
+
+	if (log) {
+		cb.u = &u;
+		cb.name = newname;
+		for_each_log_record(st, oldname, copy_log_record, &cb);
+	}
+	if (log || should_write_log(st, newrefname, newname, 0))
+		fill_log_record(add_log_record(&u), newname, u.update_index,
+				&orig_oid, &orig_oid, git_committer_info(0),
+				logmsg);
+
+	/* As in the files backend, log the update in HEAD's reflog, too. */
+	head_ref = refs_resolve_ref_unsafe(&refs->base, "HEAD",
+					   RESOLVE_REF_READING, NULL, &head_flag);
+	if (head_ref && (head_flag & REF_ISSYMREF) &&
+	    !strcmp(head_ref, newrefname)) {
+		const char *head_name;
+
+		if (stack_for(refs, "HEAD", &head_name) == st &&
+		    should_write_log(st, "HEAD", head_name, 0))
+			fill_log_record(add_log_record(&u), head_name,
+					u.update_index, &orig_oid, &orig_oid,
+					git_committer_info(0), logmsg);
+	}
+
+	if (stack_update_commit(&u, &err)) {
+		if (copy)
+			ret = error("unable to copy '%s' to '%s': %s",
+				    oldrefname, newrefname, err.buf);
+		else
+			ret = error("unable to rename '%s' to '%s': %s",
+				    oldrefname, newrefname, err.buf);
+	}
+
+out:
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_rename_ref(struct ref_store *ref_store,
+			       const char *oldrefname, const char *newrefname,
+			       const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname,
+					   newrefname, logmsg, 0);
+}
+
+static int reftable_copy_ref(struct ref_store *ref_store,
+			     const char *oldrefname, const char *newrefname,
+			     const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname,
+					   newrefname, logmsg, 1);
+}
+
+/* Reflogs */
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+
+	struct ref_store *ref_store;
+	struct string_list refnames;
+	size_t pos;
+	struct object_id oid;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	while (iter->pos < iter->refnames.nr) {
+		const char *refname = iter->refnames.items[iter->pos++].string;
+		int flags;
+
+		if (refs_read_ref_full(iter->ref_store, refname, 0,
+				       &iter->oid, &flags)) {
+			error("bad ref for %s", refname);
+			continue;
+		}
+
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	return ref_iterator_abort(ref_iterator);
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator,
+					 struct object_id *peeled)
+{
+	BUG("ref_iterator_peel() called for reflog_iterator");
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	string_list_clear(&iter->refnames, 0);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	reftable_reflog_iterator_advance,
+	reftable_reflog_iterator_peel,
+	reftable_reflog_iterator_abort
+};
+
+/*
+ * Collect the names of all non-empty reflogs in `st` that pass
+ * `filter`.
+ */
+static void collect_reflog_names(struct reftable_stack *st,
+				 enum worktree_filter filter,
+				 struct string_list *out)
+{
+	struct reftable_snapshot *snap = reftable_stack_snapshot(st);
+	struct reftable_merged_iter it;
+	const char *last = NULL;
+
+	if (!snap->nr)
+		return;
+
+	reftable_merged_iter_init(&it, snap, 0, snap->nr - 1,
+				  REFTABLE_BLOCK_TYPE_LOG, NULL, 0);
+	while (!reftable_merged_iter_next(&it)) {
+		const char *refname = it.rec->key.buf;
+		int is_normal;
+
+		if (it.rec->value_type == REFTABLE_LOG_DELETION ||
+		    (last && !strcmp(last, refname)))
+			continue;
+
+		is_normal = ref_type(refname) == REF_TYPE_NORMAL;
+		if ((filter == FILTER_SHARED_ONLY && !is_normal) ||
+		    (filter == FILTER_PER_WORKTREE_ONLY && is_normal))
+			continue;
+
+		last = string_list_append(out, refname)->string;
+	}
+	reftable_merged_iter_release(&it);
+}
+
+static struct ref_iterator *reftable_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "reflog_iterator_begin");
+	struct reftable_reflog_iterator *iter = xcalloc(1, sizeof(*iter));
+	struct ref_iterator *ref_iterator = &iter->base;
+
+	base_ref_iterator_init(ref_iterator, &reftable_reflog_iterator_vtable, 0);
+	iter->ref_store = ref_store;
+	string_list_init(&iter->refnames, 1);
+
+	if (refs->worktree_stack) {
+		collect_reflog_names(refs->worktree_stack,
+				     FILTER_PER_WORKTREE_ONLY, &iter->refnames);
+		collect_reflog_names(&refs->main_stack, FILTER_SHARED_ONLY,
+				     &iter->refnames);
+	} else {
+		collect_reflog_names(&refs->main_stack, FILTER_NONE,
+				     &iter->refnames);
+	}
+
+	return ref_iterator;
+}
+
+static int show_log_record(struct reftable_record *rec,
+			   each_reflog_ent_fn fn, void *cb_data)
+{
+	struct strbuf message = STRBUF_INIT;
+	int ret;
+
+	/* Callers expect the message to be terminated like in a file. */
+	strbuf_addbuf(&message, &rec->message);
+	strbuf_addch(&message, '\n');
+	ret = fn(&rec->old_oid, &rec->new_oid, rec->ident.buf,
+		 rec->time, rec->tz, message.buf, cb_data);
+	strbuf_release(&message);
+	return ret;
+}
+
+struct collect_log_cb {
+	struct reftable_record *recs;
+	size_t nr, alloc;
+};
+
+static int collect_log_record(struct reftable_record *rec, void *cb_data)
+{
+	struct collect_log_cb *cb = cb_data;
+
+	if (rec->value_type == REFTABLE_LOG_DELETION ||
+	    is_reflog_existence_marker(rec))
+		return 0;
+	ALLOC_GROW(cb->recs, cb->nr + 1, cb->alloc);
+	reftable_record_init(&cb->recs[cb->nr]);
+	reftable_record_copy(&cb->recs[cb->nr++], rec);
+	return 0;
+}
+
+/* Collect the live entries of the reflog of `refname`, newest first. */
+static void collect_log_records(struct reftable_ref_store *refs,
+				const char *refname,
+				struct collect_log_cb *cb)
+{
+	const char *name;
+	struct reftable_stack *st = stack_for(refs, refname, &name);
+
+	memset(cb, 0, sizeof(*cb));
+	for_each_log_record(st, name, collect_log_record, cb);
+}
+
+static void release_log_records(struct collect_log_cb *cb)
+{
+	size_t i;
+
+	for (i = 0; i < cb->nr; i++)
+		reftable_record_release(&cb->recs[i]);
+	free(cb->recs);
+}
+
+static int reftable_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						const char *refname,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent_reverse");
+	struct collect_log_cb cb;
+	size_t i;
+	int ret = 0;
+
+	collect_log_records(refs, refname, &cb);
+	for (i = 0; !ret && i < cb.nr; i++)
+		ret = show_log_record(&cb.recs[i], fn, cb_data);
+	release_log_records(&cb);
+	return ret;
+}
+
+static int reftable_for_each_reflog_ent(struct ref_store *ref_store,
+					const char *refname,
+					each_reflog_ent_fn fn, void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent");
+	struct collect_log_cb cb;
+	size_t i;
+	int ret = 0;
+
+	collect_log_records(refs, refname, &cb);
+	for (i = cb.nr; !ret && i--; )
+		ret = show_log_record(&cb.recs[i], fn, cb_data);
+	release_log_records(&cb);
+	return ret;
+}
+
+static int reftable_reflog_exists(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+	const char *name;
+	struct reftable_stack *st = stack_for(refs, refname, &name);
+
+	return stack_reflog_exists(st, name);
+}
+
+static int reftable_create_reflog(struct ref_store *ref_store,
+				  const char *refname, int force_create,
+				  struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	struct stack_update u;
+	const char *name;
+	struct reftable_stack *st = stack_for(refs, refname, &name);
+
+	if (!(force_create || should_autocreate_reflog(refname)) ||
+	    stack_reflog_exists(st, name))
+		return 0;
+
+	if (stack_update_begin(&u, st, err))
+		return -1;
+	if (!stack_reflog_exists(st, name))
+		fill_log_record(add_log_record(&u), name, u.update_index,
+				&null_oid, &null_oid, git_committer_info(0),
+				NULL);
+	return stack_update_commit(&u, err);
+}
+
+static int reftable_delete_reflog(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct strbuf err = STRBUF_INIT;
+	struct stack_update u;
+	const char *name;
+	struct reftable_stack *st = stack_for(refs, refname, &name);
+	int ret;
+
+	if (stack_update_begin(&u, st, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+	delete_log_records(&u, name);
+	ret = stack_update_commit(&u, &err);
+	if (ret)
+		error("%s", err.buf);
+
+out:
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_reflog_expire(struct ref_store *ref_store,
+				  const char *refname, const struct object_id *oid,
+				  unsigned int flags,
+				  reflog_expiry_prepare_fn prepare_fn,
+				  reflog_expiry_should_prune_fn should_prune_fn,
+				  reflog_expiry_cleanup_fn cleanup_fn,
+				  void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	struct strbuf err = STRBUF_INIT;
+	struct stack_update u;
+	struct collect_log_cb cb;
+	struct object_id last_kept_oid, current_oid;
+	const char *name;
+	struct reftable_stack *st = stack_for(refs, refname, &name);
+	int dry_run = flags & EXPIRE_REFLOGS_DRY_RUN;
+	int type = 0, ret = 0;
+	size_t i, kept = 0;
+
+	/*
+	 * Hold the lock while reading the reflog and checking the
+	 * reference, as the files backend does by locking the ref.
+	 */
+	if (stack_update_begin(&u, st, &err)) {
+		error("cannot lock ref '%s': %s", refname, err.buf);
+		strbuf_release(&err);
+		return -1;
+	}
+	if (refs_read_ref_full(&refs->base, refname, 0, &current_oid, &type))
+		oidclr(&current_oid);
+	if (oid && !oideq(oid, &current_oid)) {
+		error("cannot lock ref '%s': reference has changed", refname);
+		stack_update_release(&u);
+		return -1;
+	}
+	if (!stack_reflog_exists(st, name)) {
+		stack_update_release(&u);
+		return 0;
+	}
+
+	oidclr(&last_kept_oid);
+	collect_log_records(refs, refname, &cb);
+
+	(*prepare_fn)(refname, oid, policy_cb_data);
+	for (i = cb.nr; i--; ) {
+		struct reftable_record *rec = &cb.recs[i];
+		struct object_id *ooid = &rec->old_oid;
+		struct strbuf message = STRBUF_INIT;
+
+		if (flags & EXPIRE_REFLOGS_REWRITE)
+			ooid = &last_kept_oid;
+
+		strbuf_addbuf(&message, &rec->message);
+		strbuf_addch(&message, '\n');
+		if ((*should_prune_fn)(ooid, &rec->new_oid, rec->ident.buf,
+				       rec->time, rec->tz, message.buf,
+				       policy_cb_data)) {
+			if (dry_run)
+				printf("would prune %s", message.buf);
+			else if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("prune %s", message.buf);
+			add_log_tombstone(rec, &u);
+		} else {
+			if (!dry_run && !oideq(ooid, &rec->old_oid)) {
+				struct reftable_record *rewritten = add_log_record(&u);
+
+				reftable_record_copy(rewritten, rec);
+				oidcpy(&rewritten->old_oid, ooid);
+			}
+			oidcpy(&last_kept_oid, &rec->new_oid);
+			kept++;
+			if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("keep %s", message.buf);
+		}
+		strbuf_release(&message);
+	}
+	(*cleanup_fn)(policy_cb_data);
+
+	if (dry_run) {
+		stack_update_release(&u);
+	} else {
+		/*
+		 * It doesn't make sense to adjust a reference pointed
+		 * to by a symbolic ref based on expiring entries in
+		 * the symbolic reference's reflog. Nor can we update
+		 * a reference if there are no remaining reflog
+		 * entries.
+		 */
+		if ((flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+		    !(type & REF_ISSYMREF) &&
+		    !is_null_oid(&last_kept_oid))
+			set_ref_value(add_ref_record(&u, name, 0),
+				      &last_kept_oid, 1);
+		/* Like an emptied reflog file, the reflog keeps existing. */
+		if (!kept)
+			fill_log_record(add_log_record(&u), name,
+					u.update_index, &null_oid, &null_oid,
+					git_committer_info(0), NULL);
+		if (stack_update_commit(&u, &err))
+			ret = error("unable to write reflog '%s': %s",
+				    refname, err.buf);
+	}
+
+	release_log_records(&cb);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+
+	if (reftable_stack_create(&refs->main_stack, err))
+		return -1;
+
+	/*
+	 * Repository discovery requires "$GIT_DIR/HEAD" to exist; the
+	 * real HEAD is stored in the reftable. Point the file at an
+	 * invalid branch so that versions of Git which do not know
+	 * about this backend never use it by accident.
+	 */
+	strbuf_addf(&sb, "%s/HEAD", refs->base.gitdir);
+	if (access(sb.buf, F_OK))
+		write_file(sb.buf, "ref: refs/heads/.invalid");
+
+	/*
+	 * Discovery also wants a "refs/" directory. Make "refs/heads" a
+	 * file, as the reftable specification asks, so that those older
+	 * versions cannot create branches in there either.
+	 */
+	strbuf_reset(&sb);
+	strbuf_addf(&sb, "%s/refs", refs->base.gitdir);
+	safe_create_dir(sb.buf, 1);
+	strbuf_addstr(&sb, "/heads");
+	if (access(sb.buf, F_OK))
+		write_file(sb.buf, "this repository uses the reftable format");
+	strbuf_release(&sb);
+	return 0;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	NULL,
+	"reftable",
+	reftable_ref_store_create,
+	reftable_init_db,
+	reftable_transaction_prepare,
+	reftable_transaction_finish,
+	reftable_transaction_abort,
+	reftable_initial_transaction_commit,
+
+	reftable_pack_refs,
+	reftable_create_symref,
+	reftable_delete_refs,
+	reftable_rename_ref,
+	reftable_copy_ref,
+
+	reftable_ref_iterator_begin,
+	reftable_read_raw_ref,
+
+	reftable_reflog_iterator_begin,
+	reftable_for_each_reflog_ent,
+	reftable_for_each_reflog_ent_reverse,
+	reftable_reflog_exists,
+	reftable_create_reflog,
+	reftable_delete_reflog,
+	reftable_reflog_expire
+};
@@ -0,0 +1,1757 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../lockfile.h"
+#include "../tempfile.h"
+#include "../varint.h"
+#include "reftable.h"
+
+/*
+ * Table layout, as described in Documentation/technical/reftable.txt
+ * (all integers in network byte order):
+ *
+ *   header:  "REFT" | uint8 version | uint24 block_size |
+ *            uint64 min_update_index | uint64 max_update_index |
+ *            uint32 hash id (version 2 only)
+ *   reference blocks
+ *   reference index
+ *   object blocks
+ *   object index
+ *   reflog blocks
+ *   reflog index
+ *   footer:  copy of the header |
+ *            uint64 position of the reference index |
+ *            uint64 (position of the first object block << 5 |
+ *                    object id length) |
+ *            uint64 position of the object index |
+ *            uint64 position of the first reflog block |
+ *            uint64 position of the reflog index |
+ *            uint32 CRC-32 of the preceding footer bytes
+ *
+ *   block:   uint8 block type | uint24 block length |
+ *            records |
+ *            uint24 restart offset * restart count |
+ *            uint16 restart count |
+ *            padding
+ *
+ *   record:  varint prefix length | varint (suffix length << 3 | type) |
+ *            suffix | value
+ *
+ * The first block of the file starts at position 0 and shares its
+ * space with the header: its block type follows the header, and its
+ * length and restart offsets count the header, too. Everything after
+ * the 4-byte block header of a reflog block is zlib-compressed, and
+ * its length is that of the inflated block.
+ *
+ * The value of a reference record starts with its update index as a
+ * varint delta to min_update_index, and that of an index record (in
+ * blocks of type 'i') is the varint position of the block whose last
+ * key it holds. A section has an index if it has more than one block;
+ * index blocks may point to other index blocks.
+ *
+ * We write version 1 (which has no hash id) for SHA-1 repositories,
+ * do not align or pad the blocks (so the header says block_size 0),
+ * and do not write object blocks, whose positions are therefore 0.
+ * We can read the tables of writers that do all of these, though,
+ * and ignore their object blocks.
+ */
+
+#define REFTABLE_SIGNATURE "REFT"
+#define REFTABLE_HEADER_SIZE_V1 24
+#define REFTABLE_HEADER_SIZE_V2 28
+#define REFTABLE_FOOTER_EXTRA_SIZE (5 * 8 + 4)
+#define REFTABLE_BLOCK_HEADER_SIZE 4
+#define REFTABLE_MAX_BLOCK_SIZE ((1 << 24) - 1)
+#define REFTABLE_MIN_BLOCK_SIZE 256
+#define REFTABLE_RESTART_INTERVAL 16
+#define REFTABLE_MAX_INDEX_DEPTH 8
+
+#define REFTABLE_BLOCK_TYPE_INDEX 'i'
+
+/*
+ * How often to retry reading `tables.list` if one of its tables
+ * disappears underneath us because of a concurrent compaction.
+ */
+#define REFTABLE_RELOAD_RETRIES 8
+
+static void put_be24(unsigned char *p, uint32_t v)
+{
+	p[0] = (v >> 16) & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = v & 0xff;
+}
+
+static uint32_t get_be24(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static void put_be16(unsigned char *p, uint16_t v)
+{
+	p[0] = (v >> 8) & 0xff;
+	p[1] = v & 0xff;
+}
+
+static void strbuf_add_varint(struct strbuf *sb, uintmax_t value)
+{
+	unsigned char varint[16];
+	strbuf_add(sb, varint, encode_varint(value, varint));
+}
+
+/*
+ * Like decode_varint(), but never reads past `end`. Return 0 on
+ * success, -1 if the varint is truncated or overflows.
+ */
+static int get_varint(const unsigned char **pp, const unsigned char *end,
+		      uint64_t *out)
+{
+	const unsigned char *p = *pp;
+	unsigned char c;
+	uint64_t val;
+
+	if (p >= end)
+		return -1;
+	c = *p++;
+	val = c & 127;
+	while (c & 128) {
+		val += 1;
+		if (!val || MSB(val, 7) || p >= end)
+			return -1;
+		c = *p++;
+		val = (val << 7) + (c & 127);
+	}
+	*pp = p;
+	*out = val;
+	return 0;
+}
+
+static int key_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+	if (cmp)
+		return cmp;
+	return a_len < b_len ? -1 : a_len > b_len;
+}
+
+/* The version we write; version 1 cannot name the hash algorithm. */
+static int reftable_version(void)
+{
+	return hash_algo_by_ptr(the_hash_algo) == GIT_HASH_SHA1 ? 1 : 2;
+}
+
+static size_t header_size(int version)
+{
+	return version == 1 ? REFTABLE_HEADER_SIZE_V1 : REFTABLE_HEADER_SIZE_V2;
+}
+
+void reftable_record_init(struct reftable_record *rec)
+{
+	memset(rec, 0, sizeof(*rec));
+	strbuf_init(&rec->key, 0);
+	strbuf_init(&rec->target, 0);
+	strbuf_init(&rec->ident, 0);
+	strbuf_init(&rec->message, 0);
+}
+
+void reftable_record_release(struct reftable_record *rec)
+{
+	strbuf_release(&rec->key);
+	strbuf_release(&rec->target);
+	strbuf_release(&rec->ident);
+	strbuf_release(&rec->message);
+}
+
+void reftable_record_copy(struct reftable_record *dst,
+			  const struct reftable_record *src)
+{
+	strbuf_reset(&dst->key);
+	strbuf_addbuf(&dst->key, &src->key);
+	dst->value_type = src->value_type;
+	oidcpy(&dst->oid, &src->oid);
+	oidcpy(&dst->peeled, &src->peeled);
+	strbuf_reset(&dst->target);
+	strbuf_addbuf(&dst->target, &src->target);
+	dst->update_index = src->update_index;
+	oidcpy(&dst->old_oid, &src->old_oid);
+	oidcpy(&dst->new_oid, &src->new_oid);
+	strbuf_reset(&dst->ident);
+	strbuf_addbuf(&dst->ident, &src->ident);
+	dst->time = src->time;
+	dst->tz = src->tz;
+	strbuf_reset(&dst->message);
+	strbuf_addbuf(&dst->message, &src->message);
+}
+
+void reftable_log_key(struct reftable_record *rec, const char *refname,
+		      uint64_t update_index)
+{
+	unsigned char be[8];
+
+	strbuf_reset(&rec->key);
+	strbuf_addstr(&rec->key, refname);
+	strbuf_addch(&rec->key, '\0');
+	put_be64(be, ~update_index);
+	strbuf_add(&rec->key, be, sizeof(be));
+	rec->update_index = update_index;
+}
+
+/*
+ * Reflog records store the name and email of the ident separately,
+ * and the timezone as an offset in minutes rather than as "+hhmm".
+ */
+static void split_ident(const struct strbuf *ident,
+			const char **name, size_t *name_len,
+			const char **email, size_t *email_len)
+{
+	const char *lt = strchr(ident->buf, '<');
+	const char *gt = lt ? strchr(lt, '>') : NULL;
+
+	*name = ident->buf;
+	if (!gt) {
+		*name_len = ident->len;
+		*email = "";
+		*email_len = 0;
+		return;
+	}
+	*name_len = lt - ident->buf;
+	while (*name_len && ident->buf[*name_len - 1] == ' ')
+		(*name_len)--;
+	*email = lt + 1;
+	*email_len = gt - *email;
+}
+
+static int tz_to_minutes(int tz)
+{
+	int sign = tz < 0 ? -1 : 1;
+
+	tz *= sign;
+	return sign * (tz / 100 * 60 + tz % 100);
+}
+
+static int tz_from_minutes(int minutes)
+{
+	int sign = minutes < 0 ? -1 : 1;
+
+	minutes *= sign;
+	return sign * (minutes / 60 * 100 + minutes % 60);
+}
+
+static void encode_key(struct strbuf *out, const struct strbuf *prev_key,
+		       const struct strbuf *key, unsigned int type)
+{
+	size_t prefix = 0, suffix;
+
+	if (prev_key)
+		while (prefix < prev_key->len && prefix < key->len &&
+		       prev_key->buf[prefix] == key->buf[prefix])
+			prefix++;
+	suffix = key->len - prefix;
+
+	strbuf_add_varint(out, prefix);
+	strbuf_add_varint(out, (suffix << 3) | type);
+	strbuf_add(out, key->buf + prefix, suffix);
+}
+
+static void encode_record(struct strbuf *out, int block_type,
+			  const struct reftable_record *rec,
+			  const struct strbuf *prev_key,
+			  uint64_t min_update_index)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+	const char *name, *email;
+	size_t name_len, email_len;
+	unsigned char tz[2];
+
+	encode_key(out, prev_key, &rec->key, rec->value_type);
+
+	if (block_type == REFTABLE_BLOCK_TYPE_REF) {
+		strbuf_add_varint(out, rec->update_index - min_update_index);
+		switch (rec->value_type) {
+		case REFTABLE_REF_DELETION:
+			break;
+		case REFTABLE_REF_VAL1:
+			strbuf_add(out, rec->oid.hash, rawsz);
+			break;
+		case REFTABLE_REF_VAL2:
+			strbuf_add(out, rec->oid.hash, rawsz);
+			strbuf_add(out, rec->peeled.hash, rawsz);
+			break;
+		case REFTABLE_REF_SYMREF:
+			strbuf_add_varint(out, rec->target.len);
+			strbuf_addbuf(out, &rec->target);
+			break;
+		default:
+			BUG("unknown reference value type %u", rec->value_type);
+		}
+		return;
+	}
+
+	switch (rec->value_type) {
+	case REFTABLE_LOG_DELETION:
+		break;
+	case REFTABLE_LOG_UPDATE:
+		strbuf_add(out, rec->old_oid.hash, rawsz);
+		strbuf_add(out, rec->new_oid.hash, rawsz);
+		split_ident(&rec->ident, &name, &name_len, &email, &email_len);
+		strbuf_add_varint(out, name_len);
+		strbuf_add(out, name, name_len);
+		strbuf_add_varint(out, email_len);
+		strbuf_add(out, email, email_len);
+		strbuf_add_varint(out, rec->time);
+		put_be16(tz, (uint16_t)(int16_t)tz_to_minutes(rec->tz));
+		strbuf_add(out, tz, sizeof(tz));
+		strbuf_add_varint(out, rec->message.len);
+		strbuf_addbuf(out, &rec->message);
+		break;
+	default:
+		BUG("unknown reflog value type %u", rec->value_type);
+	}
+}
+
+static int get_string(const unsigned char **pp, const unsigned char *end,
+		      struct strbuf *sb)
+{
+	uint64_t len;
+
+	if (get_varint(pp, end, &len) || len > end - *pp)
+		return -1;
+	strbuf_add(sb, *pp, len);
+	*pp += len;
+	return 0;
+}
+
+static int read_oid(const unsigned char **pp, const unsigned char *end,
+		   struct object_id *oid)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+
+	if (end - *pp < rawsz)
+		return -1;
+	oidread(oid, *pp);
+	*pp += rawsz;
+	return 0;
+}
+
+/*
+ * Decode the key at *pp, which shares a prefix with the previous key
+ * already stored in `key`, and return the type bits in *type.
+ */
+static int decode_key(const unsigned char **pp, const unsigned char *end,
+		      struct strbuf *key, unsigned int *type)
+{
+	const unsigned char *p = *pp;
+	uint64_t prefix, suffix;
+
+	if (get_varint(&p, end, &prefix) || get_varint(&p, end, &suffix) ||
+	    prefix > key->len || (suffix >> 3) > end - p)
+		return -1;
+
+	*type = suffix & 7;
+	suffix >>= 3;
+	strbuf_setlen(key, prefix);
+	strbuf_add(key, p, suffix);
+	*pp = p + suffix;
+	return 0;
+}
+
+/*
+ * Decode the record at *pp, whose key shares a prefix with the key
+ * already stored in rec->key. Return 0 on success, -1 if the record
+ * is corrupt.
+ */
+static int decode_record(const unsigned char **pp, const unsigned char *end,
+			 int block_type, uint64_t min_update_index,
+			 struct reftable_record *rec)
+{
+	const unsigned char *p = *pp;
+	uint64_t tz, time, delta;
+
+	if (decode_key(&p, end, &rec->key, &rec->value_type))
+		return -1;
+
+	if (block_type == REFTABLE_BLOCK_TYPE_REF) {
+		if (get_varint(&p, end, &delta))
+			return -1;
+		rec->update_index = min_update_index + delta;
+		switch (rec->value_type) {
+		case REFTABLE_REF_DELETION:
+			break;
+		case REFTABLE_REF_VAL1:
+			if (read_oid(&p, end, &rec->oid))
+				return -1;
+			oidclr(&rec->peeled);
+			break;
+		case REFTABLE_REF_VAL2:
+			if (read_oid(&p, end, &rec->oid) ||
+			    read_oid(&p, end, &rec->peeled))
+				return -1;
+			break;
+		case REFTABLE_REF_SYMREF:
+			strbuf_reset(&rec->target);
+			if (get_string(&p, end, &rec->target))
+				return -1;
+			break;
+		default:
+			return -1;
+		}
+		*pp = p;
+		return 0;
+	}
+
+	if (rec->key.len < 9 || rec->key.buf[rec->key.len - 9])
+		return -1;
+	rec->update_index = ~get_be64(rec->key.buf + rec->key.len - 8);
+
+	switch (rec->value_type) {
+	case REFTABLE_LOG_DELETION:
+		break;
+	case REFTABLE_LOG_UPDATE:
+		strbuf_reset(&rec->ident);
+		if (read_oid(&p, end, &rec->old_oid) ||
+		    read_oid(&p, end, &rec->new_oid) ||
+		    get_string(&p, end, &rec->ident))
+			return -1;
+		strbuf_addstr(&rec->ident, " <");
+		if (get_string(&p, end, &rec->ident) ||
+		    get_varint(&p, end, &time) ||
+		    end - p < 2)
+			return -1;
+		strbuf_addch(&rec->ident, '>');
+		rec->time = time;
+		tz = get_be16(p);
+		rec->tz = tz_from_minutes((int16_t)tz);
+		p += 2;
+		strbuf_reset(&rec->message);
+		if (get_string(&p, end, &rec->message))
+			return -1;
+		break;
+	default:
+		return -1;
+	}
+	*pp = p;
+	return 0;
+}
+
+/* The last key of every block of a section, and where the block is. */
+struct reftable_index_entry {
+	char *key;
+	size_t key_len;
+	uint64_t offset;
+};
+
+static void add_block_entry(struct reftable_index_entry **index,
+			    size_t *nr, size_t *alloc,
+			    const struct strbuf *key, uint64_t offset)
+{
+	struct reftable_index_entry *e;
+
+	ALLOC_GROW(*index, *nr + 1, *alloc);
+	e = &(*index)[(*nr)++];
+	e->key = xmemdupz(key->buf, key->len);
+	e->key_len = key->len;
+	e->offset = offset;
+}
+
+static void free_index_entries(struct reftable_index_entry *index, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		free(index[i].key);
+	free(index);
+}
+
+/* Writer */
+
+enum writer_section {
+	WRITER_SECTION_NONE = 0,
+	WRITER_SECTION_REFS,
+	WRITER_SECTION_LOGS,
+	WRITER_SECTION_DONE
+};
+
+struct reftable_writer {
+	uint32_t block_size;
+	uint64_t min_update_index, max_update_index;
+	int version;
+
+	/* The table written so far: */
+	struct strbuf out;
+
+	enum writer_section section;
+
+	/*
+	 * The block under construction, from its block header on, and
+	 * the number of bytes of the file header that come before it.
+	 */
+	struct strbuf block;
+	uint64_t block_pos;
+	size_t block_header_off;
+	uint32_t *restarts;
+	size_t restarts_nr, restarts_alloc;
+	size_t block_records;
+	struct strbuf last_key;
+
+	/* The blocks of the current section: */
+	struct reftable_index_entry *index;
+	size_t index_nr, index_alloc;
+
+	uint64_t ref_index_pos, log_pos, log_index_pos;
+	int log_blocks;
+
+	struct strbuf scratch;
+};
+
+static void writer_put_header(struct reftable_writer *w, struct strbuf *out)
+{
+	unsigned char header[REFTABLE_HEADER_SIZE_V2];
+
+	memcpy(header, REFTABLE_SIGNATURE, 4);
+	header[4] = w->version;
+	put_be24(header + 5, 0); /* unaligned */
+	put_be64(header + 8, w->min_update_index);
+	put_be64(header + 16, w->max_update_index);
+	if (w->version != 1)
+		put_be32(header + 24, the_hash_algo->format_id);
+	strbuf_add(out, header, header_size(w->version));
+}
+
+struct reftable_writer *reftable_writer_new(uint32_t block_size,
+					    uint64_t min_update_index,
+					    uint64_t max_update_index)
+{
+	struct reftable_writer *w = xcalloc(1, sizeof(*w));
+
+	if (block_size < REFTABLE_MIN_BLOCK_SIZE ||
+	    block_size > REFTABLE_MAX_BLOCK_SIZE)
+		BUG("invalid reftable block size %"PRIu32, block_size);
+	if (min_update_index > max_update_index)
+		BUG("invalid update index range");
+
+	w->block_size = block_size;
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+	w->version = reftable_version();
+	strbuf_init(&w->out, 0);
+	strbuf_init(&w->block, block_size);
+	strbuf_init(&w->last_key, 0);
+	strbuf_init(&w->scratch, 0);
+
+	writer_put_header(w, &w->out);
+	return w;
+}
+
+static int writer_block_type(struct reftable_writer *w)
+{
+	return w->section == WRITER_SECTION_LOGS ?
+		REFTABLE_BLOCK_TYPE_LOG : REFTABLE_BLOCK_TYPE_REF;
+}
+
+/* Append the restart table to `block` and fill in its block header. */
+static void finish_block(struct strbuf *block, size_t header_off, int type,
+			 const uint32_t *restarts, size_t restarts_nr)
+{
+	unsigned char buf[3];
+	size_t i;
+
+	if (restarts_nr > 0xffff)
+		die(_("too many records in a reftable block"));
+	for (i = 0; i < restarts_nr; i++) {
+		put_be24(buf, restarts[i]);
+		strbuf_add(block, buf, 3);
+	}
+	put_be16(buf, restarts_nr);
+	strbuf_add(block, buf, 2);
+
+	if (header_off + block->len > REFTABLE_MAX_BLOCK_SIZE)
+		die(_("reftable block is too large"));
+	block->buf[0] = type;
+	put_be24((unsigned char *)block->buf + 1, header_off + block->len);
+}
+
+static void deflate_block(struct strbuf *out, const char *data, size_t len)
+{
+	git_zstream stream;
+	unsigned long bound;
+	int result;
+
+	git_deflate_init(&stream, zlib_compression_level);
+	bound = git_deflate_bound(&stream, len);
+	strbuf_grow(out, bound);
+	stream.next_in = (unsigned char *)data;
+	stream.avail_in = len;
+	stream.next_out = (unsigned char *)out->buf + out->len;
+	stream.avail_out = bound;
+	do {
+		result = git_deflate(&stream, Z_FINISH);
+	} while (result == Z_OK);
+	if (result != Z_STREAM_END)
+		die(_("unable to compress reftable block (%d)"), result);
+	strbuf_setlen(out, out->len + stream.total_out);
+	git_deflate_end(&stream);
+}
+
+static void writer_flush_block(struct reftable_writer *w)
+{
+	int type = writer_block_type(w);
+
+	if (!w->block_records)
+		return;
+
+	finish_block(&w->block, w->block_header_off, type,
+		     w->restarts, w->restarts_nr);
+	add_block_entry(&w->index, &w->index_nr, &w->index_alloc,
+			&w->last_key, w->block_pos);
+
+	if (type == REFTABLE_BLOCK_TYPE_LOG) {
+		if (!w->log_blocks++)
+			w->log_pos = w->block_pos;
+		strbuf_add(&w->out, w->block.buf, REFTABLE_BLOCK_HEADER_SIZE);
+		deflate_block(&w->out, w->block.buf + REFTABLE_BLOCK_HEADER_SIZE,
+			      w->block.len - REFTABLE_BLOCK_HEADER_SIZE);
+	} else {
+		strbuf_addbuf(&w->out, &w->block);
+	}
+	strbuf_reset(&w->block);
+	w->restarts_nr = 0;
+	w->block_records = 0;
+}
+
+/*
+ * Write the index of the blocks of the current section, if it has
+ * more than one, as a single block; return its position or 0.
+ */
+static uint64_t writer_write_index(struct reftable_writer *w)
+{
+	struct strbuf block = STRBUF_INIT;
+	struct strbuf key = STRBUF_INIT, prev_key = STRBUF_INIT;
+	uint32_t *restarts = NULL;
+	size_t restarts_nr = 0, restarts_alloc = 0, i;
+	uint64_t pos = 0;
+
+	if (w->index_nr < 2)
+		goto out;
+
+	strbuf_addchars(&block, 0, REFTABLE_BLOCK_HEADER_SIZE);
+	for (i = 0; i < w->index_nr; i++) {
+		int restart = !(i % REFTABLE_RESTART_INTERVAL);
+
+		if (restart) {
+			ALLOC_GROW(restarts, restarts_nr + 1, restarts_alloc);
+			restarts[restarts_nr++] = block.len;
+		}
+		strbuf_reset(&key);
+		strbuf_add(&key, w->index[i].key, w->index[i].key_len);
+		encode_key(&block, restart ? NULL : &prev_key, &key, 0);
+		strbuf_add_varint(&block, w->index[i].offset);
+		strbuf_swap(&key, &prev_key);
+	}
+	finish_block(&block, 0, REFTABLE_BLOCK_TYPE_INDEX,
+		     restarts, restarts_nr);
+
+	pos = w->out.len;
+	strbuf_addbuf(&w->out, &block);
+
+out:
+	free_index_entries(w->index, w->index_nr);
+	w->index = NULL;
+	w->index_nr = w->index_alloc = 0;
+	free(restarts);
+	strbuf_release(&block);
+	strbuf_release(&key);
+	strbuf_release(&prev_key);
+	return pos;
+}
+
+/* Flush the pending block and write the index; return its position. */
+static uint64_t writer_finish_section(struct reftable_writer *w)
+{
+	writer_flush_block(w);
+	strbuf_reset(&w->last_key);
+	return writer_write_index(w);
+}
+
+static void writer_enter_section(struct reftable_writer *w,
+				 enum writer_section section)
+{
+	if (section < w->section)
+		BUG("reftable records added out of order");
+
+	if (w->section == WRITER_SECTION_NONE)
+		w->section = WRITER_SECTION_REFS;
+	if (section == WRITER_SECTION_REFS)
+		return;
+
+	if (w->section == WRITER_SECTION_REFS) {
+		w->ref_index_pos = writer_finish_section(w);
+		w->section = WRITER_SECTION_LOGS;
+	}
+	if (section == WRITER_SECTION_LOGS)
+		return;
+
+	if (w->section == WRITER_SECTION_LOGS) {
+		w->log_index_pos = writer_finish_section(w);
+		w->section = WRITER_SECTION_DONE;
+	}
+}
+
+void reftable_writer_add(struct reftable_writer *w, int block_type,
+			 const struct reftable_record *rec)
+{
+	int restart;
+
+	writer_enter_section(w, block_type == REFTABLE_BLOCK_TYPE_LOG ?
+			     WRITER_SECTION_LOGS : WRITER_SECTION_REFS);
+
+	if (w->block_records &&
+	    key_cmp(w->last_key.buf, w->last_key.len,
+		    rec->key.buf, rec->key.len) >= 0)
+		BUG("reftable records added out of order: '%s'", rec->key.buf);
+	if (block_type == REFTABLE_BLOCK_TYPE_REF &&
+	    (rec->update_index < w->min_update_index ||
+	     rec->update_index > w->max_update_index))
+		BUG("reftable record for '%s' has update index %"PRIu64
+		    " outside of the table", rec->key.buf, rec->update_index);
+
+	restart = !(w->block_records % REFTABLE_RESTART_INTERVAL);
+	strbuf_reset(&w->scratch);
+	encode_record(&w->scratch, block_type, rec,
+		      restart ? NULL : &w->last_key, w->min_update_index);
+
+	if (w->block_records &&
+	    w->block_header_off + w->block.len + w->scratch.len +
+	    3 * (w->restarts_nr + restart) + 2 > w->block_size) {
+		writer_flush_block(w);
+		if (!restart) {
+			restart = 1;
+			strbuf_reset(&w->scratch);
+			encode_record(&w->scratch, block_type, rec, NULL,
+				      w->min_update_index);
+		}
+	}
+
+	if (!w->block_records) {
+		/* The first block of the file includes the header. */
+		w->block_header_off = w->out.len == header_size(w->version) ?
+			w->out.len : 0;
+		w->block_pos = w->out.len - w->block_header_off;
+		strbuf_addchars(&w->block, 0, REFTABLE_BLOCK_HEADER_SIZE);
+	}
+	if (restart) {
+		ALLOC_GROW(w->restarts, w->restarts_nr + 1, w->restarts_alloc);
+		w->restarts[w->restarts_nr++] =
+			w->block_header_off + w->block.len;
+	}
+	strbuf_addbuf(&w->block, &w->scratch);
+	w->block_records++;
+
+	strbuf_reset(&w->last_key);
+	strbuf_addbuf(&w->last_key, &rec->key);
+}
+
+void reftable_writer_finish(struct reftable_writer *w, struct strbuf *out)
+{
+	size_t footer_start;
+	unsigned char be[8];
+
+	writer_enter_section(w, WRITER_SECTION_DONE);
+
+	footer_start = w->out.len;
+	writer_put_header(w, &w->out);
+	put_be64(be, w->ref_index_pos);
+	strbuf_add(&w->out, be, 8);
+	put_be64(be, 0); /* no object blocks */
+	strbuf_add(&w->out, be, 8);
+	put_be64(be, 0); /* no object index */
+	strbuf_add(&w->out, be, 8);
+	put_be64(be, w->log_pos);
+	strbuf_add(&w->out, be, 8);
+	put_be64(be, w->log_index_pos);
+	strbuf_add(&w->out, be, 8);
+	put_be32(be, crc32(0, (const unsigned char *)w->out.buf + footer_start,
+			   w->out.len - footer_start));
+	strbuf_add(&w->out, be, 4);
+
+	strbuf_addbuf(out, &w->out);
+
+	strbuf_release(&w->out);
+	strbuf_release(&w->block);
+	strbuf_release(&w->last_key);
+	strbuf_release(&w->scratch);
+	free_index_entries(w->index, w->index_nr);
+	free(w->restarts);
+	free(w);
+}
+
+/* Reader */
+
+struct reftable_section {
+	int block_type;
+	struct reftable_index_entry *index;
+	size_t index_nr, index_alloc;
+};
+
+struct reftable_table {
+	unsigned int refcount;
+	char *name;
+	const unsigned char *map;
+	size_t size;
+	int version;
+	uint32_t block_size;
+	uint64_t footer_start;
+	uint64_t min_update_index, max_update_index;
+	struct reftable_section refs, logs;
+};
+
+/* A block of a table, inflated if it is a reflog block. */
+struct reftable_block {
+	int type;
+	const unsigned char *data; /* restart offsets are relative to this */
+	const unsigned char *records, *records_end;
+	size_t restarts_nr;
+	uint64_t next; /* position of the following block */
+};
+
+/*
+ * Read the block at position `pos` of `t`, inflating reflog blocks
+ * into `buf`. Return -1 if it is corrupt.
+ */
+static int read_block(struct reftable_table *t, uint64_t pos,
+		      struct reftable_block *b, struct strbuf *buf)
+{
+	size_t header_off = pos ? 0 : header_size(t->version);
+	const unsigned char *start = t->map + pos;
+	uint64_t avail;
+	uint32_t len;
+
+	if (pos > t->footer_start ||
+	    t->footer_start - pos < header_off + REFTABLE_BLOCK_HEADER_SIZE)
+		return -1;
+	avail = t->footer_start - pos;
+	b->type = start[header_off];
+	len = get_be24(start + header_off + 1);
+	if (len < header_off + REFTABLE_BLOCK_HEADER_SIZE + 2 ||
+	    (b->type == REFTABLE_BLOCK_TYPE_LOG && !buf))
+		return -1;
+
+	if (b->type == REFTABLE_BLOCK_TYPE_LOG) {
+		size_t skip = header_off + REFTABLE_BLOCK_HEADER_SIZE;
+		git_zstream stream;
+		int result;
+
+		strbuf_reset(buf);
+		strbuf_grow(buf, len);
+		memcpy(buf->buf, start, skip);
+		memset(&stream, 0, sizeof(stream));
+		git_inflate_init(&stream);
+		stream.next_in = (unsigned char *)start + skip;
+		stream.avail_in = avail - skip;
+		stream.next_out = (unsigned char *)buf->buf + skip;
+		stream.avail_out = len - skip;
+		do {
+			result = git_inflate(&stream, Z_FINISH);
+		} while (result == Z_OK);
+		git_inflate_end(&stream);
+		if (result != Z_STREAM_END || stream.total_out != len - skip)
+			return -1;
+		strbuf_setlen(buf, len);
+		b->data = (const unsigned char *)buf->buf;
+		b->next = pos + skip + stream.total_in;
+	} else {
+		if (len > avail)
+			return -1;
+		b->data = start;
+		b->next = pos + len;
+		/* Aligned blocks are padded with NULs. */
+		if (t->block_size && len < t->block_size &&
+		    b->next < t->footer_start && !t->map[b->next])
+			b->next = pos + t->block_size;
+	}
+
+	b->restarts_nr = get_be16(b->data + len - 2);
+	if (!b->restarts_nr ||
+	    header_off + REFTABLE_BLOCK_HEADER_SIZE + 3 * b->restarts_nr + 2 > len)
+		return -1;
+	b->records = b->data + header_off + REFTABLE_BLOCK_HEADER_SIZE;
+	b->records_end = b->data + len - 2 - 3 * b->restarts_nr;
+	return 0;
+}
+
+/* Return the type of the block at position `pos`, or 0. */
+static int block_type_at(struct reftable_table *t, uint64_t pos)
+{
+	size_t header_off = pos ? 0 : header_size(t->version);
+
+	if (pos > t->footer_start || t->footer_start - pos <= header_off)
+		return 0;
+	return t->map[pos + header_off];
+}
+
+/* Collect the leaf entries of the index block at `pos`. */
+static int read_index(struct reftable_table *t, struct reftable_section *sec,
+		      uint64_t pos, int depth)
+{
+	struct reftable_block b;
+	struct strbuf key = STRBUF_INIT;
+	const unsigned char *p;
+	int ret = -1;
+
+	if (depth > REFTABLE_MAX_INDEX_DEPTH ||
+	    read_block(t, pos, &b, NULL) ||
+	    b.type != REFTABLE_BLOCK_TYPE_INDEX)
+		return -1;
+
+	for (p = b.records; p < b.records_end; ) {
+		unsigned int type;
+		uint64_t offset;
+		int sub;
+
+		if (decode_key(&p, b.records_end, &key, &type) ||
+		    get_varint(&p, b.records_end, &offset))
+			goto out;
+		sub = block_type_at(t, offset);
+		if (sub == REFTABLE_BLOCK_TYPE_INDEX) {
+			if (read_index(t, sec, offset, depth + 1))
+				goto out;
+		} else if (sub == sec->block_type) {
+			add_block_entry(&sec->index, &sec->index_nr,
+					&sec->index_alloc, &key, offset);
+		} else {
+			goto out;
+		}
+	}
+	ret = 0;
+out:
+	strbuf_release(&key);
+	return ret;
+}
+
+/*
+ * Find the blocks of a section that starts at `pos`, which is either
+ * indexed at `index_pos` or has a single block.
+ */
+static int read_section(struct reftable_table *t, struct reftable_section *sec,
+			int block_type, uint64_t pos, uint64_t index_pos)
+{
+	struct reftable_record rec;
+	struct reftable_block b;
+	struct strbuf buf = STRBUF_INIT;
+	int ret = 0;
+
+	sec->block_type = block_type;
+	if (index_pos)
+		return read_index(t, sec, index_pos, 0);
+	if (block_type_at(t, pos) != block_type)
+		return 0;
+
+	/* Without an index, we need the last key of the block. */
+	reftable_record_init(&rec);
+	if (read_block(t, pos, &b, &buf))
+		ret = -1;
+	while (!ret && b.records < b.records_end)
+		ret = decode_record(&b.records, b.records_end, block_type,
+				    t->min_update_index, &rec);
+	if (!ret)
+		add_block_entry(&sec->index, &sec->index_nr,
+				&sec->index_alloc, &rec.key, pos);
+	reftable_record_release(&rec);
+	strbuf_release(&buf);
+	return ret;
+}
+
+static void table_free(struct reftable_table *t)
+{
+	if (!t)
+		return;
+	if (t->map)
+		munmap((void *)t->map, t->size);
+	free_index_entries(t->refs.index, t->refs.index_nr);
+	free_index_entries(t->logs.index, t->logs.index_nr);
+	free(t->name);
+	free(t);
+}
+
+/*
+ * Open and validate the table `name` in directory `dir`. On errors,
+ * return NULL with errno set; ENOENT means that the table vanished.
+ */
+static struct reftable_table *table_open(const char *dir, const char *name)
+{
+	struct reftable_table *t;
+	struct strbuf path = STRBUF_INIT;
+	const unsigned char *footer;
+	uint64_t ref_index, log_pos, log_index;
+	size_t hdr_size, footer_size;
+	struct stat st;
+	int fd;
+
+	strbuf_addf(&path, "%s/%s", dir, name);
+	fd = open(path.buf, O_RDONLY);
+	if (fd < 0) {
+		strbuf_release(&path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		int saved_errno = errno;
+		close(fd);
+		strbuf_release(&path);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	t = xcalloc(1, sizeof(*t));
+	t->name = xstrdup(name);
+	t->size = xsize_t(st.st_size);
+	if (t->size < 2 * REFTABLE_HEADER_SIZE_V1 + REFTABLE_FOOTER_EXTRA_SIZE) {
+		close(fd);
+		goto corrupt;
+	}
+	t->map = xmmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (memcmp(t->map, REFTABLE_SIGNATURE, 4))
+		goto corrupt;
+	t->version = t->map[4];
+	if (t->version != 1 && t->version != 2) {
+		error(_("reftable '%s' has unsupported version %d"),
+		      path.buf, t->version);
+		goto corrupt;
+	}
+	hdr_size = header_size(t->version);
+	footer_size = hdr_size + REFTABLE_FOOTER_EXTRA_SIZE;
+	if (t->size < hdr_size + footer_size)
+		goto corrupt;
+	t->footer_start = t->size - footer_size;
+	footer = t->map + t->footer_start;
+	if (memcmp(t->map, footer, hdr_size) ||
+	    get_be32(footer + footer_size - 4) !=
+	    crc32(0, footer, footer_size - 4))
+		goto corrupt;
+	if ((t->version == 1 ? hash_algos[GIT_HASH_SHA1].format_id :
+	     get_be32(t->map + 24)) != the_hash_algo->format_id) {
+		error(_("reftable '%s' uses a different hash algorithm"),
+		      path.buf);
+		goto corrupt;
+	}
+	t->block_size = get_be24(t->map + 5);
+	t->min_update_index = get_be64(t->map + 8);
+	t->max_update_index = get_be64(t->map + 16);
+
+	ref_index = get_be64(footer + hdr_size);
+	log_pos = get_be64(footer + hdr_size + 24);
+	log_index = get_be64(footer + hdr_size + 32);
+	if (ref_index >= t->footer_start || log_pos >= t->footer_start ||
+	    log_index >= t->footer_start)
+		goto corrupt;
+
+	/*
+	 * The references start with the first block, if that is a
+	 * reference block. The reflog of a table without references may
+	 * start there, too, in which case log_pos is 0.
+	 */
+	if (read_section(t, &t->refs, REFTABLE_BLOCK_TYPE_REF, 0, ref_index) ||
+	    read_section(t, &t->logs, REFTABLE_BLOCK_TYPE_LOG,
+			 log_pos, log_index))
+		goto corrupt;
+
+	t->refcount = 1;
+	strbuf_release(&path);
+	return t;
+
+corrupt:
+	error(_("reftable '%s' is corrupt"), path.buf);
+	strbuf_release(&path);
+	table_free(t);
+	errno = EINVAL;
+	return NULL;
+}
+
+static void table_release(struct reftable_table *t)
+{
+	if (!--t->refcount)
+		table_free(t);
+}
+
+/* Iterating over a single table section */
+
+struct reftable_table_iter {
+	struct reftable_table *table;
+	struct reftable_section *sec;
+	size_t block;
+	struct strbuf buf; /* the current block, if inflated */
+	const unsigned char *pos, *end;
+	struct reftable_record rec;
+	int done;
+};
+
+static NORETURN void die_corrupt_table(struct reftable_table_iter *it)
+{
+	die(_("reftable '%s' is corrupt"), it->table->name);
+}
+
+static void table_iter_load_block(struct reftable_table_iter *it, size_t block,
+				  struct reftable_block *b)
+{
+	if (read_block(it->table, it->sec->index[block].offset, b, &it->buf) ||
+	    b->type != it->sec->block_type)
+		die_corrupt_table(it);
+	it->block = block;
+	it->pos = b->records;
+	it->end = b->records_end;
+	strbuf_reset(&it->rec.key);
+}
+
+/* Move to the next record; set it->done at the end of the section. */
+static void table_iter_advance(struct reftable_table_iter *it)
+{
+	if (it->done)
+		return;
+	if (it->pos == it->end) {
+		struct reftable_block b;
+
+		if (it->block + 1 >= it->sec->index_nr) {
+			it->done = 1;
+			return;
+		}
+		table_iter_load_block(it, it->block + 1, &b);
+	}
+	if (decode_record(&it->pos, it->end, it->sec->block_type,
+			  it->table->min_update_index, &it->rec))
+		die_corrupt_table(it);
+}
+
+/*
+ * Position the iterator on the first record whose key is not smaller
+ * than `seek`.
+ */
+static void table_iter_start(struct reftable_table_iter *it,
+			     struct reftable_table *table, int block_type,
+			     const char *seek, size_t seek_len)
+{
+	struct reftable_block b;
+	size_t lo, hi;
+
+	reftable_record_init(&it->rec);
+	strbuf_init(&it->buf, 0);
+	it->table = table;
+	it->sec = block_type == REFTABLE_BLOCK_TYPE_LOG ?
+		&table->logs : &table->refs;
+	it->done = 0;
+
+	/* Find the first block whose last key is >= seek. */
+	lo = 0;
+	hi = it->sec->index_nr;
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		struct reftable_index_entry *e = &it->sec->index[mi];
+
+		if (key_cmp(e->key, e->key_len, seek, seek_len) < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	if (lo == it->sec->index_nr) {
+		it->done = 1;
+		return;
+	}
+
+	/* Find the last restart point whose key is <= seek. */
+	table_iter_load_block(it, lo, &b);
+	lo = 0;
+	hi = b.restarts_nr;
+	while (hi - lo > 1) {
+		size_t mi = lo + (hi - lo) / 2;
+		const unsigned char *p = b.data + get_be24(b.records_end + 3 * mi);
+		int cmp;
+
+		if (p < b.records || p >= b.records_end)
+			die_corrupt_table(it);
+		strbuf_reset(&it->rec.key);
+		if (decode_record(&p, b.records_end, it->sec->block_type,
+				  table->min_update_index, &it->rec))
+			die_corrupt_table(it);
+		cmp = key_cmp(it->rec.key.buf, it->rec.key.len, seek, seek_len);
+		if (cmp <= 0)
+			lo = mi;
+		else
+			hi = mi;
+	}
+	it->pos = b.data + get_be24(b.records_end + 3 * lo);
+	if (it->pos < b.records || it->pos >= b.records_end)
+		die_corrupt_table(it);
+	strbuf_reset(&it->rec.key);
+
+	do {
+		table_iter_advance(it);
+	} while (!it->done &&
+		 key_cmp(it->rec.key.buf, it->rec.key.len, seek, seek_len) < 0);
+}
+
+static void table_iter_release(struct reftable_table_iter *it)
+{
+	reftable_record_release(&it->rec);
+	strbuf_release(&it->buf);
+}
+
+/* Snapshots */
+
+void reftable_snapshot_acquire(struct reftable_snapshot *snap)
+{
+	snap->refcount++;
+}
+
+void reftable_snapshot_release(struct reftable_snapshot *snap)
+{
+	size_t i;
+
+	if (--snap->refcount)
+		return;
+	for (i = 0; i < snap->nr; i++)
+		table_release(snap->tables[i]);
+	free(snap->tables);
+	free(snap);
+}
+
+uint64_t reftable_snapshot_max_update_index(struct reftable_snapshot *snap)
+{
+	return snap->nr ? snap->tables[snap->nr - 1]->max_update_index : 0;
+}
+
+int reftable_snapshot_lookup(struct reftable_snapshot *snap, int block_type,
+			     const char *key, size_t key_len,
+			     struct reftable_record *rec)
+{
+	size_t i;
+
+	for (i = snap->nr; i--; ) {
+		struct reftable_table_iter it;
+		int found;
+
+		table_iter_start(&it, snap->tables[i], block_type, key, key_len);
+		found = !it.done && !key_cmp(it.rec.key.buf, it.rec.key.len,
+					     key, key_len);
+		if (found)
+			reftable_record_copy(rec, &it.rec);
+		table_iter_release(&it);
+		if (found)
+			return 1;
+	}
+	return 0;
+}
+
+void reftable_merged_iter_init(struct reftable_merged_iter *it,
+			       struct reftable_snapshot *snap,
+			       size_t first, size_t last, int block_type,
+			       const char *seek, size_t seek_len)
+{
+	size_t i;
+
+	memset(it, 0, sizeof(*it));
+	it->snap = snap;
+	reftable_snapshot_acquire(snap);
+	if (first > last || last >= snap->nr)
+		return;
+
+	it->nr = last - first + 1;
+	CALLOC_ARRAY(it->subs, it->nr);
+	ALLOC_ARRAY(it->advance, it->nr);
+	for (i = 0; i < it->nr; i++)
+		table_iter_start(&it->subs[i], snap->tables[first + i],
+				 block_type, seek ? seek : "", seek_len);
+}
+
+int reftable_merged_iter_next(struct reftable_merged_iter *it)
+{
+	struct reftable_table_iter *best = NULL;
+	size_t i;
+
+	/* Step past the records returned (or shadowed) last time. */
+	for (i = 0; i < it->advance_nr; i++)
+		table_iter_advance(&it->subs[it->advance[i]]);
+	it->advance_nr = 0;
+
+	/* On ties, the newest table (highest index) wins. */
+	for (i = 0; i < it->nr; i++) {
+		struct reftable_table_iter *sub = &it->subs[i];
+
+		if (sub->done)
+			continue;
+		if (!best || key_cmp(sub->rec.key.buf, sub->rec.key.len,
+				     best->rec.key.buf, best->rec.key.len) <= 0)
+			best = sub;
+	}
+	if (!best) {
+		it->rec = NULL;
+		return 1;
+	}
+
+	for (i = 0; i < it->nr; i++) {
+		struct reftable_table_iter *sub = &it->subs[i];
+
+		if (!sub->done &&
+		    !key_cmp(sub->rec.key.buf, sub->rec.key.len,
+			     best->rec.key.buf, best->rec.key.len))
+			it->advance[it->advance_nr++] = i;
+	}
+	it->rec = &best->rec;
+	return 0;
+}
+
+void reftable_merged_iter_release(struct reftable_merged_iter *it)
+{
+	size_t i;
+
+	for (i = 0; i < it->nr; i++)
+		table_iter_release(&it->subs[i]);
+	free(it->subs);
+	free(it->advance);
+	if (it->snap)
+		reftable_snapshot_release(it->snap);
+	memset(it, 0, sizeof(*it));
+}
+
+/* Stacks */
+
+uint32_t reftable_block_size(void)
+{
+	static int block_size;
+
+	if (!block_size) {
+		block_size = 4096;
+		git_config_get_int("reftable.blocksize", &block_size);
+		if (block_size < REFTABLE_MIN_BLOCK_SIZE ||
+		    block_size > REFTABLE_MAX_BLOCK_SIZE)
+			die(_("reftable.blockSize must be between %d and %d"),
+			    REFTABLE_MIN_BLOCK_SIZE, REFTABLE_MAX_BLOCK_SIZE);
+	}
+	return block_size;
+}
+
+static long reftable_lock_timeout_ms(void)
+{
+	static int configured;
+	static int timeout_ms = 1000;
+
+	if (!configured) {
+		git_config_get_int("reftable.locktimeout", &timeout_ms);
+		configured = 1;
+	}
+	return timeout_ms;
+}
+
+void reftable_stack_init(struct reftable_stack *st, const char *dir)
+{
+	memset(st, 0, sizeof(*st));
+	st->dir = xstrdup(dir);
+	st->list_path = xstrfmt("%s/tables.list", dir);
+}
+
+static struct reftable_table *find_table(struct reftable_snapshot *snap,
+					 const char *name)
+{
+	size_t i;
+
+	if (!snap)
+		return NULL;
+	for (i = 0; i < snap->nr; i++)
+		if (!strcmp(snap->tables[i]->name, name))
+			return snap->tables[i];
+	return NULL;
+}
+
+static void stack_reload(struct reftable_stack *st)
+{
+	int tries;
+
+	for (tries = 0; ; tries++) {
+		struct reftable_snapshot *snap;
+		struct strbuf buf = STRBUF_INIT;
+		struct string_list names = STRING_LIST_INIT_NODUP;
+		int fd, missing = 0;
+		size_t i;
+
+		snap = xcalloc(1, sizeof(*snap));
+		snap->refcount = 1;
+
+		fd = open(st->list_path, O_RDONLY);
+		if (fd < 0) {
+			if (errno != ENOENT)
+				die_errno(_("unable to read '%s'"), st->list_path);
+			stat_validity_clear(&st->validity);
+		} else {
+			if (strbuf_read(&buf, fd, 0) < 0)
+				die_errno(_("unable to read '%s'"), st->list_path);
+			stat_validity_update(&st->validity, fd);
+			close(fd);
+		}
+
+		string_list_split_in_place(&names, buf.buf, '\n', -1);
+		for (i = 0; i < names.nr; i++) {
+			const char *name = names.items[i].string;
+			struct reftable_table *t;
+
+			if (!*name)
+				continue;
+			if (strchr(name, '/') || !ends_with(name, ".ref"))
+				die(_("invalid table name '%s' in '%s'"),
+				    name, st->list_path);
+
+			t = find_table(st->snapshot, name);
+			if (t) {
+				t->refcount++;
+			} else {
+				t = table_open(st->dir, name);
+				if (!t) {
+					if (errno == ENOENT &&
+					    tries < REFTABLE_RELOAD_RETRIES) {
+						missing = 1;
+						break;
+					}
+					die_errno(_("unable to open reftable '%s/%s'"),
+						  st->dir, name);
+				}
+			}
+			ALLOC_GROW(snap->tables, snap->nr + 1, snap->alloc);
+			snap->tables[snap->nr++] = t;
+		}
+		string_list_clear(&names, 0);
+		strbuf_release(&buf);
+
+		if (missing) {
+			/* A concurrent compaction removed a table; retry. */
+			reftable_snapshot_release(snap);
+			stat_validity_clear(&st->validity);
+			continue;
+		}
+
+		if (st->snapshot)
+			reftable_snapshot_release(st->snapshot);
+		st->snapshot = snap;
+		return;
+	}
+}
+
+struct reftable_snapshot *reftable_stack_snapshot(struct reftable_stack *st)
+{
+	if (!st->snapshot || !stat_validity_check(&st->validity, st->list_path))
+		stack_reload(st);
+	return st->snapshot;
+}
+
+int reftable_stack_create(struct reftable_stack *st, struct strbuf *err)
+{
+	int fd;
+
+	if (mkdir(st->dir, 0777) && errno != EEXIST) {
+		strbuf_addf(err, "unable to create directory '%s': %s",
+			    st->dir, strerror(errno));
+		return -1;
+	}
+	adjust_shared_perm(st->dir);
+
+	fd = open(st->list_path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (fd < 0) {
+		if (errno == EEXIST)
+			return 0;
+		strbuf_addf(err, "unable to create '%s': %s",
+			    st->list_path, strerror(errno));
+		return -1;
+	}
+	close(fd);
+	adjust_shared_perm(st->list_path);
+	return 0;
+}
+
+int reftable_stack_lock(struct reftable_stack *st, struct lock_file *lock,
+			struct strbuf *err)
+{
+	if (reftable_stack_create(st, err))
+		return -1;
+	if (hold_lock_file_for_update_timeout(lock, st->list_path, 0,
+					      reftable_lock_timeout_ms()) < 0) {
+		unable_to_lock_message(st->list_path, errno, err);
+		return -1;
+	}
+
+	/*
+	 * Do not trust the stat data of `tables.list`: it might have
+	 * been replaced by a list with the same size and timestamp.
+	 */
+	stack_reload(st);
+	return 0;
+}
+
+/*
+ * Write `data` as a new table file to the stack directory and store
+ * its name in `name`.
+ */
+static int write_table_file(struct reftable_stack *st,
+			    const struct strbuf *data, struct strbuf *name,
+			    struct strbuf *err)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct tempfile *tmp;
+	const char *suffix;
+	int ret = -1;
+
+	if (data->len < REFTABLE_HEADER_SIZE_V1)
+		BUG("reftable data is too short");
+
+	strbuf_addf(&path, "%s/tmp_table_XXXXXX", st->dir);
+	tmp = mks_tempfile_m(path.buf, 0666);
+	if (!tmp) {
+		strbuf_addf(err, "unable to create '%s': %s",
+			    path.buf, strerror(errno));
+		goto out;
+	}
+	if (write_in_full(get_tempfile_fd(tmp), data->buf, data->len) < 0 ||
+	    close_tempfile_gently(tmp) < 0) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    get_tempfile_path(tmp), strerror(errno));
+		delete_tempfile(&tmp);
+		goto out;
+	}
+	adjust_shared_perm(get_tempfile_path(tmp));
+
+	suffix = strrchr(get_tempfile_path(tmp), '_') + 1;
+	strbuf_reset(name);
+	strbuf_addf(name, "%016"PRIx64"-%016"PRIx64"-%s.ref",
+		    get_be64(data->buf + 8), get_be64(data->buf + 16), suffix);
+	strbuf_reset(&path);
+	strbuf_addf(&path, "%s/%s", st->dir, name->buf);
+	if (rename_tempfile(&tmp, path.buf)) {
+		strbuf_addf(err, "unable to rename table to '%s': %s",
+			    path.buf, strerror(errno));
+		goto out;
+	}
+	ret = 0;
+
+out:
+	strbuf_release(&path);
+	return ret;
+}
+
+/*
+ * Merge the tables `first` through `last` of `snap` into a single
+ * table. Deletion records are only needed to shadow records of older
+ * tables, so they are dropped if there are none.
+ */
+static void merge_tables(struct reftable_snapshot *snap, size_t first,
+			 size_t last, struct strbuf *out)
+{
+	struct reftable_writer *w;
+	struct reftable_merged_iter it;
+	int keep_deletions = first > 0;
+	int types[] = { REFTABLE_BLOCK_TYPE_REF, REFTABLE_BLOCK_TYPE_LOG };
+	size_t i;
+
+	w = reftable_writer_new(reftable_block_size(),
+				snap->tables[first]->min_update_index,
+				snap->tables[last]->max_update_index);
+	for (i = 0; i < ARRAY_SIZE(types); i++) {
+		reftable_merged_iter_init(&it, snap, first, last, types[i],
+					  NULL, 0);
+		while (!reftable_merged_iter_next(&it)) {
+			/* Both deletion types share the value 0. */
+			if (!it.rec->value_type && !keep_deletions)
+				continue;
+			reftable_writer_add(w, types[i], it.rec);
+		}
+		reftable_merged_iter_release(&it);
+	}
+	reftable_writer_finish(w, out);
+}
+
+/*
+ * Decide which of the newest tables of `snap` to merge so that every
+ * table is at least twice as large as all newer ones combined.
+ * Return the index of the first table to merge, or `snap->nr - 1` if
+ * there is nothing to do.
+ */
+static size_t compaction_start(struct reftable_snapshot *snap)
+{
+	size_t i = snap->nr - 1;
+	uint64_t bytes = snap->tables[i]->size;
+
+	while (i > 0 && snap->tables[i - 1]->size < 2 * bytes) {
+		i--;
+		bytes += snap->tables[i]->size;
+	}
+	return i;
+}
+
+static int write_tables_list(struct lock_file *lock,
+			     struct reftable_snapshot *snap, size_t nr,
+			     const char *extra, struct strbuf *err)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < nr; i++)
+		strbuf_addf(&buf, "%s\n", snap->tables[i]->name);
+	if (extra)
+		strbuf_addf(&buf, "%s\n", extra);
+	if (write_in_full(get_lock_file_fd(lock), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(lock) < 0) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    get_lock_file_path(lock), strerror(errno));
+		rollback_lock_file(lock);
+		ret = -1;
+	}
+	strbuf_release(&buf);
+	return ret;
+}
+
+static void unlink_tables(struct reftable_stack *st,
+			  struct reftable_snapshot *snap, size_t first)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t i;
+
+	for (i = first; i < snap->nr; i++) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", st->dir, snap->tables[i]->name);
+		unlink_or_warn(path.buf);
+	}
+	strbuf_release(&path);
+}
+
+/*
+ * Merge tables `first` and later of `snap` into a single table, and
+ * commit `lock` with the resulting list.
+ */
+static int compact_tables(struct reftable_stack *st, struct lock_file *lock,
+			  struct reftable_snapshot *snap, size_t first,
+			  struct strbuf *err)
+{
+	struct strbuf data = STRBUF_INIT;
+	struct strbuf name = STRBUF_INIT;
+	int ret;
+
+	merge_tables(snap, first, snap->nr - 1, &data);
+	ret = write_table_file(st, &data, &name, err);
+	if (ret)
+		rollback_lock_file(lock);
+	else
+		ret = write_tables_list(lock, snap, first, name.buf, err);
+	if (!ret)
+		unlink_tables(st, snap, first);
+
+	strbuf_release(&data);
+	strbuf_release(&name);
+	return ret;
+}
+
+int reftable_stack_add(struct reftable_stack *st, struct lock_file *lock,
+		       const struct strbuf *table, int auto_compact,
+		       struct strbuf *err)
+{
+	struct reftable_snapshot *snap = NULL;
+	struct reftable_table *t;
+	struct strbuf name = STRBUF_INIT;
+	size_t first;
+	int ret = -1;
+
+	if (write_table_file(st, table, &name, err)) {
+		rollback_lock_file(lock);
+		goto out;
+	}
+
+	if (!auto_compact || !(t = table_open(st->dir, name.buf))) {
+		/* Compaction is best effort; the new table is fine. */
+		ret = write_tables_list(lock, st->snapshot, st->snapshot->nr,
+					name.buf, err);
+		goto out;
+	}
+
+	snap = xcalloc(1, sizeof(*snap));
+	snap->refcount = 1;
+	ALLOC_ARRAY(snap->tables, st->snapshot->nr + 1);
+	for (snap->nr = 0; snap->nr < st->snapshot->nr; snap->nr++) {
+		snap->tables[snap->nr] = st->snapshot->tables[snap->nr];
+		snap->tables[snap->nr]->refcount++;
+	}
+	snap->tables[snap->nr++] = t;
+
+	first = compaction_start(snap);
+	if (first == snap->nr - 1)
+		ret = write_tables_list(lock, snap, snap->nr, NULL, err);
+	else
+		ret = compact_tables(st, lock, snap, first, err);
+
+out:
+	if (snap)
+		reftable_snapshot_release(snap);
+	stat_validity_clear(&st->validity);
+	strbuf_release(&name);
+	return ret;
+}
+
+/*
+ * Remove table files that are neither listed in `snap` nor named
+ * `keep`, e.g. because a process died before it could add its table.
+ * Must be called while holding the lock.
+ */
+static void remove_stale_tables(struct reftable_stack *st,
+				struct reftable_snapshot *snap,
+				const char *keep)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(st->dir);
+	if (!dir)
+		return;
+	while ((de = readdir(dir))) {
+		if (!ends_with(de->d_name, ".ref") ||
+		    find_table(snap, de->d_name) ||
+		    (keep && !strcmp(de->d_name, keep)))
+			continue;
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", st->dir, de->d_name);
+		unlink_or_warn(path.buf);
+	}
+	closedir(dir);
+	strbuf_release(&path);
+}
+
+int reftable_stack_compact_all(struct reftable_stack *st, struct strbuf *err)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct reftable_snapshot *snap;
+	struct strbuf data = STRBUF_INIT;
+	struct strbuf name = STRBUF_INIT;
+	int ret = 0;
+
+	if (reftable_stack_lock(st, &lock, err))
+		return -1;
+
+	snap = st->snapshot;
+	reftable_snapshot_acquire(snap);
+	if (snap->nr > 1) {
+		merge_tables(snap, 0, snap->nr - 1, &data);
+		if (write_table_file(st, &data, &name, err)) {
+			rollback_lock_file(&lock);
+			ret = -1;
+			goto out;
+		}
+	}
+
+	remove_stale_tables(st, snap, name.len ? name.buf : NULL);
+
+	if (name.len) {
+		ret = write_tables_list(&lock, snap, 0, name.buf, err);
+		if (!ret)
+			unlink_tables(st, snap, 0);
+	} else {
+		rollback_lock_file(&lock);
+	}
+
+out:
+	reftable_snapshot_release(snap);
+	stat_validity_clear(&st->validity);
+	strbuf_release(&data);
+	strbuf_release(&name);
+	return ret;
+}
@@ -0,0 +1,201 @@
+#ifndef REFS_REFTABLE_H
+#define REFS_REFTABLE_H
+
+#include "../lockfile.h"
+
+/*
+ * Block-based reference tables.
+ *
+ * A reftable is an immutable file holding a sorted set of reference
+ * records followed by a sorted set of reflog records. Records are
+ * grouped into blocks of (at most) `block_size` bytes. Within a
+ * block, each record stores only the suffix of its key that differs
+ * from the previous key; every REFTABLE_RESTART_INTERVAL records a
+ * "restart point" stores the full key, so that a block can be
+ * binary-searched via its table of restart offsets. Each section is
+ * followed by an index holding the last key of every block, which
+ * allows a lookup to go straight to the single block that may hold
+ * the key.
+ *
+ * A directory of reftables (a "stack") is described by its
+ * `tables.list` file, which lists the tables from oldest to newest.
+ * Newer tables shadow the records of older ones, so a single update
+ * only has to write a small table and atomically rewrite the list.
+ * Deletions are recorded as tombstone records, which are dropped
+ * once tables are compacted into the oldest one.
+ *
+ * The layout (see reftable.c) is the one described in
+ * Documentation/technical/reftable.txt, so that other implementations
+ * can read our tables and we theirs. We leave out its optional object
+ * blocks when writing, and skip them when reading.
+ */
+
+#define REFTABLE_BLOCK_TYPE_REF 'r'
+#define REFTABLE_BLOCK_TYPE_LOG 'g'
+
+/* Value types of reference records: */
+#define REFTABLE_REF_DELETION 0
+#define REFTABLE_REF_VAL1 1 /* object name */
+#define REFTABLE_REF_VAL2 2 /* object name and peeled object name */
+#define REFTABLE_REF_SYMREF 3 /* name of the referent */
+
+/* Value types of reflog records: */
+#define REFTABLE_LOG_DELETION 0
+#define REFTABLE_LOG_UPDATE 1
+
+/*
+ * A decoded record. For reference records, `key` is the refname and
+ * the object names (or `target` for symrefs) carry the value. For
+ * reflog records, `key` is the refname, a NUL, and the bitwise
+ * inverse of `update_index` in network byte order, so that the
+ * entries of each reflog sort newest first; `key.buf` can therefore
+ * also be used as the (NUL-terminated) refname.
+ */
+struct reftable_record {
+	struct strbuf key;
+	unsigned int value_type;
+
+	/* reference records */
+	struct object_id oid;
+	struct object_id peeled;
+	struct strbuf target;
+
+	/* reflog records */
+	uint64_t update_index;
+	struct object_id old_oid;
+	struct object_id new_oid;
+	struct strbuf ident; /* "Name <email>" */
+	timestamp_t time;
+	int tz;
+	struct strbuf message;
+};
+
+void reftable_record_init(struct reftable_record *rec);
+void reftable_record_release(struct reftable_record *rec);
+void reftable_record_copy(struct reftable_record *dst,
+			  const struct reftable_record *src);
+
+/* Set rec->key (and rec->update_index) for a reflog record. */
+void reftable_log_key(struct reftable_record *rec, const char *refname,
+		      uint64_t update_index);
+
+/*
+ * Serialize a table into an in-memory buffer. Records must be added
+ * in key order, all reference records before any reflog record.
+ */
+struct reftable_writer;
+
+struct reftable_writer *reftable_writer_new(uint32_t block_size,
+					    uint64_t min_update_index,
+					    uint64_t max_update_index);
+void reftable_writer_add(struct reftable_writer *w, int block_type,
+			 const struct reftable_record *rec);
+/* Finish the table, append it to `out` and free the writer. */
+void reftable_writer_finish(struct reftable_writer *w, struct strbuf *out);
+
+struct reftable_table;
+
+/*
+ * A consistent view of the tables of a stack. Snapshots are
+ * reference-counted so that iterators can keep using them while the
+ * stack is reloaded underneath them.
+ */
+struct reftable_snapshot {
+	unsigned int refcount;
+	struct reftable_table **tables; /* oldest first */
+	size_t nr, alloc;
+};
+
+void reftable_snapshot_acquire(struct reftable_snapshot *snap);
+void reftable_snapshot_release(struct reftable_snapshot *snap);
+uint64_t reftable_snapshot_max_update_index(struct reftable_snapshot *snap);
+
+/*
+ * Look up the record with the given key, consulting the tables from
+ * newest to oldest. Return 1 and fill `rec` if a record was found
+ * (which might be a deletion), 0 otherwise.
+ */
+int reftable_snapshot_lookup(struct reftable_snapshot *snap, int block_type,
+			     const char *key, size_t key_len,
+			     struct reftable_record *rec);
+
+/*
+ * Iterate over the merged records of the tables `first` through
+ * `last` (inclusive) of a snapshot, in key order, starting at the
+ * first key that is not smaller than `seek`. When several tables
+ * hold a record with the same key, only the newest one is returned.
+ * Deletion records are returned as well; it is up to the caller to
+ * skip them.
+ */
+struct reftable_merged_iter {
+	struct reftable_snapshot *snap;
+	struct reftable_table_iter *subs;
+	size_t nr;
+	size_t *advance;
+	size_t advance_nr;
+	struct reftable_record *rec; /* current record */
+};
+
+void reftable_merged_iter_init(struct reftable_merged_iter *it,
+			       struct reftable_snapshot *snap,
+			       size_t first, size_t last, int block_type,
+			       const char *seek, size_t seek_len);
+/* Return 0 if positioned on a record, 1 if exhausted. */
+int reftable_merged_iter_next(struct reftable_merged_iter *it);
+void reftable_merged_iter_release(struct reftable_merged_iter *it);
+
+/*
+ * A directory of tables, e.g. "$GIT_DIR/reftable".
+ */
+struct reftable_stack {
+	char *dir;
+	char *list_path;
+	struct reftable_snapshot *snapshot;
+	struct stat_validity validity;
+};
+
+void reftable_stack_init(struct reftable_stack *st, const char *dir);
+
+/*
+ * Return the current snapshot of the stack, re-reading `tables.list`
+ * if it changed on disk. The snapshot is owned by the stack; call
+ * reftable_snapshot_acquire() to keep it around. Dies if the stack
+ * is corrupt.
+ */
+struct reftable_snapshot *reftable_stack_snapshot(struct reftable_stack *st);
+
+/*
+ * Create the directory of the stack and an empty `tables.list` if
+ * they do not exist yet.
+ */
+int reftable_stack_create(struct reftable_stack *st, struct strbuf *err);
+
+/*
+ * Lock `tables.list` for an update and make sure the snapshot is up
+ * to date with the on-disk state. The lock must be released by
+ * reftable_stack_add() or rollback_lock_file().
+ */
+int reftable_stack_lock(struct reftable_stack *st, struct lock_file *lock,
+			struct strbuf *err);
+
+/*
+ * Write `table` (which must have been produced by a writer whose
+ * update indices start after reftable_snapshot_max_update_index())
+ * as a new table, append it to the stack and commit `lock`. If
+ * `auto_compact` is set, the newest tables are merged first if the
+ * stack no longer shrinks geometrically towards its top.
+ */
+int reftable_stack_add(struct reftable_stack *st, struct lock_file *lock,
+		       const struct strbuf *table, int auto_compact,
+		       struct strbuf *err);
+
+/*
+ * Merge all tables of the stack into a single one, dropping deletion
+ * records, and remove table files that are no longer referenced.
+ */
+int reftable_stack_compact_all(struct reftable_stack *st, struct strbuf *err);
+
+/* Parameters shared by all stacks (see reftable.* config). */
+uint32_t reftable_block_size(void);
+
+#endif /* REFS_REFTABLE_H */
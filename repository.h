@@ -32,9 +32,18 @@ struct repo_settings {
 	int core_commit_graph;
 	int gc_write_commit_graph;
 	int fetch_write_commit_graph;
+	int commit_graph_generation_version;
 
 	int index_version;
 	enum untracked_cache_setting core_untracked_cache;
+	int sparse_index;
+
+	/*
+	 * Whether the index has to be expanded to contain all entries
+	 * when it is read; commands that can work with sparse directory
+	 * entries clear this (see sparse-index.h).
+	 */
+	int command_requires_full_index;
 
 	int pack_use_sparse;
 	enum fetch_negotiation_setting fetch_negotiation_algorithm;
@@ -127,6 +136,12 @@ struct repository {
 	/* Repository's current hash algorithm, as serialized on disk. */
 	const struct git_hash_algo *hash_algo;
 
+	/*
+	 * Name of the backend storing the repository's references, as
+	 * given by extensions.refStorage; NULL for the "files" backend.
+	 */
+	char *ref_storage_format;
+
 	/* A unique-id for tracing purposes. */
 	int trace2_repo_id;
 
@@ -157,6 +172,7 @@ void repo_set_gitdir(struct repository *repo, const char *root,
 		     const struct set_gitdir_args *extra_args);
 void repo_set_worktree(struct repository *repo, const char *path);
 void repo_set_hash_algo(struct repository *repo, int algo);
+void repo_set_ref_storage_format(struct repository *repo, const char *format);
 void initialize_the_repository(void);
 int repo_init(struct repository *r, const char *gitdir, const char *worktree);
 
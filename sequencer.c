@@ -15,6 +15,7 @@
 #include "revision.h"
 #include "rerere.h"
 #include "merge-recursive.h"
+#include "merge-ort.h"
 #include "refs.h"
 #include "strvec.h"
 #include "quote.h"
@@ -313,6 +314,10 @@ int sequencer_remove_state(struct replay_opts *opts)
 		free(opts->xopts[i]);
 	free(opts->xopts);
 	strbuf_release(&opts->current_fixups);
+	if (opts->ort_result) {
+		merge_finalize(NULL, opts->ort_result);
+		FREE_AND_NULL(opts->ort_result);
+	}
 
 	strbuf_reset(&buf);
 	strbuf_addstr(&buf, get_dir(opts));
@@ -611,11 +616,27 @@ static int do_recursive_merge(struct repository *r,
 	for (i = 0; i < opts->xopts_nr; i++)
 		parse_merge_opt(&o, opts->xopts[i]);
 
-	clean = merge_trees(&o,
-			    head_tree,
-			    next_tree, base_tree);
-	if (is_rebase_i(opts) && clean <= 0)
-		fputs(o.obuf.buf, stdout);
+	if (opts->strategy && !strcmp(opts->strategy, "ort")) {
+		/*
+		 * Keep the merge result around so that the next pick can
+		 * reuse the renames this one found on our side.
+		 */
+		if (!opts->ort_result)
+			opts->ort_result = xcalloc(1, sizeof(*opts->ort_result));
+		merge_incore_nonrecursive(&o, base_tree, head_tree, next_tree,
+					  opts->ort_result);
+		clean = opts->ort_result->clean;
+		if (clean >= 0 &&
+		    merge_switch_to_result(&o, head_tree, opts->ort_result, 1,
+					   !is_rebase_i(opts) || !clean))
+			clean = -1;
+	} else {
+		clean = merge_trees(&o,
+				    head_tree,
+				    next_tree, base_tree);
+		if (is_rebase_i(opts) && clean <= 0)
+			fputs(o.obuf.buf, stdout);
+	}
 	strbuf_release(&o.obuf);
 	if (clean < 0) {
 		rollback_lock_file(&index_lock);
@@ -1983,7 +2004,10 @@ static int do_pick_commit(struct repository *r,
 
 	if (is_rebase_i(opts) && write_author_script(msg.message) < 0)
 		res = -1;
-	else if (!opts->strategy || !strcmp(opts->strategy, "recursive") || command == TODO_REVERT) {
+	else if (!opts->strategy ||
+		 !strcmp(opts->strategy, "recursive") ||
+		 !strcmp(opts->strategy, "ort") ||
+		 command == TODO_REVERT) {
 		res = do_recursive_merge(r, base, next, base_label, next_label,
 					 &head, &msgbuf, opts);
 		if (res < 0)
@@ -1784,9 +1784,11 @@ int hash_object_file(const struct git_hash_algo *algo, const void *buf,
 }
 
 /* Finalize a file on disk, and close it. */
-static void close_loose_object(int fd)
+static void close_loose_object(int fd, const char *filename, int batched)
 {
-	if (fsync_object_files)
+	if (batched)
+		fsync_loose_object_bulk_checkin(fd, filename);
+	else if (fsync_object_files)
 		fsync_or_die(fd, "loose object file");
 	if (close(fd) != 0)
 		die_errno(_("error when closing loose object file"));
@@ -1848,8 +1850,14 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 	struct object_id parano_oid;
 	static struct strbuf tmp_file = STRBUF_INIT;
 	static struct strbuf filename = STRBUF_INIT;
+	const char *bulk_dir = prepare_loose_object_bulk_checkin();
 
-	loose_object_path(the_repository, &filename, oid);
+	if (bulk_dir) {
+		strbuf_reset(&filename);
+		strbuf_addf(&filename, "%s/", bulk_dir);
+		fill_loose_path(&filename, oid);
+	} else
+		loose_object_path(the_repository, &filename, oid);
 
 	fd = create_tmpfile(&tmp_file, filename.buf);
 	if (fd < 0) {
@@ -1897,7 +1905,7 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 		die(_("confused by unstable object source data for %s"),
 		    oid_to_hex(oid));
 
-	close_loose_object(fd);
+	close_loose_object(fd, tmp_file.buf, !!bulk_dir);
 
 	if (mtime) {
 		struct utimbuf utb;
@@ -1941,6 +1949,9 @@ int write_object_file(const void *buf, unsigned long len, const char *type,
 				  &hdrlen);
 	if (freshen_packed_object(oid) || freshen_loose_object(oid))
 		return 0;
+	if (bulk_checkin_all_objects())
+		return write_object_file_bulk_checkin(buf, len,
+						      type_from_string(type), oid);
 	return write_loose_object(oid, hdr, hdrlen, buf, len, 0);
 }
 
@@ -1,4 +1,13 @@
 #include "cache.h"
+#include "compat/sha-ni.h"
+
+#if defined(HAVE_SHA_NI) && !defined(DC_SHA1_EXTERNAL)
+#ifdef DC_SHA1_SUBMODULE
+#include "sha1collisiondetection/lib/ubc_check.h"
+#else
+#include "sha1dc/ubc_check.h"
+#endif
+#endif
 
 #ifdef DC_SHA1_EXTERNAL
 /*
@@ -22,12 +31,66 @@ void git_SHA1DCFinal(unsigned char hash[20], SHA1_CTX *ctx)
 	    hash_to_hex_algop(hash, &hash_algos[GIT_HASH_SHA1]));
 }
 
+#if defined(HAVE_SHA_NI) && !defined(DC_SHA1_EXTERNAL)
+/*
+ * Hash with the SHA instructions, and give sha1dc a block to look at
+ * closely only if it could be part of a collision attack, going by the
+ * unavoidable bit conditions sha1dc checks first. Few blocks meet them,
+ * and for all others sha1dc computes nothing but the plain SHA-1.
+ */
+static void sha1dc_update_ni(SHA1_CTX *ctx, const unsigned char *data,
+			     unsigned long len)
+{
+	unsigned long left = ctx->total & 63;
+
+	if (left) {
+		unsigned long fill = 64 - left < len ? 64 - left : len;
+
+		SHA1DCUpdate(ctx, (const char *)data, fill);
+		data += fill;
+		len -= fill;
+	}
+
+	if (!ctx->detect_coll) {
+		size_t nr = len / 64;
+
+		sha_ni_sha1_blocks(ctx->ihv, data, nr);
+		ctx->total += 64 * nr;
+		data += 64 * nr;
+		len -= 64 * nr;
+	}
+	for (; len >= 64; data += 64, len -= 64) {
+		uint32_t ihv[5], W[80], dvmask[DVMASKSIZE];
+
+		memcpy(ihv, ctx->ihv, sizeof(ihv));
+		sha_ni_sha1_block_expand(ctx->ihv, data, W);
+		ubc_check(W, dvmask);
+		if (dvmask[0]) {
+			memcpy(ctx->ihv, ihv, sizeof(ihv));
+			SHA1DCUpdate(ctx, (const char *)data, 64);
+		} else
+			ctx->total += 64;
+	}
+
+	if (len)
+		SHA1DCUpdate(ctx, (const char *)data, len);
+}
+#endif
+
 /*
  * Same as SHA1DCUpdate, but adjust types to match git's usual interface.
  */
 void git_SHA1DCUpdate(SHA1_CTX *ctx, const void *vdata, unsigned long len)
 {
 	const char *data = vdata;
+
+#if defined(HAVE_SHA_NI) && !defined(DC_SHA1_EXTERNAL)
+	/* without the ubc check, sha1dc looks at every block closely */
+	if (sha_ni_available() && (ctx->ubc_check || !ctx->detect_coll)) {
+		sha1dc_update_ni(ctx, vdata, len);
+		return;
+	}
+#endif
 	/* We expect an unsigned long, but sha1dc only takes an int */
 	while (len > INT_MAX) {
 		SHA1DCUpdate(ctx, data, INT_MAX);
@@ -1,5 +1,6 @@
 #include "git-compat-util.h"
 #include "./sha256.h"
+#include "../../compat/sha-ni.h"
 
 #undef RND
 #undef BLKSIZE
@@ -167,6 +168,15 @@ void blk_SHA256_Update(blk_SHA256_CTX *ctx, const void *data, size_t len)
 			return;
 		blk_SHA256_Transform(ctx, ctx->buf);
 	}
+#ifdef HAVE_SHA_NI
+	if (len >= 64 && sha_ni_available()) {
+		size_t nr = len / 64;
+
+		sha_ni_sha256_blocks(ctx->state, data, nr);
+		data = ((const char *)data + 64 * nr);
+		len -= 64 * nr;
+	}
+#endif
 	while (len >= 64) {
 		blk_SHA256_Transform(ctx, data);
 		data = ((const char *)data + 64);
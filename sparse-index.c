@@ -0,0 +1,351 @@
+#include "cache.h"
+#include "repository.h"
+#include "sparse-index.h"
+#include "tree.h"
+#include "pathspec.h"
+#include "trace2.h"
+#include "cache-tree.h"
+#include "config.h"
+#include "dir.h"
+
+static int sparse_index_enabled(struct index_state *istate)
+{
+	if (istate->split_index || !core_apply_sparse_checkout ||
+	    !core_sparse_checkout_cone)
+		return 0;
+
+	if (!istate->repo)
+		istate->repo = the_repository;
+	prepare_repo_settings(istate->repo);
+	return istate->repo->settings.sparse_index > 0;
+}
+
+static int load_cone_patterns(struct repository *r, struct pattern_list *pl)
+{
+	char *sparse = repo_git_path(r, "info/sparse-checkout");
+	int ret;
+
+	memset(pl, 0, sizeof(*pl));
+	pl->use_cone_patterns = core_sparse_checkout_cone;
+	ret = add_patterns_from_file_to_list(sparse, "", 0, pl, NULL);
+	free(sparse);
+	if (ret < 0)
+		return -1;
+
+	/* Falls back to non-cone patterns if the file was not cone-shaped */
+	if (!pl->use_cone_patterns) {
+		clear_pattern_list(pl);
+		return -1;
+	}
+	return 0;
+}
+
+static struct cache_entry *construct_sparse_dir_entry(struct index_state *istate,
+						      const char *path,
+						      size_t len,
+						      const struct object_id *oid)
+{
+	struct cache_entry *ce = make_empty_cache_entry(istate, len);
+
+	oidcpy(&ce->oid, oid);
+	memcpy(ce->name, path, len);
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	ce->ce_namelen = len;
+	ce->ce_mode = S_IFDIR;
+	return ce;
+}
+
+/*
+ * Collapse what can be collapsed of the entries [start, end) of the
+ * index, which are those below the directory "path" (empty or ending
+ * in a slash) that "it" describes. The surviving entries are written
+ * to the index from position "dst" on; returns how many there are.
+ */
+static int convert_to_sparse_rec(struct index_state *istate,
+				 struct pattern_list *pl,
+				 int dst, int start, int end,
+				 const char *path, size_t pathlen,
+				 struct cache_tree *it)
+{
+	int i, can_convert = 1;
+	int dtype = DT_DIR;
+	int dst_start = dst;
+	struct strbuf child = STRBUF_INIT;
+
+	/*
+	 * A directory outside of the cone can be replaced by a single
+	 * entry if we know its tree, and nothing in it is checked out,
+	 * modified or unmerged.
+	 */
+	if (!pathlen || !it || it->entry_count < 0 ||
+	    path_matches_pattern_list(path, pathlen, NULL, &dtype,
+				      pl, istate) != NOT_MATCHED)
+		can_convert = 0;
+
+	for (i = start; can_convert && i < end; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (ce_stage(ce) || S_ISGITLINK(ce->ce_mode) ||
+		    !ce_skip_worktree(ce) ||
+		    (ce->ce_flags & (CE_REMOVE | CE_INTENT_TO_ADD)))
+			can_convert = 0;
+	}
+
+	if (can_convert) {
+		istate->cache[dst] = construct_sparse_dir_entry(istate, path,
+								pathlen,
+								&it->oid);
+		return 1;
+	}
+
+	for (i = start; i < end; ) {
+		struct cache_entry *ce = istate->cache[i];
+		const char *name = ce->name + pathlen;
+		const char *slash = strchr(name, '/');
+		struct cache_tree_sub *sub;
+		int span;
+
+		if (!slash) {
+			istate->cache[dst++] = ce;
+			i++;
+			continue;
+		}
+
+		strbuf_reset(&child);
+		strbuf_add(&child, ce->name, slash - ce->name + 1);
+		for (span = 1; i + span < end; span++)
+			if (!starts_with(istate->cache[i + span]->name, child.buf))
+				break;
+
+		sub = NULL;
+		if (it) {
+			int pos;
+
+			for (pos = 0; pos < it->subtree_nr; pos++) {
+				sub = it->down[pos];
+				if (sub->namelen == slash - name &&
+				    !memcmp(sub->name, name, sub->namelen))
+					break;
+			}
+			if (pos == it->subtree_nr)
+				sub = NULL;
+		}
+
+		dst += convert_to_sparse_rec(istate, pl, dst, i, i + span,
+					     child.buf, child.len,
+					     sub ? sub->cache_tree : NULL);
+		i += span;
+	}
+
+	strbuf_release(&child);
+	return dst - dst_start;
+}
+
+/*
+ * The name hash refers to the entries the index had; the entries that
+ * are still there have to be hashed again when it is next needed.
+ */
+static void reset_name_hash(struct index_state *istate)
+{
+	unsigned int i;
+
+	free_name_hash(istate);
+	for (i = 0; i < istate->cache_nr; i++)
+		istate->cache[i]->ce_flags &= ~CE_HASHED;
+}
+
+static int do_convert_to_sparse(struct index_state *istate,
+				struct full_index *full)
+{
+	struct pattern_list pl;
+	int nr;
+
+	if (istate->sparse_index || !istate->cache_nr ||
+	    !sparse_index_enabled(istate))
+		return 0;
+
+	if (load_cone_patterns(istate->repo, &pl) < 0)
+		return 0;
+
+	/*
+	 * We need the trees of the directories we collapse; this fails
+	 * (and we keep the full index) if the index is unmerged.
+	 */
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_MISSING_OK)) {
+		clear_pattern_list(&pl);
+		return 0;
+	}
+
+	trace2_region_enter("index", "convert_to_sparse", istate->repo);
+	if (full) {
+		/* Collapse a copy of the entries, and keep the originals */
+		full->cache = istate->cache;
+		full->cache_nr = istate->cache_nr;
+		full->cache_alloc = istate->cache_alloc;
+		ALLOC_ARRAY(istate->cache, istate->cache_nr);
+		COPY_ARRAY(istate->cache, full->cache, istate->cache_nr);
+		istate->cache_alloc = istate->cache_nr;
+	}
+	nr = convert_to_sparse_rec(istate, &pl, 0, 0, istate->cache_nr,
+				   "", 0, istate->cache_tree);
+	if (nr != istate->cache_nr) {
+		istate->cache_nr = nr;
+		istate->sparse_index = 1;
+		istate->cache_changed |= SOMETHING_CHANGED;
+
+		/* The name hash and the cache tree refer to the old entries */
+		reset_name_hash(istate);
+		if (full)
+			full->cache_tree = istate->cache_tree;
+		else
+			cache_tree_free(&istate->cache_tree);
+		istate->cache_tree = cache_tree();
+		cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_MISSING_OK);
+	} else if (full) {
+		free(istate->cache);
+		istate->cache = full->cache;
+		istate->cache_alloc = full->cache_alloc;
+		full->cache = NULL;
+	}
+	trace2_region_leave("index", "convert_to_sparse", istate->repo);
+
+	clear_pattern_list(&pl);
+	return full && full->cache;
+}
+
+int convert_to_sparse(struct index_state *istate)
+{
+	return do_convert_to_sparse(istate, NULL);
+}
+
+int convert_to_sparse_for_write(struct index_state *istate,
+				struct full_index *full)
+{
+	memset(full, 0, sizeof(*full));
+	return do_convert_to_sparse(istate, full);
+}
+
+void restore_full_index(struct index_state *istate, struct full_index *full)
+{
+	unsigned int i;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		if (S_ISSPARSEDIR(istate->cache[i]->ce_mode))
+			discard_cache_entry(istate->cache[i]);
+	free(istate->cache);
+	istate->cache = full->cache;
+	istate->cache_nr = full->cache_nr;
+	istate->cache_alloc = full->cache_alloc;
+	istate->sparse_index = 0;
+
+	reset_name_hash(istate);
+	cache_tree_free(&istate->cache_tree);
+	istate->cache_tree = full->cache_tree;
+	memset(full, 0, sizeof(*full));
+}
+
+struct expand_data {
+	struct index_state *istate;
+	struct cache_entry **cache;
+	unsigned int nr, alloc;
+};
+
+static int add_path_to_index(const struct object_id *oid,
+			     struct strbuf *base, const char *path,
+			     unsigned int mode, int stage, void *context)
+{
+	struct expand_data *data = context;
+	struct cache_entry *ce;
+	size_t len;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	len = base->len + strlen(path);
+	ce = make_empty_cache_entry(data->istate, len);
+	oidcpy(&ce->oid, oid);
+	memcpy(ce->name, base->buf, base->len);
+	memcpy(ce->name + base->len, path, len - base->len);
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	ce->ce_namelen = len;
+	ce->ce_mode = create_ce_mode(mode);
+
+	ALLOC_GROW(data->cache, data->nr + 1, data->alloc);
+	data->cache[data->nr++] = ce;
+	return 0;
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct expand_data data = { istate };
+	struct pathspec ps;
+	unsigned int i, cache_changed;
+
+	if (!istate->sparse_index)
+		return;
+	if (!istate->repo)
+		istate->repo = the_repository;
+
+	trace2_region_enter("index", "ensure_full_index", istate->repo);
+
+	memset(&ps, 0, sizeof(ps));
+	ALLOC_GROW(data.cache, istate->cache_nr, data.alloc);
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct tree *tree;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			ALLOC_GROW(data.cache, data.nr + 1, data.alloc);
+			data.cache[data.nr++] = ce;
+			continue;
+		}
+
+		tree = lookup_tree(istate->repo, &ce->oid);
+		if (!tree || read_tree_recursive(istate->repo, tree,
+						 ce->name, ce_namelen(ce), 0,
+						 &ps, add_path_to_index, &data))
+			die(_("unable to expand sparse directory '%s'"),
+			    ce->name);
+	}
+
+	free(istate->cache);
+	istate->cache = data.cache;
+	istate->cache_nr = data.nr;
+	istate->cache_alloc = data.alloc;
+	istate->sparse_index = 0;
+
+	/*
+	 * The cache tree has to describe the expanded entries now. Only
+	 * compute it: nothing needs to be written to the object database
+	 * (or to the index file) for merely reading a sparse index.
+	 */
+	reset_name_hash(istate);
+	cache_tree_free(&istate->cache_tree);
+	istate->cache_tree = cache_tree();
+	cache_changed = istate->cache_changed;
+	cache_tree_update(istate, WRITE_TREE_DRY_RUN | WRITE_TREE_SILENT |
+			  WRITE_TREE_MISSING_OK);
+	istate->cache_changed = cache_changed;
+
+	trace2_region_leave("index", "ensure_full_index", istate->repo);
+}
+
+void ensure_full_index_if_sparse_dirs_present(struct index_state *istate)
+{
+	unsigned int i;
+
+	if (!istate->sparse_index)
+		return;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct stat st;
+
+		if (S_ISSPARSEDIR(ce->ce_mode) && !lstat(ce->name, &st)) {
+			ensure_full_index(istate);
+			return;
+		}
+	}
+}
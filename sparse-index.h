@@ -0,0 +1,76 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+/*
+ * A "sparse index" is an index in which a directory that lies entirely
+ * outside of the cone-mode sparse-checkout definition is represented
+ * by a single "sparse directory" entry: its name is the directory
+ * name with a trailing slash, its mode is S_IFDIR, it points at the
+ * tree object of that directory and has the skip-worktree bit set.
+ *
+ * Such an index is only written when index.sparse is enabled; the
+ * index then carries the "sdir" extension, which older versions of
+ * Git do not understand and refuse to read.
+ *
+ * Code that is not prepared to see sparse directory entries never
+ * does: the index is expanded right after it is read unless the
+ * command cleared repo_settings.command_requires_full_index. The index
+ * is still written sparse, and such a command gets its full index back
+ * after the write (see convert_to_sparse_for_write()). Commands that
+ * did clear it keep the index sparse in memory.
+ */
+
+struct index_state;
+struct cache_entry;
+struct cache_tree;
+
+/*
+ * The entries and cache tree of a full index, kept while the index is
+ * written in its sparse form.
+ */
+struct full_index {
+	struct cache_entry **cache;
+	unsigned int cache_nr, cache_alloc;
+	struct cache_tree *cache_tree;
+};
+
+/*
+ * Collapse the directories that are outside of the sparse-checkout
+ * cone (and contain nothing but unmodified skip-worktree entries) into
+ * sparse directory entries, if the repository is configured to use a
+ * sparse index. Marks the index as changed if anything was collapsed.
+ * Returns 0 on success, even if nothing was collapsed.
+ */
+int convert_to_sparse(struct index_state *istate);
+
+/*
+ * Like convert_to_sparse(), but keeps the entries and the cache tree of
+ * the full index in "full". Returns 1 if anything was collapsed; the
+ * caller then has to call restore_full_index() once it has written the
+ * index. This is much cheaper than expanding the index again with
+ * ensure_full_index(), which has to read the collapsed trees.
+ */
+int convert_to_sparse_for_write(struct index_state *istate,
+				struct full_index *full);
+
+/*
+ * Give the index back the entries and cache tree kept by
+ * convert_to_sparse_for_write().
+ */
+void restore_full_index(struct index_state *istate, struct full_index *full);
+
+/*
+ * Replace all sparse directory entries with the entries of the files
+ * below them. A no-op if the index is not sparse.
+ */
+void ensure_full_index(struct index_state *istate);
+
+/*
+ * Expand the index if any of its sparse directories is present in the
+ * working tree, e.g. because the user created files there. Without
+ * the list of files that are tracked in such a directory, those files
+ * cannot be told apart from untracked ones.
+ */
+void ensure_full_index_if_sparse_dirs_present(struct index_state *istate);
+
+#endif
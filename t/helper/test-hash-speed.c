@@ -1,5 +1,6 @@
 #include "test-tool.h"
 #include "cache.h"
+#include "compat/sha-ni.h"
 
 #define NUM_SECONDS 3
 
@@ -10,6 +11,26 @@ static inline void compute_hash(const struct git_hash_algo *algo, git_hash_ctx *
 	algo->final_fn(final, ctx);
 }
 
+/* Which hardware support, if any, the implementation of "algo" uses. */
+static const char *hash_accel(const struct git_hash_algo *algo)
+{
+	switch (hash_algo_by_ptr(algo)) {
+	case GIT_HASH_SHA1:
+#if defined(SHA1_DC) && !defined(DC_SHA1_EXTERNAL)
+		if (sha_ni_available())
+			return "sha-ni";
+#endif
+		break;
+	case GIT_HASH_SHA256:
+#if defined(SHA256_BLK)
+		if (sha_ni_available())
+			return "sha-ni";
+#endif
+		break;
+	}
+	return "none";
+}
+
 int cmd__hash_speed(int ac, const char **av)
 {
 	git_hash_ctx ctx;
@@ -35,6 +56,7 @@ int cmd__hash_speed(int ac, const char **av)
 	initial = clock();
 
 	printf("algo: %s\n", algo->name);
+	printf("accel: %s\n", hash_accel(algo));
 
 	for (i = 0; i < ARRAY_SIZE(bufsizes); i++) {
 		unsigned long j, kb;
@@ -51,8 +73,8 @@ int cmd__hash_speed(int ac, const char **av)
 			if (!(j & 127))
 				end = clock() - initial;
 		}
-		kb = j * bufsizes[i];
-		kb_per_sec = kb / (1024 * ((double)end - start) / CLOCKS_PER_SEC);
+		kb = j * bufsizes[i] / 1024;
+		kb_per_sec = kb / (((double)end - start) / CLOCKS_PER_SEC);
 		printf("size %u: %lu iters; %lu KiB; %0.2f KiB/s\n", bufsizes[i], j, kb, kb_per_sec);
 		free(p);
 	}
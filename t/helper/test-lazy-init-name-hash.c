@@ -4,6 +4,7 @@
 
 static int single;
 static int multi;
+static int stored;
 static int count = 1;
 static int dump;
 static int perf;
@@ -33,7 +34,10 @@ static void dump_run(void)
 	struct cache_entry *ce;
 
 	read_cache();
-	if (single) {
+	if (stored) {
+		if (test_load_name_hash(&the_index))
+			die("no usable name hash in the index");
+	} else if (single) {
 		test_lazy_init_name_hash(&the_index, 0);
 	} else {
 		int nr_threads_used = test_lazy_init_name_hash(&the_index, 1);
@@ -194,6 +198,7 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 	struct option options[] = {
 		OPT_BOOL('s', "single", &single, "run single-threaded code"),
 		OPT_BOOL('m', "multi", &multi, "run multi-threaded code"),
+		OPT_BOOL(0, "stored", &stored, "load the name hash stored in the index"),
 		OPT_INTEGER('c', "count", &count, "number of passes"),
 		OPT_BOOL('d', "dump", &dump, "dump hash tables"),
 		OPT_BOOL('p', "perf", &perf, "compare single vs multi"),
@@ -218,10 +223,10 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 			die("cannot combine dump, perf, or analyze");
 		if (count > 1)
 			die("count not valid with dump");
-		if (single && multi)
-			die("cannot use both single and multi with dump");
-		if (!single && !multi)
-			die("dump requires either single or multi");
+		if (single + multi + stored > 1)
+			die("cannot use more than one of single, multi and stored with dump");
+		if (!single && !multi && !stored)
+			die("dump requires either single, multi or stored");
 		dump_run();
 		return 0;
 	}
@@ -249,6 +254,8 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		return 0;
 	}
 
+	if (stored)
+		die("stored is only valid with dump");
 	if (!single && !multi)
 		die("require either -s or -m or both");
 
@@ -1,23 +1,59 @@
 #include "test-tool.h"
 #include "cache.h"
 #include "config.h"
+#include "repository.h"
+
+static void print_cache_entry(const struct cache_entry *ce)
+{
+	const char *type;
+
+	if (S_ISSPARSEDIR(ce->ce_mode))
+		type = "tree";
+	else if (S_ISGITLINK(ce->ce_mode))
+		type = "commit";
+	else
+		type = "blob";
+
+	printf("%06o %s %s\t%s\n", ce->ce_mode, type,
+	       oid_to_hex(&ce->oid), ce->name);
+}
 
 int cmd__read_cache(int argc, const char **argv)
 {
 	int i, cnt = 1;
 	const char *name = NULL;
+	int table = 0;
 
 	if (argc > 1 && skip_prefix(argv[1], "--print-and-refresh=", &name)) {
 		argc--;
 		argv++;
 	}
 
+	if (argc > 1 && !strcmp(argv[1], "--table")) {
+		table = 1;
+		argc--;
+		argv++;
+	}
+
 	if (argc == 2)
 		cnt = strtol(argv[1], NULL, 0);
 	setup_git_directory();
 	git_config(git_default_config, NULL);
+
+	/* show sparse directory entries as they are */
+	if (table) {
+		prepare_repo_settings(the_repository);
+		the_repository->settings.command_requires_full_index = 0;
+	}
+
 	for (i = 0; i < cnt; i++) {
 		read_cache();
+		if (table) {
+			int j;
+
+			for (j = 0; j < the_index.cache_nr; j++)
+				print_cache_entry(the_index.cache[j]);
+		}
 		if (name) {
 			int pos;
 
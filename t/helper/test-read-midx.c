@@ -34,6 +34,8 @@ static int read_midx_file(const char *object_dir)
 		printf(" object-offsets");
 	if (m->chunk_large_offsets)
 		printf(" large-offsets");
+	if (m->chunk_revindex)
+		printf(" revindex");
 
 	printf("\nnum_objects: %d\n", m->num_objects);
 
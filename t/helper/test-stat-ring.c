@@ -0,0 +1,32 @@
+#include "test-tool.h"
+#include "git-compat-util.h"
+#include "compat/stat-ring.h"
+
+/*
+ * Exit with 0 if the paths given can be lstat()ed through an io_uring,
+ * and with 1 if io_uring is not available, either because we were built
+ * without it or because the kernel refuses it.
+ */
+int cmd__stat_ring(int argc, const char **argv)
+{
+	struct stat_ring *ring;
+	struct stat *st;
+	int *res, ret = 0;
+
+	argc--;
+	argv++;
+	if (!argc)
+		die("usage: test-tool stat-ring <path>...");
+
+	ring = stat_ring_new(argc);
+	if (!ring)
+		return 1;
+	CALLOC_ARRAY(st, argc);
+	CALLOC_ARRAY(res, argc);
+	if (stat_ring_lstat(ring, argc, argv, st, res))
+		ret = 1;
+	stat_ring_free(ring);
+	free(st);
+	free(res);
+	return ret;
+}
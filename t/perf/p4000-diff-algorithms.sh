@@ -26,4 +26,16 @@ test_perf 'log -p -3000 --patience' '
 	git log -p -3000 --patience >/dev/null
 '
 
+test_perf 'log -p -3000 --ignore-all-space' '
+	git log -p -3000 --ignore-all-space >/dev/null
+'
+
+test_perf 'log -p -3000 --ignore-space-change' '
+	git log -p -3000 --ignore-space-change >/dev/null
+'
+
+test_perf 'log -p -3000 --ignore-cr-at-eol' '
+	git log -p -3000 --ignore-cr-at-eol >/dev/null
+'
+
 test_done
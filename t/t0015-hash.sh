@@ -52,4 +52,17 @@ test_expect_success 'test basic SHA-256 hash values' '
 	grep 6ef19b41225c5369f1c104d45d8d85efa9b057b53b14b4b9b939dd74decc5321 actual
 '
 
+test_expect_success 'hashes do not depend on the use of SHA instructions' '
+	for size in 1 63 64 65 1000 65536 1000003
+	do
+		test-tool genrandom $size $size >data &&
+		for algo in sha1 sha256
+		do
+			GIT_TEST_SHA_NI=false test-tool $algo <data >expect &&
+			GIT_TEST_SHA_NI=true test-tool $algo <data >actual &&
+			test_cmp expect actual || return 1
+		done
+	done
+'
+
 test_done
@@ -0,0 +1,275 @@
+#!/bin/sh
+
+test_description='reftable reference storage backend'
+
+. ./test-lib.sh
+
+INVALID_OID=$(test_oid 001)
+
+test_expect_success 'init with --ref-format=reftable' '
+	git init --ref-format=reftable repo &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	test "$(git -C repo config extensions.refStorage)" = reftable &&
+	test "$(git -C repo config core.repositoryFormatVersion)" = 1 &&
+	test "$(git -C repo symbolic-ref HEAD)" = refs/heads/master
+'
+
+test_expect_success 'reinit with a different format fails' '
+	test_must_fail git init --ref-format=files repo 2>err &&
+	test_i18ngrep "different reference storage format" err &&
+	git init repo
+'
+
+test_expect_success 'unknown ref format is rejected' '
+	test_must_fail git init --ref-format=bogus bogus 2>err &&
+	test_i18ngrep "unknown ref storage format" err
+'
+
+test_expect_success 'GIT_DEFAULT_REF_FORMAT selects the format' '
+	GIT_DEFAULT_REF_FORMAT=reftable git init env &&
+	test_path_is_file env/.git/reftable/tables.list
+'
+
+test_expect_success 'commits update branch, HEAD and their reflogs' '
+	test_commit -C repo one &&
+	test_commit -C repo two &&
+	git -C repo rev-parse two >expect &&
+	git -C repo rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse refs/heads/master >actual &&
+	test_cmp expect actual &&
+	git -C repo reflog show --format=%s HEAD >actual &&
+	cat >expect <<-\EOF &&
+	two
+	one
+	EOF
+	test_cmp expect actual &&
+	git -C repo reflog show --format=%s master >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing repo/.git/refs/heads/master &&
+	test_path_is_missing repo/.git/logs
+'
+
+test_expect_success 'for-each-ref lists refs in order' '
+	git -C repo branch b &&
+	git -C repo tag -a -m annotated v1 &&
+	cat >expect <<-EOF &&
+	$(git -C repo rev-parse two) refs/heads/b
+	$(git -C repo rev-parse two) refs/heads/master
+	$(git -C repo rev-parse one) refs/tags/one
+	$(git -C repo rev-parse two) refs/tags/two
+	$(git -C repo rev-parse v1) refs/tags/v1
+	$(git -C repo rev-parse v1^{}) refs/tags/v1^{}
+	EOF
+	git -C repo show-ref -d >actual &&
+	test_cmp expect actual &&
+	git -C repo for-each-ref --format="%(refname)" refs/tags/ >actual &&
+	cat >expect <<-\EOF &&
+	refs/tags/one
+	refs/tags/two
+	refs/tags/v1
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'update-ref checks old values' '
+	test_must_fail git -C repo update-ref refs/heads/b two one 2>err &&
+	test_i18ngrep "is at .* but expected" err &&
+	test_must_fail git -C repo update-ref refs/heads/b one $ZERO_OID 2>err &&
+	test_i18ngrep "reference already exists" err &&
+	git -C repo update-ref refs/heads/new one $ZERO_OID &&
+	git -C repo rev-parse one >expect &&
+	git -C repo rev-parse new >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'update-ref refuses missing objects' '
+	test_must_fail git -C repo update-ref refs/heads/c $INVALID_OID 2>err &&
+	test_i18ngrep "nonexistent object" err
+'
+
+test_expect_success 'directory/file conflicts are detected' '
+	test_must_fail git -C repo update-ref refs/heads/b/c HEAD &&
+	test_must_fail git -C repo update-ref refs/heads/master/x HEAD &&
+	git -C repo update-ref refs/heads/d/e HEAD &&
+	test_must_fail git -C repo update-ref refs/heads/d HEAD
+'
+
+test_expect_success 'transactions are atomic' '
+	git -C repo show-ref >before &&
+	test_must_fail git -C repo update-ref --stdin <<-EOF &&
+	update refs/heads/b $(git -C repo rev-parse one)
+	create refs/heads/new $(git -C repo rev-parse one)
+	EOF
+	git -C repo show-ref >after &&
+	test_cmp before after &&
+	git -C repo update-ref --stdin <<-EOF &&
+	update refs/heads/b $(git -C repo rev-parse one)
+	delete refs/heads/new
+	EOF
+	test_must_fail git -C repo rev-parse --verify -q new &&
+	git -C repo rev-parse one >expect &&
+	git -C repo rev-parse b >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'deleting a ref deletes its reflog' '
+	git -C repo branch to-delete &&
+	git -C repo reflog exists refs/heads/to-delete &&
+	git -C repo branch -D to-delete &&
+	test_must_fail git -C repo reflog exists refs/heads/to-delete
+'
+
+test_expect_success 'symbolic refs' '
+	git -C repo symbolic-ref refs/heads/sym refs/heads/b &&
+	test "$(git -C repo symbolic-ref refs/heads/sym)" = refs/heads/b &&
+	git -C repo update-ref refs/heads/sym two &&
+	git -C repo rev-parse two >expect &&
+	git -C repo rev-parse b >actual &&
+	test_cmp expect actual &&
+	git -C repo symbolic-ref -d refs/heads/sym &&
+	test_must_fail git -C repo rev-parse --verify -q refs/heads/sym
+'
+
+test_expect_success 'rename and copy branches with their reflogs' '
+	git -C repo branch -m b renamed &&
+	test_must_fail git -C repo rev-parse --verify -q b &&
+	git -C repo reflog show --format=%gs renamed >actual &&
+	test_line_count = 4 actual &&
+	head -n 1 actual >first &&
+	grep "renamed refs/heads/b to refs/heads/renamed" first &&
+	git -C repo branch -c renamed copied &&
+	git -C repo rev-parse renamed >expect &&
+	git -C repo rev-parse copied >actual &&
+	test_cmp expect actual &&
+	git -C repo reflog show renamed >expect &&
+	git -C repo reflog show copied >actual &&
+	test_line_count = 5 actual
+'
+
+test_expect_success 'reflog expire' '
+	git -C repo reflog expire --expire=now refs/heads/renamed &&
+	git -C repo reflog show renamed >actual &&
+	test_must_be_empty actual &&
+	git -C repo reflog exists refs/heads/renamed
+'
+
+test_expect_success 'pack-refs compacts the stack' '
+	ls repo/.git/reftable/*.ref >tables &&
+	test $(wc -l <tables) -gt 1 &&
+	git -C repo show-ref >expect &&
+	git -C repo pack-refs &&
+	ls repo/.git/reftable/*.ref >tables &&
+	test_line_count = 1 tables &&
+	test_line_count = 1 repo/.git/reftable/tables.list &&
+	git -C repo show-ref >actual &&
+	test_cmp expect actual &&
+	git -C repo reflog show --format=%s HEAD >actual &&
+	test_line_count = 2 actual
+'
+
+test_expect_success 'auto-compaction keeps the stack small' '
+	for i in $(test_seq 64)
+	do
+		git -C repo update-ref refs/heads/loop-$i HEAD || return 1
+	done &&
+	test $(wc -l <repo/.git/reftable/tables.list) -lt 10 &&
+	git -C repo for-each-ref refs/heads/loop-* >actual &&
+	test_line_count = 64 actual
+'
+
+test_expect_success 'disabling auto-compaction' '
+	git init --ref-format=reftable nocompact &&
+	test_commit -C nocompact one &&
+	git -C nocompact pack-refs &&
+	for i in 1 2 3 4 5
+	do
+		git -C nocompact -c reftable.autoCompaction=false \
+			update-ref refs/heads/b$i HEAD || return 1
+	done &&
+	test_line_count = 6 nocompact/.git/reftable/tables.list
+'
+
+test_expect_success 'small block sizes produce valid tables' '
+	git init --ref-format=reftable blocks &&
+	test_commit -C blocks one &&
+	for i in $(test_seq 100)
+	do
+		echo "create refs/heads/branch-$i HEAD" || return 1
+	done >input &&
+	git -C blocks -c reftable.blockSize=256 update-ref --stdin <input &&
+	git -C blocks -c reftable.blockSize=256 pack-refs &&
+	git -C blocks for-each-ref refs/heads/branch-* >actual &&
+	test_line_count = 100 actual &&
+	git -C blocks rev-parse --verify branch-57
+'
+
+test_expect_success 'reflogs spanning several blocks are indexed' '
+	git -C blocks -c reftable.blockSize=256 reflog branch-57 >actual &&
+	test_line_count = 1 actual &&
+	git -C blocks reflog -1 branch-99 >actual &&
+	test_line_count = 1 actual
+'
+
+test_expect_success 'tables follow the reftable file format' '
+	test_oid_cache <<-\EOF &&
+	header sha1:24
+	header sha256:28
+	footer sha1:68
+	footer sha256:72
+	EOF
+	table=blocks/.git/reftable/$(cat blocks/.git/reftable/tables.list) &&
+	test_copy_bytes 24 <$table >header &&
+	printf "REFT" >expect &&
+	test_copy_bytes 4 <header >actual &&
+	test_cmp_bin expect actual &&
+	tail -c $(test_oid footer) $table >footer &&
+	test_copy_bytes $(test_oid header) <footer >footer-header &&
+	test_copy_bytes $(test_oid header) <$table >header &&
+	test_cmp_bin header footer-header &&
+	test_path_is_file blocks/.git/refs/heads
+'
+
+test_expect_success 'corrupt tables are detected' '
+	cp -R blocks corrupt &&
+	table=$(cat corrupt/.git/reftable/tables.list) &&
+	chmod +w corrupt/.git/reftable/$table &&
+	printf "XXXX" | dd of=corrupt/.git/reftable/$table bs=1 conv=notrunc &&
+	test_must_fail git -C corrupt for-each-ref 2>err &&
+	test_i18ngrep "corrupt" err
+'
+
+test_expect_success 'gc and fsck work' '
+	git -C repo gc &&
+	git -C repo fsck
+'
+
+test_expect_success 'clone into a reftable repository' '
+	GIT_DEFAULT_REF_FORMAT=reftable git clone repo clone &&
+	test "$(git -C clone config extensions.refStorage)" = reftable &&
+	git -C repo rev-parse HEAD >expect &&
+	git -C clone rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'per-worktree refs are kept apart' '
+	git -C repo worktree add ../wt &&
+	test_commit -C wt in-worktree &&
+	git -C wt rev-parse HEAD >expect &&
+	git -C wt rev-parse wt >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse worktrees/wt/HEAD >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse HEAD >expect &&
+	git -C wt rev-parse main-worktree/HEAD >actual &&
+	test_cmp expect actual &&
+	git -C wt update-ref refs/bisect/x HEAD &&
+	git -C wt for-each-ref refs/bisect >actual &&
+	test_line_count = 1 actual &&
+	git -C repo for-each-ref refs/bisect >actual &&
+	test_must_be_empty actual &&
+	git -C repo worktree list >actual &&
+	grep "\[wt\]" actual
+'
+
+test_done
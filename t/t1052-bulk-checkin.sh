@@ -0,0 +1,85 @@
+#!/bin/sh
+
+test_description='writing all new objects to a pack with core.bulkCheckin'
+
+. ./test-lib.sh
+
+# Check that there are no loose objects, and that the objects are all in
+# packs, $1 of them.
+check_packed () {
+	git count-objects -v >counts &&
+	grep "^count: 0$" counts &&
+	grep "^packs: $1$" counts
+}
+
+test_expect_success setup '
+	git config --global core.bulkCheckin true &&
+	mkdir dir &&
+	for i in $(test_seq 1 50)
+	do
+		echo "content $i" >dir/file-$i || return 1
+	done &&
+	echo "content 1" >dir/duplicate &&
+	printf "%20000s" X >dir/large
+'
+
+test_expect_success 'add writes all objects to one pack' '
+	test_when_finished "rm -f .git/index .git/objects/pack/*" &&
+	git -c core.bigFileThreshold=10k add dir &&
+	check_packed 1 &&
+	git ls-files -s dir >stage &&
+	test_line_count = 52 stage &&
+	idx=$(echo .git/objects/pack/pack-*.idx) &&
+	git show-index <"$idx" >objects &&
+	test_line_count = 51 objects &&
+	git fsck
+'
+
+test_expect_success 'objects already in the repository are not written again' '
+	test_when_finished "rm -f .git/index .git/objects/pack/*" &&
+	git add dir/file-1 dir/file-2 &&
+	echo new >dir/new &&
+	git add dir &&
+	check_packed 2 &&
+	idx=$(ls -t .git/objects/pack/pack-*.idx | head -n 1) &&
+	git show-index <"$idx" >objects &&
+	test_line_count = 50 objects &&
+	rm dir/new
+'
+
+test_expect_success 'update-index writes all objects to one pack' '
+	test_when_finished "rm -f .git/index .git/objects/pack/*" &&
+	git ls-files -o dir >list &&
+	git update-index --add --stdin <list &&
+	check_packed 1 &&
+	git fsck
+'
+
+test_expect_success 'hash-object --stdin-paths writes all objects to one pack' '
+	test_when_finished "rm -f .git/objects/pack/*" &&
+	git ls-files -o dir >list &&
+	git hash-object -w --stdin-paths <list >oids &&
+	check_packed 1 &&
+	while read oid
+	do
+		git cat-file -e $oid || return 1
+	done <oids
+'
+
+test_expect_success 'pack.packSizeLimit splits the pack' '
+	test_when_finished "rm -f .git/index .git/objects/pack/*" &&
+	git -c pack.packSizeLimit=1k add dir &&
+	git count-objects -v >counts &&
+	grep "^count: 0$" counts &&
+	! grep "^packs: 1$" counts &&
+	git fsck
+'
+
+test_expect_success 'objects are loose without core.bulkCheckin' '
+	test_when_finished "rm -f .git/index" &&
+	git -c core.bulkCheckin=false add dir &&
+	git count-objects -v >counts &&
+	grep "^count: 51$" counts
+'
+
+test_done
@@ -0,0 +1,210 @@
+#!/bin/sh
+
+test_description='sparse index: collapse directories outside of the cone'
+
+. ./test-lib.sh
+
+# Run a command in both the full and the sparse repository and compare
+# the output.
+test_all_match () {
+	(
+		cd full &&
+		"$@" >../full-out 2>../full-err
+	) &&
+	(
+		cd sparse &&
+		"$@" >../sparse-out 2>../sparse-err
+	) &&
+	test_cmp full-out sparse-out &&
+	test_cmp full-err sparse-err
+}
+
+# Make the same change in both repositories.
+run_on_both () {
+	(
+		cd full &&
+		"$@"
+	) &&
+	(
+		cd sparse &&
+		"$@"
+	)
+}
+
+test_expect_success 'setup' '
+	git init original &&
+	(
+		cd original &&
+		echo a >a &&
+		echo e >e &&
+		for d in deep deep/deeper1 deep/deeper1/deepest deep/deeper2 \
+			 folder1 folder1/0 folder2 x
+		do
+			mkdir -p $d &&
+			echo $d >$d/a &&
+			echo $d >$d/b || return 1
+		done &&
+		git add . &&
+		git commit -m initial &&
+		git tag base
+	) &&
+	for r in full sparse
+	do
+		git clone original $r &&
+		git -C $r sparse-checkout init --cone &&
+		git -C $r sparse-checkout set deep/deeper1 || return 1
+	done &&
+	git -C sparse config index.sparse true &&
+	git -C sparse status
+'
+
+test_expect_success 'index has sparse directory entries' '
+	(
+		cd sparse &&
+		test-tool read-cache --table >../table
+	) &&
+	grep "^040000 tree .*	folder1/$" table &&
+	grep "^040000 tree .*	x/$" table &&
+	grep "^040000 tree .*	deep/deeper2/$" table &&
+	grep "^100644 blob .*	deep/deeper1/deepest/a$" table &&
+	grep "^100644 blob .*	deep/a$" table &&
+	! grep "folder1/a" table &&
+	(
+		cd full &&
+		test-tool read-cache --table >../full-table
+	) &&
+	! grep "^040000" full-table
+'
+
+test_expect_success 'sparse directory entries point at trees' '
+	oid=$(git -C sparse rev-parse HEAD:folder1) &&
+	grep "^040000 tree $oid	folder1/$" table
+'
+
+test_expect_success 'other commands see all entries' '
+	test_all_match git ls-files --stage &&
+	test_all_match git ls-files -t &&
+	test_all_match git write-tree
+'
+
+test_expect_success 'other commands keep the index sparse' '
+	cp -R sparse sparse-copy &&
+	test_when_finished "rm -rf sparse-copy" &&
+	(
+		cd sparse-copy &&
+		echo more >>deep/deeper1/a &&
+		for cmd in "add deep/deeper1/a" "commit -q -m more" \
+			   "reset -q HEAD~1" "commit -q -a -m again" \
+			   "checkout -q -b topic"
+		do
+			git $cmd &&
+			test-tool read-cache --table >../table &&
+			grep "^040000 tree .*	folder1/$" ../table &&
+			! grep "folder1/a" ../table &&
+			git ls-files >../files &&
+			grep "^folder1/a$" ../files || return 1
+		done &&
+		GIT_TRACE2_EVENT="$(pwd)/../trace-copy" git status &&
+		! grep ensure_full_index ../trace-copy
+	)
+'
+
+test_expect_success 'status does not expand the index' '
+	test_all_match git status --porcelain=v2 &&
+	(
+		cd sparse &&
+		GIT_TRACE2_EVENT="$(pwd)/../trace" git status &&
+		test-tool read-cache --table >../table
+	) &&
+	! grep ensure_full_index trace &&
+	grep "^040000 tree .*	folder1/$" table
+'
+
+test_expect_success 'status with changes inside the cone' '
+	run_on_both sh -c "echo more >>deep/deeper1/a && echo new >deep/deeper1/new" &&
+	test_all_match git status --porcelain=v2 &&
+	run_on_both git add deep/deeper1 &&
+	test_all_match git status --porcelain=v2 &&
+	rm -f trace &&
+	(
+		cd sparse &&
+		GIT_TRACE2_EVENT="$(pwd)/../trace" git status
+	) &&
+	! grep ensure_full_index trace
+'
+
+test_expect_success 'status against commits that change sparse directories' '
+	(
+		cd original &&
+		echo changed >folder1/a &&
+		echo added >folder2/c &&
+		git rm -q x/a &&
+		mkdir y &&
+		echo new >y/a &&
+		git add . &&
+		git commit -m "change outside of the cone" &&
+		git tag outside
+	) &&
+	run_on_both git fetch -q origin outside:outside &&
+	run_on_both git reset -q --soft outside &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git diff --cached --name-status HEAD &&
+	run_on_both git reset -q --soft base &&
+	test_all_match git status --porcelain=v2
+'
+
+test_expect_success 'commit and status again' '
+	run_on_both git commit -q -m "inside the cone" &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git rev-parse HEAD^{tree} &&
+	(
+		cd sparse &&
+		test-tool read-cache --table >../table
+	) &&
+	grep "^040000 tree .*	folder1/$" table
+'
+
+test_expect_success 'status with a pathspec' '
+	test_all_match git status --porcelain=v2 -- folder1 deep &&
+	test_all_match git status --porcelain=v2 -- "deep/*"
+'
+
+test_expect_success 'files created in a sparse directory' '
+	run_on_both sh -c "mkdir -p folder1 && echo untracked >folder1/new" &&
+	test_all_match git status --porcelain=v2 --untracked-files=all &&
+	run_on_both rm -r folder1
+'
+
+test_expect_success 'checkout and reset' '
+	run_on_both git checkout -q -b topic &&
+	run_on_both git reset -q --hard base &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git ls-files --stage &&
+	run_on_both git checkout -q - &&
+	test_all_match git ls-files --stage
+'
+
+test_expect_success 'widening the cone expands the directories' '
+	run_on_both git sparse-checkout set deep folder1 &&
+	test_all_match git ls-files --stage &&
+	test_all_match git status --porcelain=v2 &&
+	test_path_is_file sparse/folder1/a &&
+	(
+		cd sparse &&
+		test-tool read-cache --table >../table
+	) &&
+	! grep "	folder1/$" table &&
+	grep "^040000 tree .*	folder2/$" table
+'
+
+test_expect_success 'index.sparse=false writes a full index' '
+	git -C sparse config index.sparse false &&
+	(
+		cd sparse &&
+		git update-index --force-write-index &&
+		test-tool read-cache --table >../table
+	) &&
+	! grep "^040000" table
+'
+
+test_done
@@ -97,4 +97,90 @@ test_expect_success 'index version config precedence' '
 	test_index_version 0 true 2 2
 '
 
+test_expect_success 'setup index with many entries' '
+	git init threads &&
+	blob=$(echo content | git -C threads hash-object -w --stdin) &&
+	for i in $(test_seq 1 5000)
+	do
+		printf "100644 %s\tdir$(($i % 7))/file-%04d\n" $blob $i ||
+		return 1
+	done >index-info &&
+	git -C threads update-index --index-info <index-info &&
+	git -C threads ls-files -s --debug >expect.entries
+'
+
+for version in 2 4
+do
+	test_expect_success "index v$version written with threads" '
+		other=$((6 - $version)) &&
+		(
+			cd threads &&
+			git update-index --index-version $other &&
+			git -c index.threads=1 update-index \
+				--index-version $version &&
+			cp .git/index expect &&
+			git update-index --index-version $other &&
+			git -c index.threads=4 \
+				-c index.recordOffsetTable=false \
+				-c index.recordEndOfIndexEntries=false \
+				update-index --index-version $version &&
+			test_cmp_bin expect .git/index &&
+
+			git update-index --index-version $other &&
+			git -c index.threads=4 update-index \
+				--index-version $version &&
+			git -c index.threads=1 ls-files -s --debug >actual &&
+			test_cmp ../expect.entries actual &&
+			git -c index.threads=4 ls-files -s --debug >actual &&
+			test_cmp ../expect.entries actual
+		)
+	'
+done
+
+test_expect_success 'removing entries with threads' '
+	(
+		cd threads &&
+		cp .git/index ../index.orig &&
+		git -c index.threads=1 rm -q --cached "dir1/*" &&
+		git ls-files -s --debug >expect &&
+		cp ../index.orig .git/index &&
+		git -c index.threads=4 rm -q --cached "dir1/*" &&
+		git ls-files -s --debug >actual &&
+		test_cmp expect actual
+	)
+'
+
+for threads in 1 4
+do
+	test_expect_success "block checksums with index.threads=$threads" '
+		test_config -C threads index.blockChecksums true &&
+		test_config -C threads index.threads $threads &&
+		(
+			cd threads &&
+			cp ../index.orig .git/index &&
+			git update-index --index-version 4 &&
+			git update-index --index-version 2 &&
+			git ls-files -s --debug >actual &&
+			test_cmp ../expect.entries actual &&
+			git fsck &&
+
+			printf "\377" |
+			dd of=.git/index bs=1 seek=2000 conv=notrunc &&
+			git ls-files -s >/dev/null &&
+			test_must_fail git fsck 2>err &&
+			test_i18ngrep "bad index file block checksum" err &&
+
+			# the trailer covers what follows the blocks
+			cp ../index.orig .git/index &&
+			git update-index --index-version 2 &&
+			size=$(wc -c <.git/index) &&
+			printf "\377" |
+			dd of=.git/index bs=1 seek=$(($size - $(test_oid rawsz) - 1)) \
+				conv=notrunc &&
+			test_must_fail git fsck 2>err &&
+			test_i18ngrep "bad index file sha1 signature" err
+		)
+	'
+done
+
 test_done
@@ -0,0 +1,84 @@
+#!/bin/sh
+
+test_description='storing the name hash in the index
+
+With index.recordNameHash, the hash tables used for case-insensitive
+lookups are written to the index, and must be the same as those built
+from the entries when they are loaded back.'
+
+. ./test-lib.sh
+
+compare_name_hash () {
+	test-tool lazy-init-name-hash -d -s | sort >expect &&
+	test-tool lazy-init-name-hash -d --stored | sort >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success setup '
+	git config index.recordNameHash true &&
+	git config core.ignorecase true &&
+	mkdir -p dir/sub Other &&
+	for i in 1 2 3
+	do
+		echo $i >dir/file-$i &&
+		echo $i >dir/sub/file-$i &&
+		echo $i >Other/file-$i || return 1
+	done &&
+	echo top >top &&
+	git add . &&
+	git commit -m initial
+'
+
+test_expect_success 'stored name hash is the same as the one built' '
+	compare_name_hash &&
+	grep "^dir .* dir/sub$" actual &&
+	test_line_count = 13 actual
+'
+
+test_expect_success 'stored name hash is kept up to date' '
+	echo new >dir/sub/new &&
+	mkdir -p new/dir &&
+	echo new >new/dir/file &&
+	git add dir/sub/new new/dir/file &&
+	git rm -q dir/file-1 Other/file-* &&
+	compare_name_hash &&
+	grep "^dir .* new/dir$" actual &&
+	! grep "^dir .* Other$" actual
+'
+
+test_expect_success 'stored name hash is used for case-insensitive lookups' '
+	mkdir -p DIR/SUB &&
+	echo another >DIR/SUB/another &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git add DIR/SUB/another &&
+	grep "\"key\":\"name_hash/loaded\"" trace &&
+	git ls-files dir/sub >actual &&
+	grep "^dir/sub/another$" actual &&
+	compare_name_hash
+'
+
+test_expect_success 'directories are only stored with core.ignorecase' '
+	echo more >dir/more &&
+	git -c core.ignorecase=false add dir/more &&
+	test_must_fail test-tool lazy-init-name-hash -d --stored &&
+	git update-index --force-write-index &&
+	compare_name_hash
+'
+
+test_expect_success 'stored name hash survives threaded index loading' '
+	test_config index.threads 2 &&
+	test_config index.recordEndOfIndexEntries true &&
+	test_config index.recordOffsetTable true &&
+	git update-index --force-write-index &&
+	compare_name_hash &&
+	echo threaded >DIR/SUB/threaded &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git add DIR/SUB/threaded &&
+	grep "\"key\":\"name_hash/loaded\"" trace &&
+	compare_name_hash
+'
+
+test_expect_success 'name hash is not stored without index.recordNameHash' '
+	git -c index.recordNameHash=false update-index --force-write-index &&
+	test_must_fail test-tool lazy-init-name-hash -d --stored
+'
+
+test_done
@@ -0,0 +1,172 @@
+#!/bin/sh
+
+test_description='parallel-checkout basics
+
+Ensure that parallel-checkout basically works on clone and checkout,
+spawning the required number of workers and producing the same working
+tree as a sequential checkout.
+'
+
+. ./test-lib.sh
+
+# The tests below choose the number of workers themselves.
+sane_unset GIT_TEST_CHECKOUT_WORKERS
+
+# Runs "$@" and checks the number of workers parallel checkout used,
+# based on the trace2 output.
+test_checkout_workers () {
+	expected_workers=$1 &&
+	shift &&
+	rm -f "$TRASH_DIRECTORY/trace" &&
+	GIT_TRACE2_EVENT="$TRASH_DIRECTORY/trace" GIT_TRACE2_EVENT_NESTING=10 "$@" &&
+	grep "\"key\":\"parallel-checkout/workers\",\"value\":\"$expected_workers\"" \
+		"$TRASH_DIRECTORY/trace"
+}
+
+test_expect_success 'setup repo for checkout with various types of changes' '
+	git init various &&
+	(
+		cd various &&
+		git checkout -b B1 &&
+		echo a >a &&
+		mkdir -p d/e &&
+		echo d/f >d/f &&
+		echo d/e/g >d/e/g &&
+		echo exec >x &&
+		chmod +x x &&
+		printf "text\r\nwith\r\ncrlf\r\n" >crlf.txt &&
+		echo "\$Id\$" >ident.txt &&
+		printf "latin1 text\n" >enc.txt &&
+		echo "ident.txt ident" >.gitattributes &&
+		echo "*.txt text eol=crlf" >>.gitattributes &&
+		echo "enc.txt working-tree-encoding=ISO-8859-1" >>.gitattributes &&
+		git add -A &&
+		git commit -m B1 &&
+
+		git checkout -b B2 &&
+		echo modified >a &&
+		rm d/f &&
+		echo d/h >d/h &&
+		mkdir -p i/j &&
+		echo i/j/k >i/j/k &&
+		git add -A &&
+		git commit -m B2 &&
+
+		git checkout --orphan B3 &&
+		git rm -rf . &&
+		echo d >d &&
+		git add d &&
+		git commit -m B3 &&
+
+		git checkout B1
+	)
+'
+
+test_expect_success 'sequential clone' '
+	git -c checkout.workers=1 clone various various_sequential &&
+	git -C various_sequential checkout B1 &&
+	git -C various_sequential checkout B2
+'
+
+test_expect_success 'parallel clone' '
+	test_checkout_workers 2 \
+		git -c checkout.workers=2 -c checkout.thresholdForParallelism=0 \
+		clone various various_parallel &&
+	git -C various_parallel status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'switching between branches in parallel' '
+	(
+		cd various_parallel &&
+		for branch in B1 B3 B2
+		do
+			GIT_TEST_CHECKOUT_WORKERS=3 git checkout $branch &&
+			git status --porcelain >../actual &&
+			test_must_be_empty ../actual || return 1
+		done
+	) &&
+	git -C various_sequential checkout B2 &&
+	test_cmp various_sequential/a various_parallel/a &&
+	test_cmp various_sequential/d/h various_parallel/d/h &&
+	test_cmp various_sequential/i/j/k various_parallel/i/j/k &&
+	test_path_is_missing various_parallel/d/f
+'
+
+test_expect_success 'conversions are applied by the workers' '
+	git -C various_parallel checkout B1 &&
+	git -C various_sequential checkout B1 &&
+	for f in a d/f d/e/g x crlf.txt ident.txt enc.txt
+	do
+		test_cmp various_sequential/$f various_parallel/$f || return 1
+	done &&
+	printf "text\r\nwith\r\ncrlf\r\n" >expect &&
+	test_cmp expect various_parallel/crlf.txt &&
+	grep "\\\$Id: [0-9a-f]* \\\$" various_parallel/ident.txt
+'
+
+test_expect_success POSIXPERM 'executable bit is kept' '
+	test -x various_parallel/x
+'
+
+test_expect_success 'threshold avoids spawning workers for small checkouts' '
+	test_checkout_workers 1 \
+		git -C various_parallel -c checkout.workers=2 \
+		-c checkout.thresholdForParallelism=100 checkout B2 &&
+	git -C various_parallel status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'checkout of paths uses parallel checkout' '
+	(
+		cd various_parallel &&
+		git checkout B1 &&
+		rm -rf a d &&
+		test_checkout_workers 2 \
+			git -c checkout.workers=2 \
+			-c checkout.thresholdForParallelism=0 checkout -- a d &&
+		git status --porcelain >../actual &&
+		test_must_be_empty ../actual
+	)
+'
+
+test_expect_success 'smudge filters are run outside of the workers' '
+	test_config_global filter.rot13.smudge "tr A-Za-z N-ZA-Mn-za-m" &&
+	test_config_global filter.rot13.clean "tr A-Za-z N-ZA-Mn-za-m" &&
+	git init filtered &&
+	(
+		cd filtered &&
+		echo "*.r13 filter=rot13" >.gitattributes &&
+		echo "Hello" >f.r13 &&
+		echo plain >p &&
+		git add -A &&
+		git commit -m filtered
+	) &&
+	test_checkout_workers 2 \
+		env GIT_TEST_CHECKOUT_WORKERS=2 git clone filtered filtered_clone &&
+	echo Hello >expect &&
+	test_cmp expect filtered_clone/f.r13 &&
+	git -C filtered_clone status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success CASE_INSENSITIVE_FS 'path collisions are detected on clone' '
+	git init colliding &&
+	(
+		cd colliding &&
+		blob=$(echo content | git hash-object -w --stdin) &&
+		for f in file FILE dir/x DIR/x
+		do
+			git update-index --add --cacheinfo 100644,$blob,$f || return 1
+		done &&
+		git commit -m colliding
+	) &&
+	GIT_TEST_CHECKOUT_WORKERS=2 git clone colliding colliding_clone 2>err &&
+	test_i18ngrep "the following paths have collided" err &&
+	grep "file" err &&
+	grep "FILE" err &&
+	grep "dir/x" err &&
+	grep "DIR/x" err
+'
+
+test_done
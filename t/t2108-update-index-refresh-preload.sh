@@ -0,0 +1,81 @@
+#!/bin/sh
+
+test_description='refreshing the index with core.preloadIndex
+
+The preloaded stat data, whether the entries were stat'\''ed one by one
+or in batches through io_uring, must give the same results.'
+
+. ./test-lib.sh
+
+GIT_TEST_PRELOAD_INDEX=true
+export GIT_TEST_PRELOAD_INDEX
+
+test_lazy_prereq IO_URING_WORKS '
+	test_have_prereq IO_URING &&
+	test-tool stat-ring "$TEST_DIRECTORY"
+'
+
+test_expect_success setup '
+	git config core.preloadIndex true &&
+	for d in a b c
+	do
+		mkdir $d &&
+		for i in $(test_seq 1 100)
+		do
+			echo "$d $i" >$d/file-$i || return 1
+		done
+	done &&
+	git add . &&
+	git commit -m initial &&
+	echo changed >a/file-3 &&
+	rm b/file-50 &&
+	echo "c 100 changed" >c/file-100 &&
+	test-tool chmtime =-60 a/file-1 b/file-1 &&
+	GIT_TEST_PRELOAD_IO_URING=false git status --porcelain -uno >expect &&
+	test_line_count = 3 expect
+'
+
+for io_uring in false true
+do
+	test_expect_success "status with GIT_TEST_PRELOAD_IO_URING=$io_uring" '
+		GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TRACE2_EVENT_NESTING=5 \
+		GIT_TEST_PRELOAD_IO_URING=$io_uring \
+			git status --porcelain -uno >actual &&
+		test_cmp expect actual &&
+		grep "\"region_enter\".*\"label\":\"preload\"" trace &&
+		grep "\"key\":\"preload/sum_lstat\"" trace &&
+		rm trace
+	'
+
+	test_expect_success "update-index --refresh with GIT_TEST_PRELOAD_IO_URING=$io_uring" '
+		test-tool chmtime =-30 a/file-2 c/file-2 &&
+		test_must_fail env GIT_TEST_PRELOAD_IO_URING=$io_uring \
+			git update-index --refresh >out &&
+		cat >expect-refresh <<-\EOF &&
+		a/file-3: needs update
+		b/file-50: needs update
+		c/file-100: needs update
+		EOF
+		test_cmp expect-refresh out &&
+		git diff-files --name-only >files &&
+		test_line_count = 3 files
+	'
+done
+
+test_expect_success IO_URING_WORKS 'preload uses io_uring where the kernel allows it' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TRACE2_EVENT_NESTING=5 \
+	GIT_TEST_PRELOAD_IO_URING=true \
+		git status --porcelain -uno >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"preload/io_uring_threads\",\"value\":\"[1-9]" trace &&
+	rm trace &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TRACE2_EVENT_NESTING=5 \
+	GIT_TEST_PRELOAD_IO_URING=false \
+		git status --porcelain -uno >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"preload/io_uring_threads\",\"value\":\"0\"" trace &&
+	rm trace
+'
+
+test_done
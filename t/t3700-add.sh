@@ -423,4 +423,32 @@ test_expect_success CASE_INSENSITIVE_FS 'path is case-insensitive' '
 	git add "$downcased"
 '
 
+test_expect_success 'add with core.fsyncMethod=batch' '
+	rm -fr fsync-batch &&
+	mkdir fsync-batch &&
+	for i in $(test_seq 1 20)
+	do
+		echo "content $i" >fsync-batch/file-$i || return 1
+	done &&
+	echo "content 1" >fsync-batch/duplicate &&
+	test_seq 1 1000 >fsync-batch/big &&
+	git -c core.fsyncObjectFiles=true -c core.fsyncMethod=batch \
+		-c core.bigFileThreshold=1k add fsync-batch &&
+	git ls-files -s fsync-batch >stage &&
+	test_line_count = 22 stage &&
+	cut -d" " -f2 stage >oids &&
+	while read oid
+	do
+		git cat-file -e $oid || return 1
+	done <oids &&
+	ls .git/objects >dirs &&
+	! grep incoming dirs &&
+	git fsck
+'
+
+test_expect_success 'invalid core.fsyncMethod' '
+	test_must_fail git -c core.fsyncMethod=bogus add fsync-batch 2>err &&
+	test_i18ngrep "invalid value for core.fsyncMethod" err
+'
+
 test_done
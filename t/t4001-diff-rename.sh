@@ -262,4 +262,43 @@ test_expect_success 'diff-tree -l0 defaults to a big rename limit, not zero' '
 	grep "myotherfile.*myfile" actual
 '
 
+test_expect_success 'renames with a unique basename are found beyond the rename limit' '
+	mkdir olddir &&
+	for i in 1 2 3 4
+	do
+		{ echo $i && test_seq 20; } >olddir/file$i || return 1
+	done &&
+	git add olddir &&
+	git commit -m "add olddir" &&
+	git mv olddir newdir &&
+	for i in 1 2 3 4
+	do
+		echo changed >>newdir/file$i || return 1
+	done &&
+	git add newdir &&
+	git commit -m "move olddir to newdir" &&
+	git diff-tree -r -M -l1 --name-status HEAD^ HEAD >actual &&
+	grep -c "^R.*olddir/file[1-4]	newdir/file[1-4]$" actual >count &&
+	echo 4 >expect &&
+	test_cmp expect count
+'
+
+test_expect_success 'ambiguous basenames fall back to the full matrix' '
+	mkdir amb1 amb2 &&
+	test_seq 1 20 >amb1/same &&
+	test_seq 101 120 >amb2/same &&
+	git add amb1 amb2 &&
+	git commit -m "add two files called same" &&
+	mkdir amb3 amb4 &&
+	git mv amb1/same amb4/same &&
+	git mv amb2/same amb3/same &&
+	echo 21 >>amb4/same &&
+	echo 121 >>amb3/same &&
+	git add amb3 amb4 &&
+	git commit -m "move both" &&
+	git diff-tree -r -M --name-status HEAD^ HEAD >actual &&
+	grep "^R[0-9]*	amb1/same	amb4/same$" actual &&
+	grep "^R[0-9]*	amb2/same	amb3/same$" actual
+'
+
 test_done
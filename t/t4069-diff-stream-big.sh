@@ -0,0 +1,121 @@
+#!/bin/sh
+
+test_description='text diff of blobs above core.bigFileThreshold
+
+Such blobs are streamed and only the part in which they differ is given
+to xdiff; the output must be the same as that of a diff of the whole
+blobs.'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	for i in $(test_seq 1 3000)
+	do
+		case $i in
+		*00)	echo "func_$i () {" ;;
+		*7)	echo ;;
+		*)	echo "	line $i;" ;;
+		esac
+	done >file &&
+	cp file orig &&
+	git add file &&
+	git commit -m initial &&
+	git tag initial &&
+
+	sed -e "s/^	line 1234;/	changed 1234;/" \
+	    -e "/^	line 1240;/d" \
+	    -e "s/^	line 2500;/&\\
+	inserted;/" <orig >file &&
+	git commit -a -m middle &&
+	git tag middle &&
+
+	sed -e "s/^	line 1;/changed 1;/" <orig >file &&
+	git commit -a -m start &&
+	git tag start &&
+
+	cp orig file &&
+	printf "	last line" >>file &&
+	git commit -a -m end &&
+	git tag end &&
+
+	cp orig file &&
+	printf "\n\n" >>file &&
+	git commit -a -m blank &&
+	git tag blank &&
+
+	sed -e "s/^	line 102;/	changed 102;/" \
+	    -e "s/^	line 2902;/	changed 2902;/" <orig >file &&
+	git commit -a -m spread &&
+	git tag spread &&
+
+	git -c core.bigFileThreshold=10k repack -adq
+'
+
+# Run a diff command once as usual, and once with the blobs streamed,
+# checking that the latter did stream and that the outputs agree.
+test_stream_diff () {
+	git -c core.bigFileThreshold=1g "$@" >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c core.bigFileThreshold=10k "$@" >actual &&
+	grep "\"region_enter\".*\"label\":\"stream\"" trace &&
+	rm trace &&
+	test_cmp expect actual
+}
+
+for range in initial..middle initial..start initial..end initial..blank \
+	     middle..start start..end
+do
+	for opts in "" -U0 -U20 --histogram --ignore-all-space \
+		    --color --word-diff -R
+	do
+		test_expect_success "diff -a $opts $range" "
+			test_stream_diff diff -a $opts $range
+		"
+	done
+done
+
+test_expect_success 'funcname pattern from diff attribute' '
+	echo "file diff=custom" >.gitattributes &&
+	test_config diff.custom.binary false &&
+	test_config diff.custom.xfuncname "^func_[0-9]*00 " &&
+	test_stream_diff diff initial..middle &&
+	test_stream_diff diff -U0 initial..middle
+'
+
+test_expect_success 'working tree file' '
+	git checkout middle &&
+	cp orig file &&
+	test_stream_diff diff -a &&
+	test_stream_diff diff -a start &&
+	git checkout file
+'
+
+test_expect_success 'identical contents with a mode change' '
+	git checkout middle &&
+	test_chmod +x file &&
+	git commit -m mode &&
+	test_stream_diff diff -a HEAD^ &&
+	test_line_count = 3 actual
+'
+
+test_expect_success 'changes too far apart are diffed as a whole' '
+	git -c core.bigFileThreshold=1g diff -a initial..spread >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c core.bigFileThreshold=10k diff -a initial..spread >actual &&
+	grep "\"key\":\"stream/give-up\"" trace &&
+	rm trace &&
+	test_cmp expect actual
+'
+
+test_expect_success 'files converted to git are not streamed' '
+	git checkout initial &&
+	cp orig file &&
+	echo "line 1234" >>file &&
+	echo "file text eol=crlf" >.gitattributes &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c core.bigFileThreshold=10k diff -a >actual &&
+	! grep "\"label\":\"stream\"" trace &&
+	grep "^+line 1234" actual
+'
+
+test_done
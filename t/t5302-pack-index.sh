@@ -66,6 +66,17 @@ test_expect_success 'index-pack results should match pack-objects ones' '
 	cmp "test-2-${pack2}.idx" "2.idx"
 '
 
+test_expect_success 'index-pack with many threads and a tiny delta base cache' '
+	git -c core.deltaBaseCacheLimit=1 index-pack --threads=8 \
+		--index-version=2 -o 2-threads.idx "test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" 2-threads.idx &&
+	git -c core.deltaBaseCacheLimit=1 index-pack --threads=8 \
+		--verify-stat-only "test-2-${pack2}.pack" >stat-threads &&
+	git index-pack --threads=1 \
+		--verify-stat-only "test-2-${pack2}.pack" >stat-single &&
+	test_cmp stat-single stat-threads
+'
+
 test_expect_success 'index-pack --verify on index version 1' '
 	git index-pack --verify "test-1-${pack1}.pack"
 '
@@ -448,4 +448,34 @@ test_expect_success 'fetch with bitmaps can reuse old base' '
 	)
 '
 
+test_expect_success 'write bitmap with a lookup table' '
+	git -c pack.writeBitmapLookupTable=true repack -adb &&
+	git rev-list --test-bitmap HEAD
+'
+
+test_expect_success 'lazy and upfront loading of commit bitmaps agree' '
+	for revs in HEAD "--all" "HEAD ^HEAD~10"
+	do
+		git rev-list --objects --no-object-names $revs >expect.raw &&
+		sort expect.raw >expect &&
+		git rev-list --use-bitmap-index --objects --no-object-names \
+			$revs >lazy.raw &&
+		sort lazy.raw >lazy &&
+		GIT_TEST_READ_COMMIT_TABLE=0 git rev-list --use-bitmap-index \
+			--objects --no-object-names $revs >upfront.raw &&
+		sort upfront.raw >upfront &&
+		test_cmp expect lazy &&
+		test_cmp expect upfront || return 1
+	done
+'
+
+test_expect_success 'repack reuses bitmaps written with a lookup table' '
+	test_commit after-lookup-table &&
+	git -c pack.writeBitmapLookupTable=true repack -adb &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --count --objects --all >expect &&
+	git rev-list --use-bitmap-index --count --objects --all >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -75,16 +75,16 @@ graph_git_behavior 'no graph' full commits/3 commits/1
 
 graph_read_expect() {
 	OPTIONAL=""
-	NUM_CHUNKS=3
+	NUM_CHUNKS=4
 	if test ! -z $2
 	then
 		OPTIONAL=" $2"
-		NUM_CHUNKS=$((3 + $(echo "$2" | wc -w)))
+		NUM_CHUNKS=$((4 + $(echo "$2" | wc -w)))
 	fi
 	cat >expect <<- EOF
 	header: 43475048 1 $(test_oid oid_version) $NUM_CHUNKS 0
 	num_commits: $1
-	chunks: oid_fanout oid_lookup commit_metadata$OPTIONAL
+	chunks: oid_fanout oid_lookup commit_metadata generation_data$OPTIONAL
 	EOF
 	test-tool read-graph >output &&
 	test_cmp expect output
@@ -466,7 +466,7 @@ GRAPH_BYTE_HASH=5
 GRAPH_BYTE_CHUNK_COUNT=6
 GRAPH_CHUNK_LOOKUP_OFFSET=8
 GRAPH_CHUNK_LOOKUP_WIDTH=12
-GRAPH_CHUNK_LOOKUP_ROWS=5
+GRAPH_CHUNK_LOOKUP_ROWS=6
 GRAPH_BYTE_OID_FANOUT_ID=$GRAPH_CHUNK_LOOKUP_OFFSET
 GRAPH_BYTE_OID_LOOKUP_ID=$(($GRAPH_CHUNK_LOOKUP_OFFSET + \
 			    1 * $GRAPH_CHUNK_LOOKUP_WIDTH))
@@ -487,8 +487,12 @@ GRAPH_BYTE_COMMIT_WRONG_PARENT=$(($GRAPH_COMMIT_DATA_OFFSET + $HASH_LEN + 3))
 GRAPH_BYTE_COMMIT_GENERATION=$(($GRAPH_COMMIT_DATA_OFFSET + $HASH_LEN + 11))
 GRAPH_BYTE_COMMIT_DATE=$(($GRAPH_COMMIT_DATA_OFFSET + $HASH_LEN + 12))
 GRAPH_COMMIT_DATA_WIDTH=$(($HASH_LEN + 16))
-GRAPH_OCTOPUS_DATA_OFFSET=$(($GRAPH_COMMIT_DATA_OFFSET + \
-			     $GRAPH_COMMIT_DATA_WIDTH * $NUM_COMMITS))
+GRAPH_GENERATION_DATA_OFFSET=$(($GRAPH_COMMIT_DATA_OFFSET + \
+				$GRAPH_COMMIT_DATA_WIDTH * $NUM_COMMITS))
+GRAPH_GENERATION_DATA_WIDTH=4
+GRAPH_BYTE_GENERATION_DATA=$GRAPH_GENERATION_DATA_OFFSET
+GRAPH_OCTOPUS_DATA_OFFSET=$(($GRAPH_GENERATION_DATA_OFFSET + \
+			     $GRAPH_GENERATION_DATA_WIDTH * $NUM_COMMITS))
 GRAPH_BYTE_OCTOPUS=$(($GRAPH_OCTOPUS_DATA_OFFSET + 4))
 GRAPH_BYTE_FOOTER=$(($GRAPH_OCTOPUS_DATA_OFFSET + 4 * $NUM_OCTOPUS_EDGES))
 
@@ -631,6 +635,11 @@ test_expect_success 'detect incorrect generation number' '
 		"non-zero generation number"
 '
 
+test_expect_success 'detect incorrect generation data' '
+	corrupt_graph_and_verify $GRAPH_BYTE_GENERATION_DATA "\01" \
+		"corrected commit date"
+'
+
 test_expect_success 'detect incorrect commit date' '
 	corrupt_graph_and_verify $GRAPH_BYTE_COMMIT_DATE "\01" \
 		"commit date"
@@ -741,4 +750,48 @@ test_expect_success 'corrupt commit-graph write (missing tree)' '
 	)
 '
 
+test_expect_success 'corrected commit dates handle skewed history' '
+	rm -rf skew &&
+	git init skew &&
+	(
+		cd skew &&
+		test_commit base &&
+		git checkout -b skewed &&
+		GIT_COMMITTER_DATE="@4000000000 +0000" test_commit --notick future &&
+		GIT_COMMITTER_DATE="@1 +0000" test_commit --notick past &&
+		git checkout master &&
+		test_commit other &&
+		git commit-graph write --reachable &&
+		test-tool read-graph >output &&
+		grep "generation_data generation_data_overflow" output &&
+		git commit-graph verify &&
+
+		for version in 1 2
+		do
+			git -c commitGraph.generationVersion=$version \
+				merge-base --is-ancestor future past &&
+			test_must_fail git -c commitGraph.generationVersion=$version \
+				merge-base --is-ancestor past future &&
+			git -c commitGraph.generationVersion=$version \
+				merge-base past other >actual &&
+			git rev-parse base >expect &&
+			test_cmp expect actual &&
+			git -c commitGraph.generationVersion=$version \
+				branch --contains future >actual &&
+			echo "  skewed" >expect &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
+test_expect_success 'commitGraph.generationVersion=1 writes no generation data' '
+	(
+		cd skew &&
+		git -c commitGraph.generationVersion=1 commit-graph write --reachable &&
+		test-tool read-graph >output &&
+		! grep generation_data output &&
+		git commit-graph verify
+	)
+'
+
 test_done
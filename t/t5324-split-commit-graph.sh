@@ -13,11 +13,11 @@ test_expect_success 'setup repo' '
 	infodir=".git/objects/info" &&
 	graphdir="$infodir/commit-graphs" &&
 	test_oid_cache <<-EOM
-	shallow sha1:1760
-	shallow sha256:2064
+	shallow sha1:1820
+	shallow sha256:2124
 
-	base sha1:1376
-	base sha256:1496
+	base sha1:1408
+	base sha256:1528
 
 	oid_version sha1:1
 	oid_version sha256:2
@@ -31,9 +31,9 @@ graph_read_expect() {
 		NUM_BASE=$2
 	fi
 	cat >expect <<- EOF
-	header: 43475048 1 $(test_oid oid_version) 3 $NUM_BASE
+	header: 43475048 1 $(test_oid oid_version) 4 $NUM_BASE
 	num_commits: $1
-	chunks: oid_fanout oid_lookup commit_metadata
+	chunks: oid_fanout oid_lookup commit_metadata generation_data
 	EOF
 	test-tool read-graph >output &&
 	test_cmp expect output
@@ -427,4 +427,52 @@ done <<\EOF
 0600 -r--------
 EOF
 
+test_expect_success 'layers only get generation data on top of layers with it' '
+	git init mixed &&
+	(
+		cd mixed &&
+		git config core.commitGraph true &&
+		test_commit_bulk --id=first 5 &&
+		git -c commitGraph.generationVersion=1 \
+			commit-graph write --reachable --split=no-merge &&
+		test-tool read-graph >output &&
+		! grep generation_data output &&
+
+		test_commit_bulk --id=second 5 &&
+		git commit-graph write --reachable --split=no-merge &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		test-tool read-graph >output &&
+		! grep generation_data output &&
+		git commit-graph verify &&
+
+		git commit-graph write --reachable --split=replace &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		test-tool read-graph >output &&
+		grep generation_data output &&
+		git commit-graph verify
+	)
+'
+
+test_expect_success 'chains mixing layers with and without generation data' '
+	(
+		cd mixed &&
+		test_commit_bulk --id=third 5 &&
+		git -c commitGraph.generationVersion=1 \
+			commit-graph write --reachable --split=no-merge &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		test_commit_bulk --id=fourth 5 &&
+		git commit-graph write --reachable --split=no-merge &&
+		test_line_count = 3 $graphdir/commit-graph-chain &&
+		test-tool read-graph >output &&
+		! grep generation_data output &&
+		git commit-graph verify &&
+
+		git rev-list --topo-order HEAD >actual &&
+		git -c core.commitGraph=false rev-list --topo-order HEAD >expect &&
+		test_cmp expect actual &&
+		git merge-base --is-ancestor HEAD~12 HEAD &&
+		test_must_fail git merge-base --is-ancestor HEAD HEAD~12
+	)
+'
+
 test_done
@@ -0,0 +1,145 @@
+#!/bin/sh
+
+test_description='on-disk reverse index'
+. ./test-lib.sh
+
+# The below tests want control over the 'pack.writeReverseIndex' setting
+# themselves to assert various combinations of it with other options.
+sane_unset GIT_TEST_WRITE_REV_INDEX
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	test_commit base &&
+
+	pack=$(git pack-objects --all $packdir/pack) &&
+	rev=$packdir/pack-$pack.rev &&
+
+	test_path_is_missing $rev
+'
+
+test_index_pack () {
+	rm -f $rev &&
+	conf=$1 &&
+	shift &&
+	# remove the index since Windows won't overwrite an existing file
+	rm $packdir/pack-$pack.idx &&
+	git -c pack.writeReverseIndex=$conf index-pack "$@" \
+		$packdir/pack-$pack.pack
+}
+
+test_expect_success 'index-pack with pack.writeReverseIndex' '
+	test_index_pack "" &&
+	test_path_is_missing $rev &&
+
+	test_index_pack false &&
+	test_path_is_missing $rev &&
+
+	test_index_pack true &&
+	test_path_is_file $rev
+'
+
+test_expect_success 'index-pack with --[no-]rev-index' '
+	for conf in "" true false
+	do
+		test_index_pack "$conf" --rev-index &&
+		test_path_exists $rev &&
+
+		test_index_pack "$conf" --no-rev-index &&
+		test_path_is_missing $rev || return 1
+	done
+'
+
+test_expect_success 'index-pack can verify reverse indexes' '
+	test_when_finished "rm -f $rev" &&
+	test_index_pack true &&
+
+	test_path_is_file $rev &&
+	git index-pack --rev-index --verify $packdir/pack-$pack.pack &&
+
+	# Intentionally corrupt the reverse index.
+	chmod u+w $rev &&
+	printf "xxxx" | dd of=$rev bs=1 count=4 conv=notrunc &&
+
+	test_must_fail git index-pack --rev-index --verify \
+		$packdir/pack-$pack.pack 2>err &&
+	grep "validation error" err
+'
+
+test_expect_success 'index-pack infers reverse index name with -o' '
+	git index-pack --rev-index -o other.idx $packdir/pack-$pack.pack &&
+	test_path_is_file other.idx &&
+	test_path_is_file other.rev
+'
+
+test_expect_success 'pack-objects respects pack.writeReverseIndex' '
+	test_when_finished "rm -fr pack-1-*" &&
+
+	git -c pack.writeReverseIndex= pack-objects --all pack-1 &&
+	test_path_is_missing pack-1-*.rev &&
+
+	git -c pack.writeReverseIndex=false pack-objects --all pack-1 &&
+	test_path_is_missing pack-1-*.rev &&
+
+	git -c pack.writeReverseIndex=true pack-objects --all pack-1 &&
+	test_path_is_file pack-1-*.rev
+'
+
+test_expect_success 'reverse index is not generated when available on disk' '
+	test_index_pack true &&
+	test_path_is_file $rev &&
+
+	git rev-parse HEAD >tip &&
+	GIT_TEST_REV_INDEX_DIE_IN_MEMORY=1 git cat-file \
+		--batch-check="%(objectsize:disk)" <tip
+'
+
+test_expect_success 'pack.readReverseIndex=false ignores the .rev file' '
+	test_index_pack true &&
+	test_path_is_file $rev &&
+
+	git rev-parse HEAD >tip &&
+	test_must_fail env GIT_TEST_REV_INDEX_DIE_IN_MEMORY=1 \
+		git -c pack.readReverseIndex=false cat-file \
+		--batch-check="%(objectsize:disk)" <tip
+'
+
+test_expect_success 'on-disk and in-memory reverse indexes agree' '
+	test_commit other &&
+	git repack -ad &&
+	git -c pack.writeReverseIndex=true repack -ad &&
+	test_path_is_file $packdir/pack-*.rev &&
+
+	git cat-file --batch-all-objects --batch-check="%(objectname) %(objectsize:disk)" >on-disk &&
+	git -c pack.readReverseIndex=false cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objectsize:disk)" >in-memory &&
+	test_cmp in-memory on-disk
+'
+
+test_expect_success 'repack removes the .rev of packs it deletes' '
+	git -c pack.writeReverseIndex=true repack -ad &&
+	ls $packdir/pack-*.rev >before &&
+	test_line_count = 1 before &&
+	test_commit third &&
+	git -c pack.writeReverseIndex=true repack -ad &&
+	ls $packdir/pack-*.rev >after &&
+	test_line_count = 1 after &&
+	! test_cmp before after
+'
+
+test_expect_success 'unusable .rev files fall back to the in-memory revindex' '
+	git -c pack.writeReverseIndex=true repack -ad &&
+	rev=$(ls $packdir/pack-*.rev) &&
+	git rev-parse HEAD >tip &&
+	git -c pack.writeReverseIndex=true pack-objects small <tip &&
+	chmod u+w $rev &&
+	cp small-*.rev $rev &&
+	git cat-file --batch-all-objects --batch-check="%(objectsize:disk)" \
+		>actual 2>err &&
+	grep "reverse-index file .* is corrupt" err &&
+	git -c pack.readReverseIndex=false cat-file --batch-all-objects \
+		--batch-check="%(objectsize:disk)" >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,186 @@
+#!/bin/sh
+
+test_description='exercise basic multi-pack bitmap functionality'
+. ./test-lib.sh
+
+# We'll be writing our own midx and bitmaps, so avoid getting confused by the
+# automatic ones.
+GIT_TEST_MULTI_PACK_INDEX=0
+export GIT_TEST_MULTI_PACK_INDEX
+
+packdir=.git/objects/pack
+
+midx_bitmap () {
+	ls $packdir/multi-pack-index-*.bitmap
+}
+
+test_expect_success 'setup repo with several packs' '
+	git config core.multiPackIndex true &&
+	test_commit_bulk --id=file 40 &&
+	git repack -d &&
+	git checkout -b other HEAD~5 &&
+	test_commit_bulk --id=side 10 &&
+	git repack -d &&
+	git checkout master &&
+	test_commit_bulk --id=more 10 &&
+	git repack -d &&
+	blob=$(echo tagged-blob | git hash-object -w --stdin) &&
+	git tag tagged-blob $blob &&
+	git repack -d &&
+	ls $packdir/pack-*.pack >packs &&
+	test_line_count = 4 packs
+'
+
+test_expect_success 'write multi-pack bitmap' '
+	git multi-pack-index write --bitmap &&
+	midx_bitmap >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	test-tool read-midx .git/objects >midx &&
+	grep "^chunks: .* revindex" midx &&
+	test_path_is_missing $packdir/pack-*.bitmap
+'
+
+test_expect_success 'rev-list --test-bitmap verifies multi-pack bitmaps' '
+	git rev-list --test-bitmap HEAD 2>out &&
+	grep "OK!" out
+'
+
+rev_list_tests () {
+	state=$1
+
+	test_expect_success "counting commits via bitmap ($state)" '
+		git rev-list --count HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting non-linear history ($state)" '
+		git rev-list --count other...master >expect &&
+		git rev-list --use-bitmap-index --count other...master >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting objects via bitmap ($state)" '
+		git rev-list --count --objects HEAD >expect &&
+		git rev-list --use-bitmap-index --count --objects HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerate --objects ($state)" '
+		git rev-list --objects --use-bitmap-index HEAD >actual &&
+		git rev-list --objects HEAD >expect &&
+		test_bitmap_traversal expect actual
+	'
+
+	test_expect_success "bitmap --objects handles non-commit objects ($state)" '
+		git rev-list --objects --use-bitmap-index HEAD tagged-blob >actual &&
+		grep $blob actual
+	'
+}
+
+rev_list_tests 'multi-pack bitmap'
+
+test_expect_success 'write multi-pack bitmap with a lookup table' '
+	git -c pack.writeBitmapLookupTable=true multi-pack-index write --bitmap &&
+	git rev-list --test-bitmap HEAD
+'
+
+rev_list_tests 'multi-pack bitmap with lookup table'
+
+test_expect_success 'clone from multi-pack bitmapped repository' '
+	git clone --no-local --bare . clone.git &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'objects from the preferred pack are reused verbatim' '
+	git rev-parse HEAD >in &&
+	git pack-objects --progress --delta-base-offset --revs --stdout \
+		<in >out.pack 2>err &&
+	grep "pack-reused [1-9]" err &&
+	git index-pack --stdin <out.pack &&
+	git rev-list --objects HEAD >expect &&
+	git rev-list --objects --use-bitmap-index HEAD >actual &&
+	test_bitmap_traversal expect actual
+'
+
+test_expect_success 'objects not in the multi-pack-index are handled' '
+	test_commit loose &&
+	git rev-list --count --objects HEAD >expect &&
+	git rev-list --use-bitmap-index --count --objects HEAD >actual &&
+	test_cmp expect actual &&
+	git rev-list --count --objects HEAD~1..HEAD >expect &&
+	git rev-list --use-bitmap-index --count --objects HEAD~1..HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'multi-pack bitmap is not reported as garbage' '
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_expect_success 'rewriting the multi-pack-index removes stale bitmaps' '
+	git repack -d &&
+	git multi-pack-index write --bitmap &&
+	midx_bitmap >before &&
+	test_line_count = 1 before &&
+	test_commit another &&
+	git repack -d &&
+	git multi-pack-index write --bitmap &&
+	midx_bitmap >after &&
+	test_line_count = 1 after &&
+	! test_cmp before after &&
+	git rev-list --test-bitmap HEAD &&
+
+	git multi-pack-index write &&
+	git multi-pack-index write --bitmap &&
+	test_commit yet-another &&
+	git repack -d &&
+	git multi-pack-index write &&
+	! midx_bitmap
+'
+
+test_expect_success 'bitmap for a different multi-pack-index is ignored' '
+	git multi-pack-index write --bitmap &&
+	stale=$(midx_bitmap) &&
+	mv $stale stale.bitmap &&
+	test_commit ignored &&
+	git repack -d &&
+	git multi-pack-index write --bitmap &&
+	mv stale.bitmap $(midx_bitmap) &&
+	git rev-list --count --objects HEAD >expect &&
+	git rev-list --use-bitmap-index --count --objects HEAD >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep "checksum mismatch" err
+'
+
+test_expect_success 'preferred pack wins duplicate objects' '
+	git multi-pack-index write --bitmap &&
+	dup=$(git pack-objects --all $packdir/pack </dev/null) &&
+	test_must_fail git multi-pack-index write --bitmap \
+		--preferred-pack=pack-does-not-exist.pack 2>err &&
+	test_i18ngrep "unknown preferred pack" err &&
+	git multi-pack-index write --bitmap --preferred-pack=pack-$dup.pack &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-parse HEAD >in &&
+	git pack-objects --progress --delta-base-offset --revs --stdout \
+		<in >out.pack 2>err &&
+	git rev-list --count --objects HEAD >expect &&
+	grep "pack-reused $(cat expect)" err
+'
+
+test_expect_success '--bitmap is only for the write subcommand' '
+	test_must_fail git multi-pack-index verify --bitmap 2>err &&
+	test_i18ngrep "only for .write. subcommand" err
+'
+
+test_expect_success 'repack -ad removes the multi-pack bitmap' '
+	git multi-pack-index write --bitmap &&
+	git repack -ad &&
+	test_path_is_missing $packdir/multi-pack-index &&
+	! midx_bitmap
+'
+
+test_done
@@ -0,0 +1,218 @@
+#!/bin/sh
+
+test_description='merging with the ort strategy'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >file &&
+	test_write_lines a b c d e f g h i >renamed-source &&
+	mkdir dir &&
+	echo unchanged >dir/unchanged &&
+	echo deleteme >modify-delete &&
+	git add . &&
+	test_commit base &&
+
+	git checkout -b side1 &&
+	test_write_lines 1 2 3 4 5 6 7 8 nine >file &&
+	git mv renamed-source renamed-target &&
+	echo side1 >dir/side1 &&
+	echo modified >modify-delete &&
+	git add . &&
+	test_commit side1-change &&
+
+	git checkout -b side2 base &&
+	test_write_lines one 2 3 4 5 6 7 8 9 >file &&
+	test_write_lines a b c d e f g h eye >renamed-source &&
+	echo side2 >dir/side2 &&
+	git rm modify-delete &&
+	git add . &&
+	test_commit side2-change
+'
+
+test_expect_success 'clean merge with a rename' '
+	git checkout -b clean side1 &&
+	git rm -q modify-delete &&
+	git commit -q -m "drop modify-delete" &&
+	git merge -s ort side2 &&
+	test_write_lines one 2 3 4 5 6 7 8 nine >expect &&
+	test_cmp expect file &&
+	test_write_lines a b c d e f g h eye >expect &&
+	test_cmp expect renamed-target &&
+	test_path_is_missing renamed-source &&
+	test_path_is_file dir/side1 &&
+	test_path_is_file dir/side2 &&
+	git diff --exit-code &&
+	git diff --cached --exit-code
+'
+
+test_expect_success 'modify/delete conflict' '
+	git reset --hard side1 &&
+	test_must_fail git merge -s ort side2 >out &&
+	test_i18ngrep "CONFLICT (modify/delete): modify-delete deleted in side2 and modified in HEAD" out &&
+	git ls-files -u modify-delete >actual &&
+	test_line_count = 2 actual &&
+	echo modified >expect &&
+	test_cmp expect modify-delete &&
+	git merge --abort
+'
+
+test_expect_success 'content conflict' '
+	git checkout -b content base &&
+	test_write_lines 1 2 3 4 5 6 7 8 ten >file &&
+	git commit -q -a -m ten &&
+	test_must_fail git merge -s ort side1 >out &&
+	test_i18ngrep "CONFLICT (content): Merge conflict in file" out &&
+	git ls-files -u file >actual &&
+	test_line_count = 3 actual &&
+	grep "^<<<<<<< HEAD" file &&
+	grep "^>>>>>>> side1" file &&
+	git merge --abort
+'
+
+test_expect_success 'local changes are not overwritten' '
+	git checkout -f content &&
+	echo dirty >>file &&
+	test_must_fail git merge -s ort side1 &&
+	grep dirty file &&
+	git checkout -- file
+'
+
+test_expect_success 'file/directory conflict' '
+	git checkout -b df-file base &&
+	echo file >df &&
+	git add df &&
+	git commit -q -m "df file" &&
+	git checkout -b df-dir base &&
+	mkdir df &&
+	echo dir >df/file &&
+	git add df &&
+	git commit -q -m "df dir" &&
+	test_must_fail git merge -s ort df-file >out &&
+	test_i18ngrep "CONFLICT (file/directory)" out &&
+	test_path_is_file df/file &&
+	test_path_is_file df~df-file &&
+	git ls-files -u >actual &&
+	test_line_count = 1 actual &&
+	grep " 3	df\$" actual &&
+	test_must_fail git ls-files --error-unmatch df~df-file &&
+	git merge --abort
+'
+
+test_expect_success 'rename/rename(1to2) records the stages of recursive' '
+	git checkout -b rr1 base &&
+	git mv renamed-source rr-one &&
+	git commit -q -m rr1 &&
+	git checkout -b rr2 base &&
+	git mv renamed-source rr-two &&
+	git commit -q -m rr2 &&
+	test_must_fail git merge -s ort rr1 >out &&
+	test_i18ngrep "CONFLICT (rename/rename)" out &&
+	git ls-files -u >actual &&
+	sed -e "s/.* \([123]\)	/\1 /" actual >stages &&
+	test_write_lines "1 renamed-source" "3 rr-one" "2 rr-two" >expect &&
+	test_cmp expect stages &&
+	git merge --abort
+'
+
+test_expect_success 'directory renames' '
+	git checkout -b dr-rename base &&
+	git mv dir newdir &&
+	git commit -q -m "rename dir" &&
+	git checkout -b dr-add base &&
+	echo added >dir/added &&
+	git add dir/added &&
+	git commit -q -m "add to dir" &&
+	git checkout -q -b dr-merge &&
+
+	test_must_fail git -c merge.directoryRenames=conflict \
+		merge -s ort dr-rename >out &&
+	test_i18ngrep "CONFLICT (file location): dir/added added in HEAD" out &&
+	git ls-files -u >actual &&
+	grep " 2	newdir/added\$" actual &&
+	test_path_is_missing dir/added &&
+	git merge --abort &&
+
+	git -c merge.directoryRenames=true merge -s ort dr-rename >out &&
+	test_i18ngrep "Path updated: dir/added added in HEAD" out &&
+	test_path_is_file newdir/added &&
+	test_path_is_missing dir &&
+	git reset -q --hard dr-add &&
+
+	git -c merge.directoryRenames=false merge -s ort dr-rename &&
+	test_path_is_file dir/added &&
+	test_path_is_file newdir/unchanged
+'
+
+test_expect_success 'submodules are fast-forwarded' '
+	git init sub &&
+	test_commit -C sub one &&
+	git checkout -b sm-base base &&
+	git update-index --add --cacheinfo 160000,$(git -C sub rev-parse HEAD),sub &&
+	git commit -q -m "add sub" &&
+	test_commit -C sub two &&
+	git checkout -b sm-two sm-base &&
+	git update-index --cacheinfo 160000,$(git -C sub rev-parse HEAD),sub &&
+	git commit -q -m "sub two" &&
+	test_commit -C sub three &&
+	git checkout -b sm-three sm-base &&
+	git update-index --cacheinfo 160000,$(git -C sub rev-parse HEAD),sub &&
+	git commit -q -m "sub three" &&
+	git checkout sm-two &&
+	git merge -s ort sm-three &&
+	git -C sub rev-parse three >expect &&
+	git rev-parse HEAD:sub >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'criss-cross merge' '
+	git checkout -b cc1 base &&
+	echo cc1 >cc &&
+	git add cc &&
+	git commit -q -m cc1 &&
+	git checkout -b cc2 base &&
+	echo cc2 >cc2 &&
+	git add cc2 &&
+	git commit -q -m cc2 &&
+	git tag cc2-start &&
+	git merge -q -m "merge cc1" cc1 &&
+	git checkout cc1 &&
+	git merge -q -m "merge cc2" cc2-start &&
+	echo more >>cc &&
+	git commit -q -a -m "cc1 more" &&
+	git checkout cc2 &&
+	echo more >>cc2 &&
+	git commit -q -a -m "cc2 more" &&
+	test $(git merge-base --all cc1 cc2 | wc -l) = 2 &&
+	git merge -s ort cc1 &&
+	git diff --exit-code &&
+	test_write_lines cc1 more >expect &&
+	test_cmp expect cc
+'
+
+test_expect_success 'rebase replays renames across picks' '
+	git checkout -b upstream base &&
+	git mv file moved &&
+	git commit -q -m "move file" &&
+	git checkout -b topic base &&
+	for i in 1 2 3
+	do
+		echo $i >>file &&
+		git commit -q -a -m "topic $i" || return 1
+	done &&
+	git rebase -s ort upstream &&
+	test_path_is_missing file &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 1 2 3 >expect &&
+	test_cmp expect moved &&
+	test $(git rev-list --count upstream..topic) = 3
+'
+
+test_expect_success 'cherry-pick with the ort strategy' '
+	git checkout -b pick upstream &&
+	git cherry-pick --strategy=ort side2-change &&
+	test_write_lines one 2 3 4 5 6 7 8 9 >expect &&
+	test_cmp expect moved &&
+	test_path_is_file dir/side2
+'
+
+test_done
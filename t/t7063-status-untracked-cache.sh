@@ -834,4 +834,88 @@ test_expect_success '"status" after file replacement should be clean with UC=fal
 	status_is_clean
 '
 
+test_expect_success 'setup worktree for -uall' '
+	git init "$TRASH_DIRECTORY/uall" &&
+	cd "$TRASH_DIRECTORY/uall" &&
+	git config core.untrackedCache true &&
+	mkdir -p dtracked duntracked/sub &&
+	touch dtracked/file &&
+	git add dtracked &&
+	git commit -m initial &&
+	touch one dtracked/two duntracked/three duntracked/sub/four &&
+	cat >../status-uall.expect <<-\EOF
+	?? dtracked/two
+	?? duntracked/sub/four
+	?? duntracked/three
+	?? one
+	EOF
+'
+
+test_expect_success '-uall does not use the cache made for -unormal' '
+	git status --porcelain >/dev/null &&
+	: >../trace &&
+	GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+	git status --porcelain -uall >../actual &&
+	test_cmp ../status-uall.expect ../actual &&
+	test_must_be_empty ../trace &&
+	test-tool dump-untracked-cache >../actual &&
+	grep "^flags 00000006$" ../actual
+'
+
+test_expect_success 'status.showUntrackedFiles=all makes the cache for -uall' '
+	test_config status.showUntrackedFiles all &&
+	avoid_racy &&
+	git status --porcelain >../actual &&
+	iuc status --porcelain >../status.iuc &&
+	test_cmp ../status-uall.expect ../status.iuc &&
+	test_cmp ../status-uall.expect ../actual &&
+	test-tool dump-untracked-cache >../actual &&
+	grep "^flags 00000000$" ../actual &&
+	: >../trace &&
+	GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+	git status --porcelain >../actual &&
+	test_cmp ../status-uall.expect ../actual &&
+	grep "^opendir: 0$" ../trace
+'
+
+test_expect_success '-uall cache notices new files' '
+	test_config status.showUntrackedFiles all &&
+	touch duntracked/sub/five &&
+	git status --porcelain >../actual &&
+	grep "^?? duntracked/sub/five$" ../actual &&
+	rm duntracked/sub/five
+'
+
+test_expect_success '-unormal does not use the cache made for -uall' '
+	test_config status.showUntrackedFiles all &&
+	git status --porcelain -unormal >../actual &&
+	iuc status --porcelain -unormal >../status.iuc &&
+	test_cmp ../status.iuc ../actual &&
+	test-tool dump-untracked-cache >../actual &&
+	grep "^flags 00000000$" ../actual
+'
+
+test_expect_success '-uall cache notices nested repositories' '
+	test_config status.showUntrackedFiles all &&
+	avoid_racy &&
+	git status --porcelain >../actual &&
+	test_cmp ../status-uall.expect ../actual &&
+	git init -q duntracked/sub &&
+	cat >../status-nested.expect <<-\EOF &&
+	?? dtracked/two
+	?? duntracked/sub/
+	?? duntracked/three
+	?? one
+	EOF
+	git status --porcelain >../actual &&
+	test_cmp ../status-nested.expect ../actual &&
+	git status --porcelain >../actual &&
+	test_cmp ../status-nested.expect ../actual &&
+	rm -rf duntracked/sub/.git &&
+	git status --porcelain >../actual &&
+	test_cmp ../status-uall.expect ../actual &&
+	git status --porcelain >../actual &&
+	test_cmp ../status-uall.expect ../actual
+'
+
 test_done
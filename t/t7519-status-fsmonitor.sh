@@ -383,4 +383,52 @@ test_expect_success 'status succeeds after staging/unstaging' '
 	)
 '
 
+test_expect_success UNTRACKED_CACHE 'unchanged .gitignore files are read only when needed' '
+	test_create_repo defer-ignore &&
+	(
+		cd defer-ignore &&
+		# keep the cache even if the directories look racily clean
+		GIT_FORCE_UNTRACKED_CACHE=true &&
+		export GIT_FORCE_UNTRACKED_CACHE &&
+		mkdir -p dir/sub &&
+		: >dir/tracked &&
+		: >dir/sub/tracked &&
+		git add . &&
+		git commit -m initial &&
+		mkdir -p .git/hooks &&
+		write_script .git/hooks/fsmonitor-list <<-\EOF &&
+		test "$1" = 2 || exit 1
+		printf "last_update_token\0"
+		test -z "$FSMONITOR_LIST" || printf "%s\0" $FSMONITOR_LIST
+		EOF
+		git config core.fsmonitor .git/hooks/fsmonitor-list &&
+		git config status.showUntrackedFiles all &&
+		git update-index --untracked-cache --fsmonitor &&
+		echo "*.o" >dir/.gitignore &&
+		: >dir/a.tmp &&
+		FSMONITOR_LIST="dir/.gitignore dir/a.tmp" \
+			git status --porcelain >../actual &&
+		grep "^?? dir/a.tmp$" ../actual &&
+
+		# not reported, so the cached result still holds
+		echo "*.tmp" >>dir/.gitignore &&
+		FSMONITOR_LIST= git status --porcelain >../actual &&
+		grep "^?? dir/a.tmp$" ../actual &&
+
+		FSMONITOR_LIST="dir/.gitignore" git status --porcelain >../actual &&
+		! grep "a.tmp" ../actual &&
+
+		# the .gitignore of an unchanged parent applies to a new file
+		: >dir/sub/b.o &&
+		: >dir/sub/c &&
+		FSMONITOR_LIST="dir/sub/b.o dir/sub/c" \
+			git status --porcelain >../actual &&
+		cat >../expect <<-\EOF &&
+		?? dir/.gitignore
+		?? dir/sub/c
+		EOF
+		test_cmp ../expect ../actual
+	)
+'
+
 test_done
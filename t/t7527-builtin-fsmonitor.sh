@@ -0,0 +1,181 @@
+#!/bin/sh
+
+test_description='git status with the builtin filesystem monitor daemon'
+
+. ./test-lib.sh
+
+test -n "$FSMONITOR_DAEMON_BACKEND" && test -z "$NO_UNIX_SOCKETS" || {
+	skip_all='skipping fsmonitor--daemon tests, not supported on this platform'
+	test_done
+}
+
+# don't leave a stale daemon running
+test_atexit 'git fsmonitor--daemon stop'
+
+# Compare "git status" with and without the daemon's help. The latter
+# works on a copy of the index, as it drops the fsmonitor extension.
+check_status () {
+	cp .git/index .git/index-expect &&
+	GIT_INDEX_FILE=.git/index-expect \
+		git -c core.useBuiltinFSMonitor=false status --porcelain=v1 >expect &&
+	git status --porcelain=v1 >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	mkdir dir1 dir2 dir1/sub &&
+	for f in modified deleted untouched
+	do
+		echo $f >$f &&
+		echo $f >dir1/$f &&
+		echo $f >dir2/$f &&
+		echo $f >dir1/sub/$f || return 1
+	done &&
+	git add . &&
+	git commit -q -m initial &&
+	cat >.gitignore <<-\EOF &&
+	.gitignore
+	expect*
+	actual*
+	EOF
+	git config core.useBuiltinFSMonitor true
+'
+
+test_expect_success 'daemon is not running yet' '
+	test_expect_code 1 git fsmonitor--daemon status >out &&
+	test_i18ngrep "not watching" out &&
+	test_must_fail git fsmonitor--daemon stop
+'
+
+test_expect_success 'start the daemon' '
+	git fsmonitor--daemon start &&
+	git fsmonitor--daemon status >out &&
+	test_i18ngrep "is watching .$(pwd)" out &&
+	test_must_fail git fsmonitor--daemon start
+'
+
+test_expect_success 'status picks up the index extension' '
+	git update-index --fsmonitor &&
+	check_status &&
+	check_status &&
+	test-tool dump-fsmonitor >out &&
+	grep "^fsmonitor last update builtin:" out
+'
+
+test_expect_success 'unchanged files are not checked again' '
+	check_status &&
+	git ls-files -f >out &&
+	grep "^h untouched" out &&
+	grep "^h dir1/sub/untouched" out
+'
+
+test_expect_success 'modified and deleted files' '
+	echo more >>modified &&
+	echo more >>dir1/sub/modified &&
+	rm deleted dir2/deleted &&
+	check_status &&
+	check_status
+'
+
+test_expect_success 'new files and directories' '
+	echo new >new &&
+	mkdir -p dir3/deeper &&
+	echo new >dir3/deeper/new &&
+	echo new >dir1/sub/new &&
+	check_status &&
+	git add dir3 &&
+	check_status
+'
+
+test_expect_success 'renamed and removed directories' '
+	mv dir1 dir4 &&
+	check_status &&
+	rm -r dir2 &&
+	check_status &&
+	mv dir4 dir1 &&
+	check_status
+'
+
+test_expect_success 'with the untracked cache' '
+	git update-index --untracked-cache &&
+	check_status &&
+	mkdir dir5 &&
+	echo untracked >dir5/file &&
+	check_status &&
+	rm -r dir5 &&
+	check_status &&
+	git update-index --no-untracked-cache
+'
+
+test_expect_success 'a stopped daemon makes status check everything' '
+	git fsmonitor--daemon stop &&
+	test_expect_code 1 git fsmonitor--daemon status &&
+	echo changed >untouched &&
+	check_status &&
+	git fsmonitor--daemon start &&
+	echo changed >dir1/untouched &&
+	check_status &&
+	check_status
+'
+
+test_expect_success PERL 'a client that sends nothing is dropped' '
+	git fsmonitor--daemon stop &&
+	GIT_TEST_FSMONITOR_CLIENT_TIMEOUT=500 git fsmonitor--daemon start &&
+	cat >stall.pl <<-\EOF &&
+	use IO::Socket::UNIX;
+	my $s = IO::Socket::UNIX->new(Peer => ".git/fsmonitor--daemon.ipc")
+		or die "cannot connect: $!";
+	open(my $f, ">", "stalled") or die;
+	close($f);
+	sleep 30;
+	EOF
+	{ "$PERL_PATH" stall.pl & } &&
+	stall_pid=$! &&
+	test_when_finished "kill $stall_pid; rm -f stall.pl stalled" &&
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		test -f stalled && break
+		sleep 1
+	done &&
+	test_path_is_file stalled &&
+	git fsmonitor--daemon status >out 2>err &&
+	test_i18ngrep "is watching" out &&
+	kill -0 $stall_pid
+'
+
+test_expect_success PERL 'a client that hangs up before the answer' '
+	# make the answer larger than what the socket can buffer
+	dir=many-$(printf "%0200d" 0) &&
+	mkdir $dir &&
+	test_when_finished "rm -rf $dir hangup.pl" &&
+	for i in $(test_seq 2000)
+	do
+		echo $i >$dir/$i || return 1
+	done &&
+	check_status &&
+	test-tool dump-fsmonitor >out &&
+	token=$(sed -n "s/^fsmonitor last update //p" out) &&
+	test -n "$token" &&
+	for i in $(test_seq 2000)
+	do
+		echo changed >$dir/$i || return 1
+	done &&
+	cat >hangup.pl <<-\EOF &&
+	use IO::Socket::UNIX;
+	my $s = IO::Socket::UNIX->new(Peer => ".git/fsmonitor--daemon.ipc")
+		or die "cannot connect: $!";
+	print $s "query $ARGV[0]\n";
+	shutdown($s, 1);
+	close($s);
+	EOF
+	"$PERL_PATH" hangup.pl "$token" &&
+	git fsmonitor--daemon status >out &&
+	test_i18ngrep "is watching" out
+'
+
+test_expect_success 'stop the daemon' '
+	git fsmonitor--daemon stop &&
+	test_path_is_missing .git/fsmonitor--daemon.ipc
+'
+
+test_done
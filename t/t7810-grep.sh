@@ -978,6 +978,24 @@ do
 	"
 done
 
+test_expect_success 'threaded grep keeps output order across many files' '
+	mkdir many &&
+	for i in $(test_seq 300)
+	do
+		test_write_lines "line $i" "match $i" "after $i" >many/file$i || return 1
+	done &&
+	git add many &&
+	test_tick &&
+	git commit -q -m many &&
+	git grep --threads=1 -n -C1 match -- many >expect &&
+	git grep --threads=8 -n -C1 match -- many >actual &&
+	test_cmp expect actual &&
+	git grep --threads=1 -n -C1 match HEAD -- many >expect &&
+	git grep --threads=8 -n -C1 match HEAD -- many >actual &&
+	test_cmp expect actual &&
+	git reset -q --hard HEAD^
+'
+
 test_expect_success !PTHREADS,C_LOCALE_OUTPUT 'grep --threads=N or pack.threads=N warns when no pthreads' '
 	git grep --threads=2 Hello hello_world 2>err &&
 	grep ^warning: err >warnings &&
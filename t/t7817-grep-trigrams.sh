@@ -0,0 +1,104 @@
+#!/bin/sh
+
+test_description='git grep with grep.trigramIndex'
+
+. ./test-lib.sh
+
+# Compare the output of "git grep" with and without the trigram index.
+test_grep_trigrams () {
+	git -c grep.trigramIndex=false grep "$@" >expect &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c grep.trigramIndex=true grep "$@" >actual &&
+	test_cmp expect actual
+}
+
+# Show how many files the last test_grep_trigrams skipped.
+skipped () {
+	sed -n "s/.*\"trigrams\/skipped\",\"value\":\"\([0-9]*\)\".*/\1/p" trace
+}
+
+test_expect_success 'setup' '
+	for i in $(test_seq 20)
+	do
+		test_write_lines "file $i" "common line" "number$i" >file$i || return 1
+	done &&
+	test_write_lines "int needle_in_a_haystack;" "Kelvin" >needle.c &&
+	printf "short" >short &&
+	git add . &&
+	git commit -m initial
+'
+
+test_expect_success 'first search builds the index' '
+	test_path_is_missing .git/objects/info/grep-trigrams &&
+	test_grep_trigrams -n needle &&
+	test_path_is_file .git/objects/info/grep-trigrams &&
+	test_line_count = 1 actual
+'
+
+test_expect_success 'searches skip files that cannot match' '
+	test_grep_trigrams -n needle &&
+	test "$(skipped)" = 21 &&
+	test_grep_trigrams -n needle HEAD &&
+	test "$(skipped)" = 21 &&
+	test_grep_trigrams --cached -l number1 &&
+	test "$(skipped)" = 11 &&
+	test_grep_trigrams -c -e nothing-matches -e haystack &&
+	test "$(skipped)" = 21
+'
+
+test_expect_success 'several patterns and regular expressions' '
+	test_grep_trigrams -e needle -e number3 &&
+	test "$(skipped)" = 20 &&
+	test_grep_trigrams "n[aeiou]*dle_in.a_hay" &&
+	test "$(skipped)" = 21 &&
+	test_grep_trigrams -E "numbe?r1{1,2}" &&
+	test_grep_trigrams -E "need(le|ful)" &&
+	test -z "$(skipped)" &&
+	test_grep_trigrams -F "_a_hay" &&
+	test "$(skipped)" = 21
+'
+
+test_expect_success 'case-insensitive search' '
+	test_grep_trigrams -i NEEDLE &&
+	test "$(skipped)" = 21 &&
+	test_grep_trigrams -i KELVIN &&
+	test_line_count = 1 actual
+'
+
+test_expect_success 'options that need all files do not use the index' '
+	test_grep_trigrams -v needle &&
+	test -z "$(skipped)" &&
+	test_grep_trigrams -L needle &&
+	test -z "$(skipped)" &&
+	test_grep_trigrams --all-match -e needle -e int &&
+	test -z "$(skipped)"
+'
+
+test_expect_success 'modified files are searched' '
+	echo "another needle" >>file1 &&
+	test_grep_trigrams -n needle &&
+	test "$(skipped)" = 20 &&
+	test_grep_trigrams -n needle HEAD &&
+	git checkout file1
+'
+
+test_expect_success 'new blobs are added to the index' '
+	echo "a needle here" >file2 &&
+	git commit -q -a -m second &&
+	test_grep_trigrams -n needle &&
+	test_grep_trigrams -n needle &&
+	test "$(skipped)" = 20 &&
+	test_grep_trigrams -n needle HEAD~1 &&
+	test "$(skipped)" = 21
+'
+
+test_expect_success 'a corrupt index is ignored and rewritten' '
+	echo garbage >.git/objects/info/grep-trigrams &&
+	test_grep_trigrams -n needle &&
+	test "$(skipped)" = 0 &&
+	test_grep_trigrams -n needle &&
+	test "$(skipped)" = 20
+'
+
+test_done
@@ -319,4 +319,39 @@ test_expect_success 'blame does not coalesce non-adjacent result lines' '
 	test_cmp expect actual
 '
 
+test_expect_success 'setup copies from many files' '
+	for i in 1 2 3 4 5 6 7 8
+	do
+		for j in 1 2 3 4 5 6 7 8 9 10
+		do
+			echo "line $j of file $i" || return 1
+		done >copy_src_$i || return 1
+	done &&
+	git add copy_src_* &&
+	test_tick &&
+	GIT_AUTHOR_NAME=Sources git commit -m Sources &&
+	for i in 8 3 5 1 7
+	do
+		sed -n -e "2,6p" copy_src_$i &&
+		echo "new line after $i" || return 1
+	done >copy_dst &&
+	sed -e "3d" copy_src_2 >copy_src_2.new &&
+	mv copy_src_2.new copy_src_2 &&
+	git add copy_dst copy_src_2 &&
+	test_tick &&
+	GIT_AUTHOR_NAME=Copier git commit -m Copier
+'
+
+test_expect_success 'blame -C -C -C does not depend on the number of threads' '
+	git -c blame.threads=1 blame -M -C -C -C copy_dst >expect &&
+	git -c blame.threads=4 blame -M -C -C -C copy_dst >actual &&
+	test_cmp expect actual &&
+	grep -c Sources actual >count &&
+	echo 25 >expect &&
+	test_cmp expect count &&
+	git -c blame.threads=4 blame -M -C -C -C --porcelain copy_dst >actual &&
+	git -c blame.threads=1 blame -M -C -C -C --porcelain copy_dst >expect &&
+	test_cmp expect actual
+'
+
 test_done
@@ -0,0 +1,95 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >file &&
+	git add file &&
+	git commit -m one &&
+	test_write_lines 1 2 three 4 5 6 7 8 9 10 >file &&
+	git commit -a -m two &&
+	git mv file renamed &&
+	test_write_lines 0 1 2 three 4 5 six 7 8 9 10 >renamed &&
+	git commit -a -m three
+'
+
+test_expect_success 'cached blame matches uncached blame' '
+	git -c blame.cache=false blame renamed >expect &&
+	git -c blame.cache=false blame --porcelain renamed >expect-porcelain &&
+	git -c blame.cache=true blame renamed >actual &&
+	test_cmp expect actual &&
+	git -c blame.cache=true blame --porcelain renamed >actual &&
+	test_cmp expect-porcelain actual
+'
+
+test_expect_success 'blame result is written to the cache' '
+	find .git/objects/info/blame-cache -type f >files &&
+	test_line_count = 1 files
+'
+
+test_expect_success 'incremental blame reuses the cached result' '
+	test_write_lines 0 1 2 three 4 5 six 7 eight 9 10 11 >renamed &&
+	git commit -a -m four &&
+	git -c blame.cache=false blame renamed >expect &&
+	git -c blame.cache=true blame renamed >actual &&
+	test_cmp expect actual &&
+	git -c blame.cache=false blame -L 3,6 --porcelain renamed >expect &&
+	git -c blame.cache=true blame -L 3,6 --porcelain renamed >actual &&
+	test_cmp expect actual &&
+	find .git/objects/info/blame-cache -type f >files &&
+	test_line_count = 2 files
+'
+
+test_expect_success 'root and boundary marks are kept' '
+	git -c blame.cache=false blame -b renamed >expect &&
+	git -c blame.cache=true blame -b renamed >actual &&
+	test_cmp expect actual &&
+	git -c blame.cache=false -c blame.showRoot=true blame renamed >expect &&
+	git -c blame.cache=true -c blame.showRoot=true blame renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'different options use different cache entries' '
+	git -c blame.cache=false blame -w renamed >expect &&
+	git -c blame.cache=true blame -w renamed >actual &&
+	test_cmp expect actual &&
+	find .git/objects/info/blame-cache -type f >files &&
+	test_line_count = 3 files
+'
+
+test_expect_success 'blame with a revision range does not use the cache' '
+	git -c blame.cache=false blame HEAD~2.. -- renamed >expect &&
+	git -c blame.cache=true blame HEAD~2.. -- renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success POSIXPERM 'cache files honor core.sharedRepository' '
+	test_when_finished "git config --unset core.sharedRepository" &&
+	git config core.sharedRepository group &&
+	rm -rf .git/objects/info/blame-cache &&
+	(
+		umask 077 &&
+		git -c blame.cache=true blame renamed >/dev/null
+	) &&
+	for f in $(find .git/objects/info/blame-cache -type f)
+	do
+		test_modebits $f >actual &&
+		echo "-rw-rw----" >expect &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'corrupt cache entries are ignored' '
+	for f in $(find .git/objects/info/blame-cache -type f)
+	do
+		chmod +w $f &&
+		echo "blame-cache v1 100" >$f || return 1
+	done &&
+	git -c blame.cache=false blame renamed >expect &&
+	git -c blame.cache=true blame renamed >actual &&
+	test_cmp expect actual
+'
+
+test_done
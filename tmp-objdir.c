@@ -279,6 +279,11 @@ int tmp_objdir_migrate(struct tmp_objdir *t)
 	return ret;
 }
 
+const char *tmp_objdir_path(struct tmp_objdir *t)
+{
+	return t->path.buf;
+}
+
 const char **tmp_objdir_env(const struct tmp_objdir *t)
 {
 	if (!t)
@@ -14,8 +14,10 @@
 #include "submodule.h"
 #include "submodule-config.h"
 #include "fsmonitor.h"
+#include "parallel-checkout.h"
 #include "object-store.h"
 #include "promisor-remote.h"
+#include "sparse-index.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -397,7 +399,7 @@ static int check_updates(struct unpack_trees_options *o,
 	int errs = 0;
 	struct progress *progress;
 	struct checkout state = CHECKOUT_INIT;
-	int i;
+	int i, pc_workers, pc_threshold;
 
 	trace_performance_enter();
 	state.force = 1;
@@ -460,18 +462,31 @@ static int check_updates(struct unpack_trees_options *o,
 					   to_fetch.oid, to_fetch.nr);
 		oid_array_clear(&to_fetch);
 	}
+
+	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
+	if (pc_workers > 1)
+		init_parallel_checkout();
+
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
 		if (ce->ce_flags & CE_UPDATE) {
+			size_t last_pc_queue_size = pc_queue_size();
+
 			if (ce->ce_flags & CE_WT_REMOVE)
 				BUG("both update and delete flags are set on %s",
 				    ce->name);
-			display_progress(progress, ++cnt);
 			ce->ce_flags &= ~CE_UPDATE;
 			errs |= checkout_entry(ce, &state, NULL, NULL);
+
+			/* Queued entries are counted when they are written. */
+			if (last_pc_queue_size == pc_queue_size())
+				display_progress(progress, ++cnt);
 		}
 	}
+	if (pc_workers > 1)
+		errs |= run_parallel_checkout(&state, pc_workers, pc_threshold,
+					      progress, &cnt);
 	stop_progress(&progress);
 	errs |= finish_delayed_checkout(&state, NULL);
 	git_attr_set_direction(GIT_ATTR_CHECKIN);
@@ -990,6 +1005,9 @@ static int compare_entry(const struct cache_entry *ce, const struct traverse_inf
 	 * Even if the beginning compared identically, the ce should
 	 * compare as bigger than a directory leading up to it!
 	 */
+	if (S_ISSPARSEDIR(ce->ce_mode) && S_ISDIR(n->mode) &&
+	    ce_namelen(ce) == traverse_path_len(info, tree_entry_len(n)) + 1)
+		return 0; /* a sparse directory entry for this directory */
 	return ce_namelen(ce) > traverse_path_len(info, tree_entry_len(n));
 }
 
@@ -1030,6 +1048,34 @@ static struct cache_entry *create_ce_entry(const struct traverse_info *info,
 	return ce;
 }
 
+/*
+ * The index has a sparse directory entry (src[0]) where the tree we
+ * are comparing it with has a directory: compare the two as a whole,
+ * without descending into the tree. Only "diff-index --cached" works
+ * on a sparse index (see unpack_trees()).
+ */
+static int unpack_sparse_directory(const struct name_entry *n,
+				   struct cache_entry **src,
+				   const struct traverse_info *info)
+{
+	struct unpack_trees_options *o = info->data;
+	size_t len = traverse_path_len(info, tree_entry_len(n)) + 1;
+	struct cache_entry *ce = make_empty_transient_cache_entry(len);
+	int rc;
+
+	ce->ce_mode = S_IFDIR;
+	ce->ce_flags = create_ce_flags(0);
+	ce->ce_namelen = len;
+	oidcpy(&ce->oid, &n->oid);
+	make_traverse_path(ce->name, len, info, n->path, n->pathlen);
+	ce->name[len - 1] = '/';
+
+	src[1] = ce;
+	rc = call_unpack_fn((const struct cache_entry * const *)src, o);
+	discard_cache_entry(ce);
+	return rc;
+}
+
 /*
  * Note that traverse_by_cache_tree() duplicates some logic in this function
  * without actually calling it. If you change the logic here you may need to
@@ -1282,6 +1328,13 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 		}
 	}
 
+	if (src[0] && S_ISSPARSEDIR(src[0]->ce_mode)) {
+		if (unpack_sparse_directory(p, src, info) < 0)
+			return -1;
+		mark_ce_used(src[0], o);
+		return mask;
+	}
+
 	if (unpack_nondirectories(n, mask, dirmask, src, names, info) < 0)
 		return -1;
 
@@ -1579,6 +1632,13 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	if (len > MAX_UNPACK_TREES)
 		die("unpack_trees takes at most %d trees", MAX_UNPACK_TREES);
 
+	/*
+	 * Only comparing the index with a single tree knows how to deal
+	 * with sparse directory entries.
+	 */
+	if (!o->diff_index_cached || len != 1)
+		ensure_full_index(o->src_index);
+
 	trace_performance_enter();
 	if (!core_apply_sparse_checkout || !o->update)
 		o->skip_sparse_checkout = 1;
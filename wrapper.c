@@ -441,6 +441,39 @@ int xmkstemp(char *filename_template)
 	return fd;
 }
 
+int git_fsync(int fd, enum fsync_action action)
+{
+	int ret;
+
+	switch (action) {
+	case FSYNC_WRITEOUT_ONLY:
+#ifdef HAVE_SYNC_FILE_RANGE
+		/*
+		 * Wait for any writeback of the file already in flight, start
+		 * our own and wait for it to finish. Unlike fsync() this does
+		 * not flush the disk's write cache, nor commit the metadata.
+		 */
+		do {
+			ret = sync_file_range(fd, 0, 0,
+					      SYNC_FILE_RANGE_WAIT_BEFORE |
+					      SYNC_FILE_RANGE_WRITE |
+					      SYNC_FILE_RANGE_WAIT_AFTER);
+		} while (ret < 0 && errno == EINTR);
+		return ret;
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	case FSYNC_HARDWARE_FLUSH:
+		do {
+			ret = fsync(fd);
+		} while (ret < 0 && errno == EINTR);
+		return ret;
+	default:
+		BUG("unexpected git_fsync(%d) call", action);
+	}
+}
+
 /* Adapted from libiberty's mkstemp.c. */
 
 #undef TMP_MAX
@@ -249,18 +249,139 @@ int xdl_recmatch(const char *l1, long s1, const char *l2, long s2, long flags)
 	return 1;
 }
 
+/*
+ * Records are hashed a machine word at a time: the bytes that make up
+ * a record (after whitespace has been skipped or folded, as the flags
+ * say) are grouped into 8-byte big-endian words, each of which is
+ * mixed into the hash, and a final partial word.
+ */
+#define XDL_HASH_MUL 0x9e3779b97f4a7c15ULL
+#define XDL_ONES 0x0101010101010101ULL
+#define XDL_HIGHS 0x8080808080808080ULL
+
+static inline uint64_t xdl_hash_mix(uint64_t h, uint64_t w) {
+	h = (h ^ w) * XDL_HASH_MUL;
+	return h ^ (h >> 29);
+}
+
+/* The high bit of each byte of w that equals c. */
+static inline uint64_t xdl_bytes_eq(uint64_t w, unsigned char c) {
+	uint64_t v = w ^ (XDL_ONES * c);
+
+	return ~(((v & ~XDL_HIGHS) + ~XDL_HIGHS) | v) & XDL_HIGHS;
+}
+
+/* The high bit of each byte of w that is a space or a control character. */
+static inline uint64_t xdl_bytes_le_space(uint64_t w) {
+	return ~(((w & ~XDL_HIGHS) + XDL_ONES * (0x80 - ' ' - 1)) | w) & XDL_HIGHS;
+}
+
+/* How many bytes of w come before the first one marked in m (not 0)? */
+#if defined(__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3  && __GNUC_MINOR__ > 3))
+#define xdl_leading_bytes(m) (__builtin_clzll(m) / 8)
+#else
+static inline int xdl_leading_bytes(uint64_t m) {
+	int n = 0;
+
+	for (; !(m & (1ULL << 63)); m <<= 8)
+		n++;
+	return n;
+}
+#endif
+
+/* The hash of a record, fed a byte or a word at a time. */
+struct xdl_hash_state {
+	uint64_t h, acc;
+	long n, len;
+};
+
+static inline void xdl_hash_byte(struct xdl_hash_state *hs, unsigned char c) {
+	hs->acc = (hs->acc << 8) | c;
+	hs->len++;
+	if (++hs->n == 8) {
+		hs->h = xdl_hash_mix(hs->h, hs->acc);
+		hs->acc = 0;
+		hs->n = 0;
+	}
+}
+
+static inline void xdl_hash_word(struct xdl_hash_state *hs, uint64_t w) {
+	hs->len += 8;
+	if (!hs->n) {
+		hs->h = xdl_hash_mix(hs->h, w);
+		return;
+	}
+	hs->h = xdl_hash_mix(hs->h, (hs->acc << (64 - 8 * hs->n)) |
+				    (w >> (8 * hs->n)));
+	hs->acc = w & ((1ULL << (8 * hs->n)) - 1);
+}
+
+/* Feed the first k bytes of the word w. */
+static inline void xdl_hash_bytes(struct xdl_hash_state *hs, uint64_t w, long k) {
+	uint64_t v = w >> (64 - 8 * k);
+	long fill = 8 - hs->n;
+
+	hs->len += k;
+	if (k < fill) {
+		hs->acc = (hs->acc << (8 * k)) | v;
+		hs->n += k;
+		return;
+	}
+	hs->h = xdl_hash_mix(hs->h, (hs->acc << (8 * fill)) |
+				    (v >> (8 * (k - fill))));
+	hs->n = k - fill;
+	hs->acc = v & ((1ULL << (8 * hs->n)) - 1);
+}
+
+static inline unsigned long xdl_hash_final(struct xdl_hash_state *hs) {
+	uint64_t h = hs->h;
+
+	if (hs->n)
+		h = xdl_hash_mix(h, hs->acc);
+	h = xdl_hash_mix(h, (uint64_t) hs->len);
+	return (unsigned long) (h ^ (h >> 32));
+}
+
 static unsigned long xdl_hash_record_with_whitespace(char const **data,
 		char const *top, long flags) {
-	unsigned long ha = 5381;
+	struct xdl_hash_state hs = { 0 };
 	char const *ptr = *data;
 	int cr_at_eol_only = (flags & XDF_WHITESPACE_FLAGS) == XDF_IGNORE_CR_AT_EOL;
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
+	while (ptr < top && *ptr != '\n') {
+		/*
+		 * Take the bytes up to the first one that needs a closer
+		 * look in one go.
+		 */
+		if (top - ptr >= 8) {
+			uint64_t w = get_be64(ptr), m;
+			long k;
+
+			if (cr_at_eol_only)
+				m = xdl_bytes_eq(w, '\n') | xdl_bytes_eq(w, '\r');
+			else
+				m = xdl_bytes_le_space(w);
+			if (!m) {
+				xdl_hash_word(&hs, w);
+				ptr += 8;
+				continue;
+			}
+			k = xdl_leading_bytes(m);
+			if (k) {
+				xdl_hash_bytes(&hs, w, k);
+				ptr += k;
+				if (*ptr == '\n')
+					break;
+			}
+		}
+
 		if (cr_at_eol_only) {
 			/* do not ignore CR at the end of an incomplete line */
 			if (*ptr == '\r' &&
-			    (ptr + 1 < top && ptr[1] == '\n'))
+			    (ptr + 1 < top && ptr[1] == '\n')) {
+				ptr++;
 				continue;
+			}
 		}
 		else if (XDL_ISSPACE(*ptr)) {
 			const char *ptr2 = ptr;
@@ -273,41 +394,43 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 				; /* already handled */
 			else if (flags & XDF_IGNORE_WHITESPACE_CHANGE
 				 && !at_eol) {
-				ha += (ha << 5);
-				ha ^= (unsigned long) ' ';
+				xdl_hash_byte(&hs, ' ');
 			}
 			else if (flags & XDF_IGNORE_WHITESPACE_AT_EOL
 				 && !at_eol) {
 				while (ptr2 != ptr + 1) {
-					ha += (ha << 5);
-					ha ^= (unsigned long) *ptr2;
+					xdl_hash_byte(&hs, *ptr2);
 					ptr2++;
 				}
 			}
+			ptr++;
 			continue;
 		}
-		ha += (ha << 5);
-		ha ^= (unsigned long) *ptr;
+		xdl_hash_byte(&hs, *ptr);
+		ptr++;
 	}
 	*data = ptr < top ? ptr + 1: ptr;
 
-	return ha;
+	return xdl_hash_final(&hs);
 }
 
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
-	unsigned long ha = 5381;
-	char const *ptr = *data;
+	struct xdl_hash_state hs = { 0 };
+	char const *ptr = *data, *eol;
 
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
-		ha += (ha << 5);
-		ha ^= (unsigned long) *ptr;
-	}
-	*data = ptr < top ? ptr + 1: ptr;
+	/* memchr() is usually the fastest way there is to find the end */
+	if (!(eol = memchr(ptr, '\n', top - ptr)))
+		eol = top;
+	for (; eol - ptr >= 8; ptr += 8)
+		xdl_hash_word(&hs, get_be64(ptr));
+	for (; ptr < eol; ptr++)
+		xdl_hash_byte(&hs, *ptr);
+	*data = eol < top ? eol + 1: eol;
 
-	return ha;
+	return xdl_hash_final(&hs);
 }
 
 unsigned int xdl_hashbits(unsigned int size) {